@@ -42,6 +42,7 @@ int range_cmp(range_t a, range_t b) {
 
 range_t range_copy(range_t *range) {
     char *buffer = dmalloc(range->size);
+    memcpy(buffer, range->ptr, range->size);
     return (range_t){.ptr = buffer, .size = range->size};
 }
 
@@ -111,6 +112,7 @@ void dbuffer_ensureCap(dbuffer_t *dbuffer, size_t size) {
         memcpy(newBuffer, dbuffer->buffer, dbuffer->usage);
         free(dbuffer->buffer);
         dbuffer->buffer = newBuffer;
+        dbuffer->capacity = newSize;
     }
 }
 
@@ -0,0 +1,288 @@
+#include "code_cache.h"
+#include "platform_utils.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// File layout: header, code, relocations, labels, names, source.
+struct code_cache_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint64_t codeSize;
+    uint64_t relocCount;
+    uint64_t labelCount;
+    uint64_t namesSize;
+    uint64_t sourceSize;
+};
+
+enum code_cache_label_kind { CCL_LOCAL, CCL_EXTERNAL };
+
+struct code_cache_label {
+    uint32_t kind;
+    uint32_t nameSize;
+    // Position for local labels and the offset of the name for external
+    // labels.
+    uint64_t value;
+};
+
+struct code_cache_reloc {
+    uint64_t offset;
+    uint32_t label;
+    int32_t bias;
+    uint8_t type;
+    uint8_t size;
+    uint8_t pad[6];
+};
+
+static const char kCodeCacheMagic[4] = {'M', 'C', 'C', 'F'};
+
+void code_cache_init(struct code_cache *cache, char *directory) {
+    cache->directory = directory;
+}
+
+// FNV-1a
+uint64_t _code_cache_hash(uint64_t hash, void *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= ((uint8_t *)data)[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+uint64_t code_cache_key(range_t source, uint64_t options) {
+    uint64_t hash = 0xcbf29ce484222325;
+    uint32_t version = CODE_CACHE_VERSION;
+    hash = _code_cache_hash(hash, &version, sizeof(version));
+    hash = _code_cache_hash(hash, &options, sizeof(options));
+    return _code_cache_hash(hash, source.ptr, source.size);
+}
+
+void _code_cache_path(struct code_cache *cache, uint64_t key, char *path,
+                      size_t size) {
+    snprintf(path, size, "%s/%016lx.mcc", cache->directory,
+             (unsigned long)key);
+}
+
+int code_cache_store(struct code_cache *cache, uint64_t key, range_t source,
+                     dbuffer_t *code, struct reloc_table *relocs,
+                     range_t *names) {
+    size_t relocCount, labelCount;
+    relocation_t *relocations = reloc_table_relocations(relocs, &relocCount);
+    label_t **labels = reloc_table_labels(relocs, &labelCount);
+
+    dbuffer_t file;
+    dbuffer_init(&file);
+    dbuffer_t nameBuffer;
+    dbuffer_init(&nameBuffer);
+
+    struct code_cache_header header = (struct code_cache_header){};
+    memcpy(header.magic, kCodeCacheMagic, 4);
+    header.version = CODE_CACHE_VERSION;
+    header.key = key;
+    header.codeSize = code->usage;
+    header.relocCount = relocCount;
+    header.labelCount = labelCount;
+    header.sourceSize = source.size;
+    dbuffer_pushData(&file, &header, sizeof(header));
+    dbuffer_pushData(&file, code->buffer, code->usage);
+    dbuffer_pushChars(&file, 0, (8 - file.usage % 8) % 8);
+
+    for (size_t i = 0; i < relocCount; i++) {
+        struct code_cache_reloc reloc = (struct code_cache_reloc){};
+        reloc.offset = relocations[i].offset;
+        reloc.label = relocations[i].label;
+        reloc.bias = relocations[i].bias;
+        reloc.type = relocations[i].type;
+        reloc.size = relocations[i].size;
+        dbuffer_pushData(&file, &reloc, sizeof(reloc));
+    }
+
+    int storable = 1;
+    for (size_t i = 0; i < labelCount; i++) {
+        label_t *label = labels[i];
+        struct code_cache_label record = (struct code_cache_label){};
+        if (names && names[i].size) {
+            record.kind = CCL_EXTERNAL;
+            record.nameSize = names[i].size;
+            record.value = nameBuffer.usage;
+            dbuffer_pushRange(&nameBuffer, &names[i]);
+        } else if (label->hasOffset && label->isLocal) {
+            record.kind = CCL_LOCAL;
+            record.value = label->offset;
+        } else {
+            // An address only means something in this process.
+            storable = 0;
+        }
+        dbuffer_pushData(&file, &record, sizeof(record));
+    }
+    dbuffer_pushData(&file, nameBuffer.buffer, nameBuffer.usage);
+    ((struct code_cache_header *)file.buffer)->namesSize = nameBuffer.usage;
+    // The key is only a hash, hits compare the source itself.
+    dbuffer_pushRange(&file, &source);
+
+    // Write to a temporary file first, readers never see partial entries.
+    char path[4096], tmpPath[4096 + 32];
+    _code_cache_path(cache, key, path, sizeof(path));
+    snprintf(tmpPath, sizeof(tmpPath), "%s.%d.tmp", path, getpid());
+
+    int result = 0;
+    FILE *out = storable ? fopen(tmpPath, "wb") : NULL;
+    if (out) {
+        result = fwrite(file.buffer, 1, file.usage, out) == file.usage;
+        result &= fclose(out) == 0;
+        if (result)
+            result = rename(tmpPath, path) == 0;
+        if (!result)
+            unlink(tmpPath);
+    }
+
+    dbuffer_free(&nameBuffer);
+    dbuffer_free(&file);
+    return result;
+}
+
+// Check that the file is an entry for the key and that nothing points outside
+// of it, returns the size of the file the header describes.
+size_t _code_cache_validate(struct code_cache_header *header, uint64_t key,
+                            size_t fileSize) {
+    if (fileSize < sizeof(*header) ||
+        memcmp(header->magic, kCodeCacheMagic, 4) ||
+        header->version != CODE_CACHE_VERSION || header->key != key)
+        return 0;
+
+    // Every part is checked against what is left of the file before it is
+    // added, crafted sizes can't wrap around.
+    size_t size = sizeof(*header);
+    if (header->codeSize > fileSize - size)
+        return 0;
+    size += header->codeSize;
+    size += (8 - size % 8) % 8;
+    if (size > fileSize ||
+        header->relocCount >
+            (fileSize - size) / sizeof(struct code_cache_reloc))
+        return 0;
+    size += header->relocCount * sizeof(struct code_cache_reloc);
+    if (header->labelCount >
+        (fileSize - size) / sizeof(struct code_cache_label))
+        return 0;
+    size += header->labelCount * sizeof(struct code_cache_label);
+    if (header->namesSize > fileSize - size)
+        return 0;
+    size += header->namesSize;
+    if (header->sourceSize > fileSize - size)
+        return 0;
+    size += header->sourceSize;
+    return size == fileSize ? size : 0;
+}
+
+int code_cache_load(struct code_cache *cache, uint64_t key, range_t source,
+                    code_cache_resolver resolve, void *ctx,
+                    struct code_cache_entry *entry) {
+    char path[4096];
+    _code_cache_path(cache, key, path, sizeof(path));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    void *file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED)
+        return 0;
+
+    struct code_cache_header *header = file;
+    if (!_code_cache_validate(header, key, st.st_size) ||
+        !header->codeSize) {
+        munmap(file, st.st_size);
+        return 0;
+    }
+
+    size_t codeOffset = sizeof(*header);
+    size_t relocOffset = codeOffset + header->codeSize;
+    relocOffset += (8 - relocOffset % 8) % 8;
+    struct code_cache_reloc *relocations = file + relocOffset;
+    struct code_cache_label *records =
+        (void *)(relocations + header->relocCount);
+    char *names = (char *)(records + header->labelCount);
+    char *storedSource = names + header->namesSize;
+    // A stale file or a colliding key must not run foreign code.
+    if (header->sourceSize != source.size ||
+        memcmp(storedSource, source.ptr, source.size)) {
+        munmap(file, st.st_size);
+        return 0;
+    }
+
+    void *code = allocate_executable(header->codeSize);
+    if (code == MAP_FAILED) {
+        munmap(file, st.st_size);
+        return 0;
+    }
+    memcpy(code, file + codeOffset, header->codeSize);
+
+    label_t *labels = dzmalloc(sizeof(label_t) * (header->labelCount + 1));
+    int result = 1;
+    for (size_t i = 0; i < header->labelCount && result; i++) {
+        struct code_cache_label *record = &records[i];
+        label_t *label = &labels[i];
+        if (record->kind == CCL_EXTERNAL) {
+            unsigned long address;
+            range_t name = (range_t){.ptr = names + record->value,
+                                     .size = record->nameSize};
+            result = record->value <= header->namesSize &&
+                     record->nameSize <= header->namesSize - record->value &&
+                     resolve(ctx, name, &address);
+            if (result)
+                label_setOffset(label, address);
+        } else if (record->kind == CCL_LOCAL) {
+            result = record->value <= header->codeSize;
+            label_setPosition(label, record->value);
+        } else {
+            result = 0;
+        }
+    }
+
+    for (size_t i = 0; i < header->relocCount && result; i++) {
+        struct code_cache_reloc *record = &relocations[i];
+        if (record->label >= header->labelCount || record->size > INT64 ||
+            record->type > ABSOLUTE ||
+            getRelocSize(record->size) > header->codeSize ||
+            record->offset > header->codeSize - getRelocSize(record->size)) {
+            result = 0;
+            break;
+        }
+        relocation_t reloc = (relocation_t){};
+        reloc.offset = record->offset;
+        reloc.label = record->label;
+        reloc.bias = record->bias;
+        reloc.type = record->type;
+        reloc.size = record->size;
+        // A resolved label can be too far away from the new code.
+        label_t *label = &labels[record->label];
+        result = relocation_fits(&reloc, label, (unsigned long)code);
+        if (result)
+            relocation_apply(&reloc, code, label, (unsigned long)code);
+    }
+
+    free(labels);
+    if (result) {
+        entry->code = code;
+        entry->size = header->codeSize;
+    } else {
+        free_executable(code, header->codeSize);
+    }
+    munmap(file, st.st_size);
+    return result;
+}
+
+void code_cache_entry_free(struct code_cache_entry *entry) {
+    free_executable(entry->code, entry->size);
+    *entry = (struct code_cache_entry){};
+}
@@ -0,0 +1,53 @@
+// On disk cache of emitted code, skips parsing and codegen on warm starts.
+#ifndef CODE_CACHE_H
+#define CODE_CACHE_H
+
+#include "buffer.h"
+#include "relocation.h"
+#include <stdint.h>
+
+// Bump when the file layout or the relocation format changes.
+#define CODE_CACHE_VERSION 3
+
+struct code_cache {
+    // Directory that holds one file per key.
+    char *directory;
+};
+
+// A piece of code loaded from the cache.
+struct code_cache_entry {
+    void *code;
+    size_t size;
+};
+
+// Resolve the address of an external label by it's name, returns 0 if the
+// name is unknown.
+typedef int (*code_cache_resolver)(void *ctx, range_t name,
+                                   unsigned long *address);
+
+void code_cache_init(struct code_cache *cache, char *directory);
+
+// Hash of the source and the compiler options that affect the output.
+uint64_t code_cache_key(range_t source, uint64_t options);
+
+// Store the code and it's unresolved relocations together with the @source
+// it was compiled from. @names is indexed by label index. Named labels are
+// resolved again on every load, even if they have an offset, addresses of
+// this process are never stored. Every other label must be a position in the
+// code. Branches must be relaxed already. Returns 0 on failure.
+int code_cache_store(struct code_cache *cache, uint64_t key, range_t source,
+                     dbuffer_t *code, struct reloc_table *relocs,
+                     range_t *names);
+
+// Look up the key, on a hit the code is copied into executable memory and
+// relocated. Returns 0 on a miss, entries stored for another @source, corrupt
+// entries and relocations that don't reach their resolved labels are misses
+// too.
+int code_cache_load(struct code_cache *cache, uint64_t key, range_t source,
+                    code_cache_resolver resolve, void *ctx,
+                    struct code_cache_entry *entry);
+
+// Release the executable memory of an entry.
+void code_cache_entry_free(struct code_cache_entry *entry);
+
+#endif
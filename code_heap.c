@@ -0,0 +1,159 @@
+#define _GNU_SOURCE
+#include "code_heap.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MFD_HUGE_2MB
+#define MFD_HUGE_2MB (21 << 26)
+#endif
+
+size_t _code_heap_alignUp(size_t value, size_t align) {
+    return (value + align - 1) / align * align;
+}
+
+struct code_range *_code_heap_freeRanges(struct code_heap *heap,
+                                         size_t *count) {
+    *count = heap->freeRanges.usage / sizeof(struct code_range);
+    return heap->freeRanges.buffer;
+}
+
+// Insert a free range, merge it with it's neighbours if they are adjacent.
+void _code_heap_insertFree(struct code_heap *heap, struct code_range range) {
+    size_t count;
+    struct code_range *ranges = _code_heap_freeRanges(heap, &count);
+
+    size_t i = 0;
+    while (i < count && (uint8_t *)ranges[i].rx < (uint8_t *)range.rx)
+        i++;
+
+    int mergePrev = i > 0 && ranges[i - 1].rx + ranges[i - 1].size == range.rx &&
+                    ranges[i - 1].rw + ranges[i - 1].size == range.rw;
+    int mergeNext = i < count && range.rx + range.size == ranges[i].rx &&
+                    range.rw + range.size == ranges[i].rw;
+
+    if (mergePrev && mergeNext) {
+        ranges[i - 1].size += range.size + ranges[i].size;
+        dbuffer_removeRange(&heap->freeRanges, i * sizeof(struct code_range),
+                            sizeof(struct code_range));
+    } else if (mergePrev) {
+        ranges[i - 1].size += range.size;
+    } else if (mergeNext) {
+        ranges[i].rw = range.rw;
+        ranges[i].rx = range.rx;
+        ranges[i].size += range.size;
+    } else {
+        dbuffer_pushData(&heap->freeRanges, &range, sizeof(range));
+        ranges = _code_heap_freeRanges(heap, &count);
+        memmove(&ranges[i + 1], &ranges[i],
+                (count - i - 1) * sizeof(struct code_range));
+        ranges[i] = range;
+    }
+}
+
+// Add a region that can hold at least @size bytes.
+int _code_heap_grow(struct code_heap *heap, size_t size) {
+    size = _code_heap_alignUp(size, CODE_HEAP_REGION_SIZE);
+    if (ftruncate(heap->fd, heap->fileSize + size) != 0)
+        return 0;
+
+    void *rw = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, heap->fd,
+                    heap->fileSize);
+    if (rw == MAP_FAILED)
+        return 0;
+    void *rx = mmap(NULL, size, PROT_READ | PROT_EXEC, MAP_SHARED, heap->fd,
+                    heap->fileSize);
+    if (rx == MAP_FAILED) {
+        munmap(rw, size);
+        return 0;
+    }
+    heap->fileSize += size;
+
+    struct code_region region = (struct code_region){rw, rx, size};
+    dbuffer_pushData(&heap->regions, &region, sizeof(region));
+    _code_heap_insertFree(heap, (struct code_range){rw, rx, size});
+    return 1;
+}
+
+int code_heap_init(struct code_heap *heap, int flags) {
+    *heap = (struct code_heap){};
+    dbuffer_init(&heap->regions);
+    dbuffer_init(&heap->freeRanges);
+
+    // Huge pages might not be reserved, fall back to normal pages when the
+    // first region can't be created.
+    if (flags & CODE_HEAP_HUGE_PAGES) {
+        heap->fd = memfd_create("code_heap",
+                                MFD_CLOEXEC | MFD_HUGETLB | MFD_HUGE_2MB);
+        if (heap->fd >= 0 && _code_heap_grow(heap, CODE_HEAP_REGION_SIZE)) {
+            heap->flags = flags;
+            return 1;
+        }
+        if (heap->fd >= 0)
+            close(heap->fd);
+        heap->fileSize = 0;
+    }
+
+    heap->flags = flags & ~CODE_HEAP_HUGE_PAGES;
+    heap->fd = memfd_create("code_heap", MFD_CLOEXEC);
+    return heap->fd >= 0;
+}
+
+void code_heap_free(struct code_heap *heap) {
+    size_t count = heap->regions.usage / sizeof(struct code_region);
+    struct code_region *regions = heap->regions.buffer;
+    for (size_t i = 0; i < count; i++) {
+        munmap(regions[i].rw, regions[i].size);
+        munmap(regions[i].rx, regions[i].size);
+    }
+    close(heap->fd);
+    dbuffer_free(&heap->regions);
+    dbuffer_free(&heap->freeRanges);
+}
+
+struct code_range code_heap_allocate(struct code_heap *heap, size_t size) {
+    size = _code_heap_alignUp(size ? size : 1, CODE_HEAP_ALIGN);
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        size_t count;
+        struct code_range *ranges = _code_heap_freeRanges(heap, &count);
+        // First fit keeps the code of a program close together.
+        for (size_t i = 0; i < count; i++) {
+            if (ranges[i].size < size)
+                continue;
+
+            struct code_range result = {ranges[i].rw, ranges[i].rx, size};
+            ranges[i].rw += size;
+            ranges[i].rx += size;
+            ranges[i].size -= size;
+            if (ranges[i].size == 0)
+                dbuffer_removeRange(&heap->freeRanges,
+                                    i * sizeof(struct code_range),
+                                    sizeof(struct code_range));
+            return result;
+        }
+        if (!_code_heap_grow(heap, size))
+            break;
+    }
+    assert(0 && "out of code memory");
+    return (struct code_range){};
+}
+
+void code_heap_deallocate(struct code_heap *heap, struct code_range range) {
+    assert(range.size % CODE_HEAP_ALIGN == 0 && "not a code heap range");
+    // Old code must not run by accident.
+    memset(range.rw, 0xCC, range.size);
+    _code_heap_insertFree(heap, range);
+}
+
+void *code_heap_writable(struct code_heap *heap, void *rx, size_t size) {
+    size_t count = heap->regions.usage / sizeof(struct code_region);
+    struct code_region *regions = heap->regions.buffer;
+    for (size_t i = 0; i < count; i++) {
+        uint8_t *start = regions[i].rx;
+        uint8_t *address = rx;
+        if (address >= start && address + size <= start + regions[i].size)
+            return regions[i].rw + (address - start);
+    }
+    return NULL;
+}
@@ -0,0 +1,56 @@
+// Executable memory for JITed code. Functions are packed into shared regions,
+// every region is mapped twice from a memfd: once writable, once executable,
+// so no page is ever writable and executable at the same time.
+#ifndef CODE_HEAP_H
+#define CODE_HEAP_H
+
+#include "buffer.h"
+#include <stdint.h>
+
+#define CODE_HEAP_REGION_SIZE (2 * 1024 * 1024)
+// Code is aligned for the instruction fetch.
+#define CODE_HEAP_ALIGN 16
+
+// Back regions with 2MB huge pages if the system has them.
+#define CODE_HEAP_HUGE_PAGES 1
+
+struct code_heap {
+    int fd;
+    int flags;
+    // Size of the memfd, regions are placed one after another.
+    size_t fileSize;
+    // code_region array.
+    dbuffer_t regions;
+    // Free code_range array, sorted by address.
+    dbuffer_t freeRanges;
+};
+
+struct code_region {
+    uint8_t *rw;
+    uint8_t *rx;
+    size_t size;
+};
+
+// A piece of memory in the code heap. Write the code through @rw, run it
+// from @rx.
+struct code_range {
+    void *rw;
+    void *rx;
+    size_t size;
+};
+
+// Returns 0 if the memfd can't be created.
+int code_heap_init(struct code_heap *heap, int flags);
+void code_heap_free(struct code_heap *heap);
+
+// Allocate @size bytes of code memory.
+struct code_range code_heap_allocate(struct code_heap *heap, size_t size);
+
+// Give the range back to the heap, it can be reused by later allocations.
+void code_heap_deallocate(struct code_heap *heap, struct code_range range);
+
+// The writable address of @size bytes of code at @rx, NULL if they aren't
+// inside a single region of the heap.
+void *code_heap_writable(struct code_heap *heap, void *rx, size_t size);
+
+#endif
@@ -0,0 +1,131 @@
+#include "code_table.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+// A replaced batch, it is freed once every thread has left @epoch.
+struct code_table_retired {
+    struct jit_batch batch;
+    size_t epoch;
+};
+
+void code_table_init(struct code_table *table) {
+    *table = (struct code_table){};
+    atomic_init(&table->epoch, 1);
+    pthread_mutex_init(&table->lock, NULL);
+    dbuffer_init(&table->slots);
+    dbuffer_init(&table->threads);
+    dbuffer_init(&table->retired);
+}
+
+void code_table_free(struct code_table *table) {
+    size_t count;
+    struct code_slot **slots =
+        (struct code_slot **)dbuffer_asPtrArray(&table->slots, &count);
+    for (size_t i = 0; i < count; i++) {
+        if (slots[i]->batch.code)
+            jit_batch_free(&slots[i]->batch);
+        free(slots[i]);
+    }
+
+    struct code_table_retired *retired = table->retired.buffer;
+    count = table->retired.usage / sizeof(struct code_table_retired);
+    for (size_t i = 0; i < count; i++)
+        jit_batch_free(&retired[i].batch);
+
+    pthread_mutex_destroy(&table->lock);
+    dbuffer_free(&table->slots);
+    dbuffer_free(&table->threads);
+    dbuffer_free(&table->retired);
+}
+
+struct code_slot *code_table_add(struct code_table *table) {
+    struct code_slot *slot = nnew(struct code_slot);
+    *slot = (struct code_slot){};
+    atomic_init(&slot->entry, NULL);
+    pthread_mutex_lock(&table->lock);
+    dbuffer_pushPtr(&table->slots, slot);
+    pthread_mutex_unlock(&table->lock);
+    return slot;
+}
+
+void code_table_register(struct code_table *table,
+                         struct code_table_thread *thread) {
+    atomic_init(&thread->epoch, 0);
+    pthread_mutex_lock(&table->lock);
+    dbuffer_pushPtr(&table->threads, thread);
+    pthread_mutex_unlock(&table->lock);
+}
+
+void code_table_unregister(struct code_table *table,
+                           struct code_table_thread *thread) {
+    pthread_mutex_lock(&table->lock);
+    size_t count;
+    void **threads = dbuffer_asPtrArray(&table->threads, &count);
+    size_t i = 0;
+    while (i < count && threads[i] != thread)
+        i++;
+    assert(i < count && "thread is not registered");
+    dbuffer_removeRange(&table->threads, i * sizeof(void *), sizeof(void *));
+    pthread_mutex_unlock(&table->lock);
+}
+
+void code_table_enter(struct code_table *table,
+                      struct code_table_thread *thread) {
+    assert(atomic_load_explicit(&thread->epoch, memory_order_relaxed) == 0 &&
+           "code table entered twice");
+    // Sequentially consistent, the store has to be visible before any slot
+    // is loaded.
+    atomic_store(&thread->epoch, atomic_load(&table->epoch));
+}
+
+void code_table_leave(struct code_table_thread *thread) {
+    atomic_store_explicit(&thread->epoch, 0, memory_order_release);
+}
+
+void *code_slot_entry(struct code_slot *slot) {
+    return atomic_load(&slot->entry);
+}
+
+void code_table_install(struct code_table *table, struct code_slot *slot,
+                        struct jit_batch batch, void *entry) {
+    pthread_mutex_lock(&table->lock);
+    struct jit_batch old = slot->batch;
+    slot->batch = batch;
+    atomic_exchange(&slot->entry, entry);
+
+    // Threads that loaded the old entry entered in this epoch or before.
+    size_t epoch = atomic_fetch_add(&table->epoch, 1);
+    if (old.code) {
+        struct code_table_retired retired = {.batch = old, .epoch = epoch};
+        dbuffer_pushData(&table->retired, &retired, sizeof(retired));
+    }
+    pthread_mutex_unlock(&table->lock);
+    code_table_reclaim(table);
+}
+
+size_t code_table_reclaim(struct code_table *table) {
+    pthread_mutex_lock(&table->lock);
+    // Oldest epoch a thread is still in.
+    size_t oldest = SIZE_MAX;
+    size_t count;
+    struct code_table_thread **threads = (struct code_table_thread **)
+        dbuffer_asPtrArray(&table->threads, &count);
+    for (size_t i = 0; i < count; i++) {
+        size_t epoch = atomic_load(&threads[i]->epoch);
+        if (epoch && epoch < oldest)
+            oldest = epoch;
+    }
+
+    // Retired batches are sorted by epoch.
+    struct code_table_retired *retired = table->retired.buffer;
+    count = table->retired.usage / sizeof(struct code_table_retired);
+    size_t freed = 0;
+    while (freed < count && retired[freed].epoch < oldest)
+        jit_batch_free(&retired[freed++].batch);
+    if (freed)
+        dbuffer_removeRange(&table->retired, 0,
+                            freed * sizeof(struct code_table_retired));
+    pthread_mutex_unlock(&table->lock);
+    return count - freed;
+}
@@ -0,0 +1,67 @@
+// Replaceable JITed functions. Callers go through a slot that holds the
+// current entry, new code is installed with an atomic store and the old code
+// is freed once no thread can still be running it (epoch based reclamation).
+#ifndef CODE_TABLE_H
+#define CODE_TABLE_H
+
+#include "buffer.h"
+#include "jit.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+struct code_slot {
+    _Atomic(void *) entry;
+    // The batch entry points into, owned by the slot.
+    struct jit_batch batch;
+};
+
+// A thread that calls through the table.
+struct code_table_thread {
+    // Epoch the thread entered the table in, 0 while it is outside.
+    atomic_size_t epoch;
+};
+
+struct code_table {
+    // Starts at 1, bumped by every install.
+    atomic_size_t epoch;
+
+    pthread_mutex_t lock;
+    // code_slot pointers.
+    dbuffer_t slots;
+    // code_table_thread pointers.
+    dbuffer_t threads;
+    // code_table_retired entries, in retirement order.
+    dbuffer_t retired;
+};
+
+void code_table_init(struct code_table *table);
+// Frees every slot and retired batch, no thread may be inside the table.
+void code_table_free(struct code_table *table);
+
+struct code_slot *code_table_add(struct code_table *table);
+
+void code_table_register(struct code_table *table,
+                         struct code_table_thread *thread);
+void code_table_unregister(struct code_table *table,
+                           struct code_table_thread *thread);
+
+// Code loaded from a slot stays valid until the thread leaves the table.
+// Enter and leave don't nest.
+void code_table_enter(struct code_table *table,
+                      struct code_table_thread *thread);
+void code_table_leave(struct code_table_thread *thread);
+
+// Current entry of the slot, NULL if nothing is installed.
+void *code_slot_entry(struct code_slot *slot);
+
+// Make @entry inside @batch the code of @slot, the slot takes the batch. The
+// previous batch is retired.
+void code_table_install(struct code_table *table, struct code_slot *slot,
+                        struct jit_batch batch, void *entry);
+
+// Free the retired batches no thread can reach anymore, returns the number
+// of batches still waiting.
+size_t code_table_reclaim(struct code_table *table);
+
+#endif
@@ -1,6 +1,7 @@
 #include "codegen.h"
 #include "list.h"
 #include "x86_64_codegen.h"
+#include <stdint.h>
 
 void _lruBump(struct codegen *cg, struct variable *var);
 
@@ -12,10 +13,239 @@ void codegen_init(struct codegen *cg, size_t registerCount) {
 
     LIST_INIT(&cg->lruVariables);
     cg->registerStatus = dzmalloc(sizeof(void *) * cg->registerCount);
+
+    reloc_table_init(&cg->relocs);
+    dbuffer_init(&cg->branches);
+}
+
+void codegen_free(struct codegen *cg) {
+    dbuffer_free(&cg->buffer);
+    free(cg->registerStatus);
+    reloc_table_free(&cg->relocs);
+    dbuffer_free(&cg->branches);
 }
 
 void codegen_pushBlock(struct codegen *cg, label_t *label) {
-    label_setOffset(label, cg->buffer.usage);
+    codegen_addLabel(cg, label);
+    label_setPosition(label, cg->buffer.usage);
+}
+
+void codegen_addLabel(struct codegen *cg, label_t *label) {
+    reloc_table_addLabel(&cg->relocs, label);
+}
+
+void codegen_jumpCond(struct codegen *cg, int cond, label_t *label) {
+    codegen_addLabel(cg, label);
+
+    struct branch branch = (struct branch){};
+    branch.offset = cg->buffer.usage;
+    branch.label = label;
+    branch.cond = cond;
+
+    size_t dispOffset = arch_encodeBranch(&cg->buffer, cond, 0);
+    relocation_set(label, RELATIVE, INT8, 1, branch.offset + dispOffset);
+    dbuffer_pushData(&cg->branches, &branch, sizeof(struct branch));
+}
+
+void codegen_jump(struct codegen *cg, label_t *label) {
+    codegen_jumpCond(cg, -1, label);
+}
+
+// Where @offset ends up after relaxation, @growth[i] is the total growth of
+// the first i branches.
+size_t _relaxedOffset(struct branch *branches, size_t *growth, size_t count,
+                      size_t offset) {
+    // Find the number of branches that come before @offset.
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (branches[mid].offset < offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return offset + growth[low];
+}
+
+void _computeGrowth(struct branch *branches, size_t *growth, size_t count) {
+    growth[0] = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t extra = 0;
+        if (branches[i].isLong)
+            extra = arch_branchSize(branches[i].cond, 1) -
+                    arch_branchSize(branches[i].cond, 0);
+        growth[i + 1] = growth[i] + extra;
+    }
+}
+
+void codegen_relaxBranches(struct codegen *cg) {
+    size_t count = cg->branches.usage / sizeof(struct branch);
+    struct branch *branches = cg->branches.buffer;
+    if (count == 0)
+        return;
+
+    size_t *growth = dmalloc(sizeof(size_t) * (count + 1));
+
+    // Start with every jump short and widen the ones that are out of range.
+    // Widening a jump can only push other targets further away, so this
+    // converges.
+    int changed;
+    do {
+        changed = 0;
+        _computeGrowth(branches, growth, count);
+
+        for (size_t i = 0; i < count; i++) {
+            struct branch *branch = &branches[i];
+            if (branch->isLong)
+                continue;
+            assert(branch->label->hasOffset && branch->label->isLocal &&
+                   "jump target must be placed inside the buffer");
+
+            long target = _relaxedOffset(branches, growth, count,
+                                         branch->label->offset);
+            long end = _relaxedOffset(branches, growth, count, branch->offset) +
+                       arch_branchSize(branch->cond, 0);
+            long disp = target - end;
+            if (disp < INT8_MIN || disp > INT8_MAX) {
+                branch->isLong = 1;
+                changed = 1;
+            }
+        }
+    } while (changed);
+
+    if (growth[count] == 0) {
+        free(growth);
+        return;
+    }
+
+    // Move every relocation to its new place, relocations and branches are
+    // both sorted by offset so this is a single pass.
+    size_t relocCount;
+    relocation_t *relocs = reloc_table_relocations(&cg->relocs, &relocCount);
+    size_t b = 0;
+    for (size_t i = 0; i < relocCount; i++) {
+        relocation_t *reloc = &relocs[i];
+        // Skip the branches that end before this relocation.
+        while (b < count && branches[b].offset +
+                                    arch_branchSize(branches[b].cond, 0) <=
+                                reloc->offset)
+            b++;
+
+        // Displacement of a widened jump.
+        if (b < count && reloc->offset > branches[b].offset &&
+            branches[b].isLong) {
+            size_t size = arch_branchSize(branches[b].cond, 1);
+            reloc->offset = branches[b].offset + growth[b] + size - 4;
+            reloc->size = INT32;
+            reloc->bias = 4;
+            continue;
+        }
+        reloc->offset += growth[b];
+    }
+
+    size_t labelCount;
+    label_t **labels = reloc_table_labels(&cg->relocs, &labelCount);
+    for (size_t i = 0; i < labelCount; i++) {
+        label_t *label = labels[i];
+        if (label->hasOffset && label->isLocal)
+            label->offset =
+                _relaxedOffset(branches, growth, count, label->offset);
+    }
+
+    // Rebuild the buffer with the wide jumps.
+    dbuffer_t result;
+    dbuffer_initSize(&result, cg->buffer.usage + growth[count]);
+
+    size_t last = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct branch *branch = &branches[i];
+        dbuffer_pushData(&result, cg->buffer.buffer + last,
+                         branch->offset - last);
+        last = branch->offset + arch_branchSize(branch->cond, 0);
+
+        branch->offset = result.usage;
+        arch_encodeBranch(&result, branch->cond, branch->isLong);
+    }
+    dbuffer_pushData(&result, cg->buffer.buffer + last,
+                     cg->buffer.usage - last);
+
+    dbuffer_swap(&cg->buffer, &result);
+    dbuffer_free(&result);
+    free(growth);
+}
+
+// Number of insertions that come before a relocation or branch at @offset.
+size_t _insertedBefore(struct codegen_insertion *insertions, size_t count,
+                       size_t offset) {
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (insertions[mid].offset <= offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+void codegen_insert(struct codegen *cg, struct codegen_insertion *insertions,
+                    size_t count) {
+    if (count == 0)
+        return;
+    size_t *growth = dmalloc(sizeof(size_t) * (count + 1));
+    growth[0] = 0;
+    for (size_t i = 0; i < count; i++)
+        growth[i + 1] = growth[i] + insertions[i].code.usage;
+
+    size_t relocCount;
+    relocation_t *relocs = reloc_table_relocations(&cg->relocs, &relocCount);
+    for (size_t i = 0; i < relocCount; i++)
+        relocs[i].offset +=
+            growth[_insertedBefore(insertions, count, relocs[i].offset)];
+
+    size_t branchCount = cg->branches.usage / sizeof(struct branch);
+    struct branch *branches = cg->branches.buffer;
+    for (size_t i = 0; i < branchCount; i++)
+        branches[i].offset +=
+            growth[_insertedBefore(insertions, count, branches[i].offset)];
+
+    // Labels stay in front of the code inserted at their offset.
+    size_t labelCount;
+    label_t **labels = reloc_table_labels(&cg->relocs, &labelCount);
+    for (size_t i = 0; i < labelCount; i++) {
+        label_t *label = labels[i];
+        if (!label->hasOffset || !label->isLocal)
+            continue;
+        size_t end = _insertedBefore(insertions, count, label->offset);
+        size_t first = end;
+        while (first > 0 && insertions[first - 1].offset == label->offset)
+            first--;
+        size_t n = first;
+        for (size_t k = first; k < end; k++) {
+            for (size_t j = 0; j < insertions[k].behindCount; j++) {
+                if (insertions[k].behind[j] == label)
+                    n = k + 1;
+            }
+        }
+        label->offset += growth[n];
+    }
+
+    dbuffer_t result;
+    dbuffer_initSize(&result, cg->buffer.usage + growth[count]);
+    size_t last = 0;
+    for (size_t i = 0; i < count; i++) {
+        dbuffer_pushData(&result, cg->buffer.buffer + last,
+                         insertions[i].offset - last);
+        dbuffer_pushData(&result, insertions[i].code.buffer,
+                         insertions[i].code.usage);
+        last = insertions[i].offset;
+    }
+    dbuffer_pushData(&result, cg->buffer.buffer + last,
+                     cg->buffer.usage - last);
+
+    dbuffer_swap(&cg->buffer, &result);
+    dbuffer_free(&result);
+    free(growth);
 }
 
 void codegen_popBlock(struct codegen *cg) {
@@ -33,6 +263,7 @@ struct variable *codegen_newVarReg(struct codegen *cg, int reg) {
     var->reg = reg;
     var->stackPos = -1; // no stack pos.
     cg->registerStatus[reg] = var;
+    cg->usedRegisters |= 1u << reg;
 
     list_add(&cg->lruVariables, &var->list);
     return var;
@@ -79,11 +310,32 @@ void variable_store(struct codegen *cg, struct variable *var) {
     var->reg = -1;
 }
 
+void variable_moveReg(struct codegen *cg, struct variable *var, int reg) {
+    assert(!cg->registerStatus[reg] && "register is in use");
+    int from = var->reg;
+    variable_freeReg(cg, var);
+    var->reg = reg;
+    cg->registerStatus[reg] = var;
+    cg->usedRegisters |= 1u << reg;
+    list_add(&cg->lruVariables, &var->list);
+    arch_moveReg(cg, from, reg);
+}
+
+void variable_freeReg(struct codegen *cg, struct variable *var) {
+    if (var->reg < 0)
+        return;
+    list_deattach(&var->list);
+    cg->registerStatus[var->reg] = NULL;
+    var->reg = -1;
+}
+
 int codegen_allocateReg(struct codegen *cg) {
     for (int i = 0; i < cg->registerCount; i++) {
         // Found a free register.
-        if (cg->registerStatus[i] == NULL)
+        if (cg->registerStatus[i] == NULL) {
+            cg->usedRegisters |= 1u << i;
             return i;
+        }
     }
     // Free a register.
     assert(cg->lruVariables.next != NULL && "invalid state");
@@ -92,6 +344,7 @@ int codegen_allocateReg(struct codegen *cg) {
     int reg = var->reg;
 
     variable_store(cg, var);
+    cg->usedRegisters |= 1u << reg;
     return reg;
 }
 
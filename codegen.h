@@ -30,6 +30,25 @@ struct codegen {
     // Sometimes we need to free a specific register.
     // for example when we need to do a function call.
     struct variable **registerStatus; // register -> variable;
+    // Registers that got a variable as a bit mask, users clear it.
+    unsigned usedRegisters;
+
+    // -- Relocation stuff --
+    // Relocations of the buffer and the labels they refer to.
+    struct reloc_table relocs;
+    // Jumps that can be relaxed, in emission order.
+    dbuffer_t branches;
+};
+
+// A jump emitted with codegen_jump, starts with the short encoding.
+struct branch {
+    // Offset of the jump instruction.
+    size_t offset;
+    label_t *label;
+    // Condition code, -1 for unconditional jumps.
+    int cond;
+    // Does this jump use the rel32 encoding ?
+    int isLong;
 };
 
 // This can be stored on a hashmap.
@@ -43,9 +62,38 @@ struct variable {
 };
 
 void codegen_init(struct codegen *cg, size_t registerCount);
+void codegen_free(struct codegen *cg);
 void codegen_pushBlock(struct codegen *cg, label_t *label);
 void codegen_popBlock(struct codegen *cg);
 
+// Make the label known to codegen. Every label that gets a relocation inside the
+// buffer must be added before branch relaxation.
+void codegen_addLabel(struct codegen *cg, label_t *label);
+
+// Emit a relaxable jump.
+void codegen_jump(struct codegen *cg, label_t *label);
+// Emit a relaxable conditional jump.
+void codegen_jumpCond(struct codegen *cg, int cond, label_t *label);
+
+// Code added to the buffer after the fact. Labels at @offset point to it,
+// except the @behindCount labels of @behind which move behind it.
+struct codegen_insertion {
+    size_t offset;
+    dbuffer_t code;
+    label_t **behind;
+    size_t behindCount;
+};
+
+// Insert the code of @insertions, sorted by offset, into the buffer. Labels,
+// relocations and branches after them move along, so this must happen
+// before branch relaxation. The code itself can't have relocations.
+void codegen_insert(struct codegen *cg, struct codegen_insertion *insertions,
+                    size_t count);
+
+// Widen the jumps that can't reach their target with a rel8 displacement.
+// All block labels must be placed, labels must not be applied yet.
+void codegen_relaxBranches(struct codegen *cg);
+
 // Usefull for things like function arguments.
 struct variable *codegen_newVarReg(struct codegen *cg, int reg);
 struct variable *codegen_newVar(struct codegen *cg);
@@ -53,6 +101,7 @@ struct variable *codegen_newVar(struct codegen *cg);
 void codegen_initFunction(struct codegen *cg, int argCount,
                           struct variable **vars);
 
+// Release the register of the variable without spilling it.
 void variable_freeReg(struct codegen *cg, struct variable *var);
 
 int codegen_allocateReg(struct codegen *cg);
@@ -62,5 +111,7 @@ int codegen_allocateReg(struct codegen *cg);
 // at any time. This needs to be called every time variable is used.
 int variable_ref(struct codegen *cg, struct variable *var);
 void variable_store(struct codegen *cg, struct variable *var);
+// Move the variable to the free register @reg.
+void variable_moveReg(struct codegen *cg, struct variable *var, int reg);
 
 #endif
@@ -0,0 +1,251 @@
+#include "compile_queue.h"
+#include "ir_creation.h"
+#include "parser.h"
+#include "ssa_conversion.h"
+
+#include <assert.h>
+#include <time.h>
+
+void *_compile_worker(void *arg);
+
+void compile_queue_init(struct compile_queue *queue, size_t workerCount) {
+    *queue = (struct compile_queue){};
+    dbuffer_init(&queue->heap);
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->wake, NULL);
+    pthread_cond_init(&queue->finished, NULL);
+
+    queue->workerCount = workerCount;
+    queue->workers = dmalloc(workerCount * sizeof(pthread_t));
+    for (size_t i = 0; i < workerCount; i++) {
+        int err =
+            pthread_create(&queue->workers[i], NULL, _compile_worker, queue);
+        assert(err == 0 && "couldn't start a compiler thread");
+    }
+}
+
+void _compile_job_unref(struct compile_job *job) {
+    if (atomic_fetch_sub(&job->references, 1) != 1)
+        return;
+    if (job->batch.code)
+        jit_batch_free(&job->batch);
+    free(job->source.ptr);
+    free(job);
+}
+
+// -- Priority heap, must hold the lock --
+
+int _compile_before(struct compile_job *a, struct compile_job *b) {
+    if (a->priority != b->priority)
+        return a->priority > b->priority;
+    return a->sequence < b->sequence;
+}
+
+void _compile_heapPush(struct compile_queue *queue, struct compile_job *job) {
+    dbuffer_pushPtr(&queue->heap, job);
+    struct compile_job **heap = queue->heap.buffer;
+    size_t i = queue->heap.usage / sizeof(void *) - 1;
+    while (i > 0 && _compile_before(heap[i], heap[(i - 1) / 2])) {
+        struct compile_job *tmp = heap[i];
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+struct compile_job *_compile_heapPop(struct compile_queue *queue) {
+    struct compile_job **heap = queue->heap.buffer;
+    size_t count = queue->heap.usage / sizeof(void *);
+    struct compile_job *top = heap[0];
+    heap[0] = heap[--count];
+    dbuffer_popPtr(&queue->heap);
+
+    size_t i = 0;
+    while (1) {
+        size_t best = i;
+        size_t left = i * 2 + 1, right = i * 2 + 2;
+        if (left < count && _compile_before(heap[left], heap[best]))
+            best = left;
+        if (right < count && _compile_before(heap[right], heap[best]))
+            best = right;
+        if (best == i)
+            break;
+        struct compile_job *tmp = heap[i];
+        heap[i] = heap[best];
+        heap[best] = tmp;
+        i = best;
+    }
+    return top;
+}
+
+// Move the job to a final state, must hold the lock.
+void _compile_finish(struct compile_queue *queue, struct compile_job *job,
+                     enum compile_status status) {
+    atomic_store(&job->status, status);
+    pthread_cond_broadcast(&queue->finished);
+}
+
+void compile_queue_free(struct compile_queue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->stop = 1;
+    while (queue->heap.usage) {
+        struct compile_job *job = _compile_heapPop(queue);
+        if (atomic_load(&job->status) == COMPILE_PENDING)
+            _compile_finish(queue, job, COMPILE_CANCELLED);
+        _compile_job_unref(job);
+    }
+    pthread_cond_broadcast(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+
+    for (size_t i = 0; i < queue->workerCount; i++)
+        pthread_join(queue->workers[i], NULL);
+    free(queue->workers);
+
+    pthread_cond_destroy(&queue->finished);
+    pthread_cond_destroy(&queue->wake);
+    pthread_mutex_destroy(&queue->lock);
+    dbuffer_free(&queue->heap);
+}
+
+struct compile_job *compile_queue_submit(struct compile_queue *queue,
+                                         range_t source, int priority,
+                                         uint64_t budget) {
+    struct compile_job *job = nnew(struct compile_job);
+    *job = (struct compile_job){.priority = priority, .budget = budget};
+    job->source = range_copy(&source);
+    // One for the caller, one for the queue.
+    atomic_init(&job->references, 2);
+    atomic_init(&job->status, COMPILE_PENDING);
+    atomic_init(&job->cancelled, 0);
+
+    pthread_mutex_lock(&queue->lock);
+    job->sequence = queue->sequence++;
+    _compile_heapPush(queue, job);
+    pthread_cond_signal(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+enum compile_status compile_job_poll(struct compile_job *job) {
+    return atomic_load(&job->status);
+}
+
+int _compile_isFinal(enum compile_status status) {
+    return status != COMPILE_PENDING && status != COMPILE_RUNNING;
+}
+
+enum compile_status compile_job_wait(struct compile_queue *queue,
+                                     struct compile_job *job) {
+    pthread_mutex_lock(&queue->lock);
+    while (!_compile_isFinal(atomic_load(&job->status)))
+        pthread_cond_wait(&queue->finished, &queue->lock);
+    pthread_mutex_unlock(&queue->lock);
+    return atomic_load(&job->status);
+}
+
+void compile_job_cancel(struct compile_queue *queue, struct compile_job *job) {
+    atomic_store(&job->cancelled, 1);
+    // The worker skips cancelled jobs when it pops them.
+    pthread_mutex_lock(&queue->lock);
+    if (atomic_load(&job->status) == COMPILE_PENDING)
+        _compile_finish(queue, job, COMPILE_CANCELLED);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void compile_job_release(struct compile_queue *queue, struct compile_job *job) {
+    compile_job_cancel(queue, job);
+    _compile_job_unref(job);
+}
+
+uint64_t _compile_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Checked between the stages, returns the status the job stops with or
+// COMPILE_RUNNING to go on.
+enum compile_status _compile_check(struct compile_job *job, uint64_t deadline) {
+    if (atomic_load(&job->cancelled))
+        return COMPILE_CANCELLED;
+    if (job->budget && _compile_now() > deadline)
+        return COMPILE_TIMED_OUT;
+    return COMPILE_RUNNING;
+}
+
+// parser -> IR -> SSA -> codegen.
+enum compile_status _compile_run(struct compile_job *job) {
+    uint64_t deadline = _compile_now() + job->budget;
+
+    parser_t parser;
+    parser_init(&parser, job->source);
+    struct ast_node *node = parser_parseFunction(&parser);
+    if (!node) {
+        job->error = parser.error ? parser.error : "unknown parser error";
+        zone_free(&parser.zone);
+        return COMPILE_FAILED;
+    }
+
+    enum compile_status status = _compile_check(job, deadline);
+    if (status != COMPILE_RUNNING) {
+        zone_free(&parser.zone);
+        return status;
+    }
+
+    ir_context_t ctx;
+    ir_context_init(&ctx);
+    struct ir_creator creator;
+    ir_creator_init(&creator, &ctx);
+    function_t *fn =
+        ir_creator_createFunction(&creator, AST_AS_TYPE(node, function));
+    zone_free(&parser.zone);
+
+    status = _compile_check(job, deadline);
+    if (status == COMPILE_RUNNING) {
+        ssa_convertFunction(&ctx, fn);
+        status = _compile_check(job, deadline);
+    }
+    if (status == COMPILE_RUNNING) {
+        jit_compileBatch(&ctx, &fn, 1, &job->batch);
+        job->entry = job->batch.entries[0];
+        status = _compile_check(job, deadline);
+        if (status == COMPILE_RUNNING) {
+            status = COMPILE_DONE;
+        } else {
+            jit_batch_free(&job->batch);
+            job->batch = (struct jit_batch){};
+            job->entry = NULL;
+        }
+    }
+
+    ir_context_free(&ctx);
+    return status;
+}
+
+void *_compile_worker(void *arg) {
+    struct compile_queue *queue = arg;
+    pthread_mutex_lock(&queue->lock);
+    while (1) {
+        while (!queue->stop && queue->heap.usage == 0)
+            pthread_cond_wait(&queue->wake, &queue->lock);
+        if (queue->stop)
+            break;
+
+        struct compile_job *job = _compile_heapPop(queue);
+        if (atomic_load(&job->status) != COMPILE_PENDING) {
+            // Cancelled while it was waiting.
+            _compile_job_unref(job);
+            continue;
+        }
+        atomic_store(&job->status, COMPILE_RUNNING);
+        pthread_mutex_unlock(&queue->lock);
+
+        enum compile_status status = _compile_run(job);
+
+        pthread_mutex_lock(&queue->lock);
+        _compile_finish(queue, job, status);
+        _compile_job_unref(job);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
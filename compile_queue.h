@@ -0,0 +1,83 @@
+// Asynchronous compilation, source goes in and executable code comes out on a
+// pool of worker threads. Submitting, polling and cancelling never wait for a
+// compilation.
+#ifndef COMPILE_QUEUE_H
+#define COMPILE_QUEUE_H
+
+#include "buffer.h"
+#include "jit.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+enum compile_status {
+    COMPILE_PENDING,
+    COMPILE_RUNNING,
+    COMPILE_DONE,
+    COMPILE_FAILED,
+    COMPILE_CANCELLED,
+    // The budget ran out, the result is dropped.
+    COMPILE_TIMED_OUT
+};
+
+// A submitted compilation, the handle stays valid until it is released.
+struct compile_job {
+    // Our copy of the source.
+    range_t source;
+    int priority;
+    // Submission order, breaks priority ties.
+    uint64_t sequence;
+    // Nanoseconds the compilation may take, 0 for no limit.
+    uint64_t budget;
+
+    _Atomic(enum compile_status) status;
+    atomic_int cancelled;
+    // Released by the caller and the queue, the last one frees the job.
+    atomic_int references;
+
+    // Valid once the status is COMPILE_DONE.
+    void *entry;
+    struct jit_batch batch;
+    // Set when the status is COMPILE_FAILED.
+    char *error;
+};
+
+struct compile_queue {
+    pthread_t *workers;
+    size_t workerCount;
+
+    pthread_mutex_t lock;
+    // Signaled when a job is submitted or the queue stops.
+    pthread_cond_t wake;
+    // Signaled when a job reaches a final state.
+    pthread_cond_t finished;
+    // Binary heap of jobs, the highest priority is on top.
+    dbuffer_t heap;
+    uint64_t sequence;
+    int stop;
+};
+
+void compile_queue_init(struct compile_queue *queue, size_t workerCount);
+// Pending jobs are cancelled, running ones are finished first.
+void compile_queue_free(struct compile_queue *queue);
+
+// Queue a function for compilation. Higher priorities are compiled first,
+// @budget is in nanoseconds and is checked between the compiler stages.
+struct compile_job *compile_queue_submit(struct compile_queue *queue,
+                                         range_t source, int priority,
+                                         uint64_t budget);
+
+enum compile_status compile_job_poll(struct compile_job *job);
+
+// Block until the job reaches a final state.
+enum compile_status compile_job_wait(struct compile_queue *queue,
+                                     struct compile_job *job);
+
+// A pending job is dropped right away, a running one stops at the next stage.
+void compile_job_cancel(struct compile_queue *queue, struct compile_job *job);
+
+// Give up the handle, the job is cancelled if it isn't finished.
+void compile_job_release(struct compile_queue *queue, struct compile_job *job);
+
+#endif
@@ -85,17 +85,14 @@ void dominators_compute(struct dominators *doms, basic_block_t *entry) {
     int changed = 1;
     while (changed) {
         changed = 0;
-        for (size_t i = elementCount - 1; i < elementCount; i--) {
+        // The start node is skipped, it dominates itself.
+        for (size_t i = elementCount - 2; i < elementCount; i--) {
             basic_block_t *block = postorder[i];
-            size_t newDom = doms->doms[i];
+            size_t newDom = SIZE_MAX;
 
+            // Only predecessors that were processed count, the first one is
+            // not necessarily one of them.
             struct block_predecessor_it it = block_predecessor_begin(block);
-            if (!block_predecessor_end(it)) {
-                basic_block_t *predBlock = block_predecessor_get(it);
-                newDom = dominators_getNumber(doms, predBlock);
-                it = block_predecessor_next(it);
-            }
-
             for (; !block_predecessor_end(it);
                  it = block_predecessor_next(it)) {
                 basic_block_t *predBlock = block_predecessor_get(it);
@@ -104,7 +101,10 @@ void dominators_compute(struct dominators *doms, basic_block_t *entry) {
                 if (doms->doms[predBlockNum] == SIZE_MAX)
                     continue;
 
-                newDom = intersect(doms, predBlockNum, newDom);
+                if (newDom == SIZE_MAX)
+                    newDom = predBlockNum;
+                else
+                    newDom = intersect(doms, predBlockNum, newDom);
             }
             if (doms->doms[i] != newDom)
                 changed = 1;
@@ -132,6 +132,13 @@ void dominators_compute(struct dominators *doms, basic_block_t *entry) {
 basic_block_t **dominators_getChilds(struct dominators *doms, basic_block_t *,
                                      size_t *count);
 
+basic_block_t *dominators_common(struct dominators *doms, basic_block_t *a,
+                                 basic_block_t *b) {
+    size_t common = intersect(doms, dominators_getNumber(doms, a),
+                              dominators_getNumber(doms, b));
+    return doms->postorder[common];
+}
+
 basic_block_t *dominators_getIDom(struct dominators *doms,
                                   basic_block_t *block) {
     size_t blockNum = dominators_getNumber(doms, block);
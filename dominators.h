@@ -48,6 +48,10 @@ void dominators_free(struct dominators *doms);
 basic_block_t *dominators_getIDom(struct dominators *doms,
                                   basic_block_t *block);
 
+// Get the nearest block that dominates both \p a and \p b.
+basic_block_t *dominators_common(struct dominators *doms, basic_block_t *a,
+                                 basic_block_t *b);
+
 // Compute the dominator frontiers based on the dominators.
 void domfrontiers_compute(struct domfrontiers *df, struct dominators *doms);
 
@@ -0,0 +1,575 @@
+#include "elf.h"
+#include "buffer.h"
+#include "relocation.h"
+
+#include <assert.h>
+#include <stddef.h>
+
+void elf64_initIdent(struct elf_ident *ident) {
+    ident->signiture[0] = 0x7F;
+    ident->signiture[1] = 'E';
+    ident->signiture[2] = 'L';
+    ident->signiture[3] = 'F';
+
+    ident->eclass = ELF_CLASS_64;
+    ident->endiannes = ELF_LITTLE_ENDIAN;
+    ident->version = 1;
+    ident->abi = ELF_LINUX;
+    ident->abi_version = 0;
+
+    memset(ident->pad, 0, 7);
+}
+
+void elf_writer_init(struct elf_writer *writer) {
+    for (int i = 0; i < ELF_SECTION_COUNT; i++)
+        dbuffer_init(&writer->sections[i]);
+    dbuffer_init(&writer->dataLabels);
+    dbuffer_init(&writer->symbols);
+}
+
+void elf_writer_free(struct elf_writer *writer) {
+    for (int i = 0; i < ELF_SECTION_COUNT; i++)
+        dbuffer_free(&writer->sections[i]);
+    dbuffer_free(&writer->dataLabels);
+    dbuffer_free(&writer->symbols);
+}
+
+void _elf_align(dbuffer_t *dbuffer, size_t align) {
+    size_t padding = (align - dbuffer->usage % align) % align;
+    dbuffer_pushChars(dbuffer, 0, padding);
+}
+
+void elf_writer_addData(struct elf_writer *writer, enum elf_section_id section,
+                        label_t *label, void *data, size_t size, size_t align) {
+    assert(section != ELF_TEXT && "code lives in the codegen buffer");
+    dbuffer_t *content = &writer->sections[section];
+    _elf_align(content, align);
+
+    struct elf_data_label dataLabel = (struct elf_data_label){
+        .label = label, .section = section, .position = content->usage};
+    dbuffer_pushData(&writer->dataLabels, &dataLabel, sizeof(dataLabel));
+    dbuffer_pushData(content, data, size);
+}
+
+void elf_writer_addSymbol(struct elf_writer *writer, range_t name,
+                          label_t *label, int isFunction) {
+    struct elf_symbol symbol = (struct elf_symbol){
+        .name = name, .label = label, .isFunction = isFunction};
+    dbuffer_pushData(&writer->symbols, &symbol, sizeof(symbol));
+}
+
+// What a label refers to, from the point of view of the writer.
+enum elf_label_kind {
+    EL_TEXT,    // position inside .text
+    EL_DATA,    // position inside .rodata or .data
+    EL_VALUE,   // a known value, like the size of the stack frame.
+    EL_EXTERNAL // defined somewhere else.
+};
+
+struct elf_label_info {
+    enum elf_label_kind kind;
+    enum elf_section_id section;
+    size_t position;
+    // Symbol table index, 0 if there is no symbol for this label.
+    size_t symbol;
+    int isFunction;
+};
+
+struct elf_data_label *_elf_findDataLabel(struct elf_writer *writer,
+                                          label_t *label) {
+    size_t count = writer->dataLabels.usage / sizeof(struct elf_data_label);
+    struct elf_data_label *dataLabels = writer->dataLabels.buffer;
+    for (size_t i = 0; i < count; i++) {
+        if (dataLabels[i].label == label)
+            return &dataLabels[i];
+    }
+    return NULL;
+}
+
+struct elf_label_info _elf_classifyLabel(struct elf_writer *writer,
+                                         label_t *label) {
+    struct elf_label_info info = (struct elf_label_info){};
+    struct elf_data_label *dataLabel = _elf_findDataLabel(writer, label);
+
+    if (dataLabel) {
+        info.kind = EL_DATA;
+        info.section = dataLabel->section;
+        info.position = dataLabel->position;
+    } else if (label->hasOffset && label->isLocal) {
+        info.kind = EL_TEXT;
+        info.section = ELF_TEXT;
+        info.position = label->offset;
+    } else if (label->hasOffset) {
+        info.kind = EL_VALUE;
+    } else {
+        info.kind = EL_EXTERNAL;
+    }
+    return info;
+}
+
+// A section of the output file.
+struct elf_out_section {
+    char *name;
+    uint32_t type;
+    uint64_t flags;
+    dbuffer_t *content;
+    size_t align;
+    uint32_t link;
+    uint32_t info;
+    uint64_t entsize;
+
+    // Offset of the name in the section name table, see _elf_nameSections.
+    uint32_t nameOffset;
+    // Filled during layout.
+    uint64_t offset;
+    uint64_t addr;
+};
+
+uint32_t _elf_addString(dbuffer_t *strtab, range_t string) {
+    uint32_t offset = strtab->usage;
+    dbuffer_pushRange(strtab, &string);
+    dbuffer_pushChar(strtab, 0);
+    return offset;
+}
+
+size_t _elf_alignTo(size_t value, size_t align) {
+    return (value + align - 1) / align * align;
+}
+
+// Fill the section name table, it must be the last section. Every string
+// table is complete before the layout.
+void _elf_nameSections(struct elf_out_section *sections, size_t count) {
+    dbuffer_t *shstrtab = sections[count - 1].content;
+    dbuffer_pushChar(shstrtab, 0);
+    for (size_t i = 0; i < count; i++)
+        sections[i].nameOffset =
+            _elf_addString(shstrtab, range_fromString(sections[i].name));
+}
+
+// Layout the sections in to the file starting from @offset. If @base is not 0
+// loadable sections start on a new page and get an address.
+void _elf_layout(struct elf_out_section *sections, size_t count, size_t offset,
+                 uint64_t base) {
+    for (size_t i = 0; i < count; i++) {
+        struct elf_out_section *section = &sections[i];
+        int loadable = base && (section->flags & ELF_SHF_ALLOC);
+
+        offset =
+            _elf_alignTo(offset, loadable ? ELF_PAGE_SIZE : section->align);
+        section->offset = offset;
+        if (loadable)
+            section->addr = base + offset;
+        offset += section->content->usage;
+    }
+}
+
+// Append the contents of the laid out sections and the section header table.
+void _elf_writeSections(dbuffer_t *out, struct elf64_header *header,
+                        struct elf_out_section *sections, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        struct elf_out_section *section = &sections[i];
+        assert(section->offset >= out->usage && "sections overlap");
+        dbuffer_pushChars(out, 0, section->offset - out->usage);
+        dbuffer_pushData(out, section->content->buffer,
+                         section->content->usage);
+    }
+
+    dbuffer_pushChars(out, 0, _elf_alignTo(out->usage, 8) - out->usage);
+    header->sh_offset = out->usage;
+    header->she_size = sizeof(struct elf64_section);
+    // The null section comes first.
+    header->she_num = count + 1;
+    header->she_stridx = count;
+
+    struct elf64_section null = (struct elf64_section){};
+    dbuffer_pushData(out, &null, sizeof(null));
+    for (size_t i = 0; i < count; i++) {
+        struct elf_out_section *section = &sections[i];
+        struct elf64_section sh = (struct elf64_section){};
+        sh.name = section->nameOffset;
+        sh.type = section->type;
+        sh.flags = section->flags;
+        sh.addr = section->addr;
+        sh.offset = section->offset;
+        sh.size = section->content->usage;
+        sh.link = section->link;
+        sh.info = section->info;
+        sh.addralign = section->align;
+        sh.entsize = section->entsize;
+        dbuffer_pushData(out, &sh, sizeof(sh));
+    }
+}
+
+void _elf_initHeader(struct elf64_header *header, uint16_t type) {
+    *header = (struct elf64_header){};
+    elf64_initIdent(&header->ident);
+    header->type = type;
+    header->machine = ELF_AMD64;
+    header->e_version = 1;
+    header->header_size = sizeof(struct elf64_header);
+}
+
+// Indices of the output sections, the null section is 0.
+enum {
+    EXE_TEXT = 1,
+    EXE_RODATA,
+    EXE_DATA,
+    EXE_SYMTAB,
+    EXE_STRTAB,
+    EXE_SHSTRTAB,
+    EXE_COUNT = EXE_SHSTRTAB
+};
+
+enum {
+    OBJ_TEXT = 1,
+    OBJ_RODATA,
+    OBJ_DATA,
+    OBJ_RELA,
+    OBJ_SYMTAB,
+    OBJ_STRTAB,
+    OBJ_NOTE_STACK,
+    OBJ_SHSTRTAB,
+    OBJ_COUNT = OBJ_SHSTRTAB
+};
+
+void _elf_pushSymbol(dbuffer_t *symtab, uint32_t name, uint8_t info,
+                     uint16_t shndx, uint64_t value) {
+    struct elf64_symbol symbol = (struct elf64_symbol){};
+    symbol.name = name;
+    symbol.info = info;
+    symbol.shndx = shndx;
+    symbol.value = value;
+    dbuffer_pushData(symtab, &symbol, sizeof(symbol));
+}
+
+// Add the names of the named symbols to @strtab, returns a dmalloc'ed array
+// of their offsets.
+uint32_t *_elf_symbolNames(struct elf_writer *writer, dbuffer_t *strtab) {
+    size_t count = writer->symbols.usage / sizeof(struct elf_symbol);
+    struct elf_symbol *symbols = writer->symbols.buffer;
+    uint32_t *names = dmalloc(sizeof(uint32_t) * (count + 1));
+    dbuffer_pushChar(strtab, 0);
+    for (size_t i = 0; i < count; i++)
+        names[i] = _elf_addString(strtab, symbols[i].name);
+    return names;
+}
+
+// Write the named symbols with the @names of _elf_symbolNames, @addresses
+// holds the address of each writer section.
+void _elf_writeSymbols(struct elf_writer *writer, dbuffer_t *symtab,
+                       uint32_t *names, uint64_t *addresses) {
+    size_t count = writer->symbols.usage / sizeof(struct elf_symbol);
+    struct elf_symbol *symbols = writer->symbols.buffer;
+
+    for (size_t i = 0; i < count; i++) {
+        struct elf_label_info info =
+            _elf_classifyLabel(writer, symbols[i].label);
+        uint32_t name = names[i];
+
+        int type = symbols[i].isFunction ? ELF_STT_FUNC : ELF_STT_NOTYPE;
+        if (info.kind == EL_DATA)
+            type = ELF_STT_OBJECT;
+        uint8_t symInfo = ELF_SYMBOL_INFO(ELF_STB_GLOBAL, type);
+
+        if (info.kind == EL_EXTERNAL)
+            _elf_pushSymbol(symtab, name, symInfo, ELF_SHN_UNDEF, 0);
+        else if (info.kind == EL_VALUE)
+            assert(0 && "can't name a value label");
+        else
+            _elf_pushSymbol(symtab, name, symInfo, info.section + 1,
+                            addresses[info.section] + info.position);
+    }
+}
+
+void elf_writer_writeExecutable(struct elf_writer *writer, dbuffer_t *text,
+                                struct reloc_table *relocs, label_t *entry,
+                                dbuffer_t *out) {
+    dbuffer_t contents[EXE_COUNT];
+    for (int i = 0; i < EXE_COUNT; i++)
+        dbuffer_init(&contents[i]);
+    dbuffer_pushData(&contents[0], text->buffer, text->usage);
+    dbuffer_pushData(&contents[1], writer->sections[ELF_RODATA].buffer,
+                     writer->sections[ELF_RODATA].usage);
+    dbuffer_pushData(&contents[2], writer->sections[ELF_DATA].buffer,
+                     writer->sections[ELF_DATA].usage);
+
+    struct elf_out_section sections[EXE_COUNT] = {
+        {.name = ".text",
+         .type = ELF_SHT_PROGBITS,
+         .flags = ELF_SHF_ALLOC | ELF_SHF_EXECINSTR,
+         .content = &contents[0],
+         .align = 16},
+        {.name = ".rodata",
+         .type = ELF_SHT_PROGBITS,
+         .flags = ELF_SHF_ALLOC,
+         .content = &contents[1],
+         .align = 16},
+        {.name = ".data",
+         .type = ELF_SHT_PROGBITS,
+         .flags = ELF_SHF_ALLOC | ELF_SHF_WRITE,
+         .content = &contents[2],
+         .align = 16},
+        {.name = ".symtab",
+         .type = ELF_SHT_SYMTAB,
+         .content = &contents[3],
+         .align = 8,
+         .link = EXE_STRTAB,
+         .info = 1,
+         .entsize = sizeof(struct elf64_symbol)},
+        {.name = ".strtab",
+         .type = ELF_SHT_STRTAB,
+         .content = &contents[4],
+         .align = 1},
+        {.name = ".shstrtab",
+         .type = ELF_SHT_STRTAB,
+         .content = &contents[5],
+         .align = 1},
+    };
+    uint32_t segmentFlags[] = {ELF_PF_R | ELF_PF_X, ELF_PF_R,
+                               ELF_PF_R | ELF_PF_W};
+
+    // Only non empty sections get a segment.
+    size_t segmentCount = 0;
+    for (int i = 0; i < ELF_SECTION_COUNT; i++)
+        segmentCount += sections[i].content->usage != 0;
+
+    size_t headersSize = sizeof(struct elf64_header) +
+                         segmentCount * sizeof(struct elf64_program);
+    // The symbol table size is known before the layout, the values are filled
+    // in once the addresses are.
+    size_t symbolCount = writer->symbols.usage / sizeof(struct elf_symbol);
+    dbuffer_pushChars(&contents[3], 0,
+                      (symbolCount + 1) * sizeof(struct elf64_symbol));
+    uint32_t *names = _elf_symbolNames(writer, &contents[4]);
+    _elf_nameSections(sections, EXE_COUNT);
+    _elf_layout(sections, EXE_COUNT, headersSize, ELF_BASE_ADDRESS);
+    uint64_t addresses[ELF_SECTION_COUNT];
+    for (int i = 0; i < ELF_SECTION_COUNT; i++)
+        addresses[i] = sections[i].addr;
+
+    // Resolve relocations against the final addresses.
+    size_t relocCount;
+    relocation_t *relocations = reloc_table_relocations(relocs, &relocCount);
+    label_t **labels = (label_t **)relocs->labels.buffer;
+    for (size_t i = 0; i < relocCount; i++) {
+        label_t *label = labels[relocations[i].label];
+        struct elf_label_info info = _elf_classifyLabel(writer, label);
+        assert(info.kind != EL_EXTERNAL && "unresolved label in executable");
+
+        label_t resolved = *label;
+        if (info.kind == EL_DATA) {
+            resolved.isLocal = 0;
+            resolved.offset = addresses[info.section] + info.position;
+        }
+        relocation_apply(&relocations[i], contents[0].buffer, &resolved,
+                         addresses[ELF_TEXT]);
+    }
+
+    dbuffer_clear(&contents[3]);
+    _elf_pushSymbol(&contents[3], 0, 0, 0, 0);
+    _elf_writeSymbols(writer, &contents[3], names, addresses);
+    free(names);
+
+    struct elf_label_info entryInfo = _elf_classifyLabel(writer, entry);
+    assert(entryInfo.kind == EL_TEXT && "entry must be inside .text");
+
+    struct elf64_header header;
+    _elf_initHeader(&header, ELF_ET_EXEC);
+    header.entry_point = addresses[ELF_TEXT] + entryInfo.position;
+    header.ph_offset = sizeof(struct elf64_header);
+    header.phe_size = sizeof(struct elf64_program);
+    header.phe_num = segmentCount;
+
+    dbuffer_t file;
+    dbuffer_init(&file);
+    dbuffer_pushData(&file, &header, sizeof(header));
+    for (int i = 0; i < ELF_SECTION_COUNT; i++) {
+        struct elf_out_section *section = &sections[i];
+        if (section->content->usage == 0)
+            continue;
+        struct elf64_program program = (struct elf64_program){};
+        program.type = ELF_PT_LOAD;
+        program.flags = segmentFlags[i];
+        program.offset = section->offset;
+        program.vaddr = section->addr;
+        program.addr = section->addr;
+        program.fsize = section->content->usage;
+        program.msize = section->content->usage;
+        program.allign = ELF_PAGE_SIZE;
+        dbuffer_pushData(&file, &program, sizeof(program));
+    }
+
+    _elf_writeSections(&file, &header, sections, EXE_COUNT);
+    memcpy(file.buffer, &header, sizeof(header));
+
+    dbuffer_pushData(out, file.buffer, file.usage);
+    dbuffer_free(&file);
+    for (int i = 0; i < EXE_COUNT; i++)
+        dbuffer_free(&contents[i]);
+}
+
+int _elf_relocationType(enum reloc_type type, enum reloc_size size,
+                        int isFunction) {
+    if (type == RELATIVE) {
+        switch (size) {
+        case INT8:
+            return R_X86_64_PC8;
+        case INT16:
+            return R_X86_64_PC16;
+        case INT32:
+            return isFunction ? R_X86_64_PLT32 : R_X86_64_PC32;
+        case INT64:
+            assert(0 && "64 bit relative relocations are not supported");
+        }
+    }
+    switch (size) {
+    case INT8:
+        return R_X86_64_8;
+    case INT16:
+        return R_X86_64_16;
+    case INT32:
+        return R_X86_64_32S;
+    case INT64:
+        return R_X86_64_64;
+    }
+    return 0;
+}
+
+// Symbol table index of a named label, 0 if the label doesn't have a name.
+size_t _elf_symbolIndex(struct elf_writer *writer, label_t *label,
+                        size_t firstSymbol, int *isFunction) {
+    size_t count = writer->symbols.usage / sizeof(struct elf_symbol);
+    struct elf_symbol *symbols = writer->symbols.buffer;
+    for (size_t i = 0; i < count; i++) {
+        if (symbols[i].label == label) {
+            *isFunction = symbols[i].isFunction;
+            return firstSymbol + i;
+        }
+    }
+    return 0;
+}
+
+void elf_writer_writeObject(struct elf_writer *writer, dbuffer_t *text,
+                            struct reloc_table *relocs, dbuffer_t *out) {
+    dbuffer_t contents[OBJ_COUNT];
+    for (int i = 0; i < OBJ_COUNT; i++)
+        dbuffer_init(&contents[i]);
+    dbuffer_pushData(&contents[0], text->buffer, text->usage);
+    dbuffer_pushData(&contents[1], writer->sections[ELF_RODATA].buffer,
+                     writer->sections[ELF_RODATA].usage);
+    dbuffer_pushData(&contents[2], writer->sections[ELF_DATA].buffer,
+                     writer->sections[ELF_DATA].usage);
+
+    // null symbol, then a symbol for each section, then named symbols.
+    size_t firstSymbol = 1 + ELF_SECTION_COUNT;
+    dbuffer_t *symtab = &contents[OBJ_SYMTAB - 1];
+    dbuffer_t *strtab = &contents[OBJ_STRTAB - 1];
+    _elf_pushSymbol(symtab, 0, 0, 0, 0);
+    for (int i = 0; i < ELF_SECTION_COUNT; i++)
+        _elf_pushSymbol(symtab, 0,
+                        ELF_SYMBOL_INFO(ELF_STB_LOCAL, ELF_STT_SECTION), i + 1,
+                        0);
+    uint32_t *names = _elf_symbolNames(writer, strtab);
+    uint64_t addresses[ELF_SECTION_COUNT] = {};
+    _elf_writeSymbols(writer, symtab, names, addresses);
+    free(names);
+
+    size_t relocCount;
+    relocation_t *relocations = reloc_table_relocations(relocs, &relocCount);
+    label_t **labels = (label_t **)relocs->labels.buffer;
+    for (size_t i = 0; i < relocCount; i++) {
+        relocation_t *reloc = &relocations[i];
+        label_t *label = labels[reloc->label];
+        struct elf_label_info info = _elf_classifyLabel(writer, label);
+
+        // Known values and jumps inside .text don't need the linker.
+        if (info.kind == EL_VALUE ||
+            (info.kind == EL_TEXT && reloc->type == RELATIVE)) {
+            relocation_apply(reloc, contents[0].buffer, label, 0);
+            continue;
+        }
+
+        int isFunction = 0;
+        size_t symbol;
+        int64_t addend = 0;
+        if (info.kind == EL_EXTERNAL) {
+            symbol = _elf_symbolIndex(writer, label, firstSymbol, &isFunction);
+            assert(symbol && "external label must have a name");
+        } else {
+            // Refer to the section, named symbols could be preempted.
+            symbol = info.section + 1;
+            addend = info.position;
+        }
+        if (reloc->type == RELATIVE)
+            addend -= reloc->bias;
+
+        struct elf64_rela rela = (struct elf64_rela){};
+        rela.offset = reloc->offset;
+        rela.info = ELF_RELA_INFO(
+            symbol, _elf_relocationType(reloc->type, reloc->size, isFunction));
+        rela.addend = addend;
+        dbuffer_pushData(&contents[OBJ_RELA - 1], &rela, sizeof(rela));
+    }
+
+    struct elf_out_section sections[OBJ_COUNT] = {
+        {.name = ".text",
+         .type = ELF_SHT_PROGBITS,
+         .flags = ELF_SHF_ALLOC | ELF_SHF_EXECINSTR,
+         .content = &contents[0],
+         .align = 16},
+        {.name = ".rodata",
+         .type = ELF_SHT_PROGBITS,
+         .flags = ELF_SHF_ALLOC,
+         .content = &contents[1],
+         .align = 16},
+        {.name = ".data",
+         .type = ELF_SHT_PROGBITS,
+         .flags = ELF_SHF_ALLOC | ELF_SHF_WRITE,
+         .content = &contents[2],
+         .align = 16},
+        {.name = ".rela.text",
+         .type = ELF_SHT_RELA,
+         .flags = ELF_SHF_INFO_LINK,
+         .content = &contents[3],
+         .align = 8,
+         .link = OBJ_SYMTAB,
+         .info = OBJ_TEXT,
+         .entsize = sizeof(struct elf64_rela)},
+        {.name = ".symtab",
+         .type = ELF_SHT_SYMTAB,
+         .content = symtab,
+         .align = 8,
+         .link = OBJ_STRTAB,
+         .info = firstSymbol,
+         .entsize = sizeof(struct elf64_symbol)},
+        {.name = ".strtab",
+         .type = ELF_SHT_STRTAB,
+         .content = strtab,
+         .align = 1},
+        // Empty, the code doesn't need an executable stack.
+        {.name = ".note.GNU-stack",
+         .type = ELF_SHT_PROGBITS,
+         .content = &contents[OBJ_NOTE_STACK - 1],
+         .align = 1},
+        {.name = ".shstrtab",
+         .type = ELF_SHT_STRTAB,
+         .content = &contents[OBJ_SHSTRTAB - 1],
+         .align = 1},
+    };
+    _elf_nameSections(sections, OBJ_COUNT);
+    _elf_layout(sections, OBJ_COUNT, sizeof(struct elf64_header), 0);
+
+    struct elf64_header header;
+    _elf_initHeader(&header, ELF_ET_REL);
+
+    dbuffer_t file;
+    dbuffer_init(&file);
+    dbuffer_pushData(&file, &header, sizeof(header));
+    _elf_writeSections(&file, &header, sections, OBJ_COUNT);
+    memcpy(file.buffer, &header, sizeof(header));
+
+    dbuffer_pushData(out, file.buffer, file.usage);
+    dbuffer_free(&file);
+    for (int i = 0; i < OBJ_COUNT; i++)
+        dbuffer_free(&contents[i]);
+}
@@ -1,6 +1,8 @@
 #ifndef ELF_H
 #define ELF_H
 
+#include "buffer.h"
+#include "relocation.h"
 #include <stdint.h>
 
 #pragma pack(push, 1)
@@ -13,12 +15,56 @@
 
 #define ELF_LINUX 3
 
+#define ELF_ET_REL 1
 #define ELF_ET_EXEC 2
 
 #define ELF_AMD64 0x3E
 
 #define ELF_PT_LOAD 1
 
+// Segment permissions.
+#define ELF_PF_X 1
+#define ELF_PF_W 2
+#define ELF_PF_R 4
+
+// Section types.
+#define ELF_SHT_PROGBITS 1
+#define ELF_SHT_SYMTAB 2
+#define ELF_SHT_STRTAB 3
+#define ELF_SHT_RELA 4
+
+// Section flags.
+#define ELF_SHF_WRITE 1
+#define ELF_SHF_ALLOC 2
+#define ELF_SHF_EXECINSTR 4
+#define ELF_SHF_INFO_LINK 0x40
+
+// Symbol binding and types.
+#define ELF_STB_LOCAL 0
+#define ELF_STB_GLOBAL 1
+#define ELF_STT_NOTYPE 0
+#define ELF_STT_OBJECT 1
+#define ELF_STT_FUNC 2
+#define ELF_STT_SECTION 3
+#define ELF_SYMBOL_INFO(bind, type) (((bind) << 4) | (type))
+
+#define ELF_SHN_UNDEF 0
+
+// x86_64 relocation types.
+#define R_X86_64_64 1
+#define R_X86_64_PC32 2
+#define R_X86_64_PLT32 4
+#define R_X86_64_32S 11
+#define R_X86_64_16 12
+#define R_X86_64_PC16 13
+#define R_X86_64_8 14
+#define R_X86_64_PC8 15
+#define ELF_RELA_INFO(symbol, type) (((uint64_t)(symbol) << 32) | (type))
+
+// Where executables get loaded.
+#define ELF_BASE_ADDRESS 0x400000
+#define ELF_PAGE_SIZE 0x1000
+
 struct elf_ident {
     int8_t signiture[4];
     int8_t eclass;
@@ -72,6 +118,74 @@ struct elf64_section {
     uint64_t entsize;
 };
 
+struct elf64_symbol {
+    uint32_t name;
+    uint8_t info;
+    uint8_t other;
+    uint16_t shndx;
+    uint64_t value;
+    uint64_t size;
+};
+
+struct elf64_rela {
+    uint64_t offset;
+    uint64_t info;
+    int64_t addend;
+};
+
 #pragma pack(pop)
 
+// -- ELF writer --
+
+// Sections we can put code and data into.
+enum elf_section_id { ELF_TEXT, ELF_RODATA, ELF_DATA, ELF_SECTION_COUNT };
+
+// A label that points inside .rodata or .data.
+struct elf_data_label {
+    label_t *label;
+    enum elf_section_id section;
+    size_t position;
+};
+
+// A named label, defined if the label has a position, external otherwise.
+struct elf_symbol {
+    range_t name;
+    label_t *label;
+    int isFunction;
+};
+
+struct elf_writer {
+    // Contents of .rodata and .data, .text comes from the codegen buffer.
+    dbuffer_t sections[ELF_SECTION_COUNT];
+    // elf_data_label array.
+    dbuffer_t dataLabels;
+    // elf_symbol array.
+    dbuffer_t symbols;
+};
+
+void elf64_initIdent(struct elf_ident *ident);
+
+void elf_writer_init(struct elf_writer *writer);
+void elf_writer_free(struct elf_writer *writer);
+
+// Place data inside .rodata or .data and point the label to it.
+void elf_writer_addData(struct elf_writer *writer, enum elf_section_id section,
+                        label_t *label, void *data, size_t size, size_t align);
+
+// Name a label, so it shows up in the symbol table. Labels that don't have a
+// position are external symbols, only allowed in relocatable objects.
+void elf_writer_addSymbol(struct elf_writer *writer, range_t name,
+                          label_t *label, int isFunction);
+
+// Write a static executable. The labels of the relocation table get resolved
+// to their final addresses.
+void elf_writer_writeExecutable(struct elf_writer *writer, dbuffer_t *text,
+                                struct reloc_table *relocs, label_t *entry,
+                                dbuffer_t *out);
+
+// Write a relocatable object (ET_REL), relocations that can't be resolved
+// inside .text become R_X86_64 relocations.
+void elf_writer_writeObject(struct elf_writer *writer, dbuffer_t *text,
+                            struct reloc_table *relocs, dbuffer_t *out);
+
 #endif
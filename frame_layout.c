@@ -0,0 +1,224 @@
+#include "frame_layout.h"
+#include "utils.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Positions and liveness sets of a block, the sets are bit sets indexed by
+// frame_range numbers.
+struct _fl_block {
+    size_t start;
+    size_t end;
+    uint64_t *in;
+    uint64_t *out;
+    // Used before they are defined in the block, and defined in the block.
+    uint64_t *gen;
+    uint64_t *kill;
+    // Operands of the phis of the successors that come from this block.
+    uint64_t *phiOut;
+    struct hm_bucket_entry entry;
+};
+
+void _fl_set(uint64_t *set, size_t i) { set[i / 64] |= 1ull << (i % 64); }
+
+int _fl_has(uint64_t *set, size_t i) { return (set[i / 64] >> (i % 64)) & 1; }
+
+struct frame_range *frame_layout_get(struct frame_layout *layout,
+                                     value_t *value) {
+    struct hm_bucket_entry *entry = hashmap_getPtr(&layout->ranges, value);
+    return entry ? containerof(entry, struct frame_range, entry) : NULL;
+}
+
+// NULL for blocks that aren't emitted.
+struct _fl_block *_fl_block(hashmap_t *blocks, basic_block_t *block) {
+    struct hm_bucket_entry *entry = hashmap_getPtr(blocks, block);
+    return entry ? containerof(entry, struct _fl_block, entry) : NULL;
+}
+
+void _fl_addRange(struct frame_layout *layout, dbuffer_t *ranges,
+                  value_t *value, size_t position) {
+    struct frame_range *range = znnew(&layout->zone, struct frame_range);
+    *range = (struct frame_range){.start = position, .end = position};
+    range->number = ranges->usage / sizeof(void *);
+    hashmap_setPtr(&layout->ranges, value, &range->entry);
+    dbuffer_pushPtr(ranges, range);
+}
+
+void _fl_extend(struct frame_range *range, size_t position) {
+    if (position < range->start)
+        range->start = position;
+    if (position > range->end)
+        range->end = position;
+}
+
+// Local liveness of the block, phi operands go to their predecessor.
+void _fl_scan(struct frame_layout *layout, hashmap_t *blocks,
+              struct _fl_block *block, basic_block_t *bb) {
+    LIST_FOR_EACH(&bb->instructions) {
+        instruction_t *inst = containerof(c, instruction_t, inst_list);
+        struct frame_range *own = frame_layout_get(layout, &inst->value);
+        size_t count;
+        use_t **uses = inst_getUses(inst, &count);
+
+        if (inst->type == INST_PHI) {
+            for (size_t i = 0; i < count; i += 2) {
+                struct _fl_block *pred = _fl_block(
+                    blocks, containerof(uses[i]->value, basic_block_t, value));
+                struct frame_range *range =
+                    frame_layout_get(layout, uses[i + 1]->value);
+                if (!pred)
+                    continue;
+                // The copy writes the phi at the end of the predecessor.
+                _fl_extend(own, pred->end);
+                if (!range)
+                    continue;
+                _fl_set(pred->phiOut, range->number);
+                _fl_extend(range, pred->end);
+            }
+            _fl_set(block->kill, own->number);
+            continue;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            struct frame_range *range =
+                frame_layout_get(layout, uses[i]->value);
+            if (!range)
+                continue;
+            if (!_fl_has(block->kill, range->number))
+                _fl_set(block->gen, range->number);
+            _fl_extend(range, inst->i);
+        }
+        if (own)
+            _fl_set(block->kill, own->number);
+    }
+}
+
+// Backward dataflow until the live in sets don't change.
+void _fl_liveness(hashmap_t *blocks, struct _fl_block *info,
+                  basic_block_t **order, size_t count, size_t words) {
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (size_t b = count; b-- > 0;) {
+            struct _fl_block *block = &info[b];
+            memcpy(block->out, block->phiOut, words * sizeof(uint64_t));
+            struct block_successor_it it = block_successor_begin(order[b]);
+            for (; !block_successor_end(it); it = block_successor_next(it)) {
+                struct _fl_block *next =
+                    _fl_block(blocks, block_successor_get(it));
+                for (size_t w = 0; w < words; w++)
+                    block->out[w] |= next->in[w];
+            }
+            for (size_t w = 0; w < words; w++) {
+                uint64_t in =
+                    block->gen[w] | (block->out[w] & ~block->kill[w]);
+                changed |= in != block->in[w];
+                block->in[w] = in;
+            }
+        }
+    }
+}
+
+int _fl_compareStart(const void *a, const void *b) {
+    const struct frame_range *x = *(struct frame_range **)a;
+    const struct frame_range *y = *(struct frame_range **)b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+// Linear scan over the ranges, a slot is free again after the end of the
+// range that had it.
+void _fl_color(struct frame_layout *layout, struct frame_range **ranges,
+               size_t count) {
+    qsort(ranges, count, sizeof(struct frame_range *), _fl_compareStart);
+    dbuffer_t ends;
+    dbuffer_init(&ends);
+    for (size_t i = 0; i < count; i++) {
+        size_t *slotEnds = (size_t *)ends.buffer;
+        size_t slotCount = ends.usage / sizeof(size_t);
+        size_t slot = 0;
+        while (slot < slotCount && slotEnds[slot] >= ranges[i]->start)
+            slot++;
+        if (slot == slotCount)
+            dbuffer_pushData(&ends, &ranges[i]->end, sizeof(size_t));
+        else
+            slotEnds[slot] = ranges[i]->end;
+        ranges[i]->slot = slot + 1;
+    }
+    layout->slotCount = ends.usage / sizeof(size_t);
+    dbuffer_free(&ends);
+}
+
+void frame_layout_compute(struct frame_layout *layout, function_t *fn,
+                          basic_block_t **order, size_t count) {
+    *layout = (struct frame_layout){};
+    hashmap_init(&layout->ranges, ptrKeyType);
+    zone_init(&layout->zone);
+
+    hashmap_t blocks;
+    hashmap_init(&blocks, ptrKeyType);
+    struct _fl_block *info = dzmalloc(sizeof(struct _fl_block) * (count + 1));
+    dbuffer_t ranges;
+    dbuffer_init(&ranges);
+
+    // Arguments are defined before the first instruction, empty blocks still
+    // get a position.
+    for (size_t i = 0; i < fn->argumentCount; i++)
+        _fl_addRange(layout, &ranges, &fn->arguments[i].value, 0);
+    size_t position = 0;
+    for (size_t b = 0; b < count; b++) {
+        info[b].start = position;
+        hashmap_setPtr(&blocks, order[b], &info[b].entry);
+        LIST_FOR_EACH(&order[b]->instructions) {
+            instruction_t *inst = containerof(c, instruction_t, inst_list);
+            inst->i = position;
+            if (inst->value.dataType != VOID)
+                _fl_addRange(layout, &ranges, &inst->value, position);
+            position++;
+        }
+        if (position == info[b].start)
+            position++;
+        info[b].end = position - 1;
+    }
+
+    size_t valueCount = ranges.usage / sizeof(void *);
+    struct frame_range **rangeArray = ranges.buffer;
+    // Arguments arrive in registers that are spilled at the end of the entry
+    // block at the latest.
+    for (size_t i = 0; i < fn->argumentCount && count; i++)
+        _fl_extend(rangeArray[i], info[0].end);
+    size_t words = (valueCount + 63) / 64;
+    uint64_t *sets = dzmalloc(sizeof(uint64_t) * (words * 5 * count + 1));
+    for (size_t b = 0; b < count; b++) {
+        uint64_t *set = sets + words * 5 * b;
+        info[b].in = set;
+        info[b].out = set + words;
+        info[b].gen = set + words * 2;
+        info[b].kill = set + words * 3;
+        info[b].phiOut = set + words * 4;
+    }
+    for (size_t b = 0; b < count; b++)
+        _fl_scan(layout, &blocks, &info[b], order[b]);
+    _fl_liveness(&blocks, info, order, count, words);
+
+    // Values that are live across a block boundary cover it.
+    for (size_t b = 0; b < count; b++) {
+        for (size_t n = 0; n < valueCount; n++) {
+            if (_fl_has(info[b].in, n))
+                _fl_extend(rangeArray[n], info[b].start);
+            if (_fl_has(info[b].out, n))
+                _fl_extend(rangeArray[n], info[b].end);
+        }
+    }
+    _fl_color(layout, rangeArray, valueCount);
+
+    free(sets);
+    free(info);
+    dbuffer_free(&ranges);
+    hashmap_free(&blocks);
+}
+
+void frame_layout_free(struct frame_layout *layout) {
+    hashmap_free(&layout->ranges);
+    zone_free(&layout->zone);
+}
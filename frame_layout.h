@@ -0,0 +1,44 @@
+// Stack slots of the values of a function. Instructions are numbered in
+// emission order and a value is live on the hull of the positions where it is
+// defined, used or live across a block boundary. Values whose ranges don't
+// overlap share a slot, so the frame only grows with the values that are live
+// at the same time.
+#ifndef FRAME_LAYOUT_H
+#define FRAME_LAYOUT_H
+
+#include "hashmap.h"
+#include "ir.h"
+#include "zone_alloc.h"
+
+struct frame_range {
+    // Positions of the first and the last instruction the value is live at,
+    // both inclusive.
+    size_t start;
+    size_t end;
+    // 1-based like the stack positions of variables.
+    size_t slot;
+    // Index in the liveness sets.
+    size_t number;
+    struct hm_bucket_entry entry;
+};
+
+struct frame_layout {
+    // value -> frame_range
+    hashmap_t ranges;
+    // The values use the slots 1 to slotCount.
+    size_t slotCount;
+    zone_allocator zone;
+};
+
+// Blocks are emitted in @order, the position of every instruction is stored
+// in inst->i. Phi copies happen at the end of the predecessors, so phis and
+// their operands are live there. @order starts with the entry block.
+void frame_layout_compute(struct frame_layout *layout, function_t *fn,
+                          basic_block_t **order, size_t count);
+void frame_layout_free(struct frame_layout *layout);
+
+// NULL for values without a slot, like constants and blocks.
+struct frame_range *frame_layout_get(struct frame_layout *layout,
+                                     value_t *value);
+
+#endif
@@ -0,0 +1,599 @@
+#include "interp.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+// Bytecode operations, loads, assigns and phi copies all become moves and
+// binary instructions get one operation per operator.
+//
+// move       dst = a
+// binary     dst = a op b
+// jump       pc = a
+// jump_cond  pc = a ? dst : b
+// loop       count a back edge of loops[a]
+// call       dst = calls[a](...)
+// return     return a
+
+// clang-format off
+#define INTERP_OPS(o)               \
+    o(IOP_MOVE, move)               \
+    o(IOP_ADD, add)                 \
+    o(IOP_SUB, sub)                 \
+    o(IOP_MUL, mul)                 \
+    o(IOP_DIV, div)                 \
+    o(IOP_EQUALS, equals)           \
+    o(IOP_LESS, less)               \
+    o(IOP_GREATER, greater)         \
+    o(IOP_LESS_EQ, less_eq)         \
+    o(IOP_GREATER_EQ, greater_eq)   \
+    o(IOP_JUMP, jump)               \
+    o(IOP_JUMP_COND, jump_cond)     \
+    o(IOP_LOOP, loop)               \
+    o(IOP_CALL, call)               \
+    o(IOP_RETURN, return)
+
+// Binary operators in the order of enum binary_ops.
+// o(name, c operator)
+#define INTERP_BINARY_OPS(o)        \
+    o(add, +)                       \
+    o(sub, -)                       \
+    o(mul, *)                       \
+    o(div, /)                       \
+    o(equals, ==)                   \
+    o(less, <)                      \
+    o(greater, >)                   \
+    o(less_eq, <=)                  \
+    o(greater_eq, >=)
+// clang-format on
+
+#define COMMA_FIRST(a, b) a,
+enum interp_opcode { INTERP_OPS(COMMA_FIRST) };
+#undef COMMA_FIRST
+
+// Operands are frame slots or bytecode positions.
+struct interp_op {
+    uint32_t op;
+    uint32_t dst;
+    uint32_t a;
+    uint32_t b;
+};
+
+struct interp_call {
+    function_t *fn;
+    // Resolved on the first call.
+    struct interp_program *program;
+    // Argument slots live in interp_program::callArgs.
+    size_t argStart;
+    size_t argCount;
+};
+
+struct interp_loop {
+    basic_block_t *header;
+    // Back edges since the OSR hook was last asked.
+    size_t count;
+};
+
+struct interp_program {
+    function_t *fn;
+    struct interp_op *ops;
+    // The initial frame, arguments come first, constants are already in
+    // place.
+    int64_t *frame;
+    size_t slotCount;
+    size_t argumentCount;
+
+    struct interp_call *calls;
+    size_t callCount;
+    uint32_t *callArgs;
+
+    struct interp_loop *loops;
+    // Variables in the order they were first seen, and their slots.
+    size_t *varIds;
+    uint32_t *varSlots;
+    size_t varCount;
+
+    struct hm_bucket_entry entry;
+};
+
+// A frame slot or a bytecode position.
+struct _interp_slot {
+    uint32_t slot;
+    struct hm_bucket_entry entry;
+};
+
+struct _interp_decoder {
+    struct interp_program *p;
+    // value -> _interp_slot.
+    hashmap_t values;
+    // rId -> _interp_slot, variables before SSA conversion.
+    hashmap_t variables;
+    // block -> _interp_slot, where the block starts.
+    hashmap_t blocks;
+    // header -> _interp_slot, index of the loop.
+    hashmap_t loops;
+
+    dbuffer_t ops;
+    dbuffer_t frame;
+    dbuffer_t calls;
+    dbuffer_t callArgs;
+    dbuffer_t loopList;
+    dbuffer_t varIds;
+    dbuffer_t varSlots;
+    // Byte offsets into ops of jump targets, in pairs with the target block.
+    dbuffer_t fixups;
+    // Slots for phi copies, shared by every edge.
+    dbuffer_t temps;
+
+    zone_allocator zone;
+};
+
+void interp_init(struct interp *in, ir_context_t *ctx) {
+    *in = (struct interp){};
+    in->ctx = ctx;
+    hashmap_init(&in->programs, ptrKeyType);
+    dbuffer_init(&in->programList);
+}
+
+void interp_free(struct interp *in) {
+    size_t count;
+    struct interp_program **programs = (struct interp_program **)
+        dbuffer_asPtrArray(&in->programList, &count);
+    for (size_t i = 0; i < count; i++) {
+        free(programs[i]->ops);
+        free(programs[i]->frame);
+        free(programs[i]->calls);
+        free(programs[i]->callArgs);
+        free(programs[i]->loops);
+        free(programs[i]->varIds);
+        free(programs[i]->varSlots);
+        free(programs[i]);
+    }
+    dbuffer_free(&in->programList);
+    hashmap_free(&in->programs);
+}
+
+uint32_t _interp_newSlot(struct _interp_decoder *d, int64_t initial) {
+    dbuffer_pushData(&d->frame, &initial, sizeof(int64_t));
+    return d->p->slotCount++;
+}
+
+struct _interp_slot *_interp_newEntry(struct _interp_decoder *d,
+                                      uint32_t slot) {
+    struct _interp_slot *entry = znnew(&d->zone, struct _interp_slot);
+    entry->slot = slot;
+    return entry;
+}
+
+uint32_t _interp_valueSlot(struct _interp_decoder *d, value_t *value) {
+    if (value->type == ARGUMENT)
+        return containerof(value, value_argument_t, value)->index;
+
+    struct hm_bucket_entry *entry = hashmap_getPtr(&d->values, value);
+    if (entry)
+        return containerof(entry, struct _interp_slot, entry)->slot;
+
+    uint32_t slot;
+    if (value->type == CONST)
+        slot = _interp_newSlot(
+            d, containerof(value, value_constant_t, value)->number);
+    else if (value->type == INST)
+        slot = _interp_newSlot(d, 0);
+    else
+        assert(0 && "value can't be interpreted");
+
+    hashmap_setPtr(&d->values, value, &_interp_newEntry(d, slot)->entry);
+    return slot;
+}
+
+uint32_t _interp_variableSlot(struct _interp_decoder *d, size_t rId) {
+    struct hm_bucket_entry *entry = hashmap_getInt(&d->variables, rId);
+    if (entry)
+        return containerof(entry, struct _interp_slot, entry)->slot;
+
+    uint32_t slot = _interp_newSlot(d, 0);
+    hashmap_setInt(&d->variables, rId, &_interp_newEntry(d, slot)->entry);
+    dbuffer_pushData(&d->varIds, &rId, sizeof(rId));
+    dbuffer_pushData(&d->varSlots, &slot, sizeof(slot));
+    return slot;
+}
+
+size_t _interp_pc(struct _interp_decoder *d) {
+    return d->ops.usage / sizeof(struct interp_op);
+}
+
+struct interp_op *_interp_getOp(struct _interp_decoder *d, size_t pc) {
+    return (struct interp_op *)d->ops.buffer + pc;
+}
+
+size_t _interp_emit(struct _interp_decoder *d, enum interp_opcode op,
+                    uint32_t dst, uint32_t a, uint32_t b) {
+    struct interp_op result = {.op = op, .dst = dst, .a = a, .b = b};
+    dbuffer_pushData(&d->ops, &result, sizeof(result));
+    return _interp_pc(d) - 1;
+}
+
+// The field at @offset of the op at @pc will hold the position of @block.
+void _interp_fixup(struct _interp_decoder *d, size_t pc, size_t offset,
+                   basic_block_t *block) {
+    dbuffer_pushPtr(&d->fixups,
+                    (void *)(pc * sizeof(struct interp_op) + offset));
+    dbuffer_pushPtr(&d->fixups, block);
+}
+
+void _interp_jump(struct _interp_decoder *d, basic_block_t *target) {
+    size_t pc = _interp_emit(d, IOP_JUMP, 0, 0, 0);
+    _interp_fixup(d, pc, offsetof(struct interp_op, a), target);
+}
+
+// Blocks are placed in reverse postorder, a jump to a placed block is a back
+// edge. Back edges are counted for OSR.
+int _interp_isBackEdge(struct _interp_decoder *d, basic_block_t *target) {
+    return hashmap_getPtr(&d->blocks, target) != NULL;
+}
+
+void _interp_countBackEdge(struct _interp_decoder *d, basic_block_t *target) {
+    uint32_t index;
+    struct hm_bucket_entry *entry = hashmap_getPtr(&d->loops, target);
+    if (entry) {
+        index = containerof(entry, struct _interp_slot, entry)->slot;
+    } else {
+        struct interp_loop loop = {.header = target};
+        index = d->loopList.usage / sizeof(loop);
+        dbuffer_pushData(&d->loopList, &loop, sizeof(loop));
+        hashmap_setPtr(&d->loops, target, &_interp_newEntry(d, index)->entry);
+    }
+    _interp_emit(d, IOP_LOOP, 0, index, 0);
+}
+
+int _interp_hasPhi(basic_block_t *block) {
+    if (list_empty(&block->instructions))
+        return 0;
+    instruction_t *first =
+        containerof(block->instructions.next, instruction_t, inst_list);
+    return first->type == INST_PHI;
+}
+
+uint32_t _interp_temp(struct _interp_decoder *d, size_t i) {
+    if (i * sizeof(void *) == d->temps.usage)
+        dbuffer_pushPtr(&d->temps, (void *)(size_t)_interp_newSlot(d, 0));
+    return (size_t)((void **)d->temps.buffer)[i];
+}
+
+// Assign the phis of @to for the edge @from -> @to. A phi can read another
+// phi of the same block, so the values go through temporaries first.
+void _interp_phiCopies(struct _interp_decoder *d, basic_block_t *from,
+                       basic_block_t *to) {
+    dbuffer_t phis;
+    dbuffer_init(&phis);
+    LIST_FOR_EACH(&to->instructions) {
+        instruction_t *inst = containerof(c, instruction_t, inst_list);
+        if (inst->type != INST_PHI)
+            break;
+        inst_phi_t *phi = IR_INST_AS_TYPE(inst, inst_phi_t);
+        for (size_t i = 0; i < phi->useCount; i += 2) {
+            if (phi->uses[i]->value != &from->value)
+                continue;
+            dbuffer_pushPtr(&phis, inst);
+            dbuffer_pushPtr(&phis, phi->uses[i + 1]->value);
+            break;
+        }
+    }
+
+    size_t count;
+    void **pairs = dbuffer_asPtrArray(&phis, &count);
+    count /= 2;
+    if (count == 1) {
+        instruction_t *phi = pairs[0];
+        _interp_emit(d, IOP_MOVE, _interp_valueSlot(d, &phi->value),
+                     _interp_valueSlot(d, pairs[1]), 0);
+    } else {
+        for (size_t i = 0; i < count; i++)
+            _interp_emit(d, IOP_MOVE, _interp_temp(d, i),
+                         _interp_valueSlot(d, pairs[i * 2 + 1]), 0);
+        for (size_t i = 0; i < count; i++) {
+            instruction_t *phi = pairs[i * 2];
+            _interp_emit(d, IOP_MOVE, _interp_valueSlot(d, &phi->value),
+                         _interp_temp(d, i), 0);
+        }
+    }
+    dbuffer_free(&phis);
+}
+
+void _interp_jumpCond(struct _interp_decoder *d, basic_block_t *block,
+                      inst_jump_cond_t *jump) {
+    basic_block_t *targets[2];
+    for (int i = 0; i < 2; i++)
+        targets[i] = containerof(jump->uses[i]->value, basic_block_t, value);
+
+    size_t pc = _interp_emit(d, IOP_JUMP_COND, 0,
+                             _interp_valueSlot(d, jump->uses[2]->value), 0);
+    size_t offsets[2] = {offsetof(struct interp_op, dst),
+                         offsetof(struct interp_op, b)};
+
+    // Phi copies and back edge counters must only happen on the taken edge,
+    // they get a stub.
+    for (int i = 0; i < 2; i++) {
+        int isBackEdge = _interp_isBackEdge(d, targets[i]);
+        if (!isBackEdge && !_interp_hasPhi(targets[i])) {
+            _interp_fixup(d, pc, offsets[i], targets[i]);
+            continue;
+        }
+        uint32_t stub = _interp_pc(d);
+        struct interp_op *op = _interp_getOp(d, pc);
+        if (i == 0)
+            op->dst = stub;
+        else
+            op->b = stub;
+        if (isBackEdge)
+            _interp_countBackEdge(d, targets[i]);
+        _interp_phiCopies(d, block, targets[i]);
+        _interp_jump(d, targets[i]);
+    }
+}
+
+void _interp_functionCall(struct _interp_decoder *d,
+                          inst_function_call_t *call) {
+    value_t *callee = call->uses[0]->value;
+    struct interp_call result = {
+        .fn = containerof(callee, function_t, value),
+        .argStart = d->callArgs.usage / sizeof(uint32_t),
+        .argCount = call->useCount - 1,
+    };
+    for (size_t i = 1; i < call->useCount; i++) {
+        uint32_t slot = _interp_valueSlot(d, call->uses[i]->value);
+        dbuffer_pushData(&d->callArgs, &slot, sizeof(slot));
+    }
+    dbuffer_pushData(&d->calls, &result, sizeof(result));
+
+    _interp_emit(d, IOP_CALL, _interp_valueSlot(d, &call->inst.value),
+                 d->calls.usage / sizeof(result) - 1, 0);
+}
+
+// Returns 1 if the instruction ends the block.
+int _interp_instruction(struct _interp_decoder *d, basic_block_t *block,
+                        basic_block_t *next, instruction_t *inst) {
+    switch (inst->type) {
+    case INST_PHI:
+        // Assigned by the predecessors.
+        break;
+    case INST_LOAD_VAR: {
+        inst_load_var_t *load = IR_INST_AS_TYPE(inst, inst_load_var_t);
+        _interp_emit(d, IOP_MOVE, _interp_valueSlot(d, &inst->value),
+                     _interp_variableSlot(d, load->rId), 0);
+        break;
+    }
+    case INST_ASSIGN_VAR: {
+        inst_assign_var_t *assign = IR_INST_AS_TYPE(inst, inst_assign_var_t);
+        _interp_emit(d, IOP_MOVE, _interp_variableSlot(d, assign->rId),
+                     _interp_valueSlot(d, assign->var->value), 0);
+        break;
+    }
+    case INST_BINARY: {
+        inst_binary_t *binary = IR_INST_AS_TYPE(inst, inst_binary_t);
+        _interp_emit(d, IOP_ADD + binary->op,
+                     _interp_valueSlot(d, &inst->value),
+                     _interp_valueSlot(d, binary->left->value),
+                     _interp_valueSlot(d, binary->right->value));
+        break;
+    }
+    case INST_FUNCTION_CALL:
+        _interp_functionCall(d, IR_INST_AS_TYPE(inst, inst_function_call_t));
+        break;
+    case INST_JUMP: {
+        inst_jump_t *jump = IR_INST_AS_TYPE(inst, inst_jump_t);
+        basic_block_t *target =
+            containerof(jump->uses[0]->value, basic_block_t, value);
+        if (_interp_isBackEdge(d, target))
+            _interp_countBackEdge(d, target);
+        _interp_phiCopies(d, block, target);
+        // The next block is placed right after this one.
+        if (target != next)
+            _interp_jump(d, target);
+        return 1;
+    }
+    case INST_JUMP_COND:
+        _interp_jumpCond(d, block, IR_INST_AS_TYPE(inst, inst_jump_cond_t));
+        return 1;
+    case INST_RETURN: {
+        inst_return_t *ret = IR_INST_AS_TYPE(inst, inst_return_t);
+        uint32_t slot = ret->hasReturn
+                            ? _interp_valueSlot(d, ret->uses[0]->value)
+                            : _interp_newSlot(d, 0);
+        _interp_emit(d, IOP_RETURN, 0, slot, 0);
+        return 1;
+    }
+    }
+    return 0;
+}
+
+struct interp_program *_interp_decode(function_t *fn) {
+    struct interp_program *p = nnew(struct interp_program);
+    *p = (struct interp_program){.fn = fn,
+                                 .argumentCount = fn->argumentCount};
+
+    struct _interp_decoder d = {.p = p};
+    hashmap_init(&d.values, ptrKeyType);
+    hashmap_init(&d.variables, intKeyType);
+    hashmap_init(&d.blocks, ptrKeyType);
+    hashmap_init(&d.loops, ptrKeyType);
+    dbuffer_init(&d.ops);
+    dbuffer_init(&d.frame);
+    dbuffer_init(&d.calls);
+    dbuffer_init(&d.callArgs);
+    dbuffer_init(&d.loopList);
+    dbuffer_init(&d.varIds);
+    dbuffer_init(&d.varSlots);
+    dbuffer_init(&d.fixups);
+    dbuffer_init(&d.temps);
+    zone_init(&d.zone);
+
+    for (size_t i = 0; i < fn->argumentCount; i++)
+        _interp_newSlot(&d, 0);
+
+    // Reverse postorder, the entry block starts at 0.
+    size_t count;
+    basic_block_t **postorder = function_computePostorder(fn, &count);
+    for (size_t i = count; i-- > 0;) {
+        basic_block_t *block = postorder[i];
+        basic_block_t *next = i > 0 ? postorder[i - 1] : NULL;
+        hashmap_setPtr(&d.blocks, block,
+                       &_interp_newEntry(&d, _interp_pc(&d))->entry);
+
+        int terminated = 0;
+        LIST_FOR_EACH(&block->instructions) {
+            instruction_t *inst = containerof(c, instruction_t, inst_list);
+            terminated = _interp_instruction(&d, block, next, inst);
+            if (terminated)
+                break;
+        }
+        // Falling off the end of a block returns from the function.
+        if (!terminated)
+            _interp_emit(&d, IOP_RETURN, 0, _interp_newSlot(&d, 0), 0);
+    }
+    free(postorder);
+
+    size_t fixupCount;
+    void **fixups = dbuffer_asPtrArray(&d.fixups, &fixupCount);
+    for (size_t i = 0; i < fixupCount; i += 2) {
+        struct hm_bucket_entry *entry =
+            hashmap_getPtr(&d.blocks, fixups[i + 1]);
+        *(uint32_t *)((char *)d.ops.buffer + (size_t)fixups[i]) =
+            containerof(entry, struct _interp_slot, entry)->slot;
+    }
+
+    // The program takes the buffers.
+    p->ops = d.ops.buffer;
+    p->frame = d.frame.buffer;
+    p->calls = d.calls.buffer;
+    p->callCount = d.calls.usage / sizeof(struct interp_call);
+    p->callArgs = d.callArgs.buffer;
+    p->loops = d.loopList.buffer;
+    p->varIds = d.varIds.buffer;
+    p->varSlots = d.varSlots.buffer;
+    p->varCount = d.varIds.usage / sizeof(size_t);
+
+    hashmap_free(&d.values);
+    hashmap_free(&d.variables);
+    hashmap_free(&d.blocks);
+    hashmap_free(&d.loops);
+    dbuffer_free(&d.fixups);
+    dbuffer_free(&d.temps);
+    zone_free(&d.zone);
+    return p;
+}
+
+struct interp_program *_interp_program(struct interp *in, function_t *fn) {
+    struct hm_bucket_entry *entry = hashmap_getPtr(&in->programs, fn);
+    if (entry)
+        return containerof(entry, struct interp_program, entry);
+
+    struct interp_program *p = _interp_decode(fn);
+    hashmap_setPtr(&in->programs, fn, &p->entry);
+    dbuffer_pushPtr(&in->programList, p);
+    return p;
+}
+
+void interp_prepare(struct interp *in, function_t *fn) {
+    struct interp_program *p = _interp_program(in, fn);
+    for (size_t i = 0; i < p->callCount; i++) {
+        struct interp_call *call = &p->calls[i];
+        if (call->program)
+            continue;
+        call->program = _interp_program(in, call->fn);
+        interp_prepare(in, call->fn);
+    }
+}
+
+void interp_setOsr(struct interp *in, size_t threshold, interp_osrHook hook,
+                   void *ctx) {
+    in->osrThreshold = threshold;
+    in->osrHook = hook;
+    in->osrCtx = ctx;
+}
+
+int _interp_osr(struct interp *in, struct interp_program *p, int64_t *frame,
+                basic_block_t *header, int64_t *result) {
+    int64_t values[p->argumentCount + p->varCount + 1];
+    memcpy(values, frame, p->argumentCount * sizeof(int64_t));
+    for (size_t i = 0; i < p->varCount; i++)
+        values[p->argumentCount + i] = frame[p->varSlots[i]];
+
+    struct interp_osr_state state = {.fn = p->fn,
+                                     .header = header,
+                                     .values = values,
+                                     .rIds = p->varIds,
+                                     .rIdCount = p->varCount};
+    return in->osrHook(in->osrCtx, &state, result);
+}
+
+// Dispatch is threaded through a table of label addresses, every handler
+// jumps straight to the next one. Like the JIT, dividing by zero traps.
+int64_t _interp_run(struct interp *in, struct interp_program *p,
+                    int64_t *args) {
+#define LABEL_ADDRESS(e, name) &&op_##name,
+    static void *dispatch[] = {INTERP_OPS(LABEL_ADDRESS)};
+#undef LABEL_ADDRESS
+
+    int64_t frame[p->slotCount];
+    memcpy(frame, p->frame, p->slotCount * sizeof(int64_t));
+    memcpy(frame, args, p->argumentCount * sizeof(int64_t));
+
+    struct interp_op *ops = p->ops;
+    struct interp_op *pc = ops;
+
+#define NEXT() goto *dispatch[(++pc)->op]
+#define JUMP(target) goto *dispatch[(pc = ops + (target))->op]
+
+    JUMP(0);
+
+op_move:
+    frame[pc->dst] = frame[pc->a];
+    NEXT();
+
+#define BINARY_HANDLER(name, operator)                                         \
+    op_##name : frame[pc->dst] = frame[pc->a] operator frame[pc->b];           \
+    NEXT();
+    INTERP_BINARY_OPS(BINARY_HANDLER)
+#undef BINARY_HANDLER
+
+op_jump:
+    JUMP(pc->a);
+
+op_jump_cond:
+    JUMP(frame[pc->a] ? pc->dst : pc->b);
+
+op_loop : {
+    struct interp_loop *loop = &p->loops[pc->a];
+    if (in->osrHook && ++loop->count >= in->osrThreshold) {
+        loop->count = 0;
+        int64_t result;
+        if (_interp_osr(in, p, frame, loop->header, &result))
+            return result;
+    }
+    NEXT();
+}
+
+op_call : {
+    struct interp_call *call = &p->calls[pc->a];
+    if (!call->program)
+        call->program = _interp_program(in, call->fn);
+
+    int64_t callArgs[call->argCount + 1];
+    for (size_t i = 0; i < call->argCount; i++)
+        callArgs[i] = frame[p->callArgs[call->argStart + i]];
+    frame[pc->dst] = _interp_run(in, call->program, callArgs);
+    NEXT();
+}
+
+op_return:
+    return frame[pc->a];
+
+#undef NEXT
+#undef JUMP
+}
+
+int64_t interp_call(struct interp *in, function_t *fn, int64_t *args) {
+    return _interp_run(in, _interp_program(in, fn), args);
+}
@@ -0,0 +1,55 @@
+// Interpreter for IR functions, works both before and after SSA conversion.
+// Functions are decoded once into a compact bytecode, so the first call costs
+// a single pass over the IR instead of a full codegen.
+#ifndef INTERP_H
+#define INTERP_H
+
+#include "hashmap.h"
+#include "ir.h"
+
+#include <stdint.h>
+
+// State of an interpreted function at a loop header.
+struct interp_osr_state {
+    function_t *fn;
+    basic_block_t *header;
+    // The arguments followed by the values of the variables @rIds.
+    int64_t *values;
+    size_t *rIds;
+    size_t rIdCount;
+};
+
+// Called when a loop gets hot. Returns 1 if the hook finished the call in
+// faster code, the result of the call is stored in @result.
+typedef int (*interp_osrHook)(void *ctx, struct interp_osr_state *state,
+                              int64_t *result);
+
+struct interp {
+    ir_context_t *ctx;
+    // function -> interp_program, decoded on the first call.
+    hashmap_t programs;
+    // Every decoded program, freed at the end.
+    dbuffer_t programList;
+
+    interp_osrHook osrHook;
+    void *osrCtx;
+    // Back edges taken before the hook is asked again.
+    size_t osrThreshold;
+};
+
+void interp_init(struct interp *in, ir_context_t *ctx);
+void interp_free(struct interp *in);
+
+// Ask @hook to take over loops after @threshold back edges.
+void interp_setOsr(struct interp *in, size_t threshold, interp_osrHook hook,
+                   void *ctx);
+
+// Decode @fn and every function it can reach through calls. After this
+// calling them doesn't read their IR anymore, so it can change.
+void interp_prepare(struct interp *in, function_t *fn);
+
+// Call @fn with @args, it must have fn->argumentCount arguments. Void
+// functions return 0.
+int64_t interp_call(struct interp *in, function_t *fn, int64_t *args);
+
+#endif
@@ -32,7 +32,7 @@ void _value_init(value_t *value, enum value_type type,
 value_constant_t *ir_constant_value(ir_context_t *ctx, int64_t value) {
     // TODO: Constant uniqeing.
     value_constant_t *result = znnew(&ctx->alloc, value_constant_t);
-    _value_init(&result->value, CONST, INT64);
+    _value_init(&result->value, CONST, DT_INT64);
     result->number = value;
     return result;
 }
@@ -69,6 +69,7 @@ basic_block_t *block_new(ir_context_t *ctx, function_t *fn) {
     block->parent = fn;
     _value_init(&block->value, V_BLOCK, DT_BLOCK);
     LIST_INIT(&block->instructions);
+    return block;
 }
 
 void _block_dump(ir_context_t *ctx, basic_block_t *block, dbuffer_t *dbuffer,
@@ -81,8 +82,9 @@ function_t *value_getFunction(value_t *value) {
     } else if (value->type == INST) {
         instruction_t *inst = containerof(value, instruction_t, value);
         return inst->parent->parent;
+    } else if (value->type == ARGUMENT) {
+        return containerof(value, value_argument_t, value)->parent;
     }
-    // FIXME: Support arguments.
     return NULL;
 }
 
@@ -335,6 +337,14 @@ void inst_dumpd(ir_context_t *ctx, instruction_t *inst, dbuffer_t *dbuffer,
             format_dbuffer("{int}", dbuffer, vConst->number);
             break;
         }
+        case ARGUMENT: {
+            value_argument_t *arg = containerof(value, value_argument_t, value);
+            format_dbuffer("arg{int}", dbuffer, arg->index);
+            break;
+        }
+        case UNKNOWN_CONST:
+            format_dbuffer("@{range}", dbuffer, value->name);
+            break;
         default:
             assert(0 && "Unknown value type");
         }
@@ -387,12 +397,27 @@ INSTRUCTIONS(GEN_NEW_INST)
 // this would be very usefull for ir creation.
 function_t *ir_new_function(ir_context_t *ctx, range_t name) {
     function_t *fun = znnew(&ctx->alloc, function_t);
-    fun->valueNameCounter = 0;
+    *fun = (function_t){};
+    _value_init(&fun->value, UNKNOWN_CONST, PTR);
+    value_setName(ctx, &fun->value, name);
+    fun->returnType = VOID;
 
     list_add(&ctx->functions, &fun->functions);
     return fun;
 }
 
+void function_setArguments(ir_context_t *ctx, function_t *fn, size_t count) {
+    fn->argumentCount = count;
+    fn->arguments = zone_alloc(&ctx->alloc, sizeof(value_argument_t) * count);
+    for (size_t i = 0; i < count; i++) {
+        value_argument_t *arg = &fn->arguments[i];
+        *arg = (value_argument_t){};
+        _value_init(&arg->value, ARGUMENT, DT_INT64);
+        arg->index = i;
+        arg->parent = fn;
+    }
+}
+
 inst_load_var_t *inst_new_load_var(ir_context_t *ctx, size_t i,
                                    enum data_type type) {
     inst_load_var_t *var = _inst_new_load_var(ctx, type);
@@ -437,8 +462,26 @@ inst_jump_cond_t *inst_new_jump_cond(ir_context_t *ctx, basic_block_t *a,
     return jump;
 }
 
-inst_return_t *inst_new_return(ir_context_t *ctx) {
-    return _inst_new_return(ctx, VOID);
+inst_return_t *inst_new_return(ir_context_t *ctx, value_t *value) {
+    inst_return_t *ret = _inst_new_return(ctx, VOID);
+    if (value) {
+        ret->hasReturn = 1;
+        inst_setUse(ctx, &ret->inst, 0, value);
+    }
+    return ret;
+}
+
+inst_function_call_t *inst_new_function_call(ir_context_t *ctx, function_t *fn,
+                                             value_t **args, size_t count) {
+    inst_function_call_t *call = _inst_new_function_call(ctx, fn->returnType);
+    call->useCount = count + 1;
+    call->uses = zone_alloc(&ctx->alloc, sizeof(use_t *) * call->useCount);
+    memset(call->uses, 0, sizeof(use_t *) * call->useCount);
+
+    inst_setUse(ctx, &call->inst, 0, &fn->value);
+    for (size_t i = 0; i < count; i++)
+        inst_setUse(ctx, &call->inst, i + 1, args[i]);
+    return call;
 }
 
 inst_phi_t *inst_new_phi(ir_context_t *ctx, enum data_type type,
@@ -515,7 +558,14 @@ use_t **inst_getUses(instruction_t *inst, size_t *count) {
     switch (inst->type) {
         INST_CONSTANT_USE(GEN_INST_CONSTANT_USE)
         INST_VARIABLE_USE(GEN_INST_VARIABLE_USE)
+    case INST_RETURN: {
+        inst_return_t *ret = IR_INST_AS_TYPE(inst, inst_return_t);
+        *count = ret->hasReturn;
+        return ret->uses;
     }
+    }
+    assert(0 && "unknown instruction");
+    return NULL;
 }
 
 // ---- Iterators ----
@@ -603,16 +653,18 @@ void pre_visit(basic_block_t *block, dbuffer_t *dbuffer, hashset_t *hashset) {
     dbuffer_pushPtr(dbuffer, block);
 }
 
-basic_block_t** block_computePostorder(function_t *fn) {
+basic_block_t **function_computePostorder(function_t *fn, size_t *count) {
     hashset_t hashset; // set of pointers.
     hashset_init(&hashset, ptrKeyType);
-    
+
     dbuffer_t postorder;
     dbuffer_init(&postorder);
 
     pre_visit(fn->entry, &postorder, &hashset);
+    hashset_free(&hashset);
 
     // It is safe to return dbuffers this way.
-    return postorder.buffer;   
+    *count = postorder.usage / sizeof(void *);
+    return postorder.buffer;
 }
 
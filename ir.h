@@ -4,6 +4,8 @@
 #include "buffer.h"
 #include "hashmap.h"
 
+#include <stdint.h>
+
 #define INST_TYPE(prefix) inst_##prefix##_t
 
 #define IR_VALUE_AS_TYPE(ptr, type) containerof(ptr, type, value)
@@ -39,7 +41,7 @@ struct function;
 typedef struct function function_t;
 
 // Data types.
-enum data_type { VOID, INT64, PTR, DT_BLOCK };
+enum data_type { VOID, DT_INT64, PTR, DT_BLOCK };
 
 // The IR context, manages all IR objects.
 typedef struct {
@@ -66,6 +68,9 @@ typedef struct {
 typedef struct {
     // Inherit from value.
     value_t value;
+    // Position in the argument list.
+    size_t index;
+    function_t *parent;
 } value_argument_t;
 
 // A block, can only contain a jump at the end
@@ -93,6 +98,7 @@ struct function {
 
     // Argument count of this function.
     size_t argumentCount;
+    value_argument_t *arguments;
 
     // Used for naming values that live inside this block.
     size_t valueNameCounter;
@@ -134,6 +140,9 @@ struct instruction {
 
     basic_block_t *parent;
     size_t i; // instruction number, doesn't get updated automatically.
+    // 1-based source position, 0 when the instruction has none.
+    uint32_t line;
+    uint32_t col;
 };
 
 // The magic phi instruction, used for the SSA form.
@@ -201,6 +210,7 @@ typedef struct {
 
     // A function call have variable number of uses,
     // this is needed for passing arguments.
+    // The first use is the function, the rest are arguments.
     size_t useCount;
     use_t **uses;
 } inst_function_call_t;
@@ -283,9 +293,12 @@ inst_jump_t *inst_new_jump(ir_context_t *ctx, basic_block_t *block);
 inst_jump_cond_t *inst_new_jump_cond(ir_context_t *ctx, basic_block_t *a,
                                      basic_block_t *b, value_t *cond);
 
-// Create a new return instruction
-// FIXME: Missing return value.
-inst_return_t *inst_new_return(ir_context_t *ctx);
+// Create a new return instruction, @value is NULL for void functions.
+inst_return_t *inst_new_return(ir_context_t *ctx, value_t *value);
+
+// Create a call to @fn, the result has the return type of @fn.
+inst_function_call_t *inst_new_function_call(ir_context_t *ctx, function_t *fn,
+                                             value_t **args, size_t count);
 
 // Create a new phi value.
 inst_phi_t *inst_new_phi(ir_context_t *ctx, enum data_type type,
@@ -297,9 +310,11 @@ void inst_phi_insertValue(inst_phi_t *phi, ir_context_t *ctx,
                           basic_block_t *block, value_t *value);
 
 // Create a new function.
-// FIXME: Missing return value.
 function_t *ir_new_function(ir_context_t *context, range_t name);
 
+// Create @count DT_INT64 arguments for the function.
+void function_setArguments(ir_context_t *ctx, function_t *fn, size_t count);
+
 // Set a use of the instruction.
 void inst_setUse(ir_context_t *ctx, instruction_t *inst, size_t useOffset,
                  value_t *value);
@@ -360,7 +375,7 @@ struct block_successor_it block_successor_next(struct block_successor_it it);
 
 basic_block_t *block_successor_get(struct block_successor_it it);
 
-// Compute postorder for cfg.
-basic_block_t** function_computePostorder(function_t *fn);
+// Compute postorder for cfg, the result must be freed.
+basic_block_t **function_computePostorder(function_t *fn, size_t *count);
 
 #endif
@@ -0,0 +1,1134 @@
+#include "ir_codegen.h"
+#include "dominators.h"
+#include "mir_peephole.h"
+#include "mir_regalloc.h"
+#include "mir_schedule.h"
+#include "x86_64.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define IC_NO_BLOCK SIZE_MAX
+
+struct ir_value_info {
+    uint32_t vreg;
+    // Only used for blocks, index is the position in reverse postorder.
+    label_t label;
+    size_t index;
+    // MIR block the code of the block goes to.
+    struct mir_block *mir;
+    // Callee saved registers the block writes, as a mask of reg64.
+    unsigned calleeSaved;
+    // Blocks: an arm of a select, its code runs in the block of the if.
+    // Values: computed or assigned by a select, their vreg doesn't share a
+    // stack slot since the select moves them away from their position.
+    int selected;
+    struct hm_bucket_entry entry;
+};
+
+// Edge of a conditional jump with phi copies or a counter.
+struct _ic_edge {
+    label_t *label;
+    basic_block_t *from;
+    basic_block_t *to;
+    enum profile_counter counter;
+};
+
+void ir_codegen_init(struct ir_codegen *ic, struct codegen *cg,
+                     ir_context_t *ctx, ir_codegen_labelResolver resolveLabel,
+                     void *resolveCtx) {
+    *ic = (struct ir_codegen){};
+    ic->cg = cg;
+    ic->ctx = ctx;
+    ic->resolveLabel = resolveLabel;
+    ic->resolveCtx = resolveCtx;
+    hashmap_init(&ic->values, ptrKeyType);
+    hashmap_init(&ic->registers, intKeyType);
+    dbuffer_init(&ic->blocks);
+    dbuffer_init(&ic->edges);
+    dbuffer_init(&ic->positions);
+    zone_init(&ic->zone);
+}
+
+void ir_codegen_free(struct ir_codegen *ic) {
+    hashmap_free(&ic->values);
+    hashmap_free(&ic->registers);
+    dbuffer_free(&ic->blocks);
+    dbuffer_free(&ic->edges);
+    dbuffer_free(&ic->positions);
+    zone_free(&ic->zone);
+}
+
+struct ir_value_info *_ic_info(struct ir_codegen *ic, value_t *value) {
+    struct hm_bucket_entry *entry = hashmap_getPtr(&ic->values, value);
+    if (entry)
+        return containerof(entry, struct ir_value_info, entry);
+
+    struct ir_value_info *info = znnew(&ic->zone, struct ir_value_info);
+    *info = (struct ir_value_info){};
+    hashmap_setPtr(&ic->values, value, &info->entry);
+    return info;
+}
+
+label_t *_ic_blockLabel(struct ir_codegen *ic, basic_block_t *block) {
+    return &_ic_info(ic, &block->value)->label;
+}
+
+size_t _ic_blockIndex(struct ir_codegen *ic, basic_block_t *block) {
+    return _ic_info(ic, &block->value)->index;
+}
+
+// inc qword [counter], the flags are clobbered. They are dead at the start
+// of blocks and edges.
+void _ic_count(struct ir_codegen *ic, basic_block_t *block,
+               enum profile_counter counter) {
+    if (!ic->profiled)
+        return;
+    uint64_t *address =
+        profile_counter(ic->profiled, _ic_blockIndex(ic, block), counter);
+    uint32_t base = mir_newVreg(&ic->mir, 0);
+    mir_mov(ic->current, mir_vreg(base), mir_imm((long)address));
+    mir_inc(ic->current, mir_vmem(base, 0));
+}
+
+// vreg of @value, it takes the slot of the value in the frame layout.
+uint32_t _ic_vreg(struct ir_codegen *ic, value_t *value) {
+    struct ir_value_info *info = _ic_info(ic, value);
+    if (!info->vreg) {
+        struct frame_range *range = frame_layout_get(&ic->frame, value);
+        size_t slot = range && !info->selected ? range->slot : 0;
+        info->vreg = mir_newVreg(&ic->mir, slot);
+    }
+    return info->vreg;
+}
+
+uint32_t _ic_register(struct ir_codegen *ic, size_t rId) {
+    struct hm_bucket_entry *entry = hashmap_getInt(&ic->registers, rId);
+    if (entry)
+        return containerof(entry, struct ir_value_info, entry)->vreg;
+
+    struct ir_value_info *info = znnew(&ic->zone, struct ir_value_info);
+    *info = (struct ir_value_info){};
+    info->vreg = mir_newVreg(&ic->mir, 0);
+    hashmap_setInt(&ic->registers, rId, &info->entry);
+    return info->vreg;
+}
+
+int _ic_isImm32(value_t *value, int32_t *imm) {
+    if (value->type != CONST)
+        return 0;
+    int64_t number = containerof(value, value_constant_t, value)->number;
+    if (number < INT32_MIN || number > INT32_MAX)
+        return 0;
+    *imm = number;
+    return 1;
+}
+
+// Constants are immediates, anything else its vreg.
+struct mir_operand _ic_operand(struct ir_codegen *ic, value_t *value) {
+    if (value->type == CONST)
+        return mir_imm(containerof(value, value_constant_t, value)->number);
+
+    // Phis are assigned at the end of predecessors, which might come later.
+    assert((_ic_info(ic, value)->vreg ||
+            (value->type == INST &&
+             containerof(value, instruction_t, value)->type == INST_PHI)) &&
+           "value used before it is defined");
+    return mir_vreg(_ic_vreg(ic, value));
+}
+
+// Like _ic_operand, but constants are moved into a vreg of their own.
+struct mir_operand _ic_reg(struct ir_codegen *ic, value_t *value) {
+    struct mir_operand operand = _ic_operand(ic, value);
+    if (operand.kind != MIR_IMM)
+        return operand;
+    struct mir_operand temp = mir_vreg(mir_newVreg(&ic->mir, 0));
+    mir_mov(ic->current, temp, operand);
+    return temp;
+}
+
+// vreg of the result of the instruction.
+struct mir_operand _ic_define(struct ir_codegen *ic, instruction_t *inst) {
+    assert(!_ic_info(ic, &inst->value)->vreg && "value is defined twice");
+    return mir_vreg(_ic_vreg(ic, &inst->value));
+}
+
+cond_code _ic_condCode(enum binary_ops op) {
+    switch (op) {
+    case BO_EQUALS:
+        return CC_E;
+    case BO_LESS:
+        return CC_L;
+    case BO_GREATER:
+        return CC_G;
+    case BO_LESS_EQ:
+        return CC_LE;
+    case BO_GREATER_EQ:
+        return CC_GE;
+    default:
+        assert(0 && "not a comparison");
+    }
+    return CC_E;
+}
+
+// Condition codes come in pairs, the low bit negates them.
+cond_code _ic_negate(cond_code cc) { return cc ^ 1; }
+
+// Condition of the comparison with its operands swapped.
+cond_code _ic_swapOperands(cond_code cc) {
+    switch (cc) {
+    case CC_L:
+        return CC_G;
+    case CC_G:
+        return CC_L;
+    case CC_LE:
+        return CC_GE;
+    case CC_GE:
+        return CC_LE;
+    default:
+        return cc;
+    }
+}
+
+// The user of @inst if it is the only one and comes right after it. Only
+// then can @inst be folded into it, frame slots are shared by values that
+// aren't live at once and the operands of @inst might end their range at it.
+instruction_t *_ic_nextUser(instruction_t *inst) {
+    struct list_head *uses = &inst->value.uses;
+    if (list_empty(uses) || uses->next->next != uses)
+        return NULL;
+    instruction_t *user = containerof(uses->next, use_t, useList)->inst;
+    if (user->parent != inst->parent || user->i != inst->i + 1)
+        return NULL;
+    return user;
+}
+
+// Scale of a multiplication that can be the index of an address, 0 if
+// there is none.
+int _ic_scale(inst_binary_t *binary) {
+    int32_t imm;
+    if (binary->op != BO_MUL || binary->left->value->type == CONST ||
+        !_ic_isImm32(binary->right->value, &imm))
+        return 0;
+    return imm == 1 || imm == 2 || imm == 4 || imm == 8 ? imm : 0;
+}
+
+// Whether the code of @inst is part of the code of its user: compares feed
+// the jcc of a conditional jump, a scaled index or the sum of two registers
+// go into the address of a lea.
+int _ic_isFused(instruction_t *inst) {
+    instruction_t *user = _ic_nextUser(inst);
+    if (inst->type != INST_BINARY || !user)
+        return 0;
+    inst_binary_t *binary = IR_INST_AS_TYPE(inst, inst_binary_t);
+    if (user->type == INST_JUMP_COND)
+        return binary->op >= BO_EQUALS;
+    if (user->type != INST_BINARY)
+        return 0;
+    inst_binary_t *add = IR_INST_AS_TYPE(user, inst_binary_t);
+    if (add->op != BO_ADD)
+        return 0;
+    if (_ic_scale(binary)) {
+        // The other operand is the base.
+        value_t *other = add->left->value == &inst->value ? add->right->value
+                                                          : add->left->value;
+        return other->type != CONST;
+    }
+    int32_t imm;
+    return binary->op == BO_ADD && add->left->value == &inst->value &&
+           _ic_isImm32(add->right->value, &imm) &&
+           binary->left->value->type != CONST &&
+           binary->right->value->type != CONST;
+}
+
+// The binary instruction of @value if it is fused into its user.
+inst_binary_t *_ic_fused(value_t *value) {
+    if (value->type != INST)
+        return NULL;
+    instruction_t *inst = containerof(value, instruction_t, value);
+    return _ic_isFused(inst) ? IR_INST_AS_TYPE(inst, inst_binary_t) : NULL;
+}
+
+// cmp of the comparison @binary, returns the condition under which it is
+// true. Constants can only be the right operand.
+cond_code _ic_compare(struct ir_codegen *ic, inst_binary_t *binary) {
+    value_t *left = binary->left->value;
+    value_t *right = binary->right->value;
+    cond_code cc = _ic_condCode(binary->op);
+    if (left->type == CONST && right->type != CONST) {
+        value_t *swap = left;
+        left = right;
+        right = swap;
+        cc = _ic_swapOperands(cc);
+    }
+    int32_t imm;
+    struct mir_operand src =
+        _ic_isImm32(right, &imm) ? mir_imm(imm) : _ic_reg(ic, right);
+    mir_alu(ic->current, ALU_CMP, _ic_reg(ic, left), src);
+    return cc;
+}
+
+// [base + index * scale + disp]
+struct _ic_address {
+    value_t *base;
+    value_t *index;
+    int scale;
+    int32_t disp;
+};
+
+// Fold the sum @add and the instructions fused into it into @address.
+// Fusion makes sure there is at most a base, an index and one immediate.
+void _ic_address(inst_binary_t *add, struct _ic_address *address) {
+    for (int i = 0; i < 2; i++) {
+        value_t *value = add->uses[i]->value;
+        inst_binary_t *inner = _ic_fused(value);
+        int32_t imm;
+        if (inner && inner->op == BO_MUL) {
+            address->index = inner->left->value;
+            address->scale = _ic_scale(inner);
+        } else if (inner) {
+            _ic_address(inner, address);
+        } else if (_ic_isImm32(value, &imm)) {
+            address->disp = imm;
+        } else if (!address->base) {
+            address->base = value;
+        } else {
+            address->index = value;
+            address->scale = 1;
+        }
+    }
+}
+
+// lea dst, [address], a plain copy without index and displacement.
+void _ic_lea(struct ir_codegen *ic, instruction_t *inst,
+             struct _ic_address *address) {
+    struct mir_operand base = _ic_reg(ic, address->base);
+    struct mir_operand index = {};
+    if (address->index)
+        index = _ic_reg(ic, address->index);
+    struct mir_operand dst = _ic_define(ic, inst);
+    if (!address->index && !address->disp)
+        mir_mov(ic->current, dst, base);
+    else
+        mir_lea(ic->current, dst, base, index, address->scale,
+                address->disp);
+}
+
+void _ic_division(struct ir_codegen *ic, inst_binary_t *binary) {
+    struct mir_block *b = ic->current;
+    // idiv divides RDX:RAX, the quotient ends up in RAX.
+    struct mir_operand divisor = _ic_reg(ic, binary->right->value);
+    mir_mov(b, mir_preg(RAX), _ic_operand(ic, binary->left->value));
+    mir_cqo(b);
+    mir_unary(b, UNARY_IDIV, divisor);
+    mir_mov(b, _ic_define(ic, &binary->inst), mir_preg(RAX));
+}
+
+// Adds, subtractions of immediates and multiplications by 2, 3, 5 and 9 are
+// a single lea. Returns 0 if @binary isn't one of them.
+int _ic_selectLea(struct ir_codegen *ic, inst_binary_t *binary) {
+    value_t *left = binary->left->value;
+    struct _ic_address address = {};
+    int32_t imm;
+    int isImm = _ic_isImm32(binary->right->value, &imm);
+    if (binary->op == BO_ADD) {
+        _ic_address(binary, &address);
+    } else if (binary->op == BO_SUB && isImm && imm != INT32_MIN &&
+               left->type != CONST) {
+        address = (struct _ic_address){
+            .base = left, .index = NULL, .scale = 0, .disp = -imm};
+    } else if (binary->op == BO_MUL && isImm && left->type != CONST &&
+               (imm == 2 || imm == 3 || imm == 5 || imm == 9)) {
+        // x * (1 + scale) is x + x * scale.
+        address = (struct _ic_address){.base = left,
+                                       .index = left,
+                                       .scale = imm == 2 ? 1 : imm - 1,
+                                       .disp = 0};
+    }
+    if (!address.base)
+        return 0;
+    _ic_lea(ic, &binary->inst, &address);
+    return 1;
+}
+
+void _ic_binary(struct ir_codegen *ic, inst_binary_t *binary) {
+    struct mir_block *b = ic->current;
+    if (binary->op == BO_DIV) {
+        _ic_division(ic, binary);
+        return;
+    }
+    if (binary->op >= BO_EQUALS) {
+        mir_setcc(b, _ic_compare(ic, binary), _ic_define(ic, &binary->inst));
+        return;
+    }
+    if (_ic_selectLea(ic, binary))
+        return;
+
+    value_t *left = binary->left->value;
+    value_t *right = binary->right->value;
+    int32_t imm;
+    struct mir_operand src =
+        _ic_isImm32(right, &imm) ? mir_imm(imm) : _ic_reg(ic, right);
+    if (binary->op == BO_MUL && src.kind == MIR_IMM) {
+        struct mir_operand factor = _ic_reg(ic, left);
+        mir_imulImm(b, _ic_define(ic, &binary->inst), factor, imm);
+        return;
+    }
+    struct mir_operand dst = _ic_define(ic, &binary->inst);
+    mir_mov(b, dst, _ic_operand(ic, left));
+    if (binary->op == BO_MUL)
+        mir_imul(b, dst, src);
+    else
+        mir_alu(b, binary->op == BO_ADD ? ALU_ADD : ALU_SUB, dst, src);
+}
+
+// Assign the phis of @to for the edge @from -> @to. Phis are copied through
+// temporaries since they might read each other.
+void _ic_phiCopies(struct ir_codegen *ic, basic_block_t *from,
+                   basic_block_t *to) {
+    dbuffer_t phis, temps;
+    dbuffer_init(&phis);
+    dbuffer_init(&temps);
+
+    LIST_FOR_EACH(&to->instructions) {
+        instruction_t *inst = containerof(c, instruction_t, inst_list);
+        if (inst->type != INST_PHI)
+            break;
+        inst_phi_t *phi = IR_INST_AS_TYPE(inst, inst_phi_t);
+
+        for (size_t i = 0; i < phi->useCount; i += 2) {
+            if (phi->uses[i]->value != &from->value)
+                continue;
+            uint32_t temp = mir_newVreg(&ic->mir, 0);
+            mir_mov(ic->current, mir_vreg(temp),
+                    _ic_operand(ic, phi->uses[i + 1]->value));
+            dbuffer_pushPtr(&phis, inst);
+            dbuffer_pushData(&temps, &temp, sizeof(temp));
+            break;
+        }
+    }
+
+    size_t count;
+    instruction_t **phiArray = (instruction_t **)dbuffer_asPtrArray(&phis, &count);
+    uint32_t *tempArray = temps.buffer;
+    for (size_t i = 0; i < count; i++)
+        mir_mov(ic->current, mir_vreg(_ic_vreg(ic, &phiArray[i]->value)),
+                mir_vreg(tempArray[i]));
+
+    dbuffer_free(&phis);
+    dbuffer_free(&temps);
+}
+
+int _ic_hasPhi(basic_block_t *block) {
+    if (list_empty(&block->instructions))
+        return 0;
+    instruction_t *first =
+        containerof(block->instructions.next, instruction_t, inst_list);
+    return first->type == INST_PHI;
+}
+
+void _ic_return(struct ir_codegen *ic, inst_return_t *ret) {
+    if (ret->hasReturn)
+        mir_mov(ic->current, mir_preg(RAX),
+                _ic_operand(ic, ret->uses[0]->value));
+    mir_ret(ic->current, ret->hasReturn);
+}
+
+// Mark where the code of @inst starts if its source position is new.
+void _ic_position(struct ir_codegen *ic, instruction_t *inst) {
+    if (!inst->line)
+        return;
+    size_t count = ic->positions.usage / sizeof(struct ir_codegen_position);
+    if (count) {
+        struct ir_codegen_position *last =
+            (struct ir_codegen_position *)ic->positions.buffer + count - 1;
+        if (last->fn == ic->fn && last->line == inst->line &&
+            last->col == inst->col)
+            return;
+    }
+
+    label_t *label = znnew(&ic->zone, label_t);
+    *label = (label_t){};
+    mir_bindPosition(ic->current, label);
+    struct ir_codegen_position position = {ic->fn, label, inst->line,
+                                           inst->col};
+    dbuffer_pushData(&ic->positions, &position, sizeof(position));
+}
+
+// Most instructions an arm of a select may have.
+#define IC_SELECT_ARM_MAX 4
+// Branches that go the rarer way less than once in this many runs are
+// predicted well enough to keep.
+#define IC_SELECT_BIAS 8
+
+// An if whose arms run unconditionally, the phis of the join pick their
+// value with cmov or setcc instead of a branch.
+struct _ic_select {
+    // Arms of the taken and the not taken edge, NULL if the edge goes
+    // straight to the join.
+    basic_block_t *arms[2];
+    basic_block_t *join;
+};
+
+// Number of jumps to @block, a conditional jump counts once per edge.
+size_t _ic_jumpsTo(basic_block_t *block) {
+    size_t count = 0;
+    LIST_FOR_EACH(&block->value.uses) {
+        instruction_t *user = containerof(c, use_t, useList)->inst;
+        count += user->type == INST_JUMP || user->type == INST_JUMP_COND;
+    }
+    return count;
+}
+
+// Target of @arm if only one jump reaches it and it only computes a few
+// values without side effects, NULL otherwise.
+basic_block_t *_ic_armJoin(basic_block_t *arm) {
+    if (_ic_jumpsTo(arm) != 1)
+        return NULL;
+    size_t count = 0;
+    LIST_FOR_EACH(&arm->instructions) {
+        instruction_t *inst = containerof(c, instruction_t, inst_list);
+        if (inst->type == INST_JUMP) {
+            inst_jump_t *jump = IR_INST_AS_TYPE(inst, inst_jump_t);
+            return containerof(jump->uses[0]->value, basic_block_t, value);
+        }
+        // Division can trap.
+        if (inst->type != INST_BINARY ||
+            IR_INST_AS_TYPE(inst, inst_binary_t)->op == BO_DIV ||
+            ++count > IC_SELECT_ARM_MAX)
+            return NULL;
+    }
+    return NULL;
+}
+
+// Does the layout profile say the branch at the end of @block is biased ?
+int _ic_isPredictable(struct ir_codegen *ic, basic_block_t *block) {
+    if (!ic->layoutCounts)
+        return 0;
+    size_t index = _ic_blockIndex(ic, block);
+    uint64_t taken = *profile_counter(ic->layoutCounts, index, PROFILE_TAKEN);
+    uint64_t notTaken =
+        *profile_counter(ic->layoutCounts, index, PROFILE_NOT_TAKEN);
+    uint64_t rare = taken < notTaken ? taken : notTaken;
+    return rare * IC_SELECT_BIAS < taken + notTaken;
+}
+
+// Can the conditional jump at the end of @block become a select ? Diamonds
+// and triangles qualify unless the profile says the branch is predictable.
+// Instrumented code keeps its branches for the counters.
+int _ic_select(struct ir_codegen *ic, basic_block_t *block,
+               struct _ic_select *select) {
+    if (ic->profiled || list_empty(&block->instructions) ||
+        _ic_isPredictable(ic, block))
+        return 0;
+    instruction_t *last =
+        containerof(block->instructions.prev, instruction_t, inst_list);
+    if (last->type != INST_JUMP_COND)
+        return 0;
+    inst_jump_cond_t *jump = IR_INST_AS_TYPE(last, inst_jump_cond_t);
+    basic_block_t *targets[2], *joins[2];
+    for (int i = 0; i < 2; i++) {
+        targets[i] = containerof(jump->uses[i]->value, basic_block_t, value);
+        joins[i] = _ic_armJoin(targets[i]);
+    }
+
+    *select = (struct _ic_select){};
+    if (targets[0] == targets[1])
+        return 0;
+    if (joins[0] && joins[0] == joins[1])
+        *select = (struct _ic_select){{targets[0], targets[1]}, joins[0]};
+    else if (joins[0] == targets[1])
+        *select = (struct _ic_select){{targets[0], NULL}, targets[1]};
+    else if (joins[1] == targets[0])
+        *select = (struct _ic_select){{NULL, targets[1]}, targets[0]};
+    else
+        return 0;
+    // The join is only reached through the arms.
+    return select->join != block && _ic_jumpsTo(select->join) == 2;
+}
+
+// Mark the arms, their values and the phis of the join if @block ends with
+// a select.
+void _ic_markSelect(struct ir_codegen *ic, basic_block_t *block) {
+    struct _ic_select select;
+    if (!_ic_select(ic, block, &select))
+        return;
+    for (int i = 0; i < 2; i++) {
+        if (!select.arms[i])
+            continue;
+        _ic_info(ic, &select.arms[i]->value)->selected = 1;
+        LIST_FOR_EACH(&select.arms[i]->instructions) {
+            instruction_t *inst = containerof(c, instruction_t, inst_list);
+            _ic_info(ic, &inst->value)->selected = 1;
+        }
+    }
+    LIST_FOR_EACH(&select.join->instructions) {
+        instruction_t *inst = containerof(c, instruction_t, inst_list);
+        if (inst->type != INST_PHI)
+            break;
+        _ic_info(ic, &inst->value)->selected = 1;
+    }
+}
+
+// Value of @phi coming from @from, NULL if the variable is undefined there.
+value_t *_ic_phiIncoming(inst_phi_t *phi, basic_block_t *from) {
+    for (size_t i = 0; i < phi->useCount; i += 2) {
+        if (phi->uses[i]->value == &from->value)
+            return phi->uses[i + 1]->value;
+    }
+    return NULL;
+}
+
+int _ic_isNumber(value_t *value, int64_t number) {
+    return value->type == CONST &&
+           containerof(value, value_constant_t, value)->number == number;
+}
+
+// The code of the arms goes to the block of the if, their labels mark where
+// it starts.
+void _ic_hoistArms(struct ir_codegen *ic, struct _ic_select *select) {
+    for (int i = 0; i < 2; i++) {
+        basic_block_t *arm = select->arms[i];
+        if (!arm)
+            continue;
+        label_t *label = _ic_blockLabel(ic, arm);
+        mir_bind(ic->current, label);
+        struct ir_codegen_block placed = {
+            .fn = ic->fn, .block = arm, .label = label, .edge = 0};
+        dbuffer_pushData(&ic->blocks, &placed, sizeof(placed));
+        _ic_info(ic, &arm->value)->mir = ic->current;
+        LIST_FOR_EACH(&arm->instructions) {
+            instruction_t *inst = containerof(c, instruction_t, inst_list);
+            if (inst->type == INST_JUMP)
+                break;
+            if (_ic_isFused(inst))
+                continue;
+            _ic_position(ic, inst);
+            _ic_binary(ic, IR_INST_AS_TYPE(inst, inst_binary_t));
+        }
+    }
+}
+
+// Phi of the join and the temporary its value is selected into.
+struct _ic_selected {
+    instruction_t *phi;
+    uint32_t temp;
+    // Value if the jump is taken, unused for booleans.
+    struct mir_operand taken;
+    // 1 for cond ? 1 : 0, -1 for cond ? 0 : 1, 0 for a cmov.
+    int boolean;
+};
+
+// Runs both arms of @select and assigns the phis of the join without
+// branching. Like phi copies they go through temporaries since they might
+// read each other.
+void _ic_selectLower(struct ir_codegen *ic, basic_block_t *block,
+                     inst_jump_cond_t *jump, struct _ic_select *select) {
+    struct mir_block *b = ic->current;
+    _ic_hoistArms(ic, select);
+
+    dbuffer_t selected;
+    dbuffer_init(&selected);
+    LIST_FOR_EACH(&select->join->instructions) {
+        instruction_t *inst = containerof(c, instruction_t, inst_list);
+        if (inst->type != INST_PHI)
+            break;
+        inst_phi_t *phi = IR_INST_AS_TYPE(inst, inst_phi_t);
+        value_t *values[2];
+        for (int i = 0; i < 2; i++)
+            values[i] = _ic_phiIncoming(
+                phi, select->arms[i] ? select->arms[i] : block);
+        // Variables of a nested scope leave partial phis, like the phi copies
+        // an undefined side takes whatever the other one has.
+        if (!values[0] && !values[1])
+            continue;
+        if (!values[0] || !values[1])
+            values[0] = values[1] = values[0] ? values[0] : values[1];
+
+        struct _ic_selected entry = {.phi = inst,
+                                     .temp = mir_newVreg(&ic->mir, 0),
+                                     .taken = (struct mir_operand){},
+                                     .boolean = 0};
+        if (_ic_isNumber(values[0], 1) && _ic_isNumber(values[1], 0)) {
+            entry.boolean = 1;
+        } else if (_ic_isNumber(values[0], 0) && _ic_isNumber(values[1], 1)) {
+            entry.boolean = -1;
+        } else {
+            // cmov has no immediate form.
+            entry.taken = _ic_reg(ic, values[0]);
+            mir_mov(b, mir_vreg(entry.temp), _ic_operand(ic, values[1]));
+        }
+        dbuffer_pushData(&selected, &entry, sizeof(entry));
+    }
+
+    cond_code cc = CC_NE;
+    inst_binary_t *compare = _ic_fused(jump->uses[2]->value);
+    if (compare) {
+        cc = _ic_compare(ic, compare);
+    } else {
+        struct mir_operand cond = _ic_reg(ic, jump->uses[2]->value);
+        mir_test(b, cond, cond);
+    }
+
+    size_t count = selected.usage / sizeof(struct _ic_selected);
+    struct _ic_selected *entries = selected.buffer;
+    for (size_t i = 0; i < count; i++) {
+        struct mir_operand temp = mir_vreg(entries[i].temp);
+        if (entries[i].boolean)
+            mir_setcc(b, entries[i].boolean > 0 ? cc : _ic_negate(cc), temp);
+        else
+            mir_cmov(b, cc, temp, entries[i].taken);
+    }
+    for (size_t i = 0; i < count; i++)
+        mir_mov(b, mir_vreg(_ic_vreg(ic, &entries[i].phi->value)),
+                mir_vreg(entries[i].temp));
+    dbuffer_free(&selected);
+
+    if (select->join != ic->next)
+        mir_jmp(b, _ic_blockLabel(ic, select->join));
+}
+
+void _ic_jumpCond(struct ir_codegen *ic, basic_block_t *block,
+                  inst_jump_cond_t *jump) {
+    struct mir_block *b = ic->current;
+    struct _ic_select select;
+    if (_ic_select(ic, block, &select)) {
+        _ic_selectLower(ic, block, jump, &select);
+        return;
+    }
+    enum profile_counter counters[2] = {PROFILE_TAKEN, PROFILE_NOT_TAKEN};
+    basic_block_t *targets[2];
+    label_t *labels[2];
+    int direct[2];
+    for (int i = 0; i < 2; i++) {
+        targets[i] = containerof(jump->uses[i]->value, basic_block_t, value);
+        labels[i] = _ic_blockLabel(ic, targets[i]);
+        // Phi copies and counters must only happen on their own edge.
+        direct[i] = !_ic_hasPhi(targets[i]) && !ic->profiled;
+        if (!direct[i]) {
+            labels[i] = znnew(&ic->zone, label_t);
+            *labels[i] = (label_t){};
+            struct _ic_edge edge = {labels[i], block, targets[i], counters[i]};
+            dbuffer_pushData(&ic->edges, &edge, sizeof(edge));
+        }
+    }
+
+    // A fused comparison jumps on its own condition, anything else on
+    // being non zero.
+    cond_code cc = CC_NE;
+    inst_binary_t *compare = _ic_fused(jump->uses[2]->value);
+    if (compare) {
+        cc = _ic_compare(ic, compare);
+    } else {
+        struct mir_operand cond = _ic_reg(ic, jump->uses[2]->value);
+        mir_test(b, cond, cond);
+    }
+    if (direct[0] && targets[0] == ic->next) {
+        mir_jcc(b, _ic_negate(cc), labels[1]);
+        return;
+    }
+    mir_jcc(b, cc, labels[0]);
+    if (!direct[1] || targets[1] != ic->next)
+        mir_jmp(b, labels[1]);
+}
+
+// Code of the edges that don't go straight to their target, placed after the
+// blocks of the function. The code runs for its source block.
+void _ic_edges(struct ir_codegen *ic) {
+    size_t count = ic->edges.usage / sizeof(struct _ic_edge);
+    struct _ic_edge *edges = ic->edges.buffer;
+    for (size_t i = 0; i < count; i++) {
+        ic->current = mir_addBlock(&ic->mir, edges[i].label, edges[i].from);
+        struct ir_codegen_block placed = {.fn = ic->fn,
+                                          .block = edges[i].from,
+                                          .label = edges[i].label,
+                                          .edge = 1};
+        dbuffer_pushData(&ic->blocks, &placed, sizeof(placed));
+        _ic_count(ic, edges[i].from, edges[i].counter);
+        _ic_phiCopies(ic, edges[i].from, edges[i].to);
+        mir_jmp(ic->current, _ic_blockLabel(ic, edges[i].to));
+    }
+    dbuffer_clear(&ic->edges);
+}
+
+// Stack arguments are stored below RSP, the register arguments are moved
+// right before the call so nothing else needs their registers.
+void _ic_functionCall(struct ir_codegen *ic, inst_function_call_t *call) {
+    // %rdi,%rsi,%rdx,%rcx,%r8,%r9
+    reg64 regs[] = {RDI, RSI, RDX, RCX, R8, R9};
+    struct mir_block *b = ic->current;
+    function_t *callee = containerof(call->uses[0]->value, function_t, value);
+    label_t *label = ic->resolveLabel(ic->resolveCtx, callee);
+    assert(label && "unknown function");
+
+    ic->calls = 1;
+    size_t count = call->useCount - 1;
+    size_t regCount = count < 6 ? count : 6;
+    // The area keeps RSP aligned to 16 bytes.
+    int32_t stackSize = ((count - regCount) * 8 + 15) & ~15;
+    if (stackSize) {
+        mir_alu(b, ALU_SUB, mir_preg(RSP), mir_imm(stackSize));
+        for (size_t i = regCount; i < count; i++)
+            mir_mov(b, mir_mem(RSP, (i - regCount) * 8),
+                    _ic_reg(ic, call->uses[i + 1]->value));
+    }
+    for (size_t i = 0; i < regCount; i++)
+        mir_mov(b, mir_preg(regs[i]),
+                _ic_operand(ic, call->uses[i + 1]->value));
+    mir_call(b, label, regCount);
+    if (stackSize)
+        mir_alu(b, ALU_ADD, mir_preg(RSP), mir_imm(stackSize));
+
+    if (call->inst.value.dataType != VOID)
+        mir_mov(b, _ic_define(ic, &call->inst), mir_preg(RAX));
+}
+
+// Returns 1 if the instruction ended the block.
+int _ic_instruction(struct ir_codegen *ic, basic_block_t *block,
+                    instruction_t *inst) {
+    struct mir_block *b = ic->current;
+    switch (inst->type) {
+    case INST_PHI:
+        break;
+    case INST_LOAD_VAR: {
+        inst_load_var_t *load = IR_INST_AS_TYPE(inst, inst_load_var_t);
+        mir_mov(b, _ic_define(ic, inst), mir_vreg(_ic_register(ic, load->rId)));
+        break;
+    }
+    case INST_ASSIGN_VAR: {
+        inst_assign_var_t *assign = IR_INST_AS_TYPE(inst, inst_assign_var_t);
+        mir_mov(b, mir_vreg(_ic_register(ic, assign->rId)),
+                _ic_operand(ic, assign->var->value));
+        break;
+    }
+    case INST_BINARY:
+        _ic_binary(ic, IR_INST_AS_TYPE(inst, inst_binary_t));
+        break;
+    case INST_FUNCTION_CALL:
+        _ic_functionCall(ic, IR_INST_AS_TYPE(inst, inst_function_call_t));
+        break;
+    case INST_JUMP: {
+        inst_jump_t *jump = IR_INST_AS_TYPE(inst, inst_jump_t);
+        basic_block_t *target =
+            containerof(jump->uses[0]->value, basic_block_t, value);
+        _ic_phiCopies(ic, block, target);
+        if (target != ic->next)
+            mir_jmp(b, _ic_blockLabel(ic, target));
+        return 1;
+    }
+    case INST_JUMP_COND:
+        _ic_jumpCond(ic, block, IR_INST_AS_TYPE(inst, inst_jump_cond_t));
+        return 1;
+    case INST_RETURN:
+        _ic_return(ic, IR_INST_AS_TYPE(inst, inst_return_t));
+        return 1;
+    }
+    return 0;
+}
+
+// Unplaced successor of @block that the profile saw most often.
+size_t _ic_hottestSuccessor(struct ir_codegen *ic, struct profile_function *pf,
+                            basic_block_t *block, char *placed) {
+    if (list_empty(&block->instructions))
+        return IC_NO_BLOCK;
+    instruction_t *last =
+        containerof(block->instructions.prev, instruction_t, inst_list);
+    size_t index = _ic_blockIndex(ic, block);
+    use_t **uses;
+    uint64_t counts[2];
+    size_t edgeCount;
+    if (last->type == INST_JUMP) {
+        uses = IR_INST_AS_TYPE(last, inst_jump_t)->uses;
+        edgeCount = 1;
+        counts[0] = *profile_counter(pf, index, PROFILE_ENTRY);
+    } else if (last->type == INST_JUMP_COND) {
+        uses = IR_INST_AS_TYPE(last, inst_jump_cond_t)->uses;
+        edgeCount = 2;
+        counts[0] = *profile_counter(pf, index, PROFILE_TAKEN);
+        counts[1] = *profile_counter(pf, index, PROFILE_NOT_TAKEN);
+    } else {
+        return IC_NO_BLOCK;
+    }
+
+    size_t best = IC_NO_BLOCK;
+    uint64_t bestCount = 0;
+    for (size_t i = 0; i < edgeCount; i++) {
+        basic_block_t *target =
+            containerof(uses[i]->value, basic_block_t, value);
+        size_t t = _ic_blockIndex(ic, target);
+        if (!placed[t] && counts[i] > bestCount) {
+            best = t;
+            bestCount = counts[i];
+        }
+    }
+    return best;
+}
+
+// Chain every block to its hottest successor. When the chain ends the next
+// hot block in reverse postorder starts a new one, so dominators are still
+// placed first. Blocks that never ran go to the end of the function.
+basic_block_t **_ic_layout(struct ir_codegen *ic, struct profile_function *pf,
+                           basic_block_t **rpo, size_t count) {
+    basic_block_t **order = dmalloc(sizeof(basic_block_t *) * count);
+    char *placed = dzmalloc(count);
+    size_t current = 0;
+    for (size_t n = 0; n < count; n++) {
+        placed[current] = 1;
+        order[n] = rpo[current];
+        current = _ic_hottestSuccessor(ic, pf, rpo[current], placed);
+        for (size_t i = 0; current == IC_NO_BLOCK && i < count; i++) {
+            if (!placed[i] && *profile_counter(pf, i, PROFILE_ENTRY))
+                current = i;
+        }
+        for (size_t i = 0; current == IC_NO_BLOCK && i < count; i++) {
+            if (!placed[i])
+                current = i;
+        }
+    }
+    free(placed);
+    return order;
+}
+
+// Blocks are numbered in reverse postorder and placed in that order unless
+// the layout profile has counts for the function.
+basic_block_t **_ic_blockOrder(struct ir_codegen *ic, function_t *fn,
+                               size_t *count) {
+    basic_block_t **postorder = function_computePostorder(fn, count);
+    size_t n = *count;
+    basic_block_t **rpo = dmalloc(sizeof(basic_block_t *) * n);
+    for (size_t i = 0; i < n; i++) {
+        rpo[i] = postorder[n - 1 - i];
+        _ic_info(ic, &rpo[i]->value)->index = i;
+    }
+    free(postorder);
+
+    range_t name = fn->value.name;
+    ic->profiled = ic->instrument ? profile_add(ic->instrument, name, n) : NULL;
+    struct profile_function *pf =
+        ic->layout ? profile_get(ic->layout, name) : NULL;
+    ic->layoutCounts = NULL;
+    if (!pf || pf->blockCount != n || !*profile_counter(pf, 0, PROFILE_ENTRY))
+        return rpo;
+    ic->layoutCounts = pf;
+
+    basic_block_t **order = _ic_layout(ic, pf, rpo, n);
+    free(rpo);
+    return order;
+}
+
+// Can the callee saved registers be saved at the start of @block ? It must
+// not be part of a loop and every exit it reaches must be dominated by it,
+// so an exit either restores them or never saved them.
+int _ic_canSave(struct ir_codegen *ic, struct dominators *doms,
+                basic_block_t *block, size_t count) {
+    char *reached = dzmalloc(count);
+    dbuffer_t stack;
+    dbuffer_init(&stack);
+    dbuffer_pushPtr(&stack, block);
+    int result = 1;
+    while (stack.usage && result) {
+        basic_block_t *current = dbuffer_getLastPtr(&stack);
+        dbuffer_popPtr(&stack);
+        struct block_successor_it it = block_successor_begin(current);
+        if (block_successor_end(it) &&
+            dominators_common(doms, block, current) != block)
+            result = 0;
+        for (; !block_successor_end(it); it = block_successor_next(it)) {
+            basic_block_t *next = block_successor_get(it);
+            size_t index = _ic_blockIndex(ic, next);
+            if (next == block)
+                result = 0;
+            if (!reached[index]) {
+                reached[index] = 1;
+                dbuffer_pushPtr(&stack, next);
+            }
+        }
+    }
+    dbuffer_free(&stack);
+    free(reached);
+    return result;
+}
+
+// Shrink wrapping, the callee saved registers are saved as late as possible:
+// in the nearest dominator of their users that can save them.
+basic_block_t *_ic_savePoint(struct ir_codegen *ic, struct dominators *doms,
+                             basic_block_t **order, size_t count) {
+    basic_block_t *result = NULL;
+    for (size_t i = 0; i < count; i++) {
+        if (!_ic_info(ic, &order[i]->value)->calleeSaved)
+            continue;
+        result = result ? dominators_common(doms, result, order[i]) : order[i];
+    }
+    while (result != ic->fn->entry && !_ic_canSave(ic, doms, result, count))
+        result = dominators_getIDom(doms, result);
+    return result;
+}
+
+// Add the prologue, the saves and the epilogues now that the frame is known.
+// Functions that don't call, spill or save anything run without a frame.
+void _ic_frame(struct ir_codegen *ic, basic_block_t **order, size_t count) {
+    function_t *fn = ic->fn;
+    size_t blockCount;
+    struct mir_block **blocks = mir_blocks(&ic->mir, &blockCount);
+    unsigned saved = 0;
+    for (size_t i = 0; i < blockCount; i++) {
+        unsigned written = blocks[i]->written & mir_calleeSaved();
+        _ic_info(ic, &blocks[i]->block->value)->calleeSaved |= written;
+        saved |= written;
+    }
+
+    struct dominators doms;
+    basic_block_t *savePoint = NULL;
+    int32_t slots[16];
+    size_t frameSize = ic->mir.frameSize;
+    if (saved) {
+        dominators_compute(&doms, fn->entry);
+        savePoint = _ic_savePoint(ic, &doms, order, count);
+        for (int r = 0; r < 16; r++) {
+            if (saved & 1u << r)
+                slots[r] = ++frameSize;
+        }
+    }
+    int framed = frameSize || ic->calls || fn->argumentCount > 6;
+
+    // The code is built in scratch blocks and inserted where it belongs.
+    struct mir_block prologue = {}, saves = {}, code = {};
+    dbuffer_init(&prologue.insts);
+    dbuffer_init(&saves.insts);
+    dbuffer_init(&code.insts);
+    if (framed) {
+        mir_push(&prologue, RBP);
+        mir_mov(&prologue, mir_preg(RBP), mir_preg(RSP));
+        // Keep the stack aligned to 16 bytes for calls.
+        int32_t size = (frameSize * 8 + 15) & ~15;
+        if (size)
+            mir_alu(&prologue, ALU_SUB, mir_preg(RSP), mir_imm(size));
+    }
+    for (int r = 0; r < 16 && saved; r++) {
+        if (saved & 1u << r)
+            mir_mov(&saves, mir_stackSlot(slots[r]), mir_preg(r));
+    }
+    // Saving in the entry block is part of the prologue.
+    size_t codeCount;
+    struct mir_inst *insts = mir_insts(&saves, &codeCount);
+    if (savePoint == fn->entry)
+        mir_insert(&prologue, prologue.insts.usage / sizeof(struct mir_inst),
+                   insts, codeCount);
+    else if (savePoint)
+        mir_insert(_ic_info(ic, &savePoint->value)->mir, 0, insts, codeCount);
+    insts = mir_insts(&prologue, &codeCount);
+    mir_insert(blocks[0], 0, insts, codeCount);
+
+    for (size_t b = 0; b < blockCount; b++) {
+        size_t instCount;
+        insts = mir_insts(blocks[b], &instCount);
+        for (size_t i = instCount; i-- > 0;) {
+            if (insts[i].op != MIR_RET)
+                continue;
+            dbuffer_clear(&code.insts);
+            basic_block_t *block = blocks[b]->block;
+            if (savePoint &&
+                dominators_common(&doms, savePoint, block) == savePoint) {
+                for (int r = 0; r < 16; r++) {
+                    if (saved & 1u << r)
+                        mir_mov(&code, mir_preg(r), mir_stackSlot(slots[r]));
+                }
+            }
+            if (framed) {
+                mir_mov(&code, mir_preg(RSP), mir_preg(RBP));
+                mir_pop(&code, RBP);
+            }
+            struct mir_inst *epilogue = mir_insts(&code, &codeCount);
+            mir_insert(blocks[b], i, epilogue, codeCount);
+            insts = mir_insts(blocks[b], &instCount);
+        }
+    }
+    dbuffer_free(&prologue.insts);
+    dbuffer_free(&saves.insts);
+    dbuffer_free(&code.insts);
+    if (saved)
+        dominators_free(&doms);
+}
+
+void ir_codegen_function(struct ir_codegen *ic, function_t *fn,
+                         label_t *entry) {
+    ic->fn = fn;
+    // Register ids are local to a function.
+    hashmap_free(&ic->registers);
+    hashmap_init(&ic->registers, intKeyType);
+
+    ic->calls = 0;
+    size_t count;
+    basic_block_t **order = _ic_blockOrder(ic, fn, &count);
+    // vregs that aren't values get slots after the shared ones.
+    frame_layout_compute(&ic->frame, fn, order, count);
+    mir_function_init(&ic->mir);
+    ic->mir.slotCount = ic->frame.slotCount;
+
+    // %rdi,%rsi,%rdx,%rcx,%r8,%r9
+    reg64 regs[] = {RDI, RSI, RDX, RCX, R8, R9};
+    ic->current = mir_addBlock(&ic->mir, entry, fn->entry);
+    for (size_t i = 0; i < fn->argumentCount; i++) {
+        struct mir_operand arg =
+            mir_vreg(_ic_vreg(ic, &fn->arguments[i].value));
+        // The rest are above the return address.
+        if (i < 6)
+            mir_mov(ic->current, arg, mir_preg(regs[i]));
+        else
+            mir_mov(ic->current, arg, mir_mem(RBP, 16 + (i - 6) * 8));
+    }
+
+    // The entry block only needs a block of its own if it is the target of
+    // a jump, the prologue must not run again.
+    int entryJumped =
+        !block_predecessor_end(block_predecessor_begin(fn->entry));
+    for (size_t i = 0; i < count; i++)
+        _ic_markSelect(ic, order[i]);
+    for (size_t i = 0; i < count; i++) {
+        basic_block_t *block = order[i];
+        if (_ic_info(ic, &block->value)->selected)
+            continue;
+        // Arms of selects are placed in their if.
+        size_t next = i + 1;
+        while (next < count && _ic_info(ic, &order[next]->value)->selected)
+            next++;
+        ic->next = next < count ? order[next] : NULL;
+        struct ir_codegen_block placed = {.fn = fn,
+                                          .block = block,
+                                          .label = _ic_blockLabel(ic, block),
+                                          .edge = 0};
+        dbuffer_pushData(&ic->blocks, &placed, sizeof(placed));
+        if (i || entryJumped)
+            ic->current = mir_addBlock(&ic->mir, placed.label, block);
+        else
+            mir_bind(ic->current, placed.label);
+        _ic_info(ic, &block->value)->mir = ic->current;
+        _ic_count(ic, block, PROFILE_ENTRY);
+
+        int terminated = 0;
+        LIST_FOR_EACH(&block->instructions) {
+            instruction_t *inst = containerof(c, instruction_t, inst_list);
+            // The user emits it.
+            if (_ic_isFused(inst))
+                continue;
+            _ic_position(ic, inst);
+            terminated = _ic_instruction(ic, block, inst);
+            if (terminated)
+                break;
+        }
+        // Falling off the end of a block returns from the function.
+        if (!terminated)
+            mir_ret(ic->current, 0);
+    }
+    _ic_edges(ic);
+    ic->next = NULL;
+
+    mir_schedule(&ic->mir);
+    mir_allocate(&ic->mir, ic->cg->registerCount);
+    mir_peephole(&ic->mir);
+    _ic_frame(ic, order, count);
+    mir_encode(&ic->mir, ic->cg);
+    mir_function_free(&ic->mir);
+    frame_layout_free(&ic->frame);
+    free(order);
+}
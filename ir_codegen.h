@@ -0,0 +1,95 @@
+// Lowering of IR functions to machine code, works both before and after SSA
+// conversion. Functions go through the machine IR: they are lowered to it,
+// registers are allocated and the frame is added before it is encoded.
+#ifndef IR_CODEGEN_H
+#define IR_CODEGEN_H
+
+#include "codegen.h"
+#include "frame_layout.h"
+#include "hashmap.h"
+#include "ir.h"
+#include "mir.h"
+#include "profile.h"
+
+// Allocatable registers, the last five are callee saved. They are used when
+// the others run out and for values that live across calls.
+#define IR_CODEGEN_REGISTERS 14
+
+// Find the label of a called function.
+typedef label_t *(*ir_codegen_labelResolver)(void *ctx, function_t *fn);
+
+// A block placed by ir_codegen_function.
+struct ir_codegen_block {
+    function_t *fn;
+    basic_block_t *block;
+    label_t *label;
+    // The code of an edge leaving @block, placed after the blocks of the
+    // function.
+    int edge;
+};
+
+// The code from @label on comes from @line:@col of @fn.
+struct ir_codegen_position {
+    function_t *fn;
+    label_t *label;
+    uint32_t line;
+    uint32_t col;
+};
+
+struct ir_codegen {
+    struct codegen *cg;
+    ir_context_t *ctx;
+    function_t *fn;
+
+    ir_codegen_labelResolver resolveLabel;
+    void *resolveCtx;
+
+    // Counters for every block and conditional edge are added to the code
+    // when set. The increments aren't atomic, threads may lose counts.
+    struct profile *instrument;
+    // Blocks are laid out after the counts of this profile when set.
+    struct profile *layout;
+    // Counters of the current function, NULL if it isn't instrumented.
+    struct profile_function *profiled;
+    // Counts of the current function in the layout profile, NULL if there
+    // are none.
+    struct profile_function *layoutCounts;
+    // Block placed after the current one, jumps to it fall through.
+    basic_block_t *next;
+
+    // value -> ir_value_info, values that live in a vreg or blocks.
+    hashmap_t values;
+    // rId -> ir_value_info, variables before SSA conversion.
+    hashmap_t registers;
+    // ir_codegen_block entries in emission order, the blocks and edges of a
+    // function are contiguous.
+    dbuffer_t blocks;
+    // Conditional edges that need code of their own, placed after the
+    // blocks of the function.
+    dbuffer_t edges;
+    // ir_codegen_position entries in emission order, only instructions with
+    // a source position add one.
+    dbuffer_t positions;
+    // Stack slots of the values of the current function.
+    struct frame_layout frame;
+    // Machine IR of the current function and the block code goes to.
+    struct mir_function mir;
+    struct mir_block *current;
+    // Does the current function call other functions ?
+    int calls;
+    // Labels of blocks and stack frames live here, the relocations of the
+    // codegen refer to them.
+    zone_allocator zone;
+};
+
+void ir_codegen_init(struct ir_codegen *ic, struct codegen *cg,
+                     ir_context_t *ctx, ir_codegen_labelResolver resolveLabel,
+                     void *resolveCtx);
+// Labels are freed too, apply the relocations of the codegen first.
+void ir_codegen_free(struct ir_codegen *ic);
+
+// Lower the function to cg->buffer, @entry is placed at the first
+// instruction. The codegen can hold multiple functions.
+void ir_codegen_function(struct ir_codegen *ic, function_t *fn, label_t *entry);
+
+#endif
@@ -25,7 +25,7 @@ struct block_info {
 enum data_type convertDataType(enum token_type type) {
     switch (type) {
     case TK_KW_INT64:
-        return INT64;
+        return DT_INT64;
     case TK_KW_VOID:
         return VOID;
     }
@@ -45,20 +45,100 @@ void ir_creator_init(struct ir_creator *creator, ir_context_t *ctx) {
 basic_block_t *create_block(struct ir_creator *creator, struct ast_block *block,
                             basic_block_t **last);
 
-function_t *ir_creator_createFunction(struct ir_creator *creator,
-                                      struct ast_function *func) {
+// Insert @inst into @block, attributed to the source of @node.
+void _insert(basic_block_t *block, instruction_t *inst, struct ast_node *node) {
+    inst->line = node->pos.line + 1;
+    inst->col = node->pos.col + 1;
+    block_insert(block, inst);
+}
+
+void _createReg(struct ir_creator *creator, range_t range,
+                enum token_type dataType);
+struct variable *_findReg(struct ir_creator *creator, range_t range);
+
+function_t *_declareFunction(struct ir_creator *creator,
+                             struct ast_function *func) {
     assert(func->childCount == func->argumentCount + 1 &&
            "Incorrect child count for function");
 
     function_t *result = ir_new_function(_ ctx, func->name);
-    _ function = result;
+    result->returnType = convertDataType(func->returnType);
+    function_setArguments(_ ctx, result, func->argumentCount);
+    return result;
+}
+
+// Arguments live in a scope around the body, the entry block starts by
+// assigning them to their variables.
+void _defineFunction(struct ir_creator *creator, function_t *fn,
+                     struct ast_function *func) {
+    _ function = fn;
+    struct block_info arguments = {};
+    hashmap_init(&arguments.variableMap, rangeKeyType);
+    zone_init(&arguments.zone);
+    _ blockInfo = &arguments;
+
+    for (size_t i = 0; i < func->argumentCount; i++) {
+        struct ast_declaration *decl =
+            AST_AS_TYPE(func->childs[i], declaration);
+        struct ast_variable *var = AST_AS_TYPE(decl->assignment, variable);
+        _createReg(creator, var->varName, decl->dataType);
+    }
+
+    size_t body = func->argumentCount;
+    fn->entry =
+        create_block(creator, AST_AS_TYPE(func->childs[body], block), NULL);
+
+    for (size_t i = func->argumentCount; i-- > 0;) {
+        struct ast_declaration *decl =
+            AST_AS_TYPE(func->childs[i], declaration);
+        struct ast_variable *var = AST_AS_TYPE(decl->assignment, variable);
+        inst_assign_var_t *assign = inst_new_assign_var(
+            _ ctx, _findReg(creator, var->varName)->rId,
+            &fn->arguments[i].value);
+        assign->inst.line = decl->node.pos.line + 1;
+        assign->inst.col = decl->node.pos.col + 1;
+        block_insertTop(fn->entry, &assign->inst);
+    }
+
+    _ blockInfo = NULL;
+    zone_free(&arguments.zone);
+    hashmap_free(&arguments.variableMap);
+}
+
+function_t *ir_creator_createFunction(struct ir_creator *creator,
+                                      struct ast_function *func) {
+    function_t *result = _declareFunction(creator, func);
+    _defineFunction(creator, result, func);
+    return result;
+}
 
-    // FIXME: When we add arguments.
-    result->entry =
-        create_block(creator, AST_AS_TYPE(func->childs[0], block), NULL);
+function_t **ir_creator_createModule(struct ir_creator *creator,
+                                     struct ast_module *module, size_t *count) {
+    *count = module->childCount;
+    function_t **result = dmalloc(sizeof(function_t *) * (*count + 1));
+    for (size_t i = 0; i < *count; i++) {
+        result[i] = _declareFunction(
+            creator, AST_AS_TYPE(module->childs[i], function));
+    }
+    for (size_t i = 0; i < *count; i++) {
+        _defineFunction(creator, result[i],
+                        AST_AS_TYPE(module->childs[i], function));
+    }
     return result;
 }
 
+// The newest function of the context with the name.
+function_t *_findFunction(struct ir_creator *creator, range_t name) {
+    struct list_head *functions = &_ ctx->functions;
+    for (struct list_head *c = functions->prev; c != functions; c = c->prev) {
+        function_t *fn = containerof(c, function_t, functions);
+        if (range_cmp(fn->value.name, name))
+            return fn;
+    }
+    assert(0 && "Couldn't find function");
+    return NULL;
+}
+
 struct variable *bInfo_getReg(struct block_info *bInfo, range_t range) {
     struct hm_bucket_entry *entry =
         hashmap_getRange(&bInfo->variableMap, range);
@@ -110,7 +190,7 @@ instruction_t *create_assignment(struct ir_creator *creator,
     inst_assign_var_t *assign =
         inst_new_assign_var(creator->ctx, var->rId, val);
 
-    block_insert(_ block, &assign->inst);
+    _insert(_ block, &assign->inst, &exp->node);
 }
 
 value_t *create_binary(struct ir_creator *creator,
@@ -153,7 +233,22 @@ value_t *create_binary(struct ir_creator *creator,
 
     inst_binary_t *result = inst_new_binary(_ ctx, op, left, right);
 
-    block_insert(_ block, &result->inst);
+    _insert(_ block, &result->inst, &binary->node);
+    return &result->inst.value;
+}
+
+value_t *create_call(struct ir_creator *creator,
+                     struct ast_function_call *call) {
+    function_t *fn = _findFunction(creator, call->name);
+    assert(fn->argumentCount == call->childCount &&
+           "wrong number of arguments for the call");
+
+    value_t *args[call->childCount + 1];
+    for (size_t i = 0; i < call->childCount; i++)
+        args[i] = create_value(creator, call->childs[i]);
+    inst_function_call_t *result =
+        inst_new_function_call(_ ctx, fn, args, call->childCount);
+    _insert(_ block, &result->inst, &call->node);
     return &result->inst.value;
 }
 
@@ -162,13 +257,14 @@ instruction_t *create_variable(struct ir_creator *creator,
     struct variable *varInfo = _findReg(creator, var->varName);
     inst_load_var_t *loadVar = inst_new_load_var(
         _ ctx, varInfo->rId, convertDataType(varInfo->dataType));
-    block_insert(_ block, &loadVar->inst);
+    _insert(_ block, &loadVar->inst, &var->node);
     return &loadVar->inst;
 }
 
 value_t *create_value(struct ir_creator *creator, struct ast_node *node) {
-    // TODO: Handle calls.
     switch (node->type) {
+    case FUNCTION_CALL:
+        return create_call(creator, AST_AS_TYPE(node, function_call));
     case BINARY_EXP:
         return create_binary(creator, AST_AS_TYPE(node, binary_exp));
     case VARIABLE:
@@ -187,6 +283,8 @@ void create_statement(struct ir_creator *creator, struct ast_node *node) {
         assert(exp->op == TK_ASSIGN && "statement must be a assignment");
 
         create_assignment(creator, exp);
+    } else if (node->type == FUNCTION_CALL) {
+        create_call(creator, AST_AS_TYPE(node, function_call));
     } else if (node->type == IF) {
         struct ast_if *if_node = AST_AS_TYPE(node, if);
         value_t *cond = create_value(creator, if_node->condition);
@@ -202,12 +300,12 @@ void create_statement(struct ir_creator *creator, struct ast_node *node) {
         basic_block_t *rest = block_new(_ ctx, _ function);
         inst_jump_cond_t *cjump = inst_new_jump_cond(_ ctx, bblock, rest, cond);
 
-        block_insert(_ block, &cjump->inst);
+        _insert(_ block, &cjump->inst, node);
 
         // When the block associated with the if is complete, we want to jump to
         // the rest block to continue execution.
         inst_jump_t *jump = inst_new_jump(_ ctx, rest);
-        block_insert(last, &jump->inst);
+        _insert(last, &jump->inst, node);
 
         _ block = rest;
     } else if (node->type == WHILE) {
@@ -218,7 +316,7 @@ void create_statement(struct ir_creator *creator, struct ast_node *node) {
 
         // jump to the head on entry.
         inst_jump_t *ejump = inst_new_jump(_ ctx, head);
-        block_insert(_ block, &ejump->inst);
+        _insert(_ block, &ejump->inst, node);
 
         basic_block_t *last;
         // the loop body.
@@ -226,7 +324,7 @@ void create_statement(struct ir_creator *creator, struct ast_node *node) {
             create_block(creator, AST_AS_TYPE(while_node->block, block), &last);
         // after we finished executing the loop body jump back to the loop head.
         inst_jump_t *jump = inst_new_jump(_ ctx, head);
-        block_insert(body, &jump->inst);
+        _insert(last, &jump->inst, node);
 
         // this is the part of code that comes after the function.
         basic_block_t *exit = block_new(_ ctx, _ function);
@@ -237,7 +335,7 @@ void create_statement(struct ir_creator *creator, struct ast_node *node) {
 
         // jump to body or exit.
         inst_jump_cond_t *cjump = inst_new_jump_cond(_ ctx, body, exit, cond);
-        block_insert(_ block, &cjump->inst);
+        _insert(_ block, &cjump->inst, node);
 
         // we are done.
         _ block = exit;
@@ -249,8 +347,11 @@ void create_statement(struct ir_creator *creator, struct ast_node *node) {
 
         create_assignment(creator, exp);
     } else if (node->type == RETURN) {
-        inst_return_t *returnInst = inst_new_return(_ ctx);
-        block_insert(_ block, &returnInst->inst);
+        struct ast_return *ret = AST_AS_TYPE(node, return);
+        value_t *value =
+            ret->childCount ? create_value(creator, ret->value) : NULL;
+        inst_return_t *returnInst = inst_new_return(_ ctx, value);
+        _insert(_ block, &returnInst->inst, node);
     }
 }
 
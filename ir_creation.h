@@ -18,7 +18,13 @@ struct ir_creator {
 };
 
 void ir_creator_init(struct ir_creator *creator, ir_context_t *ctx);
+// Calls go to the newest function of the context with the name, the function
+// itself included.
 function_t *ir_creator_createFunction(struct ir_creator *creator,
                                       struct ast_function *func);
+// Create every function of the module, they can call each other regardless
+// of the order. Returns a malloced array of @count functions.
+function_t **ir_creator_createModule(struct ir_creator *creator,
+                                     struct ast_module *module, size_t *count);
 
 #endif
@@ -0,0 +1,185 @@
+#include "jit.h"
+#include "codegen.h"
+#include "format.h"
+#include "hashmap.h"
+#include "ir_codegen.h"
+#include "platform_utils.h"
+
+struct jit_function {
+    label_t label;
+    struct hm_bucket_entry entry;
+};
+
+label_t *_jit_resolveLabel(void *ctx, function_t *fn) {
+    struct hm_bucket_entry *entry = hashmap_getPtr(ctx, fn);
+    if (!entry)
+        return NULL;
+    return &containerof(entry, struct jit_function, entry)->label;
+}
+
+// Every function gets a symbol followed by the symbols of its blocks and of
+// the edge code after them, edges count for their source block. The first
+// block also covers the prologue.
+void _jit_buildSymbols(struct jit_batch *batch, struct ir_codegen *ic,
+                       function_t **functions,
+                       struct jit_function *jitFunctions) {
+    size_t blockCount = ic->blocks.usage / sizeof(struct ir_codegen_block);
+    struct ir_codegen_block *blocks = ic->blocks.buffer;
+    batch->symbolCount = batch->count + blockCount;
+    batch->symbols = dmalloc(sizeof(struct jit_symbol) * batch->symbolCount);
+
+    struct jit_symbol *symbol = batch->symbols;
+    size_t b = 0;
+    for (size_t i = 0; i < batch->count; i++) {
+        size_t start = jitFunctions[i].label.offset;
+        size_t end = i + 1 < batch->count ? jitFunctions[i + 1].label.offset
+                                          : batch->size;
+        size_t first = b;
+        while (b < blockCount && blocks[b].fn == functions[i])
+            b++;
+
+        range_t name = functions[i]->value.name;
+        *symbol++ = (struct jit_symbol){.name = range_copy(&name),
+                                        .code = batch->code + start,
+                                        .size = end - start,
+                                        .blockCount = b - first,
+                                        .fn = functions[i]};
+        unsigned blockIndex = 0, edgeIndex = 0;
+        for (size_t j = first; j < b; j++) {
+            size_t blockStart = j == first ? start : blocks[j].label->offset;
+            size_t blockEnd = j + 1 < b ? blocks[j + 1].label->offset : end;
+            range_t blockName =
+                blocks[j].edge
+                    ? format_range("{range}.edge{uint}", name, edgeIndex++)
+                    : format_range("{range}.bb{uint}", name, blockIndex++);
+            *symbol++ = (struct jit_symbol){.name = blockName,
+                                            .code = batch->code + blockStart,
+                                            .size = blockEnd - blockStart,
+                                            .fn = functions[i],
+                                            .block = blocks[j].block};
+        }
+    }
+}
+
+// Sort the entries by pc, the scheduler moves positions along with their
+// instructions. They are nearly sorted and equal pcs keep their order.
+void _jit_sortPositions(struct position_entry *entries, size_t count) {
+    for (size_t i = 1; i < count; i++) {
+        struct position_entry entry = entries[i];
+        size_t j = i;
+        for (; j > 0 && entries[j - 1].pc > entry.pc; j--)
+            entries[j] = entries[j - 1];
+        entries[j] = entry;
+    }
+}
+
+// Split the recorded positions by function, they are in emission order.
+void _jit_buildPositions(struct jit_batch *batch, struct ir_codegen *ic,
+                         function_t **functions,
+                         struct jit_function *jitFunctions) {
+    size_t count = ic->positions.usage / sizeof(struct ir_codegen_position);
+    struct ir_codegen_position *positions = ic->positions.buffer;
+    struct position_entry *entries =
+        dmalloc(sizeof(struct position_entry) * (count + 1));
+    batch->positions = dmalloc(sizeof(struct position_table) * batch->count);
+
+    size_t p = 0;
+    for (size_t i = 0; i < batch->count; i++) {
+        size_t start = jitFunctions[i].label.offset;
+        size_t size = 0;
+        for (; p < count && positions[p].fn == functions[i]; p++) {
+            entries[size++] = (struct position_entry){
+                .pc = positions[p].label->offset - start,
+                .line = positions[p].line,
+                .col = positions[p].col};
+        }
+        _jit_sortPositions(entries, size);
+        position_table_build(&batch->positions[i], entries, size);
+    }
+    free(entries);
+}
+
+void jit_compileBatch(ir_context_t *ctx, function_t **functions, size_t count,
+                      struct jit_batch *batch) {
+    jit_compileBatchWith(ctx, functions, count, NULL, batch);
+}
+
+void jit_compileBatchWith(ir_context_t *ctx, function_t **functions,
+                          size_t count, struct jit_options *options,
+                          struct jit_batch *batch) {
+    struct codegen cg;
+    codegen_init(&cg, IR_CODEGEN_REGISTERS);
+
+    // function -> jit_function, so calls inside the batch can find labels.
+    hashmap_t functionMap;
+    hashmap_init(&functionMap, ptrKeyType);
+    struct jit_function *jitFunctions =
+        dzmalloc(sizeof(struct jit_function) * count);
+    for (size_t i = 0; i < count; i++)
+        hashmap_setPtr(&functionMap, functions[i], &jitFunctions[i].entry);
+
+    struct ir_codegen ic;
+    ir_codegen_init(&ic, &cg, ctx, _jit_resolveLabel, &functionMap);
+    if (options) {
+        ic.instrument = options->instrument;
+        ic.layout = options->layout;
+    }
+    for (size_t i = 0; i < count; i++)
+        ir_codegen_function(&ic, functions[i], &jitFunctions[i].label);
+    codegen_relaxBranches(&cg);
+
+    // Relocate in place, then flip the protection of the whole batch once.
+    void *code = allocate_writable(cg.buffer.usage);
+    assert(code && "can't allocate code memory");
+    memcpy(code, cg.buffer.buffer, cg.buffer.usage);
+    reloc_table_apply(&cg.relocs, code, (unsigned long)code);
+    int protected = protect_executable(code, cg.buffer.usage);
+    assert(protected && "can't make the code executable");
+
+    batch->code = code;
+    batch->size = cg.buffer.usage;
+    batch->count = count;
+    batch->entries = dmalloc(sizeof(void *) * count);
+    for (size_t i = 0; i < count; i++)
+        batch->entries[i] = code + jitFunctions[i].label.offset;
+    _jit_buildSymbols(batch, &ic, functions, jitFunctions);
+    _jit_buildPositions(batch, &ic, functions, jitFunctions);
+
+    ir_codegen_free(&ic);
+    free(jitFunctions);
+    hashmap_free(&functionMap);
+    codegen_free(&cg);
+}
+
+void jit_batch_free(struct jit_batch *batch) {
+    free_executable(batch->code, batch->size);
+    free(batch->entries);
+    for (size_t i = 0; i < batch->symbolCount; i++)
+        free(batch->symbols[i].name.ptr);
+    free(batch->symbols);
+    for (size_t i = 0; i < batch->count; i++)
+        position_table_free(&batch->positions[i]);
+    free(batch->positions);
+    *batch = (struct jit_batch){};
+}
+
+int jit_batch_lookup(struct jit_batch *batch, void *pc, uint32_t *line,
+                     uint32_t *col) {
+    if ((uint8_t *)pc < (uint8_t *)batch->code ||
+        (uint8_t *)pc >= (uint8_t *)batch->code + batch->size)
+        return 0;
+    // Entries are in code order, find the last one at or before pc.
+    size_t low = 0, high = batch->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if ((uint8_t *)batch->entries[mid] <= (uint8_t *)pc)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (!low)
+        return 0;
+    uint32_t offset = (uint8_t *)pc - (uint8_t *)batch->entries[low - 1];
+    return position_table_lookup(&batch->positions[low - 1], offset, line,
+                                 col);
+}
@@ -0,0 +1,61 @@
+// Compile many functions into one piece of executable memory.
+#ifndef JIT_H
+#define JIT_H
+
+#include "ir.h"
+#include "position_table.h"
+#include "profile.h"
+
+// Named piece of a batch, for profilers.
+struct jit_symbol {
+    range_t name;
+    void *code;
+    size_t size;
+    // Block and edge symbols of a function directly follow it and cover all
+    // of it.
+    size_t blockCount;
+    // The IR the code comes from, block is NULL for functions. Only valid
+    // while the IR is alive.
+    function_t *fn;
+    basic_block_t *block;
+};
+
+struct jit_batch {
+    void *code;
+    size_t size;
+    // Entry points, in the order the functions were given.
+    void **entries;
+    size_t count;
+    // Every function followed by its blocks.
+    struct jit_symbol *symbols;
+    size_t symbolCount;
+    // Source positions of every function, pcs are relative to the entry.
+    struct position_table *positions;
+};
+
+struct jit_options {
+    // Add block and edge counters to the code, the profile must outlive the
+    // batch.
+    struct profile *instrument;
+    // Lay the blocks out after the counts of this profile.
+    struct profile *layout;
+};
+
+// Compile the functions into a single blob. Calls between the functions are
+// direct rel32 calls, every called function must be a part of the batch.
+// The memory becomes executable with a single protection change.
+void jit_compileBatch(ir_context_t *ctx, function_t **functions, size_t count,
+                      struct jit_batch *batch);
+// Same as jit_compileBatch, @options may be NULL.
+void jit_compileBatchWith(ir_context_t *ctx, function_t **functions,
+                          size_t count, struct jit_options *options,
+                          struct jit_batch *batch);
+
+void jit_batch_free(struct jit_batch *batch);
+
+// Source position of the code at @pc, returns 0 if @pc is outside of the
+// batch or has no position.
+int jit_batch_lookup(struct jit_batch *batch, void *pc, uint32_t *line,
+                     uint32_t *col);
+
+#endif
@@ -0,0 +1,215 @@
+#include "lazy.h"
+#include "ir_codegen.h"
+#include "ssa_conversion.h"
+#include "x86_64.h"
+
+#include <assert.h>
+
+#define LAZY_CALL_SIZE 5
+
+struct _lazy_callee {
+    label_t label;
+    struct lazy_function *lf;
+};
+
+// Labels of the functions called by the function that is being compiled.
+struct _lazy_labels {
+    struct lazy_module *module;
+    function_t *fn;
+    label_t *entry;
+    // _lazy_callee pointers.
+    dbuffer_t callees;
+    zone_allocator zone;
+};
+
+void *_lazy_resolve(struct lazy_function *lf);
+
+int lazy_init(struct lazy_module *module, ir_context_t *ctx) {
+    *module = (struct lazy_module){.ctx = ctx};
+    if (!code_heap_init(&module->heap, CODE_HEAP_HUGE_PAGES))
+        return 0;
+    hashmap_init(&module->functions, ptrKeyType);
+    dbuffer_init(&module->functionList);
+    pthread_mutex_init(&module->lock, NULL);
+    return 1;
+}
+
+void lazy_free(struct lazy_module *module) {
+    size_t count;
+    struct lazy_function **functions = (struct lazy_function **)
+        dbuffer_asPtrArray(&module->functionList, &count);
+    for (size_t i = 0; i < count; i++) {
+        dbuffer_free(&functions[i]->callers);
+        free(functions[i]);
+    }
+
+    pthread_mutex_destroy(&module->lock);
+    dbuffer_free(&module->functionList);
+    hashmap_free(&module->functions);
+    code_heap_free(&module->heap);
+}
+
+struct lazy_function *_lazy_get(struct lazy_module *module, function_t *fn) {
+    struct hm_bucket_entry *entry = hashmap_getPtr(&module->functions, fn);
+    if (!entry)
+        return NULL;
+    return containerof(entry, struct lazy_function, hmEntry);
+}
+
+// The stub jumps through lf->target. Before the function is compiled the
+// target is the second half of the stub, which saves the argument registers,
+// calls the resolver and jumps to the code it returns.
+void _lazy_emitStub(struct lazy_module *module, struct lazy_function *lf) {
+    dbuffer_t dbuffer;
+    dbuffer_init(&dbuffer);
+    emit_storeConst64(&dbuffer, RAX, (long)&lf->target);
+    emit_jumpMem64(&dbuffer, RAX, 0);
+    size_t resolveOffset = dbuffer.usage;
+
+    reg64 arguments[] = {RDI, RSI, RDX, RCX, R8, R9};
+    for (int i = 0; i < 6; i++)
+        emit_pushReg(&dbuffer, arguments[i]);
+    // Six pushes and the return address, realign the stack for the call.
+    emit_aluRegImm64(&dbuffer, ALU_SUB, RSP, 8);
+    emit_storeConst64(&dbuffer, RDI, (long)lf);
+    emit_storeConst64(&dbuffer, RAX, (long)_lazy_resolve);
+    emit_callReg64(&dbuffer, RAX);
+    emit_aluRegImm64(&dbuffer, ALU_ADD, RSP, 8);
+    for (int i = 5; i >= 0; i--)
+        emit_popReg(&dbuffer, arguments[i]);
+    emit_jumpReg64(&dbuffer, RAX);
+
+    lf->stub = code_heap_allocate(&module->heap, dbuffer.usage);
+    memcpy(lf->stub.rw, dbuffer.buffer, dbuffer.usage);
+    atomic_init(&lf->target, (uint8_t *)lf->stub.rx + resolveOffset);
+    dbuffer_free(&dbuffer);
+}
+
+void lazy_add(struct lazy_module *module, function_t *fn) {
+    pthread_mutex_lock(&module->lock);
+    assert(!_lazy_get(module, fn) && "function is already added");
+    struct lazy_function *lf = nnew(struct lazy_function);
+    *lf = (struct lazy_function){.fn = fn, .module = module};
+    dbuffer_init(&lf->callers);
+    _lazy_emitStub(module, lf);
+    hashmap_setPtr(&module->functions, fn, &lf->hmEntry);
+    dbuffer_pushPtr(&module->functionList, lf);
+    pthread_mutex_unlock(&module->lock);
+}
+
+void *lazy_entry(struct lazy_module *module, function_t *fn) {
+    pthread_mutex_lock(&module->lock);
+    struct lazy_function *lf = _lazy_get(module, fn);
+    assert(lf && "function is not a part of the module");
+    void *entry = lf->entry ? lf->entry : lf->stub.rx;
+    pthread_mutex_unlock(&module->lock);
+    return entry;
+}
+
+// Calls go to the code of the callee if it is compiled, to its stub if not.
+label_t *_lazy_resolveLabel(void *ctx, function_t *fn) {
+    struct _lazy_labels *labels = ctx;
+    if (fn == labels->fn)
+        return labels->entry;
+    struct lazy_function *callee = _lazy_get(labels->module, fn);
+    if (!callee)
+        return NULL;
+
+    struct _lazy_callee *c = znnew(&labels->zone, struct _lazy_callee);
+    *c = (struct _lazy_callee){.lf = callee};
+    void *target = callee->entry ? callee->entry : callee->stub.rx;
+    label_setOffset(&c->label, (unsigned long)target);
+    dbuffer_pushPtr(&labels->callees, c);
+    return &c->label;
+}
+
+// Point the call instruction at @call to the code of @lf. The call is left
+// going through the stub if it can't be patched safely.
+void _lazy_patchCall(struct lazy_module *module, struct lazy_function *lf,
+                     uint8_t *call) {
+    uint8_t *rw = code_heap_writable(&module->heap, call, LAZY_CALL_SIZE);
+    assert(rw && rw[0] == 0xE8 && "not a call inside the code heap");
+
+    uint8_t *next = call + LAZY_CALL_SIZE;
+    int64_t target = (uint8_t *)lf->entry - next;
+    if (target < INT32_MIN || target > INT32_MAX)
+        return;
+    // Other threads may be running the call, the displacement must be
+    // written with a single atomic store that doesn't cross a cache line.
+    if (((uintptr_t)(call + 1) & 63) > 60)
+        return;
+    int32_t rel = (int32_t)target;
+    __atomic_store_n((int32_t *)(rw + 1), rel, __ATOMIC_RELEASE);
+    module->patched++;
+}
+
+// Remember the calls of the new code that go to stubs, they are patched when
+// the callee gets compiled.
+void _lazy_recordCallers(struct _lazy_labels *labels,
+                         struct reloc_table *relocs, uint8_t *code) {
+    size_t relocCount, labelCount, calleeCount;
+    relocation_t *relocations = reloc_table_relocations(relocs, &relocCount);
+    label_t **tableLabels = reloc_table_labels(relocs, &labelCount);
+    struct _lazy_callee **callees = (struct _lazy_callee **)dbuffer_asPtrArray(
+        &labels->callees, &calleeCount);
+
+    for (size_t i = 0; i < relocCount; i++) {
+        label_t *label = tableLabels[relocations[i].label];
+        for (size_t j = 0; j < calleeCount; j++) {
+            if (label != &callees[j]->label || callees[j]->lf->entry)
+                continue;
+            // The displacement follows the call opcode.
+            uint8_t *call = code + relocations[i].offset - 1;
+            dbuffer_pushPtr(&callees[j]->lf->callers, call);
+        }
+    }
+}
+
+void _lazy_compile(struct lazy_module *module, struct lazy_function *lf) {
+    ssa_convertFunction(module->ctx, lf->fn);
+
+    struct codegen cg;
+    codegen_init(&cg, IR_CODEGEN_REGISTERS);
+    label_t entry = {};
+    struct _lazy_labels labels = {.module = module, .fn = lf->fn,
+                                  .entry = &entry};
+    dbuffer_init(&labels.callees);
+    zone_init(&labels.zone);
+
+    struct ir_codegen ic;
+    ir_codegen_init(&ic, &cg, module->ctx, _lazy_resolveLabel, &labels);
+    ir_codegen_function(&ic, lf->fn, &entry);
+    codegen_relaxBranches(&cg);
+
+    lf->code = code_heap_allocate(&module->heap, cg.buffer.usage);
+    memcpy(lf->code.rw, cg.buffer.buffer, cg.buffer.usage);
+    reloc_table_apply(&cg.relocs, lf->code.rw, (unsigned long)lf->code.rx);
+    lf->entry = (uint8_t *)lf->code.rx + entry.offset;
+    _lazy_recordCallers(&labels, &cg.relocs, lf->code.rx);
+
+    // Calls from now on skip the stub.
+    atomic_store_explicit(&lf->target, lf->entry, memory_order_release);
+    size_t count;
+    uint8_t **callers = (uint8_t **)dbuffer_asPtrArray(&lf->callers, &count);
+    for (size_t i = 0; i < count; i++)
+        _lazy_patchCall(module, lf, callers[i]);
+    dbuffer_clear(&lf->callers);
+    module->compiled++;
+
+    ir_codegen_free(&ic);
+    dbuffer_free(&labels.callees);
+    zone_free(&labels.zone);
+    codegen_free(&cg);
+}
+
+// Called by the stub on the first call.
+void *_lazy_resolve(struct lazy_function *lf) {
+    struct lazy_module *module = lf->module;
+    pthread_mutex_lock(&module->lock);
+    // Another thread may have compiled it while we waited.
+    if (!lf->entry)
+        _lazy_compile(module, lf);
+    void *entry = lf->entry;
+    pthread_mutex_unlock(&module->lock);
+    return entry;
+}
@@ -0,0 +1,58 @@
+// Lazy compilation of module functions. Every function starts out as a small
+// stub, the first call through it compiles the function. The rel32 of every
+// compiled call to the stub is then patched to the code, so startup only pays
+// for the code that actually runs.
+#ifndef LAZY_H
+#define LAZY_H
+
+#include "code_heap.h"
+#include "hashmap.h"
+#include "ir.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+struct lazy_module;
+
+struct lazy_function {
+    function_t *fn;
+    struct lazy_module *module;
+    // The stub jumps through this, it points to the resolver part of the
+    // stub until the function is compiled.
+    _Atomic(void *) target;
+    struct code_range stub;
+    // Compiled code, entry is NULL until the first call.
+    struct code_range code;
+    void *entry;
+    // Addresses of compiled calls that still go to the stub.
+    dbuffer_t callers;
+
+    struct hm_bucket_entry hmEntry;
+};
+
+struct lazy_module {
+    ir_context_t *ctx;
+    struct code_heap heap;
+    // function_t -> lazy_function
+    hashmap_t functions;
+    dbuffer_t functionList;
+
+    // Taken by the resolver, compilation is serialized.
+    pthread_mutex_t lock;
+    size_t compiled;
+    // Call sites that were redirected from a stub to the code.
+    size_t patched;
+};
+
+// Returns 0 if the code heap can't be created.
+int lazy_init(struct lazy_module *module, ir_context_t *ctx);
+void lazy_free(struct lazy_module *module);
+
+// Register @fn and create its stub, the IR belongs to the module from now
+// on. Every function @fn calls must be added before @fn runs.
+void lazy_add(struct lazy_module *module, function_t *fn);
+
+// Address to call @fn through, the stub until the function is compiled.
+void *lazy_entry(struct lazy_module *module, function_t *fn);
+
+#endif
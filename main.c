@@ -6,50 +6,50 @@
 #include "buffer.h"
 #include "elf.h"
 #include "relocation.h"
+#include "x86_64.h"
 
-void elf64_initIdent(struct elf_ident *ident) {
-    ident->signiture[0] = 0x7F;
-    ident->signiture[1] = 'E';
-    ident->signiture[2] = 'L';
-    ident->signiture[3] = 'F';
-
-    ident->eclass = ELF_CLASS_64;
-    ident->endiannes = ELF_LITTLE_ENDIAN;
-    ident->version = 1;
-    ident->abi = ELF_LINUX;
-    ident->abi_version = 3;
-
-    memset(ident->pad, 0, 7);
-}
+#define SYS_WRITE 1
+#define SYS_EXIT 60
 
+// Emit a static executable that prints a message and exits.
 void emit(dbuffer_t *dbuffer) {
-    label_t start;
+    struct reloc_table relocs;
+    reloc_table_init(&relocs);
+    struct elf_writer writer;
+    elf_writer_init(&writer);
 
-    struct elf64_header header = (struct elf64_header){};
-    elf64_initIdent(&header.ident);
+    label_t start = (label_t){};
+    label_t message = (label_t){};
+    reloc_table_addLabel(&relocs, &start);
+    reloc_table_addLabel(&relocs, &message);
 
-    header.type = ELF_ET_EXEC;
-    header.machine = ELF_AMD64;
-    header.e_version = 1;
-    header.entry_point = 0;
-    header.ph_offset = 0x40; // Right after the header.
-    header.header_size = 0x40;
-    header.phe_size = sizeof(struct elf64_program);
-    header.phe_num = 1;
+    char text[] = "Hello world!\n";
+    elf_writer_addData(&writer, ELF_RODATA, &message, text, sizeof(text) - 1,
+                       1);
+    elf_writer_addSymbol(&writer, RANGE_STRING("_start"), &start, 1);
 
-    dbuffer_pushData(dbuffer, &header, sizeof(struct elf64_header));
-    relocation_set(&start, ABSOLUTE, INT64, 0,
-                   offsetof(struct elf64_header, entry_point));
+    dbuffer_t code;
+    dbuffer_init(&code);
+    label_setPosition(&start, code.usage);
+    emit_storeConst64(&code, RAX, SYS_WRITE);
+    emit_storeConst64(&code, RDI, 1);
+    emit_storeLabel64(&code, RSI, &message);
+    emit_storeConst64(&code, RDX, sizeof(text) - 1);
+    emit_syscall(&code);
+    emit_storeConst64(&code, RAX, SYS_EXIT);
+    emit_storeConst64(&code, RDI, 0);
+    emit_syscall(&code);
 
-    struct elf64_program program = (struct elf64_program){};
+    elf_writer_writeExecutable(&writer, &code, &relocs, &start, dbuffer);
 
-    dbuffer_pushData(dbuffer, &program, sizeof(struct elf64_program));
+    dbuffer_free(&code);
+    elf_writer_free(&writer);
+    reloc_table_free(&relocs);
 }
 
 int main() {
     dbuffer_t dbuffer;
     dbuffer_init(&dbuffer);
-    //  dbuffer_pushInt(&dbuffer, 0xFFAA, 2);
     emit(&dbuffer);
     FILE *file = fopen("test.out", "wb");
     if (file == NULL) {
@@ -59,6 +59,7 @@ int main() {
     dbuffer_write(&dbuffer, file);
 
     fclose(file);
+    dbuffer_free(&dbuffer);
 
     return 0;
 }
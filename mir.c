@@ -0,0 +1,734 @@
+#include "mir.h"
+#include "hashmap.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <string.h>
+
+char *kMirOpcodeNames[] = {MIR_OPCODES(FIRST3, STR_COMMA)};
+unsigned kMirOpcodeFlags[] = {MIR_OPCODES(SECOND3, COMMA)};
+
+char *_kMirRegNames[] = {REGISTER64(FIRST3, STR_COMMA)};
+char *_kMirAluNames[] = {ALU_OPS(FIRST4, STR_COMMA)};
+char *_kMirUnaryNames[] = {UNARY_OPS(FIRST3, STR_COMMA)};
+char *_kMirCondNames[] = {CONDITION_CODES(FIRST3, STR_COMMA)};
+
+void mir_function_init(struct mir_function *fn) {
+    *fn = (struct mir_function){};
+    dbuffer_init(&fn->blocks);
+    dbuffer_init(&fn->slots);
+    zone_init(&fn->zone);
+    // vreg 0 is no register.
+    fn->vregCount = 1;
+    size_t none = 0;
+    dbuffer_pushData(&fn->slots, &none, sizeof(none));
+}
+
+void mir_function_free(struct mir_function *fn) {
+    size_t count;
+    struct mir_block **blocks = mir_blocks(fn, &count);
+    for (size_t i = 0; i < count; i++)
+        dbuffer_free(&blocks[i]->insts);
+    dbuffer_free(&fn->blocks);
+    dbuffer_free(&fn->slots);
+    zone_free(&fn->zone);
+}
+
+struct mir_block *mir_addBlock(struct mir_function *fn, label_t *label,
+                               basic_block_t *block) {
+    struct mir_block *result = znnew(&fn->zone, struct mir_block);
+    *result = (struct mir_block){.label = label, .block = block};
+    dbuffer_init(&result->insts);
+    dbuffer_pushPtr(&fn->blocks, result);
+    return result;
+}
+
+struct mir_block **mir_blocks(struct mir_function *fn, size_t *count) {
+    return (struct mir_block **)dbuffer_asPtrArray(&fn->blocks, count);
+}
+
+struct mir_inst *mir_insts(struct mir_block *block, size_t *count) {
+    *count = block->insts.usage / sizeof(struct mir_inst);
+    return block->insts.buffer;
+}
+
+uint32_t mir_newVreg(struct mir_function *fn, size_t slot) {
+    dbuffer_pushData(&fn->slots, &slot, sizeof(slot));
+    return fn->vregCount++;
+}
+
+size_t mir_slot(struct mir_function *fn, uint32_t vreg) {
+    assert(vreg != MIR_NO_VREG && vreg < fn->vregCount && "unknown vreg");
+    size_t *slots = fn->slots.buffer;
+    if (!slots[vreg])
+        slots[vreg] = ++fn->slotCount;
+    return slots[vreg];
+}
+
+void mir_insert(struct mir_block *block, size_t index, struct mir_inst *insts,
+                size_t count) {
+    size_t size = count * sizeof(struct mir_inst);
+    size_t offset = index * sizeof(struct mir_inst);
+    assert(offset <= block->insts.usage && "insertion past the end");
+    dbuffer_ensureCap(&block->insts, size);
+    char *buffer = block->insts.buffer;
+    memmove(buffer + offset + size, buffer + offset,
+            block->insts.usage - offset);
+    memcpy(buffer + offset, insts, size);
+    block->insts.usage += size;
+}
+
+struct mir_operand mir_vreg(uint32_t vreg) {
+    return (struct mir_operand){.kind = MIR_VREG, .reg = vreg};
+}
+
+struct mir_operand mir_preg(reg64 reg) {
+    return (struct mir_operand){.kind = MIR_PREG, .reg = reg};
+}
+
+struct mir_operand mir_imm(int64_t imm) {
+    return (struct mir_operand){.kind = MIR_IMM, .imm = imm};
+}
+
+struct mir_operand mir_mem(reg64 base, int32_t disp) {
+    return (struct mir_operand){.kind = MIR_MEM, .reg = base, .imm = disp};
+}
+
+struct mir_operand mir_vmem(uint32_t base, int32_t disp) {
+    return (struct mir_operand){.kind = MIR_VMEM, .reg = base, .imm = disp};
+}
+
+struct mir_operand mir_label(label_t *label) {
+    return (struct mir_operand){.kind = MIR_LABEL, .label = label};
+}
+
+struct mir_operand mir_stackSlot(size_t slot) {
+    return mir_mem(RBP, -(int32_t)slot * 8);
+}
+
+void _mir_emit(struct mir_block *block, mir_opcode op, int variant,
+               size_t count, struct mir_operand a, struct mir_operand b,
+               struct mir_operand c) {
+    struct mir_inst inst = {op, variant, count, {a, b, c}};
+    dbuffer_pushData(&block->insts, &inst, sizeof(inst));
+}
+
+#define _MIR_NONE ((struct mir_operand){})
+
+void mir_mov(struct mir_block *block, struct mir_operand dst,
+             struct mir_operand src) {
+    _mir_emit(block, MIR_MOV, 0, 2, dst, src, _MIR_NONE);
+}
+
+void mir_alu(struct mir_block *block, alu_op op, struct mir_operand dst,
+             struct mir_operand src) {
+    _mir_emit(block, MIR_ALU, op, 2, dst, src, _MIR_NONE);
+}
+
+void mir_imul(struct mir_block *block, struct mir_operand dst,
+              struct mir_operand src) {
+    _mir_emit(block, MIR_IMUL, 0, 2, dst, src, _MIR_NONE);
+}
+
+void mir_imulImm(struct mir_block *block, struct mir_operand dst,
+                 struct mir_operand src, int32_t imm) {
+    _mir_emit(block, MIR_IMUL, 0, 3, dst, src, mir_imm(imm));
+}
+
+void mir_unary(struct mir_block *block, unary_op op, struct mir_operand dst) {
+    _mir_emit(block, MIR_UNARY, op, 1, dst, _MIR_NONE, _MIR_NONE);
+}
+
+void mir_cqo(struct mir_block *block) {
+    _mir_emit(block, MIR_CQO, 0, 0, _MIR_NONE, _MIR_NONE, _MIR_NONE);
+}
+
+void mir_test(struct mir_block *block, struct mir_operand a,
+              struct mir_operand b) {
+    _mir_emit(block, MIR_TEST, 0, 2, a, b, _MIR_NONE);
+}
+
+void mir_setcc(struct mir_block *block, cond_code cc, struct mir_operand dst) {
+    _mir_emit(block, MIR_SETCC, cc, 1, dst, _MIR_NONE, _MIR_NONE);
+}
+
+void mir_cmov(struct mir_block *block, cond_code cc, struct mir_operand dst,
+              struct mir_operand src) {
+    _mir_emit(block, MIR_CMOV, cc, 2, dst, src, _MIR_NONE);
+}
+
+void mir_inc(struct mir_block *block, struct mir_operand mem) {
+    _mir_emit(block, MIR_INC, 0, 1, mem, _MIR_NONE, _MIR_NONE);
+}
+
+void mir_lea(struct mir_block *block, struct mir_operand dst,
+             struct mir_operand base, struct mir_operand index, int scale,
+             int32_t disp) {
+    struct mir_inst inst = {MIR_LEA, scale, 4,
+                            {dst, base, index, mir_imm(disp)}};
+    dbuffer_pushData(&block->insts, &inst, sizeof(inst));
+}
+
+void mir_jmp(struct mir_block *block, label_t *label) {
+    _mir_emit(block, MIR_JMP, 0, 1, mir_label(label), _MIR_NONE, _MIR_NONE);
+}
+
+void mir_jcc(struct mir_block *block, cond_code cc, label_t *label) {
+    _mir_emit(block, MIR_JCC, cc, 1, mir_label(label), _MIR_NONE, _MIR_NONE);
+}
+
+void mir_call(struct mir_block *block, label_t *label, int argCount) {
+    _mir_emit(block, MIR_CALL, argCount, 1, mir_label(label), _MIR_NONE,
+              _MIR_NONE);
+}
+
+void mir_ret(struct mir_block *block, int hasValue) {
+    _mir_emit(block, MIR_RET, hasValue, 0, _MIR_NONE, _MIR_NONE, _MIR_NONE);
+}
+
+void mir_push(struct mir_block *block, reg64 reg) {
+    _mir_emit(block, MIR_PUSH, 0, 1, mir_preg(reg), _MIR_NONE, _MIR_NONE);
+}
+
+void mir_pop(struct mir_block *block, reg64 reg) {
+    _mir_emit(block, MIR_POP, 0, 1, mir_preg(reg), _MIR_NONE, _MIR_NONE);
+}
+
+void mir_bind(struct mir_block *block, label_t *label) {
+    _mir_emit(block, MIR_BIND, 0, 1, mir_label(label), _MIR_NONE,
+              _MIR_NONE);
+}
+
+void mir_bindPosition(struct mir_block *block, label_t *label) {
+    _mir_emit(block, MIR_BIND, 1, 1, mir_label(label), _MIR_NONE,
+              _MIR_NONE);
+}
+
+int _mir_isMulDiv(struct mir_inst *inst) {
+    return inst->op == MIR_UNARY &&
+           (inst->variant == UNARY_MUL || inst->variant == UNARY_IMUL ||
+            inst->variant == UNARY_DIV || inst->variant == UNARY_IDIV);
+}
+
+int mir_operandAccess(struct mir_inst *inst, size_t i) {
+    if (i >= inst->operandCount)
+        return 0;
+    switch (inst->op) {
+    case MIR_MOV:
+    case MIR_SETCC:
+    case MIR_POP:
+    case MIR_LEA:
+        return i == 0 ? MIR_DEF : MIR_USE;
+    case MIR_ALU:
+        return i == 0 && inst->variant != ALU_CMP ? MIR_USE | MIR_DEF
+                                                  : MIR_USE;
+    case MIR_CMOV:
+        // The destination keeps its value when the condition is false.
+        return i == 0 ? MIR_USE | MIR_DEF : MIR_USE;
+    case MIR_IMUL:
+        if (i)
+            return MIR_USE;
+        return inst->operandCount == 3 ? MIR_DEF : MIR_USE | MIR_DEF;
+    case MIR_UNARY:
+        return _mir_isMulDiv(inst) ? MIR_USE : MIR_USE | MIR_DEF;
+    case MIR_INC:
+        return MIR_USE | MIR_DEF;
+    default:
+        return MIR_USE;
+    }
+}
+
+unsigned mir_callerSaved() {
+    return 1u << RAX | 1u << RCX | 1u << RDX | 1u << RSI | 1u << RDI |
+           1u << R8 | 1u << R9 | 1u << R10 | 1u << R11;
+}
+
+unsigned mir_calleeSaved() {
+    return 1u << RBX | 1u << R12 | 1u << R13 | 1u << R14 | 1u << R15;
+}
+
+unsigned mir_implicitUses(struct mir_inst *inst) {
+    // %rdi,%rsi,%rdx,%rcx,%r8,%r9
+    reg64 args[] = {RDI, RSI, RDX, RCX, R8, R9};
+    unsigned result = 0;
+    switch (inst->op) {
+    case MIR_UNARY:
+        if (!_mir_isMulDiv(inst))
+            return 0;
+        result = 1u << RAX;
+        if (inst->variant == UNARY_DIV || inst->variant == UNARY_IDIV)
+            result |= 1u << RDX;
+        return result;
+    case MIR_CQO:
+        return 1u << RAX;
+    case MIR_CALL:
+        for (int i = 0; i < inst->variant; i++)
+            result |= 1u << args[i];
+        return result | 1u << RSP;
+    case MIR_RET:
+        return inst->variant ? 1u << RAX | 1u << RSP : 1u << RSP;
+    case MIR_PUSH:
+    case MIR_POP:
+        return 1u << RSP;
+    default:
+        return 0;
+    }
+}
+
+unsigned mir_implicitDefs(struct mir_inst *inst) {
+    switch (inst->op) {
+    case MIR_UNARY:
+        return _mir_isMulDiv(inst) ? 1u << RAX | 1u << RDX : 0;
+    case MIR_CQO:
+        return 1u << RDX;
+    case MIR_CALL:
+        return mir_callerSaved();
+    case MIR_PUSH:
+    case MIR_POP:
+        return 1u << RSP;
+    default:
+        return 0;
+    }
+}
+
+unsigned mir_explicitRegs(struct mir_inst *inst, int access) {
+    unsigned result = 0;
+    for (size_t o = 0; o < inst->operandCount; o++) {
+        struct mir_operand *operand = &inst->operands[o];
+        if (operand->kind == MIR_PREG &&
+            mir_operandAccess(inst, o) & access)
+            result |= 1u << operand->reg;
+        if (operand->kind == MIR_MEM && access & MIR_USE)
+            result |= 1u << operand->reg;
+    }
+    return result;
+}
+
+unsigned mir_regUses(struct mir_inst *inst) {
+    return mir_explicitRegs(inst, MIR_USE) | mir_implicitUses(inst);
+}
+
+unsigned mir_regDefs(struct mir_inst *inst) {
+    return mir_explicitRegs(inst, MIR_DEF) | mir_implicitDefs(inst);
+}
+
+int mir_isLive(uint64_t *set, uint32_t vreg) {
+    return (set[vreg / 64] >> (vreg % 64)) & 1;
+}
+
+void _mir_setLive(uint64_t *set, uint32_t vreg) {
+    set[vreg / 64] |= 1ull << (vreg % 64);
+}
+
+uint64_t *mir_liveIn(struct mir_liveness *live, size_t block) {
+    return live->in + live->words * block;
+}
+
+uint64_t *mir_liveOut(struct mir_liveness *live, size_t block) {
+    return live->out + live->words * block;
+}
+
+struct _mir_labelEntry {
+    size_t index;
+    struct hm_bucket_entry entry;
+};
+
+// Successors of the block, -1 for jumps out of the function.
+size_t _mir_successors(struct mir_block **blocks, size_t count, size_t b,
+                       hashmap_t *labels, long *succ) {
+    size_t instCount, n = 0;
+    struct mir_inst *insts = mir_insts(blocks[b], &instCount);
+    int fallsThrough = 1;
+    for (size_t i = 0; i < instCount; i++) {
+        if (insts[i].op == MIR_BIND)
+            continue;
+        fallsThrough = insts[i].op != MIR_JMP && insts[i].op != MIR_RET;
+        if (insts[i].op != MIR_JMP && insts[i].op != MIR_JCC)
+            continue;
+        struct hm_bucket_entry *entry =
+            hashmap_getPtr(labels, insts[i].operands[0].label);
+        if (entry)
+            succ[n++] =
+                containerof(entry, struct _mir_labelEntry, entry)->index;
+    }
+    if (fallsThrough && b + 1 < count)
+        succ[n++] = b + 1;
+    return n;
+}
+
+// Virtual register of a register or memory operand.
+uint32_t _mir_operandVreg(struct mir_operand *operand) {
+    if (operand->kind == MIR_VREG || operand->kind == MIR_VMEM)
+        return operand->reg;
+    return MIR_NO_VREG;
+}
+
+void mir_liveness_compute(struct mir_liveness *live, struct mir_function *fn) {
+    size_t count;
+    struct mir_block **blocks = mir_blocks(fn, &count);
+    size_t words = (fn->vregCount + 63) / 64;
+    *live = (struct mir_liveness){.words = words, .blockCount = count};
+    live->in = dzmalloc(sizeof(uint64_t) * (words * count * 2 + 1));
+    live->out = live->in + words * count;
+    uint64_t *gen = dzmalloc(sizeof(uint64_t) * (words * count * 2 + 1));
+    uint64_t *kill = gen + words * count;
+
+    hashmap_t labels;
+    hashmap_init(&labels, ptrKeyType);
+    struct _mir_labelEntry *entries =
+        dzmalloc(sizeof(struct _mir_labelEntry) * (count + 1));
+    for (size_t b = 0; b < count; b++) {
+        entries[b].index = b;
+        hashmap_setPtr(&labels, blocks[b]->label, &entries[b].entry);
+    }
+
+    // Reads before writes in the block and writes.
+    for (size_t b = 0; b < count; b++) {
+        size_t instCount;
+        struct mir_inst *insts = mir_insts(blocks[b], &instCount);
+        uint64_t *blockGen = gen + words * b, *blockKill = kill + words * b;
+        for (size_t i = 0; i < instCount; i++) {
+            for (size_t o = 0; o < insts[i].operandCount; o++) {
+                struct mir_operand *operand = &insts[i].operands[o];
+                uint32_t vreg = _mir_operandVreg(operand);
+                int access = operand->kind == MIR_VMEM
+                                 ? MIR_USE
+                                 : mir_operandAccess(&insts[i], o);
+                if (vreg && access & MIR_USE && !mir_isLive(blockKill, vreg))
+                    _mir_setLive(blockGen, vreg);
+            }
+            for (size_t o = 0; o < insts[i].operandCount; o++) {
+                struct mir_operand *operand = &insts[i].operands[o];
+                if (operand->kind == MIR_VREG &&
+                    mir_operandAccess(&insts[i], o) & MIR_DEF)
+                    _mir_setLive(blockKill, operand->reg);
+            }
+        }
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (size_t b = count; b-- > 0;) {
+            uint64_t *in = mir_liveIn(live, b), *out = mir_liveOut(live, b);
+            long succ[MIR_MAX_OPERANDS + 1];
+            size_t succCount = _mir_successors(blocks, count, b, &labels, succ);
+            for (size_t s = 0; s < succCount; s++) {
+                uint64_t *next = mir_liveIn(live, succ[s]);
+                for (size_t w = 0; w < words; w++)
+                    out[w] |= next[w];
+            }
+            for (size_t w = 0; w < words; w++) {
+                uint64_t value = gen[words * b + w] |
+                                 (out[w] & ~kill[words * b + w]);
+                changed |= value != in[w];
+                in[w] = value;
+            }
+        }
+    }
+
+    free(entries);
+    hashmap_free(&labels);
+    free(gen);
+}
+
+void mir_liveness_free(struct mir_liveness *live) { free(live->in); }
+
+void _mir_printLower(FILE *file, char *name) {
+    for (; *name; name++)
+        fputc(tolower(*name), file);
+}
+
+void _mir_printOperand(FILE *file, struct mir_operand *operand,
+                       hashmap_t *labels) {
+    switch (operand->kind) {
+    case MIR_NONE:
+        break;
+    case MIR_VREG:
+        fprintf(file, "v%u", operand->reg);
+        break;
+    case MIR_PREG:
+        _mir_printLower(file, _kMirRegNames[operand->reg]);
+        break;
+    case MIR_IMM:
+        fprintf(file, "%ld", (long)operand->imm);
+        break;
+    case MIR_MEM:
+    case MIR_VMEM:
+        fputc('[', file);
+        if (operand->kind == MIR_VMEM)
+            fprintf(file, "v%u", operand->reg);
+        else
+            _mir_printLower(file, _kMirRegNames[operand->reg]);
+        if (operand->imm)
+            fprintf(file, " %c %ld", operand->imm < 0 ? '-' : '+',
+                    labs((long)operand->imm));
+        fputc(']', file);
+        break;
+    case MIR_LABEL: {
+        struct hm_bucket_entry *entry = hashmap_getPtr(labels, operand->label);
+        if (entry)
+            fprintf(file, "bb%zu",
+                    containerof(entry, struct _mir_labelEntry, entry)->index);
+        else
+            fprintf(file, "label");
+        break;
+    }
+    }
+}
+
+// lea dst, [base + index*scale + disp]
+void _mir_printLea(FILE *file, struct mir_inst *inst, hashmap_t *labels) {
+    fputs("lea ", file);
+    _mir_printOperand(file, &inst->operands[0], labels);
+    fputs(", [", file);
+    _mir_printOperand(file, &inst->operands[1], labels);
+    if (inst->operands[2].kind != MIR_NONE) {
+        fputs(" + ", file);
+        _mir_printOperand(file, &inst->operands[2], labels);
+        fprintf(file, "*%d", inst->variant);
+    }
+    int64_t disp = inst->operands[3].imm;
+    if (disp)
+        fprintf(file, " %c %ld", disp < 0 ? '-' : '+', labs((long)disp));
+    fputs("]\n", file);
+}
+
+void _mir_printInst(FILE *file, struct mir_inst *inst, hashmap_t *labels) {
+    if (inst->op == MIR_LEA) {
+        _mir_printLea(file, inst, labels);
+        return;
+    }
+    switch (inst->op) {
+    case MIR_ALU:
+        _mir_printLower(file, _kMirAluNames[inst->variant]);
+        break;
+    case MIR_UNARY:
+        _mir_printLower(file, _kMirUnaryNames[inst->variant]);
+        break;
+    case MIR_JCC:
+    case MIR_SETCC:
+    case MIR_CMOV:
+        fputs(inst->op == MIR_JCC     ? "j"
+              : inst->op == MIR_SETCC ? "set"
+                                      : "cmov",
+              file);
+        _mir_printLower(file, _kMirCondNames[inst->variant]);
+        break;
+    default:
+        _mir_printLower(file, kMirOpcodeNames[inst->op]);
+    }
+    for (size_t i = 0; i < inst->operandCount; i++) {
+        fputs(i ? ", " : " ", file);
+        _mir_printOperand(file, &inst->operands[i], labels);
+    }
+    fputc('\n', file);
+}
+
+void mir_print(FILE *file, struct mir_function *fn) {
+    size_t count;
+    struct mir_block **blocks = mir_blocks(fn, &count);
+    hashmap_t labels;
+    hashmap_init(&labels, ptrKeyType);
+    struct _mir_labelEntry *entries =
+        dzmalloc(sizeof(struct _mir_labelEntry) * (count + 1));
+    for (size_t b = 0; b < count; b++) {
+        entries[b].index = b;
+        hashmap_setPtr(&labels, blocks[b]->label, &entries[b].entry);
+    }
+
+    for (size_t b = 0; b < count; b++) {
+        fprintf(file, "bb%zu:\n", b);
+        size_t instCount;
+        struct mir_inst *insts = mir_insts(blocks[b], &instCount);
+        for (size_t i = 0; i < instCount; i++) {
+            fputs("    ", file);
+            _mir_printInst(file, &insts[i], &labels);
+        }
+    }
+    free(entries);
+    hashmap_free(&labels);
+}
+
+// Encoder
+
+int _mir_is(struct mir_inst *inst, enum mir_operand_kind a,
+            enum mir_operand_kind b) {
+    return inst->operands[0].kind == a && inst->operands[1].kind == b;
+}
+
+void _mir_encodeMov(dbuffer_t *buffer, struct mir_inst *inst,
+                    int flagsLive) {
+    struct mir_operand *dst = &inst->operands[0], *src = &inst->operands[1];
+    if (_mir_is(inst, MIR_PREG, MIR_PREG)) {
+        if (dst->reg != src->reg)
+            emit_storeReg64(buffer, src->reg, dst->reg);
+    } else if (_mir_is(inst, MIR_PREG, MIR_IMM)) {
+        if (src->imm == 0 && !flagsLive)
+            emit_zeroReg64(buffer, dst->reg);
+        else
+            emit_storeConstShort64(buffer, dst->reg, src->imm);
+    } else if (_mir_is(inst, MIR_PREG, MIR_MEM)) {
+        emit_loadRegMem64(buffer, dst->reg, src->reg, src->imm);
+    } else if (_mir_is(inst, MIR_MEM, MIR_PREG)) {
+        emit_storeMemReg64(buffer, dst->reg, dst->imm, src->reg);
+    } else {
+        assert(0 && "mov operands can't be encoded");
+    }
+}
+
+void _mir_encodeAlu(dbuffer_t *buffer, struct mir_inst *inst) {
+    struct mir_operand *dst = &inst->operands[0], *src = &inst->operands[1];
+    alu_op op = inst->variant;
+    if (_mir_is(inst, MIR_PREG, MIR_PREG)) {
+        emit_aluRegReg64(buffer, op, dst->reg, src->reg);
+    } else if (_mir_is(inst, MIR_PREG, MIR_IMM)) {
+        assert(src->imm >= INT32_MIN && src->imm <= INT32_MAX &&
+               "alu immediate must fit in 32 bits");
+        emit_aluRegImm64(buffer, op, dst->reg, src->imm);
+    } else if (_mir_is(inst, MIR_PREG, MIR_MEM)) {
+        emit_aluRegMem64(buffer, op, dst->reg, src->reg, src->imm);
+    } else if (_mir_is(inst, MIR_MEM, MIR_PREG)) {
+        emit_aluMemReg64(buffer, op, dst->reg, dst->imm, src->reg);
+    } else {
+        assert(0 && "alu operands can't be encoded");
+    }
+}
+
+void _mir_encodeImul(dbuffer_t *buffer, struct mir_inst *inst) {
+    struct mir_operand *dst = &inst->operands[0], *src = &inst->operands[1];
+    assert(dst->kind == MIR_PREG && "imul writes a register");
+    if (inst->operandCount == 3) {
+        assert(src->kind == MIR_PREG && "imul immediate form needs a register");
+        emit_imulRegImm64(buffer, dst->reg, src->reg, inst->operands[2].imm);
+    } else if (src->kind == MIR_PREG) {
+        emit_imulRegReg64(buffer, dst->reg, src->reg);
+    } else {
+        assert(src->kind == MIR_MEM && "imul operands can't be encoded");
+        emit_imulRegMem64(buffer, dst->reg, src->reg, src->imm);
+    }
+}
+
+void _mir_encodeLea(dbuffer_t *buffer, struct mir_inst *inst) {
+    struct mir_operand *dst = &inst->operands[0], *base = &inst->operands[1],
+                       *index = &inst->operands[2];
+    assert(dst->kind == MIR_PREG && base->kind == MIR_PREG &&
+           (index->kind == MIR_PREG || index->kind == MIR_NONE) &&
+           "lea operands can't be encoded");
+    int scale = index->kind == MIR_NONE ? 0 : inst->variant;
+    emit_lea64(buffer, dst->reg, base->reg, index->reg, scale,
+               inst->operands[3].imm);
+}
+
+// @flagsLive tells whether the flags are read before the next write after
+// the instruction.
+void _mir_encodeInst(struct codegen *cg, struct mir_inst *inst,
+                     int flagsLive) {
+    dbuffer_t *buffer = &cg->buffer;
+    struct mir_operand *first = &inst->operands[0];
+    switch (inst->op) {
+    case MIR_MOV:
+        _mir_encodeMov(buffer, inst, flagsLive);
+        break;
+    case MIR_LEA:
+        _mir_encodeLea(buffer, inst);
+        break;
+    case MIR_ALU:
+        _mir_encodeAlu(buffer, inst);
+        break;
+    case MIR_IMUL:
+        _mir_encodeImul(buffer, inst);
+        break;
+    case MIR_UNARY:
+        if (first->kind == MIR_PREG)
+            emit_unaryReg64(buffer, inst->variant, first->reg);
+        else
+            emit_unaryMem64(buffer, inst->variant, first->reg, first->imm);
+        break;
+    case MIR_CQO:
+        emit_cqo(buffer);
+        break;
+    case MIR_TEST:
+        assert(_mir_is(inst, MIR_PREG, MIR_PREG) &&
+               first->reg == inst->operands[1].reg &&
+               "only a register can be tested against itself");
+        emit_checkZero64(buffer, first->reg);
+        break;
+    case MIR_SETCC:
+        assert(first->kind == MIR_PREG && "setcc writes a register");
+        emit_setccReg(buffer, inst->variant, first->reg);
+        emit_zeroExtendReg8(buffer, first->reg);
+        break;
+    case MIR_CMOV: {
+        struct mir_operand *src = &inst->operands[1];
+        assert(first->kind == MIR_PREG && "cmov writes a register");
+        if (src->kind == MIR_PREG)
+            emit_cmovRegReg64(buffer, inst->variant, first->reg, src->reg);
+        else
+            emit_cmovRegMem64(buffer, inst->variant, first->reg, src->reg,
+                              src->imm);
+        break;
+    }
+    case MIR_INC:
+        assert(first->kind == MIR_MEM && "inc takes a memory operand");
+        emit_incMem64(buffer, first->reg, first->imm);
+        break;
+    case MIR_JMP:
+        codegen_jump(cg, first->label);
+        break;
+    case MIR_JCC:
+        codegen_jumpCond(cg, inst->variant, first->label);
+        break;
+    case MIR_CALL:
+        codegen_addLabel(cg, first->label);
+        emit_call(buffer, first->label);
+        break;
+    case MIR_RET:
+        emit_ret(buffer);
+        break;
+    case MIR_PUSH:
+        emit_pushReg(buffer, first->reg);
+        break;
+    case MIR_POP:
+        emit_popReg(buffer, first->reg);
+        break;
+    case MIR_BIND:
+        codegen_addLabel(cg, first->label);
+        label_setPosition(first->label, buffer->usage);
+        break;
+    }
+}
+
+char *mir_flagsLive(struct mir_inst *insts, size_t count) {
+    char *live = dzmalloc(count + 1);
+    int flags = 0;
+    for (size_t i = count; i-- > 0;) {
+        live[i] = flags;
+        unsigned opFlags = kMirOpcodeFlags[insts[i].op];
+        if (opFlags & MIR_WRITES_FLAGS)
+            flags = 0;
+        if (opFlags & MIR_READS_FLAGS)
+            flags = 1;
+    }
+    return live;
+}
+
+void mir_encode(struct mir_function *fn, struct codegen *cg) {
+    size_t count;
+    struct mir_block **blocks = mir_blocks(fn, &count);
+    for (size_t b = 0; b < count; b++) {
+        codegen_pushBlock(cg, blocks[b]->label);
+        size_t instCount;
+        struct mir_inst *insts = mir_insts(blocks[b], &instCount);
+        char *flagsLive = mir_flagsLive(insts, instCount);
+        for (size_t i = 0; i < instCount; i++) {
+            for (size_t o = 0; o < insts[i].operandCount; o++) {
+                enum mir_operand_kind kind = insts[i].operands[o].kind;
+                assert(kind != MIR_VREG && kind != MIR_VMEM &&
+                       "virtual registers must be allocated first");
+            }
+            _mir_encodeInst(cg, &insts[i], flagsLive[i]);
+        }
+        free(flagsLive);
+    }
+}
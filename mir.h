@@ -0,0 +1,234 @@
+// Machine IR, x86_64 instructions over virtual registers. Functions are
+// lowered to it from SSA, registers are allocated on it and it is only
+// encoded at the very end, so passes can still change the code until then.
+#ifndef MIR_H
+#define MIR_H
+
+#include "codegen.h"
+#include "ir.h"
+#include "x86_64.h"
+#include "zone_alloc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Virtual registers are numbered from 1.
+#define MIR_NO_VREG 0
+#define MIR_MAX_OPERANDS 4
+
+// The instructions, operands are in Intel order so the destination comes
+// first: mov dst, src; alu dst, src; imul dst, src[, imm]; unary dst;
+// test a, b; setcc dst (setcc and a zero extension of the byte);
+// cmovcc dst, src; inc mem;
+// lea dst, base, index, disp with the scale of the index as the variant, the
+// index is MIR_NONE when there is none.
+// BIND binds its label operand to the position of the instruction, the
+// variant is 1 for source positions, nothing jumps to those.
+// o(a, name, flags)
+// clang-format off
+#define MIR_OPCODES(o, a)                   \
+    o(a, MOV, 0)                            \
+    o(a, ALU, MIR_WRITES_FLAGS)             \
+    o(a, IMUL, MIR_WRITES_FLAGS)            \
+    o(a, UNARY, MIR_WRITES_FLAGS)           \
+    o(a, CQO, 0)                            \
+    o(a, TEST, MIR_WRITES_FLAGS)            \
+    o(a, SETCC, MIR_READS_FLAGS)            \
+    o(a, CMOV, MIR_READS_FLAGS)             \
+    o(a, INC, MIR_WRITES_FLAGS)             \
+    o(a, LEA, 0)                            \
+    o(a, JMP, MIR_BRANCH)                   \
+    o(a, JCC, MIR_BRANCH | MIR_READS_FLAGS) \
+    o(a, CALL, MIR_WRITES_FLAGS)            \
+    o(a, RET, MIR_BRANCH)                   \
+    o(a, PUSH, 0)                           \
+    o(a, POP, 0)                            \
+    o(a, BIND, 0)
+// clang-format on
+
+#define MIR_COMMA(v) MIR_##v,
+
+#define MIR_WRITES_FLAGS 1
+#define MIR_READS_FLAGS 2
+// Control leaves the instruction somewhere else than the next one.
+#define MIR_BRANCH 4
+
+typedef enum { MIR_OPCODES(FIRST3, MIR_COMMA) } mir_opcode;
+
+extern char *kMirOpcodeNames[];
+extern unsigned kMirOpcodeFlags[];
+
+enum mir_operand_kind {
+    MIR_NONE,
+    // Virtual register, the register allocator replaces it.
+    MIR_VREG,
+    // Machine register, a reg64.
+    MIR_PREG,
+    MIR_IMM,
+    // [base + disp] with a machine base register.
+    MIR_MEM,
+    // [base + disp] with a virtual base register.
+    MIR_VMEM,
+    MIR_LABEL,
+};
+
+struct mir_operand {
+    enum mir_operand_kind kind;
+    // Register of MIR_VREG and MIR_PREG, base of the memory operands.
+    uint32_t reg;
+    // Immediate or displacement.
+    int64_t imm;
+    label_t *label;
+};
+
+struct mir_inst {
+    mir_opcode op;
+    // alu_op, unary_op or cond_code of the instruction, the scale of a lea.
+    // Calls keep the number of arguments in registers, returns whether RAX
+    // holds a value.
+    int variant;
+    size_t operandCount;
+    struct mir_operand operands[MIR_MAX_OPERANDS];
+};
+
+// How an instruction accesses an operand, for memory operands this is the
+// memory itself. The base register of a memory operand is always read.
+#define MIR_USE 1
+#define MIR_DEF 2
+
+struct mir_block {
+    // Bound to the start of the block.
+    label_t *label;
+    // The IR block the code runs for. Code on an edge belongs to the source
+    // of the edge, the argument copies to the entry block.
+    basic_block_t *block;
+    // mir_inst array.
+    dbuffer_t insts;
+    // Machine registers the allocated code writes, as a mask of reg64.
+    unsigned written;
+};
+
+struct mir_function {
+    // mir_block pointers in layout order, a block that doesn't end with a
+    // jmp or ret falls through to the next one.
+    dbuffer_t blocks;
+    // Virtual registers are 1 to vregCount - 1.
+    uint32_t vregCount;
+    // vreg -> stack slot as size_t, 0 if it gets one when it is spilled.
+    dbuffer_t slots;
+    // Slots up to this are taken, spills of registers without a slot get
+    // the ones after it.
+    size_t slotCount;
+    // Highest slot the code uses once registers are allocated.
+    size_t frameSize;
+    zone_allocator zone;
+};
+
+void mir_function_init(struct mir_function *fn);
+void mir_function_free(struct mir_function *fn);
+
+struct mir_block *mir_addBlock(struct mir_function *fn, label_t *label,
+                               basic_block_t *block);
+struct mir_block **mir_blocks(struct mir_function *fn, size_t *count);
+struct mir_inst *mir_insts(struct mir_block *block, size_t *count);
+// A new virtual register that is spilled to @slot, 0 for a slot of its own.
+uint32_t mir_newVreg(struct mir_function *fn, size_t slot);
+// Stack slot of the virtual register, allocates one if it has none.
+size_t mir_slot(struct mir_function *fn, uint32_t vreg);
+
+// Insert @count instructions in front of the one at @index.
+void mir_insert(struct mir_block *block, size_t index, struct mir_inst *insts,
+                size_t count);
+
+struct mir_operand mir_vreg(uint32_t vreg);
+struct mir_operand mir_preg(reg64 reg);
+struct mir_operand mir_imm(int64_t imm);
+struct mir_operand mir_mem(reg64 base, int32_t disp);
+struct mir_operand mir_vmem(uint32_t base, int32_t disp);
+struct mir_operand mir_label(label_t *label);
+// [rbp - 8 * slot]
+struct mir_operand mir_stackSlot(size_t slot);
+
+// Builders, they append to the block.
+void mir_mov(struct mir_block *block, struct mir_operand dst,
+             struct mir_operand src);
+void mir_alu(struct mir_block *block, alu_op op, struct mir_operand dst,
+             struct mir_operand src);
+void mir_imul(struct mir_block *block, struct mir_operand dst,
+              struct mir_operand src);
+// imul dst, src, imm
+void mir_imulImm(struct mir_block *block, struct mir_operand dst,
+                 struct mir_operand src, int32_t imm);
+void mir_unary(struct mir_block *block, unary_op op, struct mir_operand dst);
+void mir_cqo(struct mir_block *block);
+void mir_test(struct mir_block *block, struct mir_operand a,
+              struct mir_operand b);
+void mir_setcc(struct mir_block *block, cond_code cc, struct mir_operand dst);
+void mir_cmov(struct mir_block *block, cond_code cc, struct mir_operand dst,
+              struct mir_operand src);
+void mir_inc(struct mir_block *block, struct mir_operand mem);
+// lea dst, [base + index * scale + disp], @index may be MIR_NONE.
+void mir_lea(struct mir_block *block, struct mir_operand dst,
+             struct mir_operand base, struct mir_operand index, int scale,
+             int32_t disp);
+void mir_jmp(struct mir_block *block, label_t *label);
+void mir_jcc(struct mir_block *block, cond_code cc, label_t *label);
+// The first @argCount argument registers are read, the caller saved
+// registers are clobbered.
+void mir_call(struct mir_block *block, label_t *label, int argCount);
+void mir_ret(struct mir_block *block, int hasValue);
+void mir_push(struct mir_block *block, reg64 reg);
+void mir_pop(struct mir_block *block, reg64 reg);
+void mir_bind(struct mir_block *block, label_t *label);
+// Marks where the code of a source position starts, passes may move it along
+// with the instruction that follows it.
+void mir_bindPosition(struct mir_block *block, label_t *label);
+
+// MIR_USE and MIR_DEF bits of operand @i.
+int mir_operandAccess(struct mir_inst *inst, size_t i);
+// Machine registers the instruction reads or writes without naming them, as
+// masks of reg64.
+unsigned mir_implicitUses(struct mir_inst *inst);
+unsigned mir_implicitDefs(struct mir_inst *inst);
+
+// Machine registers of the operands with an @access bit and the bases of
+// the memory operands when @access has MIR_USE, as a mask of reg64.
+unsigned mir_explicitRegs(struct mir_inst *inst, int access);
+// All machine registers the instruction reads or writes.
+unsigned mir_regUses(struct mir_inst *inst);
+unsigned mir_regDefs(struct mir_inst *inst);
+
+// Mask of the caller saved reg64 registers.
+unsigned mir_callerSaved();
+// Mask of the callee saved reg64 registers, RBP and RSP aren't included.
+unsigned mir_calleeSaved();
+
+// Virtual registers that are live at the block boundaries, bit sets
+// indexed by vreg.
+struct mir_liveness {
+    size_t words;
+    size_t blockCount;
+    // blockCount word arrays each.
+    uint64_t *in;
+    uint64_t *out;
+};
+
+void mir_liveness_compute(struct mir_liveness *live, struct mir_function *fn);
+void mir_liveness_free(struct mir_liveness *live);
+uint64_t *mir_liveIn(struct mir_liveness *live, size_t block);
+uint64_t *mir_liveOut(struct mir_liveness *live, size_t block);
+int mir_isLive(uint64_t *set, uint32_t vreg);
+
+// Whether the flags are live after each of the @count instructions, a
+// dmalloc'ed array. Flags never live across blocks, compares stay in the
+// block of the instruction that reads them.
+char *mir_flagsLive(struct mir_inst *insts, size_t count);
+
+void mir_print(FILE *file, struct mir_function *fn);
+
+// Encode the function to cg->buffer, every virtual register must have been
+// allocated. Jumps are relaxable branches of the codegen. Immediates get
+// their shortest mov and zero is a xor where the flags are dead.
+void mir_encode(struct mir_function *fn, struct codegen *cg);
+
+#endif
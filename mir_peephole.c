@@ -0,0 +1,182 @@
+#include "mir_peephole.h"
+
+#include <string.h>
+
+#define PH_NO_REG -1
+
+// What the pass knows about the machine registers at a point of a block.
+struct _ph_state {
+    // reg64 -> the reg64 it holds a copy of, PH_NO_REG if none.
+    int copyOf[16];
+    // reg64 -> RBP displacement of the stack slot it holds a copy of, only
+    // valid if hasSlot is set.
+    int32_t slot[16];
+    char hasSlot[16];
+};
+
+// Registers the pass may rename and remove the moves to, RSP and RBP are
+// always live.
+unsigned _ph_allocatable() { return mir_callerSaved() | mir_calleeSaved(); }
+
+int _ph_isSlot(struct mir_operand *operand) {
+    return operand->kind == MIR_MEM && operand->reg == RBP;
+}
+
+int _ph_isReg(struct mir_operand *operand) {
+    return operand->kind == MIR_PREG;
+}
+
+// Register that holds the slot at @disp, PH_NO_REG if none does.
+int _ph_slotHolder(struct _ph_state *state, int32_t disp) {
+    for (int r = 0; r < 16; r++) {
+        if (state->hasSlot[r] && state->slot[r] == disp)
+            return r;
+    }
+    return PH_NO_REG;
+}
+
+// The registers of the @defs mask get new values.
+void _ph_kill(struct _ph_state *state, unsigned defs) {
+    for (int r = 0; r < 16; r++) {
+        if (defs & 1u << r) {
+            state->copyOf[r] = PH_NO_REG;
+            state->hasSlot[r] = 0;
+        } else if (state->copyOf[r] != PH_NO_REG &&
+                   defs & 1u << state->copyOf[r]) {
+            state->copyOf[r] = PH_NO_REG;
+        }
+    }
+}
+
+void _ph_killSlot(struct _ph_state *state, int32_t disp) {
+    for (int r = 0; r < 16; r++) {
+        if (state->hasSlot[r] && state->slot[r] == disp)
+            state->hasSlot[r] = 0;
+    }
+}
+
+// Read registers that are a copy of another one read the original instead,
+// so the copy might become dead.
+void _ph_propagate(struct _ph_state *state, struct mir_inst *inst) {
+    for (size_t o = 0; o < inst->operandCount; o++) {
+        struct mir_operand *operand = &inst->operands[o];
+        int read = (_ph_isReg(operand) &&
+                    mir_operandAccess(inst, o) == MIR_USE) ||
+                   operand->kind == MIR_MEM;
+        if (read && state->copyOf[operand->reg] != PH_NO_REG)
+            operand->reg = state->copyOf[operand->reg];
+    }
+}
+
+// Rewrites the instruction with what is known before it and learns from it.
+// Returns 0 if the instruction has no effect.
+int _ph_forward(struct _ph_state *state, struct mir_inst *inst) {
+    _ph_propagate(state, inst);
+    struct mir_operand *dst = &inst->operands[0], *src = &inst->operands[1];
+    int isMov = inst->op == MIR_MOV;
+    if (isMov && _ph_isReg(dst) && _ph_isSlot(src)) {
+        // Reload of a slot some register still holds.
+        int holder = _ph_slotHolder(state, src->imm);
+        if (holder == (int)dst->reg)
+            return 0;
+        if (holder != PH_NO_REG)
+            *src = mir_preg(holder);
+    }
+    if (isMov && _ph_isReg(dst) && _ph_isReg(src) && dst->reg == src->reg)
+        return 0;
+    if (isMov && _ph_isSlot(dst) && _ph_isReg(src) &&
+        state->hasSlot[src->reg] && state->slot[src->reg] == dst->imm)
+        return 0;
+
+    _ph_kill(state, mir_regDefs(inst));
+    for (size_t o = 0; o < inst->operandCount; o++) {
+        struct mir_operand *operand = &inst->operands[o];
+        if (_ph_isSlot(operand) && mir_operandAccess(inst, o) & MIR_DEF)
+            _ph_killSlot(state, operand->imm);
+    }
+    if (!isMov)
+        return 1;
+
+    unsigned allocatable = _ph_allocatable();
+    if (_ph_isReg(dst) && _ph_isReg(src) && allocatable & 1u << dst->reg &&
+        allocatable & 1u << src->reg) {
+        state->copyOf[dst->reg] = src->reg;
+    } else if (_ph_isReg(dst) && _ph_isSlot(src)) {
+        state->hasSlot[dst->reg] = 1;
+        state->slot[dst->reg] = src->imm;
+    } else if (_ph_isSlot(dst) && _ph_isReg(src)) {
+        state->hasSlot[src->reg] = 1;
+        state->slot[src->reg] = dst->imm;
+    }
+    return 1;
+}
+
+// Clears @keep for moves and leas to registers that aren't read before they
+// are written again or the block ends.
+void _ph_deadMoves(struct mir_inst *insts, size_t count, char *keep) {
+    unsigned allocatable = _ph_allocatable();
+    unsigned live = ~allocatable;
+    for (size_t i = count; i-- > 0;) {
+        if (!keep[i])
+            continue;
+        struct mir_inst *inst = &insts[i];
+        struct mir_operand *dst = &inst->operands[0];
+        if ((inst->op == MIR_MOV || inst->op == MIR_LEA) && _ph_isReg(dst) &&
+            !(live & 1u << dst->reg)) {
+            keep[i] = 0;
+            continue;
+        }
+        live = (live & ~mir_regDefs(inst)) | mir_regUses(inst) | ~allocatable;
+    }
+}
+
+void _ph_block(struct mir_block *block) {
+    size_t count;
+    struct mir_inst *insts = mir_insts(block, &count);
+    struct _ph_state state = {};
+    for (int r = 0; r < 16; r++)
+        state.copyOf[r] = PH_NO_REG;
+    char *keep = dmalloc(count + 1);
+    for (size_t i = 0; i < count; i++)
+        keep[i] = _ph_forward(&state, &insts[i]);
+    _ph_deadMoves(insts, count, keep);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (keep[i])
+            insts[kept++] = insts[i];
+    }
+    block->insts.usage = kept * sizeof(struct mir_inst);
+    free(keep);
+}
+
+// Drop a jump to @next, jcc next; jmp other becomes a jcc of the negated
+// condition to other.
+void _ph_fallThrough(struct mir_block *block, struct mir_block *next) {
+    size_t count;
+    struct mir_inst *insts = mir_insts(block, &count);
+    if (!count || insts[count - 1].op != MIR_JMP)
+        return;
+    struct mir_inst *jump = &insts[count - 1];
+    if (jump->operands[0].label == next->label) {
+        block->insts.usage -= sizeof(struct mir_inst);
+        return;
+    }
+    if (count < 2 || jump[-1].op != MIR_JCC ||
+        jump[-1].operands[0].label != next->label)
+        return;
+    // The low bit of a condition code negates it.
+    jump[-1].variant ^= 1;
+    jump[-1].operands[0] = jump->operands[0];
+    block->insts.usage -= sizeof(struct mir_inst);
+}
+
+void mir_peephole(struct mir_function *fn) {
+    size_t count;
+    struct mir_block **blocks = mir_blocks(fn, &count);
+    for (size_t b = 0; b < count; b++) {
+        _ph_block(blocks[b]);
+        if (b + 1 < count)
+            _ph_fallThrough(blocks[b], blocks[b + 1]);
+    }
+}
@@ -0,0 +1,14 @@
+// Peephole optimizations on allocated machine IR. The local allocator
+// stores everything that is live at the end of a block and reloads it in the
+// next one, the pass forwards those stores to the loads, propagates copies,
+// removes the moves that became dead and the jumps to the next block.
+#ifndef MIR_PEEPHOLE_H
+#define MIR_PEEPHOLE_H
+
+#include "mir.h"
+
+// Runs between register allocation and the frame: machine registers must
+// not be live across blocks, and only RBP may address the stack slots.
+void mir_peephole(struct mir_function *fn);
+
+#endif
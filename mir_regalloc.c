@@ -0,0 +1,364 @@
+#include "mir_regalloc.h"
+#include "x86_64_codegen.h"
+
+#include <assert.h>
+#include <string.h>
+
+#define RA_NO_REG -1
+
+struct _ra {
+    struct mir_function *fn;
+    int registerCount;
+    // reg64 -> allocator id, RA_NO_REG for registers we don't allocate.
+    int ids[16];
+    // Allocatable registers as a mask of reg64.
+    unsigned allocatable;
+    // Allocator id -> vreg, MIR_NO_VREG when free.
+    uint32_t held[ARCH_REGISTERS];
+    // The register is newer than the stack slot.
+    char dirty[ARCH_REGISTERS];
+    // Last instruction that touched the register, for LRU eviction.
+    size_t stamp[ARCH_REGISTERS];
+    // vreg -> allocator id or RA_NO_REG.
+    int *location;
+    // Machine registers written by the code keep their value until this
+    // instruction, they can't be handed out before. -1 if they aren't busy.
+    long busyUntil[16];
+
+    // Instructions of the current block before and after allocation.
+    struct mir_inst *insts;
+    size_t count;
+    dbuffer_t out;
+    // Current instruction.
+    size_t index;
+};
+
+void _ra_emit(struct _ra *ra, struct mir_inst *inst) {
+    dbuffer_pushData(&ra->out, inst, sizeof(*inst));
+}
+
+struct mir_operand _ra_slot(struct _ra *ra, uint32_t vreg) {
+    size_t slot = mir_slot(ra->fn, vreg);
+    if (slot > ra->fn->frameSize)
+        ra->fn->frameSize = slot;
+    return mir_stackSlot(slot);
+}
+
+void _ra_mov(struct _ra *ra, struct mir_operand dst, struct mir_operand src) {
+    struct mir_inst inst = {MIR_MOV, 0, 2, {dst, src}};
+    _ra_emit(ra, &inst);
+}
+
+void _ra_assign(struct _ra *ra, int id, uint32_t vreg, int dirty) {
+    ra->held[id] = vreg;
+    ra->dirty[id] = dirty;
+    ra->stamp[id] = ra->index;
+    ra->location[vreg] = id;
+}
+
+void _ra_free(struct _ra *ra, int id) {
+    ra->location[ra->held[id]] = RA_NO_REG;
+    ra->held[id] = MIR_NO_VREG;
+    ra->dirty[id] = 0;
+}
+
+void _ra_store(struct _ra *ra, int id) {
+    if (!ra->dirty[id])
+        return;
+    _ra_mov(ra, _ra_slot(ra, ra->held[id]), mir_preg(arch_realReg(id)));
+    ra->dirty[id] = 0;
+}
+
+// A free register outside of @exclude, the least recently used one is
+// evicted if there is none and @evict is set.
+int _ra_pick(struct _ra *ra, unsigned exclude, int evict) {
+    int victim = RA_NO_REG;
+    for (int id = 0; id < ra->registerCount; id++) {
+        if (exclude & 1u << arch_realReg(id))
+            continue;
+        if (!ra->held[id])
+            return id;
+        if (victim == RA_NO_REG || ra->stamp[id] < ra->stamp[victim])
+            victim = id;
+    }
+    if (!evict)
+        return RA_NO_REG;
+    assert(victim != RA_NO_REG && "no register left to allocate");
+    _ra_store(ra, victim);
+    _ra_free(ra, victim);
+    return victim;
+}
+
+// Last read of the machine register after @from before it is written
+// again, -1 if there is none.
+long _ra_lastUse(struct _ra *ra, long from, reg64 reg) {
+    long last = -1;
+    for (size_t j = from + 1; j < ra->count; j++) {
+        if (mir_regUses(&ra->insts[j]) & 1u << reg)
+            last = j;
+        if (mir_regDefs(&ra->insts[j]) & 1u << reg)
+            break;
+    }
+    return last;
+}
+
+unsigned _ra_busy(struct _ra *ra) {
+    unsigned result = 0;
+    for (int r = 0; r < 16; r++) {
+        if (ra->busyUntil[r] >= (long)ra->index)
+            result |= 1u << r;
+    }
+    return result;
+}
+
+// vreg the operand reads, MIR_NO_VREG if it reads none.
+uint32_t _ra_usedVreg(struct mir_inst *inst, size_t o) {
+    struct mir_operand *operand = &inst->operands[o];
+    if (operand->kind == MIR_VMEM)
+        return operand->reg;
+    if (operand->kind == MIR_VREG && mir_operandAccess(inst, o) & MIR_USE)
+        return operand->reg;
+    return MIR_NO_VREG;
+}
+
+int _ra_isDefined(struct mir_inst *inst, uint32_t vreg) {
+    for (size_t o = 0; o < inst->operandCount; o++) {
+        struct mir_operand *operand = &inst->operands[o];
+        if (operand->kind == MIR_VREG && operand->reg == vreg &&
+            mir_operandAccess(inst, o) & MIR_DEF)
+            return 1;
+    }
+    return 0;
+}
+
+// Which operands hold a vreg that isn't live after their instruction.
+char *_ra_deaths(struct _ra *ra, uint64_t *liveOut, size_t words) {
+    char *dies = dzmalloc(ra->count * MIR_MAX_OPERANDS + 1);
+    uint64_t *live = dmalloc(sizeof(uint64_t) * (words + 1));
+    memcpy(live, liveOut, sizeof(uint64_t) * words);
+    for (size_t i = ra->count; i-- > 0;) {
+        struct mir_inst *inst = &ra->insts[i];
+        for (size_t o = 0; o < inst->operandCount; o++) {
+            struct mir_operand *operand = &inst->operands[o];
+            if (operand->kind == MIR_VREG || operand->kind == MIR_VMEM)
+                dies[i * MIR_MAX_OPERANDS + o] =
+                    !mir_isLive(live, operand->reg);
+        }
+        for (size_t o = 0; o < inst->operandCount; o++) {
+            struct mir_operand *operand = &inst->operands[o];
+            if (operand->kind == MIR_VREG &&
+                mir_operandAccess(inst, o) == MIR_DEF)
+                live[operand->reg / 64] &= ~(1ull << (operand->reg % 64));
+        }
+        for (size_t o = 0; o < inst->operandCount; o++) {
+            uint32_t vreg = _ra_usedVreg(inst, o);
+            if (vreg)
+                live[vreg / 64] |= 1ull << (vreg % 64);
+        }
+    }
+    free(live);
+    return dies;
+}
+
+// The machine registers the instruction writes lose their vregs, the ones
+// that are still needed move to a free register or get stored.
+void _ra_clobber(struct _ra *ra, struct mir_inst *inst, char *dies,
+                 unsigned exclude) {
+    unsigned defs = mir_regDefs(inst) & ra->allocatable;
+    for (int r = 0; r < 16; r++) {
+        int id = ra->ids[r];
+        if (!(defs & 1u << r) || !ra->held[id])
+            continue;
+        uint32_t vreg = ra->held[id];
+        // Read before it is written, and not needed after.
+        int dying = 0;
+        for (size_t o = 0; o < inst->operandCount; o++)
+            dying |= _ra_usedVreg(inst, o) == vreg && dies[o];
+        if (dying && !_ra_isDefined(inst, vreg))
+            continue;
+
+        int to = _ra_pick(ra, exclude | defs, 0);
+        if (to == RA_NO_REG) {
+            _ra_store(ra, id);
+            _ra_free(ra, id);
+            continue;
+        }
+        _ra_mov(ra, mir_preg(arch_realReg(to)), mir_preg(r));
+        int dirty = ra->dirty[id];
+        _ra_free(ra, id);
+        _ra_assign(ra, to, vreg, dirty);
+    }
+}
+
+void _ra_instruction(struct _ra *ra, struct mir_inst *original, char *dies) {
+    struct mir_inst inst = *original;
+    unsigned fixed = mir_explicitRegs(&inst, MIR_USE | MIR_DEF) |
+                     mir_implicitUses(&inst) | mir_implicitDefs(&inst);
+    unsigned exclude = fixed | _ra_busy(ra);
+    _ra_clobber(ra, &inst, dies, exclude);
+
+    // Reads, the registers stay pinned for the whole instruction.
+    unsigned pinned = 0;
+    for (size_t o = 0; o < inst.operandCount; o++) {
+        uint32_t vreg = _ra_usedVreg(&inst, o);
+        if (!vreg)
+            continue;
+        int id = ra->location[vreg];
+        if (id == RA_NO_REG && inst.op == MIR_MOV && o == 1 && dies[o] &&
+            inst.operands[0].kind == MIR_PREG) {
+            // Straight from the slot to the machine register.
+            inst.operands[1] = _ra_slot(ra, vreg);
+            continue;
+        }
+        if (id == RA_NO_REG) {
+            id = _ra_pick(ra, exclude | pinned, 1);
+            _ra_mov(ra, mir_preg(arch_realReg(id)), _ra_slot(ra, vreg));
+            _ra_assign(ra, id, vreg, 0);
+        }
+        ra->stamp[id] = ra->index;
+        pinned |= 1u << arch_realReg(id);
+        struct mir_operand *operand = &inst.operands[o];
+        operand->kind = operand->kind == MIR_VMEM ? MIR_MEM : MIR_PREG;
+        operand->reg = arch_realReg(id);
+    }
+
+    // Registers of reads that die here can take the result.
+    for (size_t o = 0; o < original->operandCount; o++) {
+        uint32_t vreg = _ra_usedVreg(original, o);
+        if (vreg && dies[o] && !_ra_isDefined(original, vreg) &&
+            ra->location[vreg] != RA_NO_REG) {
+            pinned &= ~(1u << arch_realReg(ra->location[vreg]));
+            _ra_free(ra, ra->location[vreg]);
+        }
+    }
+
+    // Writes, a read and written operand already has its register.
+    for (size_t o = 0; o < inst.operandCount; o++) {
+        struct mir_operand *operand = &inst.operands[o];
+        int access = mir_operandAccess(&inst, o);
+        if (original->operands[o].kind != MIR_VREG || !(access & MIR_DEF))
+            continue;
+        uint32_t vreg = original->operands[o].reg;
+        int id = ra->location[vreg];
+        if (access == MIR_DEF && inst.op == MIR_MOV &&
+            inst.operands[1].kind == MIR_PREG) {
+            // A copy out of a register nobody needs anymore is a rename.
+            reg64 src = inst.operands[1].reg;
+            int srcId = ra->ids[src];
+            if (srcId != RA_NO_REG && !ra->held[srcId] &&
+                ra->busyUntil[src] <= (long)ra->index) {
+                if (id != RA_NO_REG)
+                    _ra_free(ra, id);
+                _ra_assign(ra, srcId, vreg, 1);
+                ra->busyUntil[src] = -1;
+                if (dies[o])
+                    _ra_free(ra, srcId);
+                return;
+            }
+        }
+        if (id == RA_NO_REG) {
+            id = _ra_pick(ra, exclude | pinned, 1);
+            _ra_assign(ra, id, vreg, 1);
+        }
+        ra->dirty[id] = 1;
+        ra->stamp[id] = ra->index;
+        pinned |= 1u << arch_realReg(id);
+        operand->kind = MIR_PREG;
+        operand->reg = arch_realReg(id);
+    }
+    _ra_emit(ra, &inst);
+
+    // Results nobody reads.
+    for (size_t o = 0; o < original->operandCount; o++) {
+        struct mir_operand *operand = &original->operands[o];
+        if (operand->kind == MIR_VREG && dies[o] &&
+            mir_operandAccess(original, o) & MIR_DEF &&
+            ra->location[operand->reg] != RA_NO_REG)
+            _ra_free(ra, ra->location[operand->reg]);
+    }
+    unsigned defs = mir_regDefs(&inst);
+    for (int r = 0; r < 16; r++) {
+        if (defs & 1u << r)
+            ra->busyUntil[r] = _ra_lastUse(ra, ra->index, r);
+    }
+}
+
+// Store everything that is dirty, whatever is still in a register is live
+// out of the block.
+void _ra_flush(struct _ra *ra) {
+    for (int id = 0; id < ra->registerCount; id++) {
+        if (ra->held[id])
+            _ra_store(ra, id);
+    }
+}
+
+unsigned _ra_written(struct mir_block *block) {
+    size_t count;
+    struct mir_inst *insts = mir_insts(block, &count);
+    unsigned result = 0;
+    for (size_t i = 0; i < count; i++)
+        result |= mir_explicitRegs(&insts[i], MIR_DEF) |
+                  mir_implicitDefs(&insts[i]);
+    return result;
+}
+
+void _ra_block(struct _ra *ra, struct mir_block *block, uint64_t *liveOut,
+               size_t words) {
+    ra->insts = mir_insts(block, &ra->count);
+    dbuffer_init(&ra->out);
+    for (int id = 0; id < ra->registerCount; id++)
+        ra->held[id] = MIR_NO_VREG;
+    // Registers that are read before they are written come from the code
+    // before the block, like the arguments.
+    for (int r = 0; r < 16; r++)
+        ra->busyUntil[r] = _ra_lastUse(ra, -1, r);
+
+    // Branches at the end don't touch vregs, the stores go in front of them.
+    size_t flushAt = ra->count;
+    while (flushAt > 0 &&
+           kMirOpcodeFlags[ra->insts[flushAt - 1].op] & MIR_BRANCH)
+        flushAt--;
+
+    char *dies = _ra_deaths(ra, liveOut, words);
+    for (size_t i = 0; i < ra->count; i++) {
+        ra->index = i;
+        if (i == flushAt)
+            _ra_flush(ra);
+        _ra_instruction(ra, &ra->insts[i], dies + i * MIR_MAX_OPERANDS);
+    }
+    if (flushAt == ra->count)
+        _ra_flush(ra);
+    for (int id = 0; id < ra->registerCount; id++) {
+        if (ra->held[id])
+            _ra_free(ra, id);
+    }
+    free(dies);
+
+    dbuffer_free(&block->insts);
+    block->insts = ra->out;
+    block->written = _ra_written(block);
+}
+
+void mir_allocate(struct mir_function *fn, int registerCount) {
+    assert(registerCount <= ARCH_REGISTERS && "too many registers");
+    struct _ra ra = {.fn = fn, .registerCount = registerCount};
+    for (int r = 0; r < 16; r++)
+        ra.ids[r] = RA_NO_REG;
+    for (int id = 0; id < registerCount; id++) {
+        ra.ids[arch_realReg(id)] = id;
+        ra.allocatable |= 1u << arch_realReg(id);
+    }
+    ra.location = dmalloc(sizeof(int) * fn->vregCount);
+    for (uint32_t v = 0; v < fn->vregCount; v++)
+        ra.location[v] = RA_NO_REG;
+
+    struct mir_liveness live;
+    mir_liveness_compute(&live, fn);
+    fn->frameSize = 0;
+    size_t count;
+    struct mir_block **blocks = mir_blocks(fn, &count);
+    for (size_t b = 0; b < count; b++)
+        _ra_block(&ra, blocks[b], mir_liveOut(&live, b), live.words);
+    mir_liveness_free(&live);
+    free(ra.location);
+}
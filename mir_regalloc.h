@@ -0,0 +1,15 @@
+// Local register allocation on machine IR. Every block starts with the
+// virtual registers in their stack slots, they are loaded when used and only
+// stored when they are evicted dirty or are still live at the end of the
+// block.
+#ifndef MIR_REGALLOC_H
+#define MIR_REGALLOC_H
+
+#include "mir.h"
+
+// Replace the virtual registers of @fn with the machine registers of the
+// allocator ids 0 to @registerCount - 1. Fills in block->written and
+// fn->frameSize.
+void mir_allocate(struct mir_function *fn, int registerCount);
+
+#endif
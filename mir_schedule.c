@@ -0,0 +1,390 @@
+#include "mir_schedule.h"
+
+#include <string.h>
+
+// Regions are cut after this many instructions, the dependencies are
+// computed pairwise.
+#define SC_WINDOW 128
+// Instructions the core starts per cycle.
+#define SC_ISSUE_WIDTH 4
+#define SC_LOAD_LATENCY 4
+#define SC_NO_UNIT ((size_t)-1)
+
+// Execution ports of a Skylake-like core.
+#define SC_PORT(n) (1u << (n))
+#define SC_ALU (SC_PORT(0) | SC_PORT(1) | SC_PORT(5) | SC_PORT(6))
+#define SC_LOAD (SC_PORT(2) | SC_PORT(3))
+#define SC_STORE SC_PORT(4)
+
+// Cycles until the result of an instruction can be used and the ports it
+// can start on.
+struct _sc_model {
+    int latency;
+    unsigned ports;
+};
+
+// What an instruction reads and writes.
+struct _sc_info {
+    // Keys of the virtual registers, see _sc_key.
+    uint64_t uses[MIR_MAX_OPERANDS];
+    uint64_t defs[MIR_MAX_OPERANDS];
+    size_t useCount, defCount;
+    // Machine registers as masks of reg64.
+    unsigned regUses, regDefs;
+    // MIR_USE and MIR_DEF bits of the memory operands.
+    int memory;
+    // MIR_READS_FLAGS and MIR_WRITES_FLAGS of the opcode.
+    unsigned flags;
+    // Whether the flags the instruction writes are read later.
+    int flagsLive;
+    struct _sc_model model;
+};
+
+// Source positions move with the instruction that follows them.
+int _sc_isPosition(struct mir_inst *inst) {
+    return inst->op == MIR_BIND && inst->variant;
+}
+
+// Instructions that stay in place, the regions are between them.
+int _sc_isBarrier(struct mir_inst *inst) {
+    return kMirOpcodeFlags[inst->op] & MIR_BRANCH || inst->op == MIR_CALL ||
+           (inst->op == MIR_BIND && !_sc_isPosition(inst));
+}
+
+// Virtual registers that share a stack slot are never live at once, but
+// reordering them would let their spills overwrite each other, so they are
+// one resource for the dependencies.
+uint64_t _sc_key(struct mir_function *fn, uint32_t vreg) {
+    size_t *slots = fn->slots.buffer;
+    return slots[vreg] ? slots[vreg] : 1ull << 32 | vreg;
+}
+
+struct _sc_model _sc_model(struct mir_inst *inst, int memory) {
+    struct _sc_model model = {1, SC_ALU};
+    switch (inst->op) {
+    case MIR_IMUL:
+        model = (struct _sc_model){3, SC_PORT(1)};
+        break;
+    case MIR_UNARY:
+        if (inst->variant == UNARY_MUL || inst->variant == UNARY_IMUL)
+            model = (struct _sc_model){3, SC_PORT(1)};
+        if (inst->variant == UNARY_DIV || inst->variant == UNARY_IDIV)
+            model = (struct _sc_model){40, SC_PORT(0)};
+        break;
+    case MIR_SETCC:
+    case MIR_CMOV:
+        model.ports = SC_PORT(0) | SC_PORT(6);
+        break;
+    case MIR_LEA:
+        model.ports = SC_PORT(1) | SC_PORT(5);
+        break;
+    case MIR_BIND:
+        // Labels emit no code.
+        model = (struct _sc_model){0, 0};
+        break;
+    default:
+        break;
+    }
+    if (memory & MIR_USE)
+        model.latency += SC_LOAD_LATENCY;
+    if (inst->op == MIR_MOV && memory)
+        model.ports = memory & MIR_DEF ? SC_STORE : SC_LOAD;
+    return model;
+}
+
+void _sc_info(struct mir_function *fn, struct mir_inst *inst, int flagsLive,
+              struct _sc_info *info) {
+    *info = (struct _sc_info){};
+    for (size_t o = 0; o < inst->operandCount; o++) {
+        struct mir_operand *operand = &inst->operands[o];
+        int access = mir_operandAccess(inst, o);
+        if (operand->kind == MIR_MEM || operand->kind == MIR_VMEM)
+            info->memory |= access;
+        if (operand->kind == MIR_VMEM)
+            info->uses[info->useCount++] = _sc_key(fn, operand->reg);
+        if (operand->kind != MIR_VREG)
+            continue;
+        if (access & MIR_USE)
+            info->uses[info->useCount++] = _sc_key(fn, operand->reg);
+        if (access & MIR_DEF)
+            info->defs[info->defCount++] = _sc_key(fn, operand->reg);
+    }
+    info->regUses = mir_regUses(inst);
+    info->regDefs = mir_regDefs(inst);
+    info->flags = kMirOpcodeFlags[inst->op];
+    info->flagsLive = flagsLive;
+    info->model = _sc_model(inst, info->memory);
+}
+
+int _sc_intersects(uint64_t *a, size_t aCount, uint64_t *b, size_t bCount) {
+    for (size_t i = 0; i < aCount; i++) {
+        for (size_t j = 0; j < bCount; j++) {
+            if (a[i] == b[j])
+                return 1;
+        }
+    }
+    return 0;
+}
+
+// Cycles @later waits for @earlier, -1 if they can be reordered.
+int _sc_dependency(struct _sc_info *earlier, struct _sc_info *later) {
+    int reads = _sc_intersects(earlier->defs, earlier->defCount, later->uses,
+                               later->useCount) ||
+                earlier->regDefs & later->regUses ||
+                (earlier->memory & MIR_DEF && later->memory) ||
+                (earlier->flags & MIR_WRITES_FLAGS &&
+                 later->flags & MIR_READS_FLAGS);
+    if (reads)
+        return earlier->model.latency;
+    // A writer of live flags also stays after the earlier writers, or its
+    // reader would see theirs.
+    int writes = _sc_intersects(earlier->uses, earlier->useCount,
+                                later->defs, later->defCount) ||
+                 _sc_intersects(earlier->defs, earlier->defCount,
+                                later->defs, later->defCount) ||
+                 earlier->regUses & later->regDefs ||
+                 earlier->regDefs & later->regDefs ||
+                 (earlier->memory && later->memory & MIR_DEF) ||
+                 (earlier->flags & MIR_READS_FLAGS &&
+                  later->flags & MIR_WRITES_FLAGS) ||
+                 (earlier->flags & MIR_WRITES_FLAGS &&
+                  later->flags & MIR_WRITES_FLAGS && later->flagsLive);
+    return writes ? 0 : -1;
+}
+
+// Marks the ports the @count instructions take in @used, returns 0 if one
+// of them finds all of its ports taken.
+int _sc_takePorts(unsigned *used, struct _sc_info *infos, size_t count) {
+    unsigned ports = *used;
+    for (size_t i = 0; i < count; i++) {
+        if (!infos[i].model.ports)
+            continue;
+        unsigned free = infos[i].model.ports & ~ports;
+        if (!free)
+            return 0;
+        ports |= free & -free;
+    }
+    *used = ports;
+    return 1;
+}
+
+// Instructions that keep a machine register busy between them stay
+// together, moving them apart would take the register away from the
+// allocator for longer. The units of a region are scheduled as a whole.
+struct _sc_region {
+    struct _sc_info *infos;
+    size_t count;
+    size_t unitCount;
+    // unitCount + 1 offsets of the first instruction of each unit.
+    size_t *units;
+    // unitCount * unitCount latencies of the edges, -1 for none.
+    int *edges;
+    int *heights;
+};
+
+// Instructions of the unit @u that take an issue slot.
+size_t _sc_issued(struct _sc_region *region, size_t u) {
+    size_t count = 0;
+    for (size_t i = region->units[u]; i < region->units[u + 1]; i++)
+        count += region->infos[i].model.ports != 0;
+    return count;
+}
+
+int *_sc_edge(struct _sc_region *region, size_t from, size_t to) {
+    return &region->edges[from * region->unitCount + to];
+}
+
+void _sc_edges(struct _sc_region *region) {
+    size_t n = region->unitCount;
+    region->edges = dmalloc(sizeof(int) * (n * n + 1));
+    memset(region->edges, -1, sizeof(int) * n * n);
+    for (size_t u = 0; u < n; u++) {
+        for (size_t v = u + 1; v < n; v++) {
+            int *edge = _sc_edge(region, u, v);
+            for (size_t j = region->units[u]; j < region->units[u + 1]; j++) {
+                for (size_t i = region->units[v]; i < region->units[v + 1];
+                     i++) {
+                    int latency = _sc_dependency(&region->infos[j],
+                                                 &region->infos[i]);
+                    if (latency < 0)
+                        continue;
+                    // Units issue one instruction per cycle.
+                    latency += (int)(j - region->units[u]) -
+                               (int)(i - region->units[v]);
+                    if (latency < 0)
+                        latency = 0;
+                    if (latency > *edge)
+                        *edge = latency;
+                }
+            }
+        }
+    }
+}
+
+// Length of the critical path from the start of each unit to the end of
+// the region.
+void _sc_heights(struct _sc_region *region) {
+    size_t n = region->unitCount;
+    region->heights = dmalloc(sizeof(int) * (n + 1));
+    for (size_t u = n; u-- > 0;) {
+        int height = 0;
+        for (size_t i = region->units[u]; i < region->units[u + 1]; i++) {
+            int end = (i - region->units[u]) + region->infos[i].model.latency;
+            if (end > height)
+                height = end;
+        }
+        for (size_t v = u + 1; v < n; v++) {
+            int edge = *_sc_edge(region, u, v);
+            if (edge >= 0 && edge + region->heights[v] > height)
+                height = edge + region->heights[v];
+        }
+        region->heights[u] = height;
+    }
+}
+
+// Cycle by cycle list scheduling, the ready unit with the longest path to
+// the end goes first, ties keep the original order. Fills @order with the
+// units in their new order.
+void _sc_list(struct _sc_region *region, size_t *order) {
+    size_t n = region->unitCount;
+    size_t *pending = dzmalloc(sizeof(size_t) * (n + 1));
+    int *readyAt = dzmalloc(sizeof(int) * (n + 1));
+    char *done = dzmalloc(n + 1);
+    for (size_t u = 0; u < n; u++) {
+        for (size_t v = u + 1; v < n; v++)
+            pending[v] += *_sc_edge(region, u, v) >= 0;
+    }
+
+    size_t scheduled = 0;
+    for (int cycle = 0; scheduled < n; cycle++) {
+        size_t issued = 0;
+        unsigned ports = 0;
+        for (;;) {
+            size_t best = SC_NO_UNIT;
+            unsigned bestPorts = 0;
+            for (size_t u = 0; u < n; u++) {
+                if (done[u] || pending[u] || readyAt[u] > cycle)
+                    continue;
+                if (best != SC_NO_UNIT &&
+                    region->heights[u] <= region->heights[best])
+                    continue;
+                size_t size = region->units[u + 1] - region->units[u];
+                unsigned taken = ports;
+                int fits = _sc_takePorts(
+                    &taken, &region->infos[region->units[u]], size);
+                size = _sc_issued(region, u);
+                // An empty cycle takes any unit, even one that is too big.
+                if (issued && (issued + size > SC_ISSUE_WIDTH || !fits))
+                    continue;
+                best = u;
+                bestPorts = taken;
+            }
+            if (best == SC_NO_UNIT)
+                break;
+            done[best] = 1;
+            order[scheduled++] = best;
+            issued += _sc_issued(region, best);
+            ports = bestPorts;
+            for (size_t v = best + 1; v < n; v++) {
+                int edge = *_sc_edge(region, best, v);
+                if (edge < 0)
+                    continue;
+                pending[v]--;
+                if (cycle + edge > readyAt[v])
+                    readyAt[v] = cycle + edge;
+            }
+        }
+    }
+    free(pending);
+    free(readyAt);
+    free(done);
+}
+
+// Schedules the instructions @start to @end of the block. @tied tells
+// whether an instruction and the next one belong to the same unit.
+void _sc_schedule(struct mir_inst *insts, struct _sc_info *infos,
+                  char *tied, size_t start, size_t end) {
+    // Units that hold a register from or into the barriers stay in place.
+    while (start < end && start && tied[start - 1])
+        start++;
+    while (end > start && tied[end - 1])
+        end--;
+    if (end - start < 2)
+        return;
+
+    struct _sc_region region = {.infos = infos + start,
+                                .count = end - start,
+                                .unitCount = 0,
+                                .units = NULL,
+                                .edges = NULL,
+                                .heights = NULL};
+    region.units = dmalloc(sizeof(size_t) * (region.count + 1));
+    for (size_t i = 0; i < region.count; i++) {
+        if (!i || !tied[start + i - 1])
+            region.units[region.unitCount++] = i;
+    }
+    region.units[region.unitCount] = region.count;
+    _sc_edges(&region);
+    _sc_heights(&region);
+    size_t *order = dmalloc(sizeof(size_t) * (region.unitCount + 1));
+    _sc_list(&region, order);
+
+    struct mir_inst *scheduled =
+        dmalloc(sizeof(struct mir_inst) * region.count);
+    size_t count = 0;
+    for (size_t k = 0; k < region.unitCount; k++) {
+        size_t u = order[k];
+        for (size_t i = region.units[u]; i < region.units[u + 1]; i++)
+            scheduled[count++] = insts[start + i];
+    }
+    memcpy(insts + start, scheduled, sizeof(struct mir_inst) * count);
+
+    free(scheduled);
+    free(order);
+    free(region.heights);
+    free(region.edges);
+    free(region.units);
+}
+
+void _sc_block(struct mir_function *fn, struct mir_block *block) {
+    size_t count;
+    struct mir_inst *insts = mir_insts(block, &count);
+    char *flagsLive = mir_flagsLive(insts, count);
+    struct _sc_info *infos = dmalloc(sizeof(struct _sc_info) * (count + 1));
+    for (size_t i = 0; i < count; i++)
+        _sc_info(fn, &insts[i], flagsLive[i], &infos[i]);
+
+    // A machine register that is live between two instructions ties them,
+    // a source position is tied to the instruction it marks.
+    unsigned allocatable = mir_callerSaved() | mir_calleeSaved();
+    char *tied = dzmalloc(count + 1);
+    unsigned live = 0;
+    for (size_t i = count; i-- > 0;) {
+        tied[i] = (live & allocatable) != 0 || _sc_isPosition(&insts[i]);
+        live = (live & ~infos[i].regDefs) | infos[i].regUses;
+    }
+
+    size_t i = 0;
+    while (i < count) {
+        if (_sc_isBarrier(&insts[i])) {
+            i++;
+            continue;
+        }
+        size_t end = i;
+        while (end < count && !_sc_isBarrier(&insts[end]) &&
+               (end - i < SC_WINDOW || tied[end - 1]))
+            end++;
+        _sc_schedule(insts, infos, tied, i, end);
+        i = end;
+    }
+    free(tied);
+    free(infos);
+    free(flagsLive);
+}
+
+void mir_schedule(struct mir_function *fn) {
+    size_t count;
+    struct mir_block **blocks = mir_blocks(fn, &count);
+    for (size_t b = 0; b < count; b++)
+        _sc_block(fn, blocks[b]);
+}
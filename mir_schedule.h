@@ -0,0 +1,15 @@
+// List scheduling of machine IR before register allocation. Blocks are
+// split into regions at calls, labels and branches, and the instructions of a
+// region are reordered along their dependencies so that long latency
+// instructions like imul and idiv start as early as possible. Source
+// positions move with the instruction they mark.
+#ifndef MIR_SCHEDULE_H
+#define MIR_SCHEDULE_H
+
+#include "mir.h"
+
+// Reorder the instructions of every block of @fn, registers must still be
+// virtual.
+void mir_schedule(struct mir_function *fn);
+
+#endif
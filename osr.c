@@ -0,0 +1,205 @@
+#include "osr.h"
+#include "format.h"
+
+#include <assert.h>
+
+struct _osr_cloner {
+    ir_context_t *ctx;
+    function_t *fn;
+    // Original value -> copy, for instructions and blocks.
+    hashmap_t values;
+    zone_allocator zone;
+};
+
+int _osr_canClone(basic_block_t *block) {
+    hashset_t defined;
+    hashset_init(&defined, ptrKeyType);
+    int result = 1;
+
+    LIST_FOR_EACH(&block->instructions) {
+        instruction_t *inst = containerof(c, instruction_t, inst_list);
+        if (inst->type == INST_PHI) {
+            result = 0;
+            break;
+        }
+        size_t count;
+        use_t **uses = inst_getUses(inst, &count);
+        for (size_t i = 0; i < count; i++) {
+            value_t *value = uses[i]->value;
+            if (value->type == INST && !hashset_existsPtr(&defined, value))
+                result = 0;
+        }
+        hashset_insertPtr(&defined, &inst->value);
+    }
+
+    hashset_free(&defined);
+    return result;
+}
+
+// Collect the blocks reachable from @header, returns 0 if one of them can't
+// be copied.
+int _osr_collect(basic_block_t *header, dbuffer_t *blocks) {
+    hashset_t seen;
+    hashset_init(&seen, ptrKeyType);
+    hashset_insertPtr(&seen, header);
+    dbuffer_pushPtr(blocks, header);
+
+    int result = 1;
+    for (size_t i = 0; result && i < blocks->usage / sizeof(void *); i++) {
+        basic_block_t *block = ((basic_block_t **)blocks->buffer)[i];
+        result = _osr_canClone(block);
+
+        struct block_successor_it it = block_successor_begin(block);
+        for (; !block_successor_end(it); it = block_successor_next(it)) {
+            basic_block_t *succ = block_successor_get(it);
+            if (hashset_insertPtr(&seen, succ))
+                dbuffer_pushPtr(blocks, succ);
+        }
+    }
+
+    hashset_free(&seen);
+    return result;
+}
+
+void _osr_setCopy(struct _osr_cloner *cl, value_t *value, value_t *copy) {
+    struct hm_bucket_pointer *entry =
+        znnew(&cl->zone, struct hm_bucket_pointer);
+    entry->pointer = copy;
+    hashmap_setPtr(&cl->values, value, &entry->entry);
+}
+
+value_t *_osr_map(struct _osr_cloner *cl, value_t *value) {
+    switch (value->type) {
+    case ARGUMENT: {
+        size_t index = containerof(value, value_argument_t, value)->index;
+        return &cl->fn->arguments[index].value;
+    }
+    case INST:
+    case V_BLOCK: {
+        struct hm_bucket_entry *entry = hashmap_getPtr(&cl->values, value);
+        assert(entry && "value is not copied yet");
+        return containerof(entry, struct hm_bucket_pointer, entry)->pointer;
+    }
+    default:
+        // Constants and functions are shared.
+        return value;
+    }
+}
+
+basic_block_t *_osr_mapBlock(struct _osr_cloner *cl, basic_block_t *block) {
+    return containerof(_osr_map(cl, &block->value), basic_block_t, value);
+}
+
+basic_block_t *_osr_target(struct _osr_cloner *cl, use_t *use) {
+    return _osr_mapBlock(cl, containerof(use->value, basic_block_t, value));
+}
+
+instruction_t *_osr_cloneInst(struct _osr_cloner *cl, instruction_t *inst) {
+    ir_context_t *ctx = cl->ctx;
+    switch (inst->type) {
+    case INST_LOAD_VAR: {
+        inst_load_var_t *load = IR_INST_AS_TYPE(inst, inst_load_var_t);
+        return &inst_new_load_var(ctx, load->rId, inst->value.dataType)->inst;
+    }
+    case INST_ASSIGN_VAR: {
+        inst_assign_var_t *assign = IR_INST_AS_TYPE(inst, inst_assign_var_t);
+        return &inst_new_assign_var(ctx, assign->rId,
+                                    _osr_map(cl, assign->var->value))
+                    ->inst;
+    }
+    case INST_BINARY: {
+        inst_binary_t *binary = IR_INST_AS_TYPE(inst, inst_binary_t);
+        return &inst_new_binary(ctx, binary->op,
+                                _osr_map(cl, binary->left->value),
+                                _osr_map(cl, binary->right->value))
+                    ->inst;
+    }
+    case INST_JUMP: {
+        inst_jump_t *jump = IR_INST_AS_TYPE(inst, inst_jump_t);
+        return &inst_new_jump(ctx, _osr_target(cl, jump->uses[0]))->inst;
+    }
+    case INST_JUMP_COND: {
+        inst_jump_cond_t *jump = IR_INST_AS_TYPE(inst, inst_jump_cond_t);
+        return &inst_new_jump_cond(ctx, _osr_target(cl, jump->uses[0]),
+                                   _osr_target(cl, jump->uses[1]),
+                                   _osr_map(cl, jump->uses[2]->value))
+                    ->inst;
+    }
+    case INST_FUNCTION_CALL: {
+        inst_function_call_t *call =
+            IR_INST_AS_TYPE(inst, inst_function_call_t);
+        value_t *args[call->useCount];
+        for (size_t i = 1; i < call->useCount; i++)
+            args[i - 1] = _osr_map(cl, call->uses[i]->value);
+        function_t *callee =
+            containerof(call->uses[0]->value, function_t, value);
+        return &inst_new_function_call(ctx, callee, args, call->useCount - 1)
+                    ->inst;
+    }
+    case INST_RETURN: {
+        inst_return_t *ret = IR_INST_AS_TYPE(inst, inst_return_t);
+        value_t *value =
+            ret->hasReturn ? _osr_map(cl, ret->uses[0]->value) : NULL;
+        return &inst_new_return(ctx, value)->inst;
+    }
+    case INST_PHI:
+        break;
+    }
+    assert(0 && "instruction can't be copied");
+    return NULL;
+}
+
+function_t *osr_buildEntry(ir_context_t *ctx, function_t *fn,
+                           basic_block_t *header, size_t *rIds,
+                           size_t rIdCount) {
+    dbuffer_t blocks;
+    dbuffer_init(&blocks);
+    if (!_osr_collect(header, &blocks)) {
+        dbuffer_free(&blocks);
+        return NULL;
+    }
+
+    range_t name = format_range("{range}.osr", fn->value.name);
+    function_t *result = ir_new_function(ctx, name);
+    free(name.ptr);
+    result->returnType = fn->returnType;
+    function_setArguments(ctx, result, fn->argumentCount + rIdCount);
+
+    struct _osr_cloner cl = {.ctx = ctx, .fn = result};
+    hashmap_init(&cl.values, ptrKeyType);
+    zone_init(&cl.zone);
+
+    // Blocks first, jumps can go forward.
+    size_t count;
+    basic_block_t **originals =
+        (basic_block_t **)dbuffer_asPtrArray(&blocks, &count);
+    for (size_t i = 0; i < count; i++)
+        _osr_setCopy(&cl, &originals[i]->value,
+                     &block_new(ctx, result)->value);
+
+    for (size_t i = 0; i < count; i++) {
+        basic_block_t *copy = _osr_mapBlock(&cl, originals[i]);
+        LIST_FOR_EACH(&originals[i]->instructions) {
+            instruction_t *inst = containerof(c, instruction_t, inst_list);
+            instruction_t *clone = _osr_cloneInst(&cl, inst);
+            clone->line = inst->line;
+            clone->col = inst->col;
+            block_insert(copy, clone);
+            _osr_setCopy(&cl, &inst->value, &clone->value);
+        }
+    }
+
+    // The entry takes the live state and continues the loop.
+    basic_block_t *entry = result->entry = block_new(ctx, result);
+    for (size_t i = 0; i < rIdCount; i++) {
+        value_t *value = &result->arguments[fn->argumentCount + i].value;
+        block_insert(entry, &inst_new_assign_var(ctx, rIds[i], value)->inst);
+    }
+    block_insert(entry,
+                 &inst_new_jump(ctx, _osr_mapBlock(&cl, header))->inst);
+
+    hashmap_free(&cl.values);
+    zone_free(&cl.zone);
+    dbuffer_free(&blocks);
+    return result;
+}
@@ -0,0 +1,16 @@
+// On stack replacement, entering optimized code in the middle of a loop.
+#ifndef OSR_H
+#define OSR_H
+
+#include "ir.h"
+
+// Build a function that continues @fn at the loop header @header. It takes the
+// arguments of @fn followed by the values of the variables @rIds, its entry
+// block assigns them and jumps to a copy of @header. Only works before SSA
+// conversion, when every value except arguments and constants lives in the
+// block that defines it. Returns NULL if @fn can't be entered at @header.
+function_t *osr_buildEntry(ir_context_t *ctx, function_t *fn,
+                           basic_block_t *header, size_t *rIds,
+                           size_t rIdCount);
+
+#endif
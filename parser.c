@@ -140,12 +140,13 @@ void token_next(struct reader *reader, struct token *token) {
         return;
     case '>':
         token->type = TK_GREATER;
+        reader_advance(reader, 1);
         if (_reader_isEq(reader, token))
             token->type = TK_GREATER_EQ;
-
-        reader_advance(reader, 1);
+        return;
     case '<':
         token->type = TK_LESS_THAN;
+        reader_advance(reader, 1);
         if (_reader_isEq(reader, token))
             token->type = TK_LESS_EQ;
         return;
@@ -153,6 +154,10 @@ void token_next(struct reader *reader, struct token *token) {
         reader_advance(reader, 1);
         token->type = TK_SEMI_COLON;
         return;
+    case ',':
+        reader_advance(reader, 1);
+        token->type = TK_COMMA;
+        return;
     case 'a' ... 'z':
         // flow through.
     case 'A' ... 'Z':
@@ -232,8 +237,10 @@ void ast_getChilds(struct ast_node *node, size_t *childCount,
         VISIT_CONST_CHILD(BINARY_EXP, binary_exp, 2)
         VISIT_VARIABLE_CHILD(MODULE, module)
         VISIT_VARIABLE_CHILD(FUNCTION, function)
+        VISIT_VARIABLE_CHILD(FUNCTION_CALL, function_call)
         VISIT_VARIABLE_CHILD(BLOCK, block)
         VISIT_VARIABLE_CHILD(IF, if)
+        VISIT_VARIABLE_CHILD(RETURN, return)
     default:
         assert(0 && "UNKNOWN node");
     }
@@ -379,12 +386,8 @@ struct token parser_fresh(parser_t *parser) {
 
 void parser_init(parser_t *parser, range_t range) {
     // initialize the reader.
-    zone_init(&parser->zone);
     *parser = (parser_t){.reader = (struct reader){.range = range}};
-}
-
-struct ast_module *parser_parseModule(parser_t *parser) {
-    struct ast_module *module = ast_module_new(parser);
+    zone_init(&parser->zone);
 }
 
 // Operator presedence.
@@ -409,6 +412,35 @@ int getPresedence(enum token_type type) {
     }
 }
 
+// Arguments of a call, @name is already consumed.
+struct ast_node *parser_parseCall(parser_t *parser, struct token name) {
+    parser_expect(TK_PARAN_OPEN, "expected '(' for the call arguments");
+    dbuffer_t arguments;
+    dbuffer_init(&arguments);
+    while (parser_peekToken(parser).type != TK_PARAN_CLOSE) {
+        struct ast_node *argument = NULL;
+        if (!arguments.usage || parser_next(parser).type == TK_COMMA)
+            argument = parser_parseExpression(parser);
+        else
+            parser->error = "expected ',' between call arguments";
+        if (!argument) {
+            dbuffer_free(&arguments);
+            return NULL;
+        }
+        dbuffer_pushPtr(&arguments, argument);
+    }
+    parser_next(parser);
+
+    struct ast_function_call *result = ast_function_call_new(parser);
+    result->node.pos = name.pos;
+    result->name = name.range;
+    result->childCount = arguments.usage / sizeof(void *);
+    result->childs = zone_alloc(&parser->zone, arguments.usage + 1);
+    memcpy(result->childs, arguments.buffer, arguments.usage);
+    dbuffer_free(&arguments);
+    return &result->node;
+}
+
 // prefix expression, number, paranthesis expression.
 struct ast_node *parser_readAtomInternal(parser_t *parser, int hasPrefix) {
     struct token tok = parser_next(parser);
@@ -426,10 +458,14 @@ struct ast_node *parser_readAtomInternal(parser_t *parser, int hasPrefix) {
         return node;
     } else if (tok.type == TK_NUMBER) {
         struct ast_number *number = ast_number_new(parser);
+        number->node.pos = tok.pos;
         number->num = range_parseInt(tok.range);
         return &number->node;
     } else if (tok.type == TK_ID) {
+        if (parser_peekToken(parser).type == TK_PARAN_OPEN)
+            return parser_parseCall(parser, tok);
         struct ast_variable *variable = ast_variable_new(parser);
+        variable->node.pos = tok.pos;
         variable->varName = tok.range;
         return &variable->node;
     }
@@ -458,6 +494,7 @@ struct ast_node *parser_parseBinary(parser_t *parser, struct ast_node *left) {
     struct ast_node *node = parser_readAtom(parser);
     parser_check_silent(node);
     struct ast_binary_exp *exp = ast_binary_exp_new(parser);
+    exp->node.pos = op.pos;
     exp->op = op.type;
     exp->left = left;
     exp->right = node;
@@ -519,6 +556,8 @@ struct ast_node *parser_parseAssignment(parser_t *parser,
     struct ast_node *assigned = parser_parseExpression(parser);
     parser_check_silent(assigned);
     struct ast_binary_exp *result = ast_binary_exp_new(parser);
+    // Assignments are attributed to the variable.
+    result->node.pos = variable->node.pos;
     result->op = TK_ASSIGN;
     result->left = &variable->node;
     result->right = assigned;
@@ -535,6 +574,7 @@ struct ast_node *parser_parseDeclaration(parser_t *parser) {
                  "expected identifier while parsing declaration");
 
     struct ast_variable *variable = ast_variable_new(parser);
+    variable->node.pos = id.pos;
     variable->varName = id.range;
 
     struct ast_node *assignment = parser_parseAssignment(parser, variable);
@@ -542,6 +582,7 @@ struct ast_node *parser_parseDeclaration(parser_t *parser) {
     parser_expect(TK_SEMI_COLON, "expected semicolon after statement");
 
     struct ast_declaration *result = ast_declaration_new(parser);
+    result->node.pos = dataType.pos;
     result->dataType = dataType.type;
     result->assignment = assignment;
 
@@ -551,18 +592,20 @@ struct ast_node *parser_parseDeclaration(parser_t *parser) {
 struct ast_node *parser_parseAssignmentOrCall(parser_t *parser) {
     struct token tok = parser_next(parser);
     parser_check(tok.type == TK_ID, "Expected identifier");
-    struct ast_variable *variable = ast_variable_new(parser);
-    variable->varName = tok.range;
-
     struct token op = parser_peekToken(parser);
 
     if (op.type == TK_ASSIGN) {
+        struct ast_variable *variable = ast_variable_new(parser);
+        variable->node.pos = tok.pos;
+        variable->varName = tok.range;
         struct ast_node *result = parser_parseAssignment(parser, variable);
         parser_expect(TK_SEMI_COLON, "expected semicolon after statement");
         return result;
     } else if (op.type == TK_PARAN_OPEN) {
-        assert("Not implemented");
-        // TODO:Parse call
+        struct ast_node *result = parser_parseCall(parser, tok);
+        parser_check_silent(result);
+        parser_expect(TK_SEMI_COLON, "expected semicolon after statement");
+        return result;
     }
     parser->error = "unrecognized token while parsing assignment or call";
 
@@ -570,7 +613,7 @@ struct ast_node *parser_parseAssignmentOrCall(parser_t *parser) {
 }
 
 struct ast_node *parser_parseIf(parser_t *parser) {
-    parser_next(parser);
+    struct token keyword = parser_next(parser);
     parser_expect(TK_PARAN_OPEN,
                   "Expected parenthesis, while trying to parse function");
     struct ast_node *condition = parser_parseExpression(parser);
@@ -579,6 +622,7 @@ struct ast_node *parser_parseIf(parser_t *parser) {
                   "Expected parenthesis close, while trying to parse function");
 
     struct ast_if *result = ast_if_new(parser);
+    result->node.pos = keyword.pos;
     struct ast_node *block = parser_parseBlock(parser);
     parser_check_silent(block);
     result->condition = condition;
@@ -590,7 +634,7 @@ struct ast_node *parser_parseIf(parser_t *parser) {
 }
 
 struct ast_node *parser_parseWhile(parser_t *parser) {
-    parser_next(parser);
+    struct token keyword = parser_next(parser);
     parser_expect(TK_PARAN_OPEN,
                   "Expected parenthesis, while trying to parse function");
     struct ast_node *condition = parser_parseExpression(parser);
@@ -599,6 +643,7 @@ struct ast_node *parser_parseWhile(parser_t *parser) {
                   "Expected parenthesis close, while trying to parse function");
 
     struct ast_while *result = ast_while_new(parser);
+    result->node.pos = keyword.pos;
     struct ast_node *block = parser_parseBlock(parser);
     parser_check_silent(block);
 
@@ -609,9 +654,15 @@ struct ast_node *parser_parseWhile(parser_t *parser) {
 }
 
 struct ast_node *parser_parseReturn(parser_t *parser) {
-    parser_next(parser);
-    // TODO: Parse the return value.
+    struct token keyword = parser_next(parser);
     struct ast_return *result = ast_return_new(parser);
+    result->node.pos = keyword.pos;
+    if (parser_peekToken(parser).type != TK_SEMI_COLON) {
+        struct ast_node *value = parser_parseExpression(parser);
+        parser_check_silent(value);
+        result->value = value;
+        result->childCount = 1;
+    }
     parser_expect(TK_SEMI_COLON, "expected semicolon after statement");
 
     return &result->node;
@@ -678,6 +729,7 @@ struct ast_node *parser_parseBlock(parser_t *parser) {
     memcpy(ptr, statements.buffer, statements.usage);
 
     struct ast_block *result = ast_block_new(parser);
+    result->node.pos = op.pos;
     result->childs = ptr;
     result->childCount = statements.usage / sizeof(void *);
 
@@ -685,6 +737,24 @@ struct ast_node *parser_parseBlock(parser_t *parser) {
     return &result->node;
 }
 
+// "int64 name"
+struct ast_node *parser_parseArgument(parser_t *parser) {
+    struct token dataType = parser_next(parser);
+    parser_check(_isDataType(dataType.type) && dataType.type != TK_KW_VOID,
+                 "expected the type of a function argument");
+    struct token name = parser_next(parser);
+    parser_check(name.type == TK_ID, "expected the name of an argument");
+
+    struct ast_variable *variable = ast_variable_new(parser);
+    variable->node.pos = name.pos;
+    variable->varName = name.range;
+    struct ast_declaration *result = ast_declaration_new(parser);
+    result->node.pos = dataType.pos;
+    result->dataType = dataType.type;
+    result->assignment = &variable->node;
+    return &result->node;
+}
+
 struct ast_node *parser_parseFunction(parser_t *parser) {
     struct token dataType = parser_next(parser);
 
@@ -694,29 +764,59 @@ struct ast_node *parser_parseFunction(parser_t *parser) {
     parser_check(name.type == TK_ID, "exptected a function name");
     parser_expect(TK_PARAN_OPEN, "expteced a '(' for function argument list");
 
-    // TODO: Parse function arguments.
-    parser_expect(TK_PARAN_CLOSE,
-                  "expteced ')' to terminate a function argument list.");
+    dbuffer_t childs;
+    dbuffer_init(&childs);
+    while (parser_peekToken(parser).type != TK_PARAN_CLOSE) {
+        struct ast_node *argument = NULL;
+        if (!childs.usage || parser_next(parser).type == TK_COMMA)
+            argument = parser_parseArgument(parser);
+        else
+            parser->error = "expected ',' between function arguments";
+        if (!argument) {
+            dbuffer_free(&childs);
+            return NULL;
+        }
+        dbuffer_pushPtr(&childs, argument);
+    }
+    parser_next(parser);
 
     struct ast_node *block = parser_parseBlock(parser);
+    if (!block) {
+        dbuffer_free(&childs);
+        return NULL;
+    }
+    dbuffer_pushPtr(&childs, block);
 
-    parser_check_silent(block);
     struct ast_function *result = ast_function_new(parser);
+    result->node.pos = dataType.pos;
     result->name = name.range;
-    result->argumentCount = 0;
-    result->childCount = 1;
+    result->childCount = childs.usage / sizeof(void *);
+    result->argumentCount = result->childCount - 1;
     result->returnType = dataType.type;
 
-    result->childs =
-        (struct ast_node **)zone_alloc(&parser->zone, sizeof(void *));
-    *result->childs = block;
+    result->childs = zone_alloc(&parser->zone, childs.usage);
+    memcpy(result->childs, childs.buffer, childs.usage);
+    dbuffer_free(&childs);
     return &result->node;
 }
 
-struct ast_node *parser_module(parser_t *parser) {
+struct ast_node *parser_parseModule(parser_t *parser) {
     dbuffer_t functions;
-    dbuffer_initSize(&functions, 8 * sizeof(void *));
+    dbuffer_init(&functions);
 
     while (parser_peekToken(parser).type != TK_EEOF) {
+        struct ast_node *function = parser_parseFunction(parser);
+        if (!function) {
+            dbuffer_free(&functions);
+            return NULL;
+        }
+        dbuffer_pushPtr(&functions, function);
     }
+
+    struct ast_module *result = ast_module_new(parser);
+    result->childCount = functions.usage / sizeof(void *);
+    result->childs = zone_alloc(&parser->zone, functions.usage + 1);
+    memcpy(result->childs, functions.buffer, functions.usage);
+    dbuffer_free(&functions);
+    return &result->node;
 }
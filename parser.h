@@ -32,7 +32,8 @@
     o(TK_CURLY_CLOSE)      \
     o(TK_PARAN_OPEN)       \
     o(TK_PARAN_CLOSE)      \
-    o(TK_SEMI_COLON)
+    o(TK_SEMI_COLON)       \
+    o(TK_COMMA)
 // clang-format on
 
 enum token_type { TK_TOKEN_TYPES(COMMA) };
@@ -72,6 +73,8 @@ extern char *kASTNodeName[];
 
 struct ast_node {
     enum ast_node_type type;
+    // Token the node is attributed to, for source positions of the code.
+    position_t pos;
 };
 
 struct ast_module {
@@ -88,6 +91,7 @@ struct ast_function {
 
     enum token_type returnType;
 
+    // The argument declarations come first, the block is the last child.
     size_t argumentCount;
     struct ast_node **childs;
     size_t childCount;
@@ -176,6 +180,7 @@ struct ast_declaration {
     struct ast_node node;
     enum token_type dataType;
 
+    // An assignment, function arguments only have the variable.
     union {
         struct ast_node *childs[1];
         struct ast_node *assignment;
@@ -184,6 +189,12 @@ struct ast_declaration {
 
 struct ast_return {
     struct ast_node node;
+    // The value is optional.
+    union {
+        struct ast_node *childs[1];
+        struct ast_node *value;
+    };
+    size_t childCount;
 };
 
 // used for things like ast_module_new
@@ -215,6 +226,8 @@ typedef struct {
 struct ast_node *parser_parseExpression(parser_t *parser);
 struct ast_node *parser_parseBlock(parser_t *parser);
 struct ast_node *parser_parseFunction(parser_t *parser);
+// Functions until the end of the input.
+struct ast_node *parser_parseModule(parser_t *parser);
 
 void parser_init(parser_t *parser, range_t range);
 
@@ -0,0 +1,156 @@
+#include "perf.h"
+#include "format.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// jitdump format, see tools/perf/Documentation/jitdump-specification.txt
+#define PERF_JITDUMP_MAGIC 0x4A695444
+#define PERF_JITDUMP_VERSION 1
+#define PERF_JITDUMP_CODE_LOAD 0
+#define PERF_ELF_MACHINE_X86_64 62
+
+struct perf_jitdump_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t elfMachine;
+    uint32_t pad;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+// Followed by the null terminated name and the code.
+struct perf_jitdump_load {
+    uint32_t id;
+    uint32_t size;
+    uint64_t timestamp;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t codeAddress;
+    uint64_t codeSize;
+    uint64_t codeIndex;
+};
+
+// perf record -k mono lines samples up with the jitdump.
+uint64_t _perf_timestamp() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Opens <directory>/<prefix>-<pid>.<extension>
+FILE *_perf_open(char *directory, char *prefix, char *extension, char *mode) {
+    char *path = format("{str}/{str}-{uint}.{str}", directory, prefix,
+                        (unsigned)getpid(), extension);
+    FILE *file = fopen(path, mode);
+    free(path);
+    return file;
+}
+
+int _perf_initJitdump(struct perf_output *perf, char *directory) {
+    perf->dump = _perf_open(directory, "jit", "dump", "w+");
+    if (!perf->dump)
+        return 0;
+
+    struct perf_jitdump_header header = {
+        .magic = PERF_JITDUMP_MAGIC,
+        .version = PERF_JITDUMP_VERSION,
+        .size = sizeof(header),
+        .elfMachine = PERF_ELF_MACHINE_X86_64,
+        .pid = getpid(),
+        .timestamp = _perf_timestamp(),
+    };
+    fwrite(&header, sizeof(header), 1, perf->dump);
+    fflush(perf->dump);
+
+    // The mapping only has to show up in the perf record.
+    perf->markerSize = sysconf(_SC_PAGESIZE);
+    perf->marker = mmap(NULL, perf->markerSize, PROT_READ | PROT_EXEC,
+                        MAP_PRIVATE, fileno(perf->dump), 0);
+    if (perf->marker == MAP_FAILED) {
+        perf->marker = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+int perf_init(struct perf_output *perf, int flags, char *directory) {
+    *perf = (struct perf_output){.flags = flags};
+    pthread_mutex_init(&perf->lock, NULL);
+    if (!directory)
+        directory = PERF_DEFAULT_DIRECTORY;
+
+    if (flags & PERF_MAP) {
+        perf->map = _perf_open(directory, "perf", "map", "w");
+        if (!perf->map)
+            return 0;
+    }
+    if (flags & PERF_JITDUMP)
+        return _perf_initJitdump(perf, directory);
+    return 1;
+}
+
+void perf_free(struct perf_output *perf) {
+    if (perf->map)
+        fclose(perf->map);
+    if (perf->marker)
+        munmap(perf->marker, perf->markerSize);
+    if (perf->dump)
+        fclose(perf->dump);
+    pthread_mutex_destroy(&perf->lock);
+}
+
+void _perf_writeLoad(struct perf_output *perf, range_t name, void *code,
+                     size_t size) {
+    struct perf_jitdump_load load = {
+        .id = PERF_JITDUMP_CODE_LOAD,
+        .size = sizeof(load) + name.size + 1 + size,
+        .timestamp = _perf_timestamp(),
+        .pid = getpid(),
+        .tid = syscall(SYS_gettid),
+        .vma = (uint64_t)code,
+        .codeAddress = (uint64_t)code,
+        .codeSize = size,
+        .codeIndex = perf->codeIndex++,
+    };
+    fwrite(&load, sizeof(load), 1, perf->dump);
+    fwrite(name.ptr, 1, name.size, perf->dump);
+    fputc(0, perf->dump);
+    fwrite(code, 1, size, perf->dump);
+}
+
+void perf_addCode(struct perf_output *perf, range_t name, void *code,
+                  size_t size) {
+    pthread_mutex_lock(&perf->lock);
+    if (perf->map) {
+        fprintf(perf->map, "%lx %zx %.*s\n", (unsigned long)code, size,
+                (int)name.size, name.ptr);
+        // perf may read the file while we are still running.
+        fflush(perf->map);
+    }
+    if (perf->dump) {
+        _perf_writeLoad(perf, name, code, size);
+        fflush(perf->dump);
+    }
+    pthread_mutex_unlock(&perf->lock);
+}
+
+void perf_addBatch(struct perf_output *perf, struct jit_batch *batch) {
+    struct jit_symbol *symbols = batch->symbols;
+    size_t count = batch->symbolCount;
+    for (size_t i = 0; i < count; i += symbols[i].blockCount + 1) {
+        if ((perf->flags & PERF_BLOCKS) && symbols[i].blockCount) {
+            for (size_t j = 1; j <= symbols[i].blockCount; j++)
+                perf_addCode(perf, symbols[i + j].name, symbols[i + j].code,
+                             symbols[i + j].size);
+        } else {
+            perf_addCode(perf, symbols[i].name, symbols[i].code,
+                         symbols[i].size);
+        }
+    }
+}
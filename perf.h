@@ -0,0 +1,44 @@
+// Symbols of JITed code for Linux perf. The perf map is a text file that
+// perf report reads to name addresses, the jitdump also carries the code so
+// `perf inject --jit` can build ELF images for annotation.
+#ifndef PERF_H
+#define PERF_H
+
+#include "jit.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Write <directory>/perf-<pid>.map
+#define PERF_MAP 1
+// Write <directory>/jit-<pid>.dump
+#define PERF_JITDUMP 2
+// Name the blocks of functions instead of the whole functions.
+#define PERF_BLOCKS 4
+
+#define PERF_DEFAULT_DIRECTORY "/tmp"
+
+struct perf_output {
+    int flags;
+    FILE *map;
+    FILE *dump;
+    // perf finds the jitdump through an executable mapping of it.
+    void *marker;
+    size_t markerSize;
+    uint64_t codeIndex;
+    pthread_mutex_t lock;
+};
+
+// Returns 0 if one of the files can't be created.
+int perf_init(struct perf_output *perf, int flags, char *directory);
+void perf_free(struct perf_output *perf);
+
+// Report @size bytes of code at @code, the code must not change afterwards.
+void perf_addCode(struct perf_output *perf, range_t name, void *code,
+                  size_t size);
+
+// Report every function of the batch, or its blocks with PERF_BLOCKS.
+void perf_addBatch(struct perf_output *perf, struct jit_batch *batch);
+
+#endif
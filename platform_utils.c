@@ -6,3 +6,15 @@ void *allocate_executable(size_t size) {
     return mmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC,
                 MAP_ANONYMOUS | MAP_PRIVATE, 0, 0);
 }
+
+void free_executable(void *ptr, size_t size) { munmap(ptr, size); }
+
+void *allocate_writable(size_t size) {
+    void *result = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    return result == MAP_FAILED ? NULL : result;
+}
+
+int protect_executable(void *ptr, size_t size) {
+    return mprotect(ptr, size, PROT_READ | PROT_EXEC) == 0;
+}
@@ -3,5 +3,12 @@
 #include <stddef.h>
 
 void *allocate_executable(size_t size);
+// Free memory returned by allocate_executable or allocate_writable.
+void free_executable(void *ptr, size_t size);
+
+// Allocate pages that are writable but not executable yet.
+void *allocate_writable(size_t size);
+// Make pages from allocate_writable executable and read only.
+int protect_executable(void *ptr, size_t size);
 
 #endif
@@ -0,0 +1,152 @@
+#include "position_table.h"
+#include "buffer.h"
+#include "utils.h"
+
+#include <assert.h>
+
+void _position_pushUleb(dbuffer_t *dbuffer, uint64_t value) {
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        dbuffer_pushChar(dbuffer, value ? byte | 0x80 : byte);
+    } while (value);
+}
+
+void _position_pushSleb(dbuffer_t *dbuffer, int64_t value) {
+    for (;;) {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        // Done once the rest is only the sign extension of this byte.
+        if ((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40))) {
+            dbuffer_pushChar(dbuffer, byte);
+            return;
+        }
+        dbuffer_pushChar(dbuffer, byte | 0x80);
+    }
+}
+
+uint64_t _position_readUleb(uint8_t **data) {
+    uint64_t result = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        byte = *(*data)++;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return result;
+}
+
+int64_t _position_readSleb(uint8_t **data) {
+    int64_t result = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        byte = *(*data)++;
+        result |= (int64_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    if (shift < 64 && (byte & 0x40))
+        result |= -((int64_t)1 << shift);
+    return result;
+}
+
+// Drop the entries that are overridden or that don't change anything.
+size_t _position_compact(struct position_entry *entries, size_t count,
+                         struct position_entry *result) {
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++) {
+        assert((!i || entries[i - 1].pc <= entries[i].pc) &&
+               "position entries must be sorted");
+        if (size && result[size - 1].pc == entries[i].pc)
+            size--;
+        if (size && result[size - 1].line == entries[i].line &&
+            result[size - 1].col == entries[i].col)
+            continue;
+        result[size++] = entries[i];
+    }
+    return size;
+}
+
+void position_table_build(struct position_table *table,
+                          struct position_entry *entries, size_t count) {
+    *table = (struct position_table){};
+    if (!count)
+        return;
+
+    struct position_entry *compact =
+        dmalloc(sizeof(struct position_entry) * count);
+    count = _position_compact(entries, count, compact);
+
+    table->checkpointCount =
+        (count + POSITION_TABLE_STRIDE - 1) / POSITION_TABLE_STRIDE;
+    table->checkpoints =
+        dmalloc(sizeof(struct position_checkpoint) * table->checkpointCount);
+
+    dbuffer_t data;
+    dbuffer_init(&data);
+    for (size_t i = 0; i < count; i++) {
+        if (i % POSITION_TABLE_STRIDE == 0) {
+            table->checkpoints[i / POSITION_TABLE_STRIDE] =
+                (struct position_checkpoint){compact[i], data.usage};
+            continue;
+        }
+        _position_pushUleb(&data, compact[i].pc - compact[i - 1].pc);
+        _position_pushSleb(&data,
+                           (int64_t)compact[i].line - compact[i - 1].line);
+        _position_pushUleb(&data, compact[i].col);
+    }
+    free(compact);
+
+    table->size = data.usage;
+    if (data.usage) {
+        table->data = dmalloc(data.usage);
+        memcpy(table->data, data.buffer, data.usage);
+    }
+    dbuffer_free(&data);
+}
+
+void position_table_free(struct position_table *table) {
+    free(table->data);
+    free(table->checkpoints);
+    *table = (struct position_table){};
+}
+
+int position_table_lookup(struct position_table *table, uint32_t pc,
+                          uint32_t *line, uint32_t *col) {
+    // Last checkpoint at or before pc.
+    size_t low = 0, high = table->checkpointCount;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (table->checkpoints[mid].entry.pc <= pc)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (!low)
+        return 0;
+
+    struct position_checkpoint *checkpoint = &table->checkpoints[low - 1];
+    struct position_entry current = checkpoint->entry;
+    uint8_t *data = table->data + checkpoint->offset;
+    uint8_t *end = low < table->checkpointCount
+                       ? table->data + table->checkpoints[low].offset
+                       : table->data + table->size;
+    while (data < end) {
+        uint32_t next = current.pc + _position_readUleb(&data);
+        if (next > pc)
+            break;
+        current.pc = next;
+        current.line += _position_readSleb(&data);
+        current.col = _position_readUleb(&data);
+    }
+
+    *line = current.line;
+    *col = current.col;
+    return 1;
+}
+
+size_t position_table_size(struct position_table *table) {
+    return table->size +
+           table->checkpointCount * sizeof(struct position_checkpoint);
+}
@@ -0,0 +1,46 @@
+// Maps code offsets back to source positions. Entries are delta encoded
+// (uleb128 pc delta, sleb128 line delta, uleb128 column), every
+// POSITION_TABLE_STRIDE-th entry is kept unencoded as a checkpoint so a lookup
+// is a binary search followed by a short linear decode.
+#ifndef POSITION_TABLE_H
+#define POSITION_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define POSITION_TABLE_STRIDE 16
+
+// The code starting at @pc up to the next entry comes from @line:@col.
+struct position_entry {
+    uint32_t pc;
+    uint32_t line;
+    uint32_t col;
+};
+
+struct position_checkpoint {
+    struct position_entry entry;
+    // Where the entries following the checkpoint start in the data.
+    uint32_t offset;
+};
+
+struct position_table {
+    uint8_t *data;
+    size_t size;
+    struct position_checkpoint *checkpoints;
+    size_t checkpointCount;
+};
+
+// @entries must be sorted by pc. Entries sharing a pc keep the last one,
+// entries that don't change the position are dropped.
+void position_table_build(struct position_table *table,
+                          struct position_entry *entries, size_t count);
+void position_table_free(struct position_table *table);
+
+// Returns 0 if @pc comes before the first entry.
+int position_table_lookup(struct position_table *table, uint32_t pc,
+                          uint32_t *line, uint32_t *col);
+
+// Encoded size of the table in bytes, checkpoints included.
+size_t position_table_size(struct position_table *table);
+
+#endif
@@ -0,0 +1,113 @@
+#include "profile.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+#define PROFILE_MAX_NAME 256
+
+void profile_init(struct profile *profile) {
+    hashmap_init(&profile->functions, rangeKeyType);
+    dbuffer_init(&profile->functionList);
+}
+
+void profile_free(struct profile *profile) {
+    size_t count;
+    struct profile_function **functions = (struct profile_function **)
+        dbuffer_asPtrArray(&profile->functionList, &count);
+    for (size_t i = 0; i < count; i++) {
+        free(functions[i]->name.ptr);
+        free(functions[i]->counters);
+        free(functions[i]);
+    }
+    hashmap_free(&profile->functions);
+    dbuffer_free(&profile->functionList);
+}
+
+struct profile_function *profile_get(struct profile *profile, range_t name) {
+    struct hm_bucket_entry *entry = hashmap_getRange(&profile->functions, name);
+    if (!entry)
+        return NULL;
+    return containerof(entry, struct profile_function, entry);
+}
+
+struct profile_function *profile_add(struct profile *profile, range_t name,
+                                     size_t blockCount) {
+    struct profile_function *pf = profile_get(profile, name);
+    if (pf) {
+        assert(pf->blockCount == blockCount &&
+               "profile doesn't match the function");
+        return pf;
+    }
+
+    pf = nnew(struct profile_function);
+    *pf = (struct profile_function){.name = range_copy(&name),
+                                    .blockCount = blockCount};
+    pf->counters = dzmalloc(sizeof(uint64_t) * PROFILE_COUNTERS * blockCount);
+    hashmap_setRange(&profile->functions, pf->name, &pf->entry);
+    dbuffer_pushPtr(&profile->functionList, pf);
+    return pf;
+}
+
+uint64_t *profile_counter(struct profile_function *pf, size_t block,
+                          enum profile_counter counter) {
+    assert(block < pf->blockCount && "block is out of range");
+    return &pf->counters[block * PROFILE_COUNTERS + counter];
+}
+
+int profile_save(struct profile *profile, char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return 0;
+
+    size_t count;
+    struct profile_function **functions = (struct profile_function **)
+        dbuffer_asPtrArray(&profile->functionList, &count);
+    for (size_t i = 0; i < count; i++) {
+        struct profile_function *pf = functions[i];
+        fprintf(file, "%.*s %zu\n", (int)pf->name.size, pf->name.ptr,
+                pf->blockCount);
+        for (size_t b = 0; b < pf->blockCount; b++) {
+            uint64_t *c = profile_counter(pf, b, PROFILE_ENTRY);
+            fprintf(file, "%" PRIu64 " %" PRIu64 " %" PRIu64 "\n", c[0], c[1],
+                    c[2]);
+        }
+    }
+    return fclose(file) == 0;
+}
+
+int _profile_loadFunction(struct profile *profile, FILE *file, char *name,
+                          size_t blockCount) {
+    struct profile_function *pf = profile_get(profile, range_fromString(name));
+    if (pf && pf->blockCount != blockCount)
+        return 0;
+    if (!pf)
+        pf = profile_add(profile, range_fromString(name), blockCount);
+
+    for (size_t b = 0; b < blockCount; b++) {
+        uint64_t c[PROFILE_COUNTERS];
+        if (fscanf(file, "%" SCNu64 " %" SCNu64 " %" SCNu64, &c[0], &c[1],
+                   &c[2]) != PROFILE_COUNTERS)
+            return 0;
+        for (int i = 0; i < PROFILE_COUNTERS; i++)
+            *profile_counter(pf, b, i) += c[i];
+    }
+    return 1;
+}
+
+int profile_load(struct profile *profile, char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return 0;
+
+    char name[PROFILE_MAX_NAME];
+    size_t blockCount;
+    int result = 1;
+    while (result && fscanf(file, "%255s %zu", name, &blockCount) == 2)
+        result = _profile_loadFunction(profile, file, name, blockCount);
+    if (!feof(file))
+        result = 0;
+    fclose(file);
+    return result;
+}
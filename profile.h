@@ -0,0 +1,56 @@
+// Execution counts of blocks and conditional edges. Instrumented code bumps
+// the counters directly, the counts then drive the block layout of later
+// compilations. Blocks are numbered in reverse postorder which only depends
+// on the IR, so a profile applies to every compilation of the same source.
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "buffer.h"
+#include "hashmap.h"
+
+#include <stdint.h>
+
+enum profile_counter {
+    PROFILE_ENTRY,
+    // Edges of the conditional jump that ends the block.
+    PROFILE_TAKEN,
+    PROFILE_NOT_TAKEN,
+    PROFILE_COUNTERS
+};
+
+struct profile_function {
+    range_t name;
+    size_t blockCount;
+    // PROFILE_COUNTERS per block, instrumented code points into this.
+    uint64_t *counters;
+    struct hm_bucket_entry entry;
+};
+
+struct profile {
+    // name -> profile_function
+    hashmap_t functions;
+    dbuffer_t functionList;
+};
+
+void profile_init(struct profile *profile);
+// Instrumented code must not run anymore.
+void profile_free(struct profile *profile);
+
+// Returns NULL if the function has no counts.
+struct profile_function *profile_get(struct profile *profile, range_t name);
+// Get the counters of a function, creating zeroed ones if needed. The block
+// count must match the one the counters were created with.
+struct profile_function *profile_add(struct profile *profile, range_t name,
+                                     size_t blockCount);
+
+uint64_t *profile_counter(struct profile_function *pf, size_t block,
+                          enum profile_counter counter);
+
+// The file is text, one "<name> <blockCount>" line per function followed by
+// a "<entry> <taken> <not taken>" line per block.
+int profile_save(struct profile *profile, char *path);
+// Counts are added to the ones already in the profile. Returns 0 if the file
+// can't be read or doesn't match the profile.
+int profile_load(struct profile *profile, char *path);
+
+#endif
@@ -1,4 +1,5 @@
 #include "relocation.h"
+#include <assert.h>
 #include <stdint.h>
 
 size_t getRelocSize(enum reloc_size type) {
@@ -12,6 +13,8 @@ size_t getRelocSize(enum reloc_size type) {
     case INT64:
         return 8;
     }
+    assert(0 && "unknown relocation size");
+    return 0;
 }
 
 void label_setOffset(label_t *label, unsigned long offset) {
@@ -19,59 +22,119 @@ void label_setOffset(label_t *label, unsigned long offset) {
     label->hasOffset = 1;
 }
 
-void relocation_set(label_t *label, enum reloc_type type, enum reloc_size size,
-                    int bias, size_t offset) {
-    relocation_t *reloc = dmalloc(sizeof(relocation_t));
-    reloc->offset = offset;
-    reloc->bias = bias;
-    reloc->size = size;
-    reloc->type = type;
-    reloc->next = label->relocations;
-    label->relocations = reloc;
+void label_setPosition(label_t *label, size_t offset) {
+    label_setOffset(label, offset);
+    label->isLocal = 1;
 }
 
-void relocation_emit(dbuffer_t *dbuffer, label_t *label, enum reloc_type type,
-                     enum reloc_size size, int bias) {
-    relocation_set(label, type, size, bias, dbuffer->usage);
+void reloc_table_init(struct reloc_table *table) {
+    dbuffer_init(&table->relocations);
+    dbuffer_initSize(&table->labels, 16 * sizeof(void *));
+}
+
+void reloc_table_free(struct reloc_table *table) {
+    dbuffer_free(&table->relocations);
+    dbuffer_free(&table->labels);
+}
+
+void reloc_table_addLabel(struct reloc_table *table, label_t *label) {
+    if (label->table == table)
+        return;
+    assert(label->table == NULL && "label belongs to another table");
+
+    label->table = table;
+    label->index = table->labels.usage / sizeof(void *);
+    dbuffer_pushPtr(&table->labels, label);
+}
+
+relocation_t *reloc_table_relocations(struct reloc_table *table,
+                                      size_t *count) {
+    *count = table->relocations.usage / sizeof(relocation_t);
+    return (relocation_t *)table->relocations.buffer;
+}
+
+label_t **reloc_table_labels(struct reloc_table *table, size_t *count) {
+    return (label_t **)dbuffer_asPtrArray(&table->labels, count);
+}
+
+size_t relocation_set(label_t *label, enum reloc_type type,
+                      enum reloc_size size, int bias, size_t offset) {
+    assert(label->table && "label must be registered to a table");
+    dbuffer_t *relocations = &label->table->relocations;
+
+    relocation_t reloc = (relocation_t){};
+    reloc.offset = offset;
+    reloc.bias = bias;
+    reloc.size = size;
+    reloc.type = type;
+    reloc.label = label->index;
+    dbuffer_pushData(relocations, &reloc, sizeof(relocation_t));
+
+    // Relocations are almost always emitted in order, keep the array sorted
+    // for the rare case they are not.
+    relocation_t *array = relocations->buffer;
+    size_t i = relocations->usage / sizeof(relocation_t) - 1;
+    for (; i > 0 && array[i - 1].offset > offset; i--)
+        array[i] = array[i - 1];
+    array[i] = reloc;
+    return i;
+}
+
+size_t relocation_emit(dbuffer_t *dbuffer, label_t *label,
+                       enum reloc_type type, enum reloc_size size, int bias) {
+    size_t index = relocation_set(label, type, size, bias, dbuffer->usage);
     dbuffer_pushChars(dbuffer, 0, getRelocSize(size));
+    return index;
 }
 
-void relocation_apply(relocation_t *relocation, void *buffer,
-                      unsigned long offset, unsigned long memLocation) {
-    uint64_t value;
+uint64_t _relocation_value(relocation_t *relocation, label_t *label,
+                           unsigned long memLocation) {
     if (relocation->type == ABSOLUTE)
-        value = offset;
-    else
-        value = offset - (memLocation + relocation->offset + relocation->bias);
+        return label->isLocal ? label->offset + memLocation : label->offset;
+    // Both sides are inside the buffer.
+    if (label->isLocal)
+        return label->offset - (relocation->offset + relocation->bias);
+    return label->offset -
+           (memLocation + relocation->offset + relocation->bias);
+}
 
+int relocation_fits(relocation_t *relocation, label_t *label,
+                    unsigned long memLocation) {
+    // Relative values are signed, they must not be truncated.
+    int64_t value = _relocation_value(relocation, label, memLocation);
+    if (relocation->type == ABSOLUTE)
+        return 1;
     switch (relocation->size) {
     case INT8:
-        value = (uint8_t)value;
-        break;
+        return value >= INT8_MIN && value <= INT8_MAX;
     case INT16:
-        value = (uint16_t)value;
-        break;
+        return value >= INT16_MIN && value <= INT16_MAX;
     case INT32:
-        value = (uint32_t)value;
-        break;
+        return value >= INT32_MIN && value <= INT32_MAX;
     case INT64:
-        break;
+        return 1;
     }
+    return 0;
+}
+
+void relocation_apply(relocation_t *relocation, void *buffer, label_t *label,
+                      unsigned long memLocation) {
+    assert(relocation_fits(relocation, label, memLocation) &&
+           "relocation out of range");
+    uint64_t value = _relocation_value(relocation, label, memLocation);
     writeLong(buffer + relocation->offset, value,
               getRelocSize(relocation->size));
 }
 
-void label_applyMemory(label_t *label, void *buffer,
+void reloc_table_apply(struct reloc_table *table, void *buffer,
                        unsigned long memLocation) {
-    for (relocation_t *current = label->relocations, *next; current != NULL;
-         current = next) {
-        next = current->next;
-        relocation_apply(current, buffer, label->offset, memLocation);
-        free(current);
-    }
-    label->relocations = NULL;
-}
+    size_t count;
+    relocation_t *relocations = reloc_table_relocations(table, &count);
+    label_t **labels = (label_t **)table->labels.buffer;
 
-void label_apply(label_t *label, void *buffer) {
-    label_applyMemory(label, buffer, 0);
+    for (size_t i = 0; i < count; i++) {
+        label_t *label = labels[relocations[i].label];
+        assert(label->hasOffset && "unresolved label");
+        relocation_apply(&relocations[i], buffer, label, memLocation);
+    }
 }
@@ -13,35 +13,68 @@ enum reloc_type { RELATIVE, ABSOLUTE };
 
 size_t getRelocSize(enum reloc_size size);
 
-// TODO: Maybe use a dbuffer instead of linked list
 struct relocation {
     enum reloc_type type;
     enum reloc_size size;
     int bias;
     size_t offset; // the offset in dbuffer.
-    struct relocation *next;
+    size_t label;  // index of the label inside the table.
 };
 
 typedef struct relocation relocation_t;
 
+// All relocations of a buffer, stored contiguously.
+struct reloc_table {
+    // relocation_t array, sorted by offset.
+    dbuffer_t relocations;
+    // label_t pointer array, relocations refer to labels by index.
+    dbuffer_t labels;
+};
+
 typedef struct {
     int hasOffset;
+    // The offset is a position inside the buffer rather than an address.
+    int isLocal;
     size_t offset;
-    relocation_t *relocations;
+    // The table this label is registered to and it's index there.
+    struct reloc_table *table;
+    size_t index;
 } label_t;
 
-void relocation_set(label_t *label, enum reloc_type type, enum reloc_size size,
-                    int bias, size_t offset);
-void relocation_emit(dbuffer_t *dbuffer, label_t *label, enum reloc_type type,
-                     enum reloc_size size, int bias);
+void reloc_table_init(struct reloc_table *table);
+void reloc_table_free(struct reloc_table *table);
+
+// Register the label to the table, does nothing if it is already registered.
+void reloc_table_addLabel(struct reloc_table *table, label_t *label);
+
+// get the relocation array.
+relocation_t *reloc_table_relocations(struct reloc_table *table,
+                                      size_t *count);
+
+// get the label array.
+label_t **reloc_table_labels(struct reloc_table *table, size_t *count);
+
+// Resolve all labels at once, every label must have an offset.
+void reloc_table_apply(struct reloc_table *table, void *buffer,
+                       unsigned long memLocation);
 
-// internal function.
-// void relocation_apply(relocation_t *relocation, void *buffer, unsigned long
-// offset, unsigned long memLocation);
+// Add a relocation for the label, the label must be registered to a table.
+// Returns the index of the relocation.
+size_t relocation_set(label_t *label, enum reloc_type type,
+                      enum reloc_size size, int bias, size_t offset);
+size_t relocation_emit(dbuffer_t *dbuffer, label_t *label,
+                       enum reloc_type type, enum reloc_size size, int bias);
 
-void label_applyMemory(label_t *label, void *buffer, unsigned long memLocation);
+// Whether the value of a relative relocation fits in its size, absolute ones
+// are truncated.
+int relocation_fits(relocation_t *relocation, label_t *label,
+                    unsigned long memLocation);
+// Apply a single relocation, prefer reloc_table_apply.
+void relocation_apply(relocation_t *relocation, void *buffer, label_t *label,
+                      unsigned long memLocation);
 
-void label_apply(label_t *label, void *buffer);
 void label_setOffset(label_t *label, unsigned long offset);
+// Point the label to a position inside the buffer.
+void label_setPosition(label_t *label, size_t offset);
 
 #endif
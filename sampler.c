@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+#include "sampler.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <ucontext.h>
+
+// Sampler the signal handler writes to.
+_Atomic(struct sampler *) _sampler_active;
+
+void _sampler_signal(int signal, siginfo_t *info, void *context) {
+    struct sampler *sampler =
+        atomic_load_explicit(&_sampler_active, memory_order_acquire);
+    if (!sampler)
+        return;
+    ucontext_t *uc = context;
+    uintptr_t pc = uc->uc_mcontext.gregs[REG_RIP];
+    size_t i = atomic_fetch_add_explicit(&sampler->count, 1,
+                                         memory_order_relaxed);
+    if (i < sampler->capacity)
+        sampler->pcs[i] = pc;
+}
+
+void sampler_init(struct sampler *sampler, size_t capacity) {
+    *sampler = (struct sampler){.capacity = capacity};
+    sampler->pcs = dmalloc(sizeof(uintptr_t) * capacity);
+    atomic_init(&sampler->count, 0);
+    dbuffer_init(&sampler->regions);
+}
+
+void sampler_free(struct sampler *sampler) {
+    assert(atomic_load(&_sampler_active) != sampler &&
+           "sampler is still running");
+    size_t count = sampler->regions.usage / sizeof(struct sampler_region);
+    struct sampler_region *regions = sampler->regions.buffer;
+    for (size_t i = 0; i < count; i++) {
+        free(regions[i].name.ptr);
+        free(regions[i].functionName.ptr);
+    }
+    dbuffer_free(&sampler->regions);
+    free(sampler->pcs);
+}
+
+int _sampler_compareRegions(const void *a, const void *b) {
+    const struct sampler_region *x = a, *y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+void _sampler_addRegion(struct sampler *sampler, struct jit_symbol *symbol,
+                        struct jit_symbol *function) {
+    struct sampler_region region = {
+        .start = (uintptr_t)symbol->code,
+        .end = (uintptr_t)symbol->code + symbol->size,
+        .name = range_copy(&symbol->name),
+        .functionName = range_copy(&function->name),
+        .fn = symbol->fn,
+        .block = symbol->block,
+    };
+    dbuffer_pushData(&sampler->regions, &region, sizeof(region));
+}
+
+void sampler_addBatch(struct sampler *sampler, struct jit_batch *batch) {
+    struct jit_symbol *symbols = batch->symbols;
+    for (size_t i = 0; i < batch->symbolCount; i += symbols[i].blockCount + 1) {
+        if (!symbols[i].blockCount)
+            _sampler_addRegion(sampler, &symbols[i], &symbols[i]);
+        for (size_t j = 1; j <= symbols[i].blockCount; j++)
+            _sampler_addRegion(sampler, &symbols[i + j], &symbols[i]);
+    }
+    qsort(sampler->regions.buffer,
+          sampler->regions.usage / sizeof(struct sampler_region),
+          sizeof(struct sampler_region), _sampler_compareRegions);
+}
+
+int sampler_start(struct sampler *sampler, long interval) {
+    struct sampler *expected = NULL;
+    if (!atomic_compare_exchange_strong(&_sampler_active, &expected, sampler))
+        return 0;
+
+    struct sigaction action = {};
+    action.sa_sigaction = _sampler_signal;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &sampler->oldAction)) {
+        atomic_store(&_sampler_active, NULL);
+        return 0;
+    }
+
+    struct itimerval timer = {
+        .it_interval = {interval / 1000000, interval % 1000000},
+        .it_value = {interval / 1000000, interval % 1000000},
+    };
+    if (setitimer(ITIMER_PROF, &timer, NULL)) {
+        sigaction(SIGPROF, &sampler->oldAction, NULL);
+        atomic_store(&_sampler_active, NULL);
+        return 0;
+    }
+    return 1;
+}
+
+void sampler_stop(struct sampler *sampler) {
+    assert(atomic_load(&_sampler_active) == sampler &&
+           "sampler isn't running");
+    struct itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, NULL);
+
+    // A tick may still be pending, it must not kill the process.
+    struct sigaction old = sampler->oldAction;
+    if (!(old.sa_flags & SA_SIGINFO) && old.sa_handler == SIG_DFL)
+        old.sa_handler = SIG_IGN;
+    sigaction(SIGPROF, &old, NULL);
+    atomic_store(&_sampler_active, NULL);
+}
+
+struct sampler_region *sampler_find(struct sampler *sampler, void *pc) {
+    struct sampler_region *regions = sampler->regions.buffer;
+    size_t low = 0;
+    size_t high = sampler->regions.usage / sizeof(struct sampler_region);
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (regions[mid].start <= (uintptr_t)pc)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (!low || (uintptr_t)pc >= regions[low - 1].end)
+        return NULL;
+    return &regions[low - 1];
+}
+
+void sampler_collect(struct sampler *sampler) {
+    size_t count = atomic_load(&sampler->count);
+    if (count > sampler->capacity)
+        count = sampler->capacity;
+    for (size_t i = sampler->collected; i < count; i++) {
+        struct sampler_region *region =
+            sampler_find(sampler, (void *)sampler->pcs[i]);
+        if (region)
+            region->samples++;
+        else
+            sampler->outside++;
+    }
+    sampler->collected = count;
+}
+
+struct _sampler_line {
+    range_t name;
+    size_t samples;
+};
+
+int _sampler_compareLines(const void *a, const void *b) {
+    const struct _sampler_line *x = a, *y = b;
+    return x->samples > y->samples ? -1 : x->samples < y->samples;
+}
+
+void _sampler_print(FILE *file, char *title, dbuffer_t *lines, size_t total) {
+    size_t count = lines->usage / sizeof(struct _sampler_line);
+    struct _sampler_line *line = lines->buffer;
+    qsort(line, count, sizeof(struct _sampler_line), _sampler_compareLines);
+    fprintf(file, "%s\n", title);
+    for (size_t i = 0; i < count && line[i].samples; i++) {
+        fprintf(file, "%6.2f%% %8zu  %.*s\n", 100.0 * line[i].samples / total,
+                line[i].samples, (int)line[i].name.size, line[i].name.ptr);
+    }
+}
+
+void sampler_report(struct sampler *sampler, FILE *file) {
+    sampler_collect(sampler);
+    size_t count = sampler->regions.usage / sizeof(struct sampler_region);
+    struct sampler_region *regions = sampler->regions.buffer;
+    size_t taken = atomic_load(&sampler->count);
+    size_t total = sampler->collected ? sampler->collected : 1;
+    fprintf(file, "%zu samples, %zu outside of JITed code, %zu dropped\n",
+            sampler->collected, sampler->outside, taken - sampler->collected);
+
+    // The blocks of a function are next to each other.
+    dbuffer_t functions, blocks;
+    dbuffer_init(&functions);
+    dbuffer_init(&blocks);
+    for (size_t i = 0; i < count; i++) {
+        struct _sampler_line line = {regions[i].name, regions[i].samples};
+        dbuffer_pushData(&blocks, &line, sizeof(line));
+
+        size_t last = functions.usage / sizeof(line);
+        struct _sampler_line *lines = functions.buffer;
+        if (last && range_cmp(lines[last - 1].name, regions[i].functionName)) {
+            lines[last - 1].samples += regions[i].samples;
+            continue;
+        }
+        line.name = regions[i].functionName;
+        dbuffer_pushData(&functions, &line, sizeof(line));
+    }
+
+    _sampler_print(file, "functions:", &functions, total);
+    _sampler_print(file, "blocks:", &blocks, total);
+    dbuffer_free(&functions);
+    dbuffer_free(&blocks);
+}
@@ -0,0 +1,63 @@
+// In-process sampling profiler for JITed code. A SIGPROF timer records the
+// interrupted pc into a preallocated buffer, the samples are attributed to
+// the functions and blocks of the registered batches afterwards. Only one
+// sampler can run at a time.
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "buffer.h"
+#include "jit.h"
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// A block of JITed code, or a whole function if it has no block symbols.
+struct sampler_region {
+    uintptr_t start;
+    uintptr_t end;
+    range_t name;
+    range_t functionName;
+    // Only valid while the IR is alive, block is NULL for whole functions.
+    function_t *fn;
+    basic_block_t *block;
+    size_t samples;
+};
+
+struct sampler {
+    uintptr_t *pcs;
+    size_t capacity;
+    // Samples taken, may be bigger than the capacity.
+    atomic_size_t count;
+    // sampler_region entries sorted by address.
+    dbuffer_t regions;
+    // Samples that are already attributed, and the ones outside of JITed
+    // code.
+    size_t collected;
+    size_t outside;
+    struct sigaction oldAction;
+};
+
+void sampler_init(struct sampler *sampler, size_t capacity);
+void sampler_free(struct sampler *sampler);
+
+// Register the code of the batch, names are copied so the batch may be freed
+// before the report.
+void sampler_addBatch(struct sampler *sampler, struct jit_batch *batch);
+
+// Take a sample every @interval microseconds of CPU time. Returns 0 if
+// another sampler is running or the timer can't be set up.
+int sampler_start(struct sampler *sampler, long interval);
+void sampler_stop(struct sampler *sampler);
+
+// Attribute the samples taken so far to the regions, the sampler must not be
+// running.
+void sampler_collect(struct sampler *sampler);
+// Region that holds @pc, NULL if it isn't registered JITed code.
+struct sampler_region *sampler_find(struct sampler *sampler, void *pc);
+
+// Flat profile of the functions followed by the hottest blocks.
+void sampler_report(struct sampler *sampler, FILE *file);
+
+#endif
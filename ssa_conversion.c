@@ -350,7 +350,8 @@ void ssa_convert(ir_context_t *ctx, function_t *fun, struct dominators *doms,
     dbuffer_t worklist;
     dbuffer_init(&worklist);
 
-    // we use this as a set.
+    // we use this as a set, blocks seen for variable i hold i + 1 so the zeroed
+    // array is empty for the first variable too.
     size_t *lastIteration = dzmalloc(doms->elementCount * sizeof(size_t));
 
     // iterate over variables. Examine blocks that assigned to it.
@@ -367,7 +368,7 @@ void ssa_convert(ir_context_t *ctx, function_t *fun, struct dominators *doms,
             inst_assign_var_t *assign = assigns[iA];
             basic_block_t *block = assign->inst.parent;
             size_t bId = dominators_getNumber(doms, block);
-            lastIteration[bId] = i;
+            lastIteration[bId] = i + 1;
             dbuffer_pushPtr(&worklist, assign->var->value);
             dbuffer_pushPtr(&worklist, block);
         }
@@ -393,8 +394,8 @@ void ssa_convert(ir_context_t *ctx, function_t *fun, struct dominators *doms,
 
                 // if we haven't visited this block for this variable, insert it
                 // into our worklist.
-                if (lastIteration[bId] < i) {
-                    lastIteration[bId] = i; // now we did.
+                if (lastIteration[bId] < i + 1) {
+                    lastIteration[bId] = i + 1; // now we did.
                     dbuffer_pushPtr(&worklist, &phi->phiInst->inst.value);
                     dbuffer_pushPtr(&worklist, dfBlock);
                 }
@@ -449,3 +450,12 @@ void ssa_convert(ir_context_t *ctx, function_t *fun, struct dominators *doms,
 
     free(blockInfo);
 }
+
+void ssa_convertFunction(ir_context_t *ctx, function_t *fun) {
+    struct dominators doms;
+    dominators_compute(&doms, fun->entry);
+    struct domfrontiers df;
+    domfrontiers_compute(&df, &doms);
+    ssa_convert(ctx, fun, &doms, &df);
+    dominators_free(&doms);
+}
@@ -5,6 +5,8 @@
 // Convert the function to the ssa form.
 void ssa_convert(ir_context_t *ctx, function_t *fun, struct dominators *doms,
                  struct domfrontiers *df);
+// Compute the dominators of the function and convert it.
+void ssa_convertFunction(ir_context_t *ctx, function_t *fun);
 
 // Convert back from the ssa form.
 // This will insert new copies as needed.
@@ -0,0 +1,175 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ir_creation.h"
+#include "jit.h"
+#include "parser.h"
+#include "ssa_conversion.h"
+
+typedef int64_t (*native1)(int64_t);
+typedef int64_t (*native2)(int64_t, int64_t);
+typedef int64_t (*native8)(int64_t, int64_t, int64_t, int64_t, int64_t,
+                           int64_t, int64_t, int64_t);
+
+// sub is called before it is defined, weigh has stack arguments.
+const char *source =
+    "int64 weigh(int64 a, int64 b, int64 c, int64 d, int64 e, int64 f,\n"
+    "            int64 g, int64 h) {\n"
+    "    return a + (b * 2) + (c * 3) + (d * 4) + (e * 5) + (f * 6) +\n"
+    "           (g * 7) + (h * 8);\n"
+    "}\n"
+    "int64 fib(int64 n) {\n"
+    "    if (n < 2) {\n"
+    "        return n;\n"
+    "    }\n"
+    "    return fib(n - 1) + fib(n - 2);\n"
+    "}\n"
+    "void nothing(int64 a) {\n"
+    "    return;\n"
+    "}\n"
+    "int64 swap(int64 a, int64 b) {\n"
+    "    return sub(b, a);\n"
+    "}\n"
+    "int64 sub(int64 a, int64 b) {\n"
+    "    return a - b;\n"
+    "}\n"
+    "int64 loop(int64 n) {\n"
+    "    int64 s = 0;\n"
+    "    int64 i = 0;\n"
+    "    while (i < n) {\n"
+    "        nothing(i);\n"
+    "        s = s + weigh(i, 1, 2, 3, 4, 5, i * 2, s);\n"
+    "        i = i + 1;\n"
+    "    }\n"
+    "    return s + n;\n"
+    "}\n"
+    "int64 wide(int64 a) {\n"
+    "    int64 b = a * 2;\n"
+    "    int64 c = a * 3;\n"
+    "    int64 d = a * 4;\n"
+    "    int64 e = a * 5;\n"
+    "    int64 f = a * 6;\n"
+    "    int64 g = a * 7;\n"
+    "    int64 h = a * 8;\n"
+    "    int64 i = a * 9;\n"
+    "    int64 j = a * 10;\n"
+    "    int64 k = a * 11;\n"
+    "    return a + b + c + d + e + f + g + h + i + j + k;\n"
+    "}\n";
+
+// Calls @fn(@arg) with known values in the callee saved registers,
+// *@changed is zero if they all survived.
+int64_t checkedCall(void *fn, int64_t arg, int64_t *changed);
+__asm__(".text\n"
+        "checkedCall:\n"
+        "    push %rbx\n"
+        "    push %rbp\n"
+        "    push %r12\n"
+        "    push %r13\n"
+        "    push %r14\n"
+        "    push %r15\n"
+        "    push %rdx\n"
+        "    mov $0x1111, %rbx\n"
+        "    mov $0x2222, %rbp\n"
+        "    mov $0x3333, %r12\n"
+        "    mov $0x4444, %r13\n"
+        "    mov $0x5555, %r14\n"
+        "    mov $0x6666, %r15\n"
+        "    mov %rdi, %rax\n"
+        "    mov %rsi, %rdi\n"
+        "    call *%rax\n"
+        "    pop %rdx\n"
+        "    xor $0x1111, %rbx\n"
+        "    xor $0x2222, %rbp\n"
+        "    xor $0x3333, %r12\n"
+        "    xor $0x4444, %r13\n"
+        "    xor $0x5555, %r14\n"
+        "    xor $0x6666, %r15\n"
+        "    or %rbp, %rbx\n"
+        "    or %r12, %rbx\n"
+        "    or %r13, %rbx\n"
+        "    or %r14, %rbx\n"
+        "    or %r15, %rbx\n"
+        "    mov %rbx, (%rdx)\n"
+        "    pop %r15\n"
+        "    pop %r14\n"
+        "    pop %r13\n"
+        "    pop %r12\n"
+        "    pop %rbp\n"
+        "    pop %rbx\n"
+        "    ret\n");
+
+int64_t checked(void *fn, int64_t arg) {
+    int64_t changed = -1;
+    int64_t result = checkedCall(fn, arg, &changed);
+    assert(!changed && "callee saved register was clobbered");
+    return result;
+}
+
+int64_t weigh(int64_t a, int64_t b, int64_t c, int64_t d, int64_t e,
+              int64_t f, int64_t g, int64_t h) {
+    return a + b * 2 + c * 3 + d * 4 + e * 5 + f * 6 + g * 7 + h * 8;
+}
+
+int64_t fib(int64_t n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }
+
+int64_t loop(int64_t n) {
+    int64_t s = 0;
+    for (int64_t i = 0; i < n; i++)
+        s = s + weigh(i, 1, 2, 3, 4, 5, i * 2, s);
+    return s + n;
+}
+
+function_t **compileModule(ir_context_t *ctx, size_t *count) {
+    parser_t parser;
+    parser_init(&parser, range_fromString((char *)source));
+    struct ast_node *node = parser_parseModule(&parser);
+    assert(node && "can't parse the source");
+
+    struct ir_creator creator;
+    ir_creator_init(&creator, ctx);
+    function_t **functions =
+        ir_creator_createModule(&creator, AST_AS_TYPE(node, module), count);
+    zone_free(&parser.zone);
+
+    for (size_t i = 0; i < *count; i++)
+        ssa_convertFunction(ctx, functions[i]);
+    return functions;
+}
+
+int main() {
+    ir_context_t ctx;
+    ir_context_init(&ctx);
+    size_t count;
+    function_t **functions = compileModule(&ctx, &count);
+    assert(count == 7);
+    assert(functions[0]->argumentCount == 8);
+    assert(functions[2]->returnType == VOID);
+
+    struct jit_batch batch;
+    jit_compileBatch(&ctx, functions, count, &batch);
+
+    native8 weighFn = batch.entries[0];
+    assert(weighFn(1, 2, 3, 4, 5, 6, 7, 8) == weigh(1, 2, 3, 4, 5, 6, 7, 8));
+    assert(weighFn(-1, 0, 0, 0, 0, 0, 9, -3) ==
+           weigh(-1, 0, 0, 0, 0, 0, 9, -3));
+    for (int64_t n = 0; n < 16; n++)
+        assert(checked(batch.entries[1], n) == fib(n));
+    ((void (*)(int64_t))batch.entries[2])(1);
+    assert(((native2)batch.entries[3])(3, 10) == 7);
+    assert(((native2)batch.entries[4])(3, 10) == -7);
+    for (int64_t n = 0; n < 8; n++)
+        assert(checked(batch.entries[5], n) == loop(n));
+    assert(checked(batch.entries[6], 3) == 3 * 66);
+
+    // Leaf functions that don't spill run without a frame, push rbp is 0x55.
+    assert(*(uint8_t *)batch.entries[4] != 0x55);
+    assert(*(uint8_t *)batch.entries[1] == 0x55);
+
+    jit_batch_free(&batch);
+    free(functions);
+    ir_context_free(&ctx);
+    puts("call tests passed");
+    return 0;
+}
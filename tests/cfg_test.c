@@ -22,7 +22,7 @@ basic_block_t *create_test_cfg(ir_context_t *ctx, function_t *fn) {
         block_insert(prev, &jmp->inst);
         prev = nblock;
     }
-    block_insert(prev, &inst_new_return(ctx)->inst);
+    block_insert(prev, &inst_new_return(ctx, NULL)->inst);
     return result;
 }
 
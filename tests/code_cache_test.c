@@ -0,0 +1,138 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "code_cache.h"
+#include "codegen.h"
+#include "x86_64.h"
+
+int64_t gValue = 40;
+
+int resolve(void *ctx, range_t name, unsigned long *address) {
+    if (!RANGE_COMPARE(name, "value"))
+        return 0;
+    *address = (unsigned long)&gValue;
+    return 1;
+}
+
+int resolveNothing(void *ctx, range_t name, unsigned long *address) {
+    return 0;
+}
+
+// return *value + 2, jumps over dead code so local relocations get stored.
+void emitFunction(struct codegen *cg, label_t *value, label_t *skip) {
+    codegen_addLabel(cg, value);
+
+    emit_storeLabel64(&cg->buffer, RCX, value);
+    emit_storeConst64(&cg->buffer, RAX, 2);
+    codegen_jump(cg, skip);
+    emit_storeConst64(&cg->buffer, RAX, 100);
+    codegen_pushBlock(cg, skip);
+    emit_aluRegMem64(&cg->buffer, ALU_ADD, RAX, RCX, 0);
+    emit_ret(&cg->buffer);
+    codegen_relaxBranches(cg);
+}
+
+// Overwrite @size bytes at @offset of the entry of @key.
+void patchEntry(char *directory, uint64_t key, long offset, void *data,
+                size_t size) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%016lx.mcc", directory,
+             (unsigned long)key);
+    FILE *file = fopen(path, "r+b");
+    assert(file && "missing entry");
+    fseek(file, offset, SEEK_SET);
+    fwrite(data, 1, size, file);
+    fclose(file);
+}
+
+// Corrupt entries must miss instead of crashing.
+void testCorrupt(struct code_cache *cache, char *directory, uint64_t key,
+                 range_t source, struct codegen *cg, range_t *names) {
+    struct code_cache_entry entry;
+    // relocCount follows magic, version, key and codeSize, the count wraps
+    // around when it is multiplied by the record size.
+    uint64_t count = UINT64_MAX / 3 + 1;
+    assert(
+        code_cache_store(cache, key, source, &cg->buffer, &cg->relocs, names));
+    patchEntry(directory, key, 24, &count, sizeof(count));
+    assert(!code_cache_load(cache, key, source, resolve, NULL, &entry));
+
+    // The size byte of the first relocation record.
+    long relocations = (56 + cg->buffer.usage + 7) / 8 * 8;
+    uint8_t size = 7;
+    assert(
+        code_cache_store(cache, key, source, &cg->buffer, &cg->relocs, names));
+    patchEntry(directory, key, relocations + 17, &size, 1);
+    assert(!code_cache_load(cache, key, source, resolve, NULL, &entry));
+}
+
+int main(int argc, char *args[]) {
+    char directory[] = "/tmp/code_cache_testXXXXXX";
+    assert(mkdtemp(directory) && "can't create the cache directory");
+    struct code_cache cache;
+    code_cache_init(&cache, directory);
+
+    range_t source = RANGE_STRING("function(a) { return a + 2; }");
+    uint64_t key = code_cache_key(source, 0);
+    assert(key != code_cache_key(source, 1) && "options must change the key");
+
+    struct code_cache_entry entry;
+    assert(!code_cache_load(&cache, key, source, resolve, NULL, &entry));
+
+    struct codegen cg;
+    codegen_init(&cg, 10);
+    label_t value = (label_t){};
+    label_t skip = (label_t){};
+    emitFunction(&cg, &value, &skip);
+
+    size_t labelCount;
+    reloc_table_labels(&cg.relocs, &labelCount);
+    range_t names[labelCount];
+    memset(names, 0, sizeof(names));
+    names[value.index] = RANGE_STRING("value");
+    assert(
+        code_cache_store(&cache, key, source, &cg.buffer, &cg.relocs, names));
+
+    assert(!code_cache_load(&cache, code_cache_key(source, 1), source,
+                            resolve, NULL, &entry));
+    assert(!code_cache_load(&cache, key, source, resolveNothing, NULL,
+                            &entry) &&
+           "unresolved names must miss");
+    // A colliding key or a stale file holds the code of another source.
+    range_t other = RANGE_STRING("function(a) { return a + 3; }");
+    assert(!code_cache_load(&cache, key, other, resolve, NULL, &entry) &&
+           "other sources must miss");
+    range_t prefix = (range_t){.ptr = source.ptr, .size = source.size - 1};
+    assert(!code_cache_load(&cache, key, prefix, resolve, NULL, &entry));
+
+    assert(code_cache_load(&cache, key, source, resolve, NULL, &entry));
+    assert(entry.size == cg.buffer.usage);
+    int64_t result = ((int64_t(*)())entry.code)();
+    assert(result == 42 && "wrong result");
+    code_cache_entry_free(&entry);
+
+    // A named label is resolved again even if it has an address already,
+    // an unnamed address is never stored.
+    label_setOffset(&value, 1);
+    uint64_t resolvedKey = code_cache_key(source, 2);
+    assert(code_cache_store(&cache, resolvedKey, source, &cg.buffer,
+                            &cg.relocs, names));
+    assert(
+        code_cache_load(&cache, resolvedKey, source, resolve, NULL, &entry));
+    assert(((int64_t(*)())entry.code)() == 42);
+    code_cache_entry_free(&entry);
+    names[value.index] = (range_t){};
+    assert(!code_cache_store(&cache, resolvedKey, source, &cg.buffer,
+                             &cg.relocs, names));
+    names[value.index] = RANGE_STRING("value");
+
+    testCorrupt(&cache, directory, code_cache_key(source, 3), source, &cg,
+                names);
+    codegen_free(&cg);
+
+    char command[128];
+    snprintf(command, sizeof(command), "rm -r %s", directory);
+    system(command);
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "code_heap.h"
+#include "x86_64.h"
+
+// Write a function that returns @value.
+struct code_range emitConstant(struct code_heap *heap, long value) {
+    dbuffer_t dbuffer;
+    dbuffer_init(&dbuffer);
+    emit_storeConst64(&dbuffer, RAX, value);
+    emit_ret(&dbuffer);
+
+    struct code_range range = code_heap_allocate(heap, dbuffer.usage);
+    memcpy(range.rw, dbuffer.buffer, dbuffer.usage);
+    dbuffer_free(&dbuffer);
+    return range;
+}
+
+long call(struct code_range range) { return ((long (*)())range.rx)(); }
+
+void test_heap(int flags) {
+    struct code_heap heap;
+    assert(code_heap_init(&heap, flags));
+
+    // Small functions must be packed together.
+    struct code_range ranges[1000];
+    for (int i = 0; i < 1000; i++)
+        ranges[i] = emitConstant(&heap, i);
+    for (int i = 0; i < 1000; i++)
+        assert(call(ranges[i]) == i);
+    assert(ranges[1].rx == ranges[0].rx + 16);
+    assert(heap.regions.usage == sizeof(struct code_region));
+
+    // Freed ranges get reused.
+    code_heap_deallocate(&heap, ranges[10]);
+    struct code_range reused = emitConstant(&heap, 42);
+    assert(reused.rx == ranges[10].rx && call(reused) == 42);
+
+    // Adjacent free ranges get merged.
+    for (int i = 100; i < 110; i++)
+        code_heap_deallocate(&heap, ranges[i]);
+    struct code_range merged = code_heap_allocate(&heap, 16 * 10);
+    assert(merged.rx == ranges[100].rx);
+
+    // Allocations that are bigger than a region get their own region.
+    struct code_range big =
+        code_heap_allocate(&heap, CODE_HEAP_REGION_SIZE + 1);
+    assert(big.size >= CODE_HEAP_REGION_SIZE + 1);
+    assert(heap.regions.usage == 2 * sizeof(struct code_region));
+
+    code_heap_free(&heap);
+}
+
+int main(int argc, char *args[]) {
+    test_heap(0);
+    // Falls back to normal pages if no huge pages are reserved.
+    test_heap(CODE_HEAP_HUGE_PAGES);
+    return 0;
+}
@@ -0,0 +1,131 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include "code_table.h"
+#include "ir.h"
+#include "jit.h"
+
+#define CONST(ctx, n) (&ir_constant_value((ctx), (n))->value)
+#define READERS 4
+#define VERSIONS 200
+
+typedef int64_t (*native0)();
+
+// int64 version() { return n; }
+void *compileVersion(ir_context_t *ctx, int64_t n, struct jit_batch *batch) {
+    function_t *fn = ir_new_function(ctx, RANGE_STRING("version"));
+    fn->returnType = DT_INT64;
+    fn->entry = block_new(ctx, fn);
+    block_insert(fn->entry, &inst_new_return(ctx, CONST(ctx, n))->inst);
+    jit_compileBatch(ctx, &fn, 1, batch);
+    return batch->entries[0];
+}
+
+void install(struct code_table *table, struct code_slot *slot,
+             ir_context_t *ctx, int64_t n) {
+    struct jit_batch batch;
+    void *entry = compileVersion(ctx, n, &batch);
+    code_table_install(table, slot, batch, entry);
+}
+
+void testRetire() {
+    ir_context_t ctx;
+    ir_context_init(&ctx);
+    struct code_table table;
+    code_table_init(&table);
+    struct code_slot *slot = code_table_add(&table);
+    assert(code_slot_entry(slot) == NULL);
+
+    struct code_table_thread thread;
+    code_table_register(&table, &thread);
+    install(&table, slot, &ctx, 1);
+
+    code_table_enter(&table, &thread);
+    native0 old = code_slot_entry(slot);
+    assert(old() == 1);
+
+    // The thread may still run the old code.
+    install(&table, slot, &ctx, 2);
+    assert(code_table_reclaim(&table) == 1);
+    assert(old() == 1);
+    assert(((native0)code_slot_entry(slot))() == 2);
+    code_table_leave(&thread);
+
+    assert(code_table_reclaim(&table) == 0);
+
+    // Threads outside of the table don't hold code back.
+    install(&table, slot, &ctx, 3);
+    assert(code_table_reclaim(&table) == 0);
+    assert(((native0)code_slot_entry(slot))() == 3);
+
+    code_table_unregister(&table, &thread);
+    code_table_free(&table);
+    ir_context_free(&ctx);
+}
+
+struct reader {
+    struct code_table *table;
+    struct code_slot *slot;
+    atomic_int *stop;
+    size_t calls;
+};
+
+void *readerMain(void *arg) {
+    struct reader *reader = arg;
+    struct code_table_thread thread;
+    code_table_register(reader->table, &thread);
+
+    int64_t last = 0;
+    while (!atomic_load(reader->stop)) {
+        code_table_enter(reader->table, &thread);
+        int64_t version = ((native0)code_slot_entry(reader->slot))();
+        code_table_leave(&thread);
+        assert(version >= last && version <= VERSIONS &&
+               "went back to an old version");
+        last = version;
+        reader->calls++;
+    }
+
+    code_table_unregister(reader->table, &thread);
+    return NULL;
+}
+
+void testHotSwap() {
+    ir_context_t ctx;
+    ir_context_init(&ctx);
+    struct code_table table;
+    code_table_init(&table);
+    struct code_slot *slot = code_table_add(&table);
+    install(&table, slot, &ctx, 1);
+
+    atomic_int stop = 0;
+    pthread_t threads[READERS];
+    struct reader readers[READERS];
+    for (size_t i = 0; i < READERS; i++) {
+        readers[i] =
+            (struct reader){.table = &table, .slot = slot, .stop = &stop};
+        pthread_create(&threads[i], NULL, readerMain, &readers[i]);
+    }
+
+    for (int64_t n = 2; n <= VERSIONS; n++)
+        install(&table, slot, &ctx, n);
+
+    atomic_store(&stop, 1);
+    for (size_t i = 0; i < READERS; i++)
+        pthread_join(threads[i], NULL);
+
+    // Every replaced version is freed once the readers are gone.
+    assert(code_table_reclaim(&table) == 0);
+    assert(((native0)code_slot_entry(slot))() == VERSIONS);
+
+    code_table_free(&table);
+    ir_context_free(&ctx);
+}
+
+int main() {
+    testRetire();
+    testHotSwap();
+    puts("code table tests passed");
+    return 0;
+}
@@ -3,21 +3,16 @@
 #include "x86_64.h"
 #include "x86_64_codegen.h"
 
-int main() {
+void test_loop() {
     struct codegen cg;
     codegen_init(&cg, 10);
     label_t putsLabel = (label_t){};
-    label_t stackSize = (label_t){};
     label_t startBlock = (label_t){};
     label_t loopBlock = (label_t){};
 
     struct variable *vars[2];
     codegen_initFunction(&cg, 2, vars);
 
-    emit_pushReg(&cg.buffer, RBP);
-    emit_storeReg64(&cg.buffer, RSP, RBP);
-    emit_subLabel64(&cg.buffer, RSP, &stackSize);
-
     codegen_pushBlock(&cg, &startBlock);
     struct variable *counter = codegen_newVar(&cg);
     variable_ref(&cg, counter);
@@ -25,7 +20,7 @@ int main() {
     codegen_popBlock(&cg);
     codegen_pushBlock(&cg, &loopBlock);
 
-    struct variable *args[] = {vars[0]};
+    struct arch_argument args[] = {{vars[0]}};
     arch_functionCall(&cg, &putsLabel, 1, args);
 
     variable_ref(&cg, counter);
@@ -34,25 +29,25 @@ int main() {
     emit_checkZero64(&cg.buffer, arch_getRealReg(counter));
 
     codegen_popBlock(&cg);
-    emit_jumpZeroRel8(&cg.buffer, &loopBlock);
+    codegen_jumpCond(&cg, CC_NE, &loopBlock);
 
-    emit_storeReg64(&cg.buffer, RBP, RSP);
-    emit_popReg(&cg.buffer, RBP);
+    arch_frameEpilogue(&cg.buffer);
     emit_ret(&cg.buffer);
 
+    // The frame size is known now, the prologue goes in front of the body.
+    struct codegen_insertion prologue = {.offset = 0};
+    dbuffer_init(&prologue.code);
+    arch_framePrologue(&prologue.code, cg.frameSize);
+    codegen_insert(&cg, &prologue, 1);
+    dbuffer_free(&prologue.code);
+
+    codegen_relaxBranches(&cg);
     void *ptr = allocate_executable(cg.buffer.usage);
 
     label_setOffset(&putsLabel, (unsigned long)puts);
-    label_setOffset(&stackSize, cg.frameSize * 8);
 
     // relative to the memory location.
-
-    label_applyMemory(&putsLabel, cg.buffer.buffer, (unsigned long)ptr);
-
-    label_apply(&stackSize, cg.buffer.buffer);
-
-    label_apply(&startBlock, cg.buffer.buffer);
-    label_apply(&loopBlock, cg.buffer.buffer);
+    reloc_table_apply(&cg.relocs, cg.buffer.buffer, (unsigned long)ptr);
 
     FILE *file = fopen("cg_out.out", "wb");
     dbuffer_write(&cg.buffer, file);
@@ -61,7 +56,57 @@ int main() {
 
     memcpy(ptr, cg.buffer.buffer, cg.buffer.usage);
     ((void (*)(char *, int))ptr)("test", 10);
+}
+
+// Jumps that are in range must stay short, the rest must be widened.
+void test_relaxation() {
+    struct codegen cg;
+    codegen_init(&cg, 10);
+    label_t loop = (label_t){};
+    label_t skip = (label_t){};
+    label_t near = (label_t){};
+    label_t exit = (label_t){};
+
+    emit_storeConst64(&cg.buffer, RAX, 0);
+    codegen_pushBlock(&cg, &loop);
+    // Loop body that doesn't fit in a rel8 jump.
+    for (int i = 0; i < 40; i++)
+        emit_aluRegImm64(&cg.buffer, ALU_ADD, RAX, 0);
+    emit_aluRegImm64(&cg.buffer, ALU_ADD, RAX, 1);
+    emit_aluRegImm64(&cg.buffer, ALU_CMP, RAX, 10);
+    codegen_jumpCond(&cg, CC_L, &loop);
+
+    codegen_jump(&cg, &near);
+    codegen_pushBlock(&cg, &near);
+    codegen_jump(&cg, &skip);
+    // Skipped code that doesn't fit in a rel8 jump.
+    for (int i = 0; i < 40; i++)
+        emit_aluRegImm64(&cg.buffer, ALU_ADD, RAX, 100);
+    codegen_pushBlock(&cg, &skip);
+    codegen_jumpCond(&cg, CC_E, &exit);
+    emit_aluRegImm64(&cg.buffer, ALU_ADD, RAX, 100);
+    codegen_pushBlock(&cg, &exit);
+    emit_ret(&cg.buffer);
+
+    codegen_relaxBranches(&cg);
 
+    struct branch *branches = cg.branches.buffer;
+    assert(branches[0].isLong && "backward jump must be widened");
+    assert(!branches[1].isLong && "near jump must stay short");
+    assert(branches[2].isLong && "forward jump must be widened");
+    assert(!branches[3].isLong && "near jump must stay short");
+    assert(((uint8_t *)cg.buffer.buffer)[branches[1].offset] == 0xEB);
+
+    void *ptr = allocate_executable(cg.buffer.usage);
+    reloc_table_apply(&cg.relocs, cg.buffer.buffer, (unsigned long)ptr);
+    memcpy(ptr, cg.buffer.buffer, cg.buffer.usage);
+    long result = ((long (*)())ptr)();
+    assert(result == 10 && "wrong result");
+}
+
+int main() {
+    test_loop();
+    test_relaxation();
     return 0;
 }
 
@@ -0,0 +1,114 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "compile_queue.h"
+
+typedef int64_t (*native0)();
+
+char *sumSource = "int64 sum() {                  "
+                  "   int64 i = 0;                "
+                  "   int64 s = 0;                "
+                  "   while (i < 10) {            "
+                  "       s = s + i;              "
+                  "       i = i + 1;              "
+                  "   }                           "
+                  "   return s;                   "
+                  "}                              ";
+
+char *constSource = "int64 answer() { return 6 * 7; }";
+
+void testCompile() {
+    struct compile_queue queue;
+    compile_queue_init(&queue, 2);
+
+    struct compile_job *sum =
+        compile_queue_submit(&queue, range_fromString(sumSource), 0, 0);
+    struct compile_job *answer =
+        compile_queue_submit(&queue, range_fromString(constSource), 0, 0);
+
+    assert(compile_job_wait(&queue, sum) == COMPILE_DONE);
+    assert(compile_job_wait(&queue, answer) == COMPILE_DONE);
+    assert(((native0)sum->entry)() == 45);
+    assert(((native0)answer->entry)() == 42);
+
+    compile_job_release(&queue, sum);
+    compile_job_release(&queue, answer);
+    compile_queue_free(&queue);
+}
+
+void testFailure() {
+    struct compile_queue queue;
+    compile_queue_init(&queue, 1);
+
+    struct compile_job *job =
+        compile_queue_submit(&queue, RANGE_STRING("int64 broken( {"), 0, 0);
+    assert(compile_job_wait(&queue, job) == COMPILE_FAILED);
+    assert(job->error);
+
+    compile_job_release(&queue, job);
+    compile_queue_free(&queue);
+}
+
+void testPriority() {
+    struct compile_queue queue;
+    compile_queue_init(&queue, 1);
+
+    range_t source = range_fromString(sumSource);
+    struct compile_job *busy = compile_queue_submit(&queue, source, 0, 0);
+    while (compile_job_poll(busy) == COMPILE_PENDING)
+        ;
+
+    struct compile_job *low = compile_queue_submit(&queue, source, 0, 0);
+    struct compile_job *high =
+        compile_queue_submit(&queue, range_fromString(constSource), 10, 0);
+    struct compile_job *cancelled = compile_queue_submit(&queue, source, -1, 0);
+    compile_job_cancel(&queue, cancelled);
+    // Everything was queued before the worker picked the next job.
+    int ordered = compile_job_poll(busy) == COMPILE_RUNNING;
+
+    assert(compile_job_wait(&queue, low) == COMPILE_DONE);
+    if (ordered) {
+        assert(compile_job_poll(high) == COMPILE_DONE);
+        assert(compile_job_poll(cancelled) == COMPILE_CANCELLED);
+    }
+    assert(compile_job_wait(&queue, high) == COMPILE_DONE);
+    assert(((native0)high->entry)() == 42);
+    if (compile_job_wait(&queue, cancelled) == COMPILE_CANCELLED)
+        assert(cancelled->entry == NULL);
+
+    compile_job_release(&queue, busy);
+    compile_job_release(&queue, low);
+    compile_job_release(&queue, high);
+    compile_job_release(&queue, cancelled);
+    compile_queue_free(&queue);
+}
+
+void testBudget() {
+    struct compile_queue queue;
+    compile_queue_init(&queue, 1);
+
+    range_t source = range_fromString(sumSource);
+    struct compile_job *job = compile_queue_submit(&queue, source, 0, 1);
+    assert(compile_job_wait(&queue, job) == COMPILE_TIMED_OUT);
+    assert(job->entry == NULL);
+
+    // Released before it is done, the queue cleans up.
+    for (int i = 0; i < 16; i++)
+        compile_job_release(&queue,
+                            compile_queue_submit(&queue, source, i, 0));
+
+    compile_job_release(&queue, job);
+    compile_queue_free(&queue);
+}
+
+int main() {
+    testCompile();
+    testFailure();
+    testPriority();
+    testBudget();
+    puts("compile queue tests passed");
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "elf.h"
+#include "relocation.h"
+#include "x86_64.h"
+
+#define SYS_EXIT 60
+
+// Writes @name in @directory and returns its path in @path.
+void writeFile(char *directory, char *name, dbuffer_t *dbuffer, char *path,
+               size_t pathSize) {
+    snprintf(path, pathSize, "%s/%s", directory, name);
+    FILE *file = fopen(path, "wb");
+    assert(file && "can't open output");
+    dbuffer_write(dbuffer, file);
+    fclose(file);
+}
+
+// exit(*value + 2), where value lives in .data
+void emitExit(dbuffer_t *code, label_t *start, label_t *value) {
+    label_setPosition(start, code->usage);
+    emit_storeLabel64(code, RAX, value);
+    emit_storeConst64(code, RDI, 2);
+    emit_aluRegMem64(code, ALU_ADD, RDI, RAX, 0);
+    emit_storeConst64(code, RAX, SYS_EXIT);
+    emit_syscall(code);
+}
+
+void test_executable(char *directory) {
+    struct reloc_table relocs;
+    reloc_table_init(&relocs);
+    struct elf_writer writer;
+    elf_writer_init(&writer);
+
+    label_t start = (label_t){};
+    label_t value = (label_t){};
+    reloc_table_addLabel(&relocs, &start);
+    reloc_table_addLabel(&relocs, &value);
+
+    int64_t number = 40;
+    elf_writer_addData(&writer, ELF_DATA, &value, &number, sizeof(number), 8);
+    elf_writer_addSymbol(&writer, RANGE_STRING("_start"), &start, 1);
+
+    dbuffer_t code;
+    dbuffer_init(&code);
+    emitExit(&code, &start, &value);
+
+    dbuffer_t out;
+    dbuffer_init(&out);
+    elf_writer_writeExecutable(&writer, &code, &relocs, &start, &out);
+
+    struct elf64_header *header = out.buffer;
+    assert(header->type == ELF_ET_EXEC && header->phe_num == 2);
+    assert(header->entry_point == ELF_BASE_ADDRESS + ELF_PAGE_SIZE);
+    // The labels of the caller must stay untouched.
+    assert(value.hasOffset == 0 && start.offset == 0);
+
+    char path[128];
+    writeFile(directory, "elf_test.out", &out, path, sizeof(path));
+    chmod(path, 0755);
+    int status = system(path);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 42);
+    unlink(path);
+
+    dbuffer_free(&out);
+    dbuffer_free(&code);
+    elf_writer_free(&writer);
+    reloc_table_free(&relocs);
+}
+
+// long answer(void) { return helper() + *value; }, where value lives in
+// .rodata and helper comes from the driver.
+void emitAnswer(dbuffer_t *code, label_t *start, label_t *value,
+                label_t *helper) {
+    label_setPosition(start, code->usage);
+    emit_pushReg(code, RBX);
+    emit_storeLabel64(code, RBX, value);
+    emit_call(code, helper);
+    emit_aluRegMem64(code, ALU_ADD, RAX, RBX, 0);
+    emit_popReg(code, RBX);
+    emit_ret(code);
+}
+
+// Links the object at @object with a C driver and runs the result.
+int linkAndRun(char *directory, char *object) {
+    static char driver[] =
+        "long helper(void) { return 2; }\n"
+        "long answer(void);\n"
+        "int main(void) { return answer() == 42 ? 0 : 1; }\n";
+    dbuffer_t source;
+    dbuffer_init(&source);
+    dbuffer_pushData(&source, driver, sizeof(driver) - 1);
+    char driverPath[128];
+    writeFile(directory, "elf_driver.c", &source, driverPath,
+              sizeof(driverPath));
+    dbuffer_free(&source);
+
+    char binary[128];
+    snprintf(binary, sizeof(binary), "%s/elf_link", directory);
+    char command[512];
+    snprintf(command, sizeof(command),
+             "cc -no-pie -Wl,--fatal-warnings -o %s %s %s && %s", binary,
+             driverPath, object, binary);
+    int status = system(command);
+    unlink(driverPath);
+    unlink(binary);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void test_object(char *directory) {
+    struct reloc_table relocs;
+    reloc_table_init(&relocs);
+    struct elf_writer writer;
+    elf_writer_init(&writer);
+
+    label_t start = (label_t){};
+    label_t value = (label_t){};
+    label_t external = (label_t){};
+    reloc_table_addLabel(&relocs, &start);
+    reloc_table_addLabel(&relocs, &value);
+    reloc_table_addLabel(&relocs, &external);
+
+    int64_t number = 40;
+    elf_writer_addData(&writer, ELF_RODATA, &value, &number, sizeof(number), 8);
+    elf_writer_addSymbol(&writer, RANGE_STRING("answer"), &start, 1);
+    elf_writer_addSymbol(&writer, RANGE_STRING("helper"), &external, 1);
+
+    dbuffer_t code;
+    dbuffer_init(&code);
+    emitAnswer(&code, &start, &value, &external);
+
+    dbuffer_t out;
+    dbuffer_init(&out);
+    elf_writer_writeObject(&writer, &code, &relocs, &out);
+
+    struct elf64_header *header = out.buffer;
+    assert(header->type == ELF_ET_REL && header->phe_num == 0);
+    assert(header->she_num == 9);
+
+    struct elf64_section *sections = out.buffer + header->sh_offset;
+    struct elf64_section *rela = &sections[4];
+    assert(rela->type == ELF_SHT_RELA && rela->info == 1);
+    assert(rela->size == 2 * sizeof(struct elf64_rela));
+    // An empty .note.GNU-stack keeps the stack of the linked program
+    // non-executable.
+    struct elf64_section *note = &sections[7];
+    assert(note->type == ELF_SHT_PROGBITS && note->size == 0);
+
+    struct elf64_rela *relas = out.buffer + rela->offset;
+    // mov rbx, imm64 refers to .rodata through the section symbol.
+    assert(relas[0].offset == 3 && relas[0].addend == 0);
+    assert(relas[0].info == ELF_RELA_INFO(2, R_X86_64_64));
+    // call rel32 refers to the named symbol.
+    assert(relas[1].offset == 12 && relas[1].addend == -4);
+    assert(relas[1].info == ELF_RELA_INFO(5, R_X86_64_PLT32));
+
+    char path[128];
+    writeFile(directory, "elf_test.o", &out, path, sizeof(path));
+    assert(linkAndRun(directory, path) == 0);
+    unlink(path);
+
+    dbuffer_free(&out);
+    dbuffer_free(&code);
+    elf_writer_free(&writer);
+    reloc_table_free(&relocs);
+}
+
+int main(int argc, char *args[]) {
+    char directory[] = "/tmp/elf_testXXXXXX";
+    assert(mkdtemp(directory) && "can't create the output directory");
+    test_executable(directory);
+    test_object(directory);
+    rmdir(directory);
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "frame_layout.h"
+#include "ir_fixtures.h"
+#include "jit.h"
+
+#define WIDE_VALUES 24
+
+typedef int64_t (*native1)(int64_t);
+
+// Every value dies right after it is used.
+const char *chainSource = "int64 chain(int64 n) {\n"
+                          "    int64 s = 0;\n"
+                          "    int64 i = 0;\n"
+                          "    while (i < n) {\n"
+                          "        int64 t = i * 3;\n"
+                          "        int64 u = t + 1;\n"
+                          "        int64 v = u * 2;\n"
+                          "        s = s + (v - u);\n"
+                          "        i = i + 1;\n"
+                          "    }\n"
+                          "    return s;\n"
+                          "}\n";
+
+// More values are live at once than there are registers, the slots past 16
+// need a disp32.
+char *wideSource() {
+    dbuffer_t source;
+    dbuffer_init(&source);
+    char line[64];
+    dbuffer_pushStr(&source, "int64 wide(int64 a) {\n");
+    for (int i = 1; i <= WIDE_VALUES; i++) {
+        snprintf(line, sizeof(line), "    int64 v%d = a * %d;\n", i, i);
+        dbuffer_pushStr(&source, line);
+    }
+    dbuffer_pushStr(&source, "    int64 s = v1 + v2;\n");
+    for (int i = 3; i <= WIDE_VALUES; i++) {
+        snprintf(line, sizeof(line), "    s = s + v%d;\n", i);
+        dbuffer_pushStr(&source, line);
+    }
+    dbuffer_pushStr(&source, "    return s;\n}\n");
+    dbuffer_push(&source, 1, 0);
+    return source.buffer;
+}
+
+// Lays out @fn and checks that values which are live at the same time never
+// share a slot. Returns the number of values.
+size_t checkLayout(function_t *fn, struct frame_layout *layout) {
+    size_t count;
+    basic_block_t **postorder = function_computePostorder(fn, &count);
+    basic_block_t **order = malloc(sizeof(basic_block_t *) * count);
+    for (size_t i = 0; i < count; i++)
+        order[i] = postorder[count - 1 - i];
+    frame_layout_compute(layout, fn, order, count);
+
+    dbuffer_t ranges;
+    dbuffer_init(&ranges);
+    for (size_t i = 0; i < fn->argumentCount; i++)
+        dbuffer_pushPtr(&ranges,
+                        frame_layout_get(layout, &fn->arguments[i].value));
+    for (size_t b = 0; b < count; b++) {
+        LIST_FOR_EACH(&order[b]->instructions) {
+            instruction_t *inst = containerof(c, instruction_t, inst_list);
+            struct frame_range *range = frame_layout_get(layout, &inst->value);
+            assert(!range == (inst->value.dataType == VOID));
+            if (range)
+                dbuffer_pushPtr(&ranges, range);
+        }
+    }
+
+    size_t rangeCount;
+    struct frame_range **array =
+        (struct frame_range **)dbuffer_asPtrArray(&ranges, &rangeCount);
+    for (size_t i = 0; i < rangeCount; i++) {
+        assert(array[i]->start <= array[i]->end);
+        assert(array[i]->slot >= 1 && array[i]->slot <= layout->slotCount);
+        for (size_t j = i + 1; j < rangeCount; j++) {
+            int overlap = array[i]->start <= array[j]->end &&
+                          array[j]->start <= array[i]->end;
+            assert(!overlap || array[i]->slot != array[j]->slot);
+        }
+    }
+    dbuffer_free(&ranges);
+    free(order);
+    free(postorder);
+    return rangeCount;
+}
+
+int64_t chain(int64_t n) {
+    int64_t s = 0;
+    for (int64_t i = 0; i < n; i++)
+        s += (i * 3 + 1) * 2 - (i * 3 + 1);
+    return s;
+}
+
+int main() {
+    ir_context_t ctx;
+    ir_context_init(&ctx);
+    char *source = wideSource();
+    function_t *functions[] = {compileSource(&ctx, source),
+                               compileSource(&ctx, chainSource)};
+    free(source);
+
+    // Short lived values reuse the slots of the dead ones.
+    struct frame_layout layout;
+    size_t values = checkLayout(functions[1], &layout);
+    assert(layout.slotCount < values);
+    frame_layout_free(&layout);
+    values = checkLayout(functions[0], &layout);
+    assert(layout.slotCount >= WIDE_VALUES && layout.slotCount < values);
+    frame_layout_free(&layout);
+
+    struct jit_batch batch;
+    jit_compileBatch(&ctx, functions, 2, &batch);
+    for (int64_t a = -3; a < 4; a++)
+        assert(((native1)batch.entries[0])(a) ==
+               a * WIDE_VALUES * (WIDE_VALUES + 1) / 2);
+    for (int64_t n = 0; n < 10; n++)
+        assert(((native1)batch.entries[1])(n) == chain(n));
+
+    jit_batch_free(&batch);
+    ir_context_free(&ctx);
+    puts("frame layout tests passed");
+    return 0;
+}
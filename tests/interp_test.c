@@ -0,0 +1,51 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "interp.h"
+#include "ir.h"
+#include "ir_fixtures.h"
+#include "jit.h"
+#include "ssa_conversion.h"
+
+int main(int argc, char *args[]) {
+    ir_context_t ctx;
+    ir_context_init(&ctx);
+
+    function_t *square = buildSquare(&ctx);
+    function_t *sumSquares = buildSumSquares(&ctx, square);
+    function_t *fib = buildFib(&ctx);
+    function_t *sumSquaresSSA = buildSumSquares(&ctx, square);
+    ssa_convertFunction(&ctx, sumSquaresSSA);
+    function_t *fibSSA = buildFib(&ctx);
+    ssa_convertFunction(&ctx, fibSSA);
+
+    struct interp in;
+    interp_init(&in, &ctx);
+
+    int64_t n = -7;
+    assert(interp_call(&in, square, &n) == 49);
+    for (n = 0; n < 20; n++) {
+        assert(interp_call(&in, sumSquares, &n) == referenceSumSquares(n));
+        assert(interp_call(&in, sumSquaresSSA, &n) == referenceSumSquares(n));
+    }
+    n = 10;
+    assert(interp_call(&in, fib, &n) == 55);
+    assert(interp_call(&in, fibSSA, &n) == 55);
+
+    // The interpreter is the reference for the JIT.
+    function_t *functions[] = {fib, fibSSA};
+    struct jit_batch batch;
+    jit_compileBatch(&ctx, functions, 2, &batch);
+    int64_t (*fibFn)(int64_t) = batch.entries[0];
+    int64_t (*fibSSAFn)(int64_t) = batch.entries[1];
+    for (n = 0; n <= 90; n++) {
+        int64_t expected = interp_call(&in, fib, &n);
+        assert(interp_call(&in, fibSSA, &n) == expected);
+        assert(fibFn(n) == expected && fibSSAFn(n) == expected);
+    }
+
+    jit_batch_free(&batch);
+    interp_free(&in);
+    ir_context_free(&ctx);
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include "ir_fixtures.h"
+#include "ir_creation.h"
+#include "parser.h"
+#include "ssa_conversion.h"
+
+#include <assert.h>
+
+value_t *insert(basic_block_t *block, instruction_t *inst) {
+    block_insert(block, inst);
+    return &inst->value;
+}
+
+value_t *load(ir_context_t *ctx, basic_block_t *block, size_t rId) {
+    return insert(block, &inst_new_load_var(ctx, rId, DT_INT64)->inst);
+}
+
+void assign(ir_context_t *ctx, basic_block_t *block, size_t rId,
+            value_t *value) {
+    insert(block, &inst_new_assign_var(ctx, rId, value)->inst);
+}
+
+value_t *binary(ir_context_t *ctx, basic_block_t *block, enum binary_ops op,
+                value_t *a, value_t *b) {
+    return insert(block, &inst_new_binary(ctx, op, a, b)->inst);
+}
+
+function_t *buildSquare(ir_context_t *ctx) {
+    function_t *fn = ir_new_function(ctx, RANGE_STRING("square"));
+    fn->returnType = DT_INT64;
+    function_setArguments(ctx, fn, 1);
+    fn->entry = block_new(ctx, fn);
+
+    value_t *arg = &fn->arguments[0].value;
+    value_t *result = binary(ctx, fn->entry, BO_MUL, arg, arg);
+    insert(fn->entry, &inst_new_return(ctx, result)->inst);
+    return fn;
+}
+
+function_t *buildSumSquares(ir_context_t *ctx, function_t *square) {
+    function_t *fn = ir_new_function(ctx, RANGE_STRING("sumSquares"));
+    fn->returnType = DT_INT64;
+    function_setArguments(ctx, fn, 1);
+    basic_block_t *entry = fn->entry = block_new(ctx, fn);
+    basic_block_t *head = block_new(ctx, fn);
+    basic_block_t *body = block_new(ctx, fn);
+    basic_block_t *exit = block_new(ctx, fn);
+
+    assign(ctx, entry, 0, CONST(ctx, 0));
+    assign(ctx, entry, 1, CONST(ctx, 0));
+    insert(entry, &inst_new_jump(ctx, head)->inst);
+
+    value_t *cond = binary(ctx, head, BO_LESS, load(ctx, head, 0),
+                           &fn->arguments[0].value);
+    insert(head, &inst_new_jump_cond(ctx, body, exit, cond)->inst);
+
+    value_t *arg = load(ctx, body, 0);
+    value_t *squared =
+        insert(body, &inst_new_function_call(ctx, square, &arg, 1)->inst);
+    value_t *half = binary(ctx, body, BO_DIV, squared, CONST(ctx, 2));
+    assign(ctx, body, 1, binary(ctx, body, BO_ADD, load(ctx, body, 1), half));
+    assign(ctx, body, 0,
+           binary(ctx, body, BO_ADD, load(ctx, body, 0), CONST(ctx, 1)));
+    insert(body, &inst_new_jump(ctx, head)->inst);
+
+    insert(exit, &inst_new_return(ctx, load(ctx, exit, 1))->inst);
+    return fn;
+}
+
+function_t *buildFib(ir_context_t *ctx) {
+    function_t *fn = ir_new_function(ctx, RANGE_STRING("fib"));
+    fn->returnType = DT_INT64;
+    function_setArguments(ctx, fn, 1);
+    basic_block_t *entry = fn->entry = block_new(ctx, fn);
+    basic_block_t *head = block_new(ctx, fn);
+    basic_block_t *body = block_new(ctx, fn);
+    basic_block_t *exit = block_new(ctx, fn);
+
+    assign(ctx, entry, 0, &fn->arguments[0].value);
+    assign(ctx, entry, 1, CONST(ctx, 1));
+    assign(ctx, entry, 2, CONST(ctx, 0));
+    insert(entry, &inst_new_jump(ctx, head)->inst);
+
+    value_t *cond =
+        binary(ctx, head, BO_GREATER, load(ctx, head, 0), CONST(ctx, 0));
+    insert(head, &inst_new_jump_cond(ctx, body, exit, cond)->inst);
+
+    assign(ctx, body, 0,
+           binary(ctx, body, BO_SUB, load(ctx, body, 0), CONST(ctx, 1)));
+    assign(ctx, body, 3, load(ctx, body, 2));
+    assign(ctx, body, 2, load(ctx, body, 1));
+    assign(ctx, body, 1,
+           binary(ctx, body, BO_ADD, load(ctx, body, 1), load(ctx, body, 3)));
+    insert(body, &inst_new_jump(ctx, head)->inst);
+
+    insert(exit, &inst_new_return(ctx, load(ctx, exit, 2))->inst);
+    return fn;
+}
+
+int64_t referenceSumSquares(int64_t n) {
+    int64_t s = 0;
+    for (int64_t i = 0; i < n; i++)
+        s += i * i / 2;
+    return s;
+}
+
+function_t *parseSource(ir_context_t *ctx, const char *source) {
+    parser_t parser;
+    parser_init(&parser, range_fromString((char *)source));
+    struct ast_node *node = parser_parseFunction(&parser);
+    assert(node && "can't parse the source");
+
+    struct ir_creator creator;
+    ir_creator_init(&creator, ctx);
+    function_t *fn =
+        ir_creator_createFunction(&creator, AST_AS_TYPE(node, function));
+    zone_free(&parser.zone);
+    return fn;
+}
+
+function_t *compileSource(ir_context_t *ctx, const char *source) {
+    function_t *fn = parseSource(ctx, source);
+    ssa_convertFunction(ctx, fn);
+    return fn;
+}
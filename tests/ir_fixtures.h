@@ -0,0 +1,35 @@
+// IR builders and sample functions shared by the tests.
+#ifndef IR_FIXTURES_H
+#define IR_FIXTURES_H
+
+#include "ir.h"
+
+#define CONST(ctx, n) (&ir_constant_value((ctx), (n))->value)
+
+value_t *insert(basic_block_t *block, instruction_t *inst);
+// Load and assign the variable @rId.
+value_t *load(ir_context_t *ctx, basic_block_t *block, size_t rId);
+void assign(ir_context_t *ctx, basic_block_t *block, size_t rId,
+            value_t *value);
+value_t *binary(ir_context_t *ctx, basic_block_t *block, enum binary_ops op,
+                value_t *a, value_t *b);
+
+// int64 square(a) { return a * a; }
+function_t *buildSquare(ir_context_t *ctx);
+// int64 sumSquares(n) {
+//   i = 0; s = 0;
+//   while (i < n) { s = s + square(i) / 2; i = i + 1; }
+//   return s;
+// }
+function_t *buildSumSquares(ir_context_t *ctx, function_t *square);
+int64_t referenceSumSquares(int64_t n);
+// int64 fib(n) { a = 1; b = 0; while (n > 0) { n = n - 1; o = b; b = a;
+// a = a + o; } return b; }
+function_t *buildFib(ir_context_t *ctx);
+
+// Parse a single function, the result still uses variables.
+function_t *parseSource(ir_context_t *ctx, const char *source);
+// Parse a single function and convert it to SSA.
+function_t *compileSource(ir_context_t *ctx, const char *source);
+
+#endif
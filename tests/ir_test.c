@@ -21,7 +21,7 @@ void test_dumpDot() {
 
     value_constant_t *con = ir_constant_value(&ctx, 10);
     inst_assign_var_t *var = inst_new_assign_var(&ctx, 1, &con->value);
-    inst_load_var_t *load = inst_new_load_var(&ctx, 1, INT64);
+    inst_load_var_t *load = inst_new_load_var(&ctx, 1, DT_INT64);
     value_setName(&ctx, &load->inst.value, RANGE_STRING("loaded_value"));
 
     // value_constant_t *a = ir_constant_value(&ctx, 15);
@@ -0,0 +1,198 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "interp.h"
+#include "ir.h"
+#include "ir_fixtures.h"
+#include "jit.h"
+#include "ssa_conversion.h"
+
+// int64 address(a, b) { u = a + b * 4 + 12; if (5 < a) return u * 9 - 7;
+// w = u * 3 * 5; return w * 2 + a; }
+// Covers the lea forms and a compare with a constant on the left fused into
+// the branch.
+function_t *buildAddress(ir_context_t *ctx) {
+    function_t *fn = ir_new_function(ctx, RANGE_STRING("address"));
+    fn->returnType = DT_INT64;
+    function_setArguments(ctx, fn, 2);
+    basic_block_t *entry = fn->entry = block_new(ctx, fn);
+    basic_block_t *big = block_new(ctx, fn);
+    basic_block_t *small = block_new(ctx, fn);
+    value_t *a = &fn->arguments[0].value, *b = &fn->arguments[1].value;
+
+    value_t *scaled = binary(ctx, entry, BO_MUL, b, CONST(ctx, 4));
+    value_t *sum = binary(ctx, entry, BO_ADD, a, scaled);
+    value_t *u = binary(ctx, entry, BO_ADD, sum, CONST(ctx, 12));
+    value_t *cond = binary(ctx, entry, BO_LESS, CONST(ctx, 5), a);
+    insert(entry, &inst_new_jump_cond(ctx, big, small, cond)->inst);
+
+    value_t *times9 = binary(ctx, big, BO_MUL, u, CONST(ctx, 9));
+    value_t *result = binary(ctx, big, BO_SUB, times9, CONST(ctx, 7));
+    insert(big, &inst_new_return(ctx, result)->inst);
+
+    value_t *times3 = binary(ctx, small, BO_MUL, u, CONST(ctx, 3));
+    value_t *w = binary(ctx, small, BO_MUL, times3, CONST(ctx, 5));
+    value_t *twice = binary(ctx, small, BO_MUL, w, CONST(ctx, 2));
+    result = binary(ctx, small, BO_ADD, twice, a);
+    insert(small, &inst_new_return(ctx, result)->inst);
+    return fn;
+}
+
+int64_t referenceAddress(int64_t a, int64_t b) {
+    int64_t u = a + b * 4 + 12;
+    if (5 < a)
+        return u * 9 - 7;
+    return u * 3 * 5 * 2 + a;
+}
+
+// int64 select(a, b) { m = a; if (a < b) m = b; s = 0; if (a > 7) s = 1;
+// t = m * 3; if (s == 0) t = t + a * 2 - 1; return t * 4 + s; }
+// After SSA conversion the ifs are small diamonds and triangles.
+function_t *buildSelect(ir_context_t *ctx) {
+    function_t *fn = ir_new_function(ctx, RANGE_STRING("select"));
+    fn->returnType = DT_INT64;
+    function_setArguments(ctx, fn, 2);
+    basic_block_t *blocks[8];
+    for (int i = 0; i < 8; i++)
+        blocks[i] = block_new(ctx, fn);
+    fn->entry = blocks[0];
+    value_t *a = &fn->arguments[0].value, *b = &fn->arguments[1].value;
+
+    value_t *less = binary(ctx, blocks[0], BO_LESS, a, b);
+    insert(blocks[0],
+           &inst_new_jump_cond(ctx, blocks[1], blocks[2], less)->inst);
+    assign(ctx, blocks[1], 0, b);
+    insert(blocks[1], &inst_new_jump(ctx, blocks[3])->inst);
+    assign(ctx, blocks[2], 0, a);
+    insert(blocks[2], &inst_new_jump(ctx, blocks[3])->inst);
+
+    assign(ctx, blocks[3], 1, CONST(ctx, 0));
+    value_t *greater = binary(ctx, blocks[3], BO_GREATER, a, CONST(ctx, 7));
+    insert(blocks[3],
+           &inst_new_jump_cond(ctx, blocks[4], blocks[5], greater)->inst);
+    assign(ctx, blocks[4], 1, CONST(ctx, 1));
+    insert(blocks[4], &inst_new_jump(ctx, blocks[5])->inst);
+
+    value_t *m = load(ctx, blocks[5], 0);
+    assign(ctx, blocks[5], 2, binary(ctx, blocks[5], BO_MUL, m, CONST(ctx, 3)));
+    value_t *unset = binary(ctx, blocks[5], BO_EQUALS, load(ctx, blocks[5], 1),
+                            CONST(ctx, 0));
+    insert(blocks[5],
+           &inst_new_jump_cond(ctx, blocks[6], blocks[7], unset)->inst);
+    value_t *twice = binary(ctx, blocks[6], BO_MUL, a, CONST(ctx, 2));
+    value_t *sum =
+        binary(ctx, blocks[6], BO_ADD, load(ctx, blocks[6], 2), twice);
+    assign(ctx, blocks[6], 2,
+           binary(ctx, blocks[6], BO_SUB, sum, CONST(ctx, 1)));
+    insert(blocks[6], &inst_new_jump(ctx, blocks[7])->inst);
+
+    value_t *scaled =
+        binary(ctx, blocks[7], BO_MUL, load(ctx, blocks[7], 2), CONST(ctx, 4));
+    value_t *result =
+        binary(ctx, blocks[7], BO_ADD, scaled, load(ctx, blocks[7], 1));
+    insert(blocks[7], &inst_new_return(ctx, result)->inst);
+    return fn;
+}
+
+int64_t referenceSelect(int64_t a, int64_t b) {
+    int64_t m = a < b ? b : a;
+    int64_t s = a > 7;
+    int64_t t = m * 3;
+    if (s == 0)
+        t = t + a * 2 - 1;
+    return t * 4 + s;
+}
+
+// Conditional assignments inside a loop need phis on the iterated dominance
+// frontier. The interpreter runs the function before SSA conversion and is the
+// reference for the converted and compiled one.
+void testLoopAssigns(ir_context_t *ctx) {
+    static const char source[] =
+        "int64 f(int64 a, int64 b, int64 c, int64 d) {"
+        "  int64 s = 0; int64 i = 0;"
+        "  while (i < 2) { if (c) { s = d; } d = s + 7; i = i + 1; }"
+        "  return d * 100 + s; }";
+    function_t *plain = parseSource(ctx, source);
+    function_t *converted = compileSource(ctx, source);
+
+    struct jit_batch batch;
+    jit_compileBatch(ctx, &converted, 1, &batch);
+    int64_t (*fn)(int64_t, int64_t, int64_t, int64_t) = batch.entries[0];
+    assert(fn(1, 2, 3, 4) == 1811);
+
+    struct interp in;
+    interp_init(&in, ctx);
+    for (int64_t c = 0; c < 2; c++) {
+        for (int64_t d = -2; d < 3; d++) {
+            int64_t args[] = {1, 2, c, d};
+            int64_t expected = interp_call(&in, plain, args);
+            assert(interp_call(&in, converted, args) == expected);
+            assert(fn(1, 2, c, d) == expected);
+        }
+    }
+    interp_free(&in);
+    jit_batch_free(&batch);
+}
+
+// The variable of the inner block only lives in one arm, SSA leaves a phi
+// without an incoming value for the other one at the join of the select.
+void testPartialPhi(ir_context_t *ctx) {
+    function_t *fn = compileSource(
+        ctx, "int64 f(int64 a, int64 b, int64 c, int64 d) {"
+             "  if (c) { if (a) { int64 v = d; } } return b; }");
+
+    struct jit_batch batch;
+    jit_compileBatch(ctx, &fn, 1, &batch);
+    int64_t (*f)(int64_t, int64_t, int64_t, int64_t) = batch.entries[0];
+    for (int64_t a = 0; a < 2; a++) {
+        for (int64_t c = 0; c < 2; c++)
+            assert(f(a, 5, c, 9) == 5);
+    }
+    jit_batch_free(&batch);
+}
+
+int main(int argc, char *args[]) {
+    ir_context_t ctx;
+    ir_context_init(&ctx);
+
+    function_t *square = buildSquare(&ctx);
+    function_t *sumSquares = buildSumSquares(&ctx, square);
+    function_t *fib = buildFib(&ctx);
+    function_t *fibSSA = buildFib(&ctx);
+    ssa_convertFunction(&ctx, fibSSA);
+    function_t *address = buildAddress(&ctx);
+    function_t *select = buildSelect(&ctx);
+    ssa_convertFunction(&ctx, select);
+
+    function_t *functions[] = {sumSquares, square, fib, fibSSA, address,
+                               select};
+    struct jit_batch batch;
+    jit_compileBatch(&ctx, functions, 6, &batch);
+
+    int64_t (*sumSquaresFn)(int64_t) = batch.entries[0];
+    int64_t (*squareFn)(int64_t) = batch.entries[1];
+    int64_t (*fibFn)(int64_t) = batch.entries[2];
+    int64_t (*fibSSAFn)(int64_t) = batch.entries[3];
+    int64_t (*addressFn)(int64_t, int64_t) = batch.entries[4];
+    int64_t (*selectFn)(int64_t, int64_t) = batch.entries[5];
+
+    assert(squareFn(-7) == 49);
+    for (int64_t n = 0; n < 20; n++)
+        assert(sumSquaresFn(n) == referenceSumSquares(n));
+    assert(fibFn(10) == 55 && fibFn(50) == 12586269025);
+    assert(fibSSAFn(10) == 55 && fibSSAFn(50) == 12586269025);
+    for (int64_t a = -3; a < 10; a++) {
+        for (int64_t b = -2; b < 3; b++)
+            assert(addressFn(a, b) == referenceAddress(a, b));
+    }
+    for (int64_t a = -3; a < 12; a++) {
+        for (int64_t b = -4; b < 14; b += 3)
+            assert(selectFn(a, b) == referenceSelect(a, b));
+    }
+
+    jit_batch_free(&batch);
+    testLoopAssigns(&ctx);
+    testPartialPhi(&ctx);
+    ir_context_free(&ctx);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "ir.h"
+#include "ir_fixtures.h"
+#include "lazy.h"
+
+typedef int64_t (*native1)(int64_t);
+
+// int64 unused() { return n; }
+function_t *buildUnused(ir_context_t *ctx, int64_t n) {
+    function_t *fn = ir_new_function(ctx, RANGE_STRING("unused"));
+    fn->returnType = DT_INT64;
+    fn->entry = block_new(ctx, fn);
+    insert(fn->entry, &inst_new_return(ctx, CONST(ctx, n))->inst);
+    return fn;
+}
+
+int main(int argc, char *args[]) {
+    ir_context_t ctx;
+    ir_context_init(&ctx);
+
+    struct lazy_module module;
+    assert(lazy_init(&module, &ctx));
+
+    function_t *square = buildSquare(&ctx);
+    function_t *sumSquares = buildSumSquares(&ctx, square);
+    lazy_add(&module, square);
+    lazy_add(&module, sumSquares);
+    for (int64_t i = 0; i < 100; i++)
+        lazy_add(&module, buildUnused(&ctx, i));
+    assert(module.compiled == 0);
+
+    // The first call compiles sumSquares, square is compiled by the first
+    // call inside of the loop.
+    void *stub = lazy_entry(&module, sumSquares);
+    for (int64_t n = 0; n < 100; n++)
+        assert(((native1)stub)(n) == referenceSumSquares(n));
+    assert(module.compiled == 2);
+    assert(module.patched == 1);
+    assert(lazy_entry(&module, sumSquares) != stub);
+
+    // Called from C, the stub forwards to the code.
+    assert(((native1)lazy_entry(&module, square))(12) == 144);
+    assert(((native1)lazy_entry(&module, sumSquares))(1000) ==
+           referenceSumSquares(1000));
+    assert(module.compiled == 2);
+
+    lazy_free(&module);
+    ir_context_free(&ctx);
+    return 0;
+}
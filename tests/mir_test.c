@@ -0,0 +1,298 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir_fixtures.h"
+#include "jit.h"
+#include "mir.h"
+#include "mir_peephole.h"
+#include "mir_regalloc.h"
+#include "mir_schedule.h"
+#include "platform_utils.h"
+
+#define WIDE_TEMPS 6
+
+typedef int64_t (*native1)(int64_t);
+
+struct sum_function {
+    struct mir_function fn;
+    label_t labels[4];
+    uint32_t n, s, i;
+};
+
+// s = 0; for (i = 0; i < n; i++) s += i * 1 + i * 2 + ... + i * WIDE_TEMPS;
+// The products are all live at once, so small register counts spill.
+void buildSum(struct sum_function *sum) {
+    struct mir_function *fn = &sum->fn;
+    mir_function_init(fn);
+    for (int i = 0; i < 4; i++)
+        sum->labels[i] = (label_t){};
+    struct mir_block *entry = mir_addBlock(fn, &sum->labels[0], NULL);
+    struct mir_block *header = mir_addBlock(fn, &sum->labels[1], NULL);
+    struct mir_block *body = mir_addBlock(fn, &sum->labels[2], NULL);
+    struct mir_block *exit = mir_addBlock(fn, &sum->labels[3], NULL);
+    sum->n = mir_newVreg(fn, 0);
+    sum->s = mir_newVreg(fn, 0);
+    sum->i = mir_newVreg(fn, 0);
+    struct mir_operand n = mir_vreg(sum->n), s = mir_vreg(sum->s),
+                       i = mir_vreg(sum->i);
+
+    mir_mov(entry, n, mir_preg(RDI));
+    mir_mov(entry, s, mir_imm(0));
+    mir_mov(entry, i, mir_imm(0));
+
+    mir_alu(header, ALU_CMP, i, n);
+    mir_jcc(header, CC_GE, exit->label);
+
+    struct mir_operand temps[WIDE_TEMPS];
+    for (int k = 0; k < WIDE_TEMPS; k++) {
+        temps[k] = mir_vreg(mir_newVreg(fn, 0));
+        mir_imulImm(body, temps[k], i, k + 1);
+    }
+    for (int k = 0; k < WIDE_TEMPS; k++)
+        mir_alu(body, ALU_ADD, s, temps[k]);
+    mir_alu(body, ALU_ADD, i, mir_imm(1));
+    mir_jmp(body, header->label);
+
+    mir_mov(exit, mir_preg(RAX), s);
+    mir_ret(exit, 1);
+}
+
+void testPrint() {
+    struct sum_function sum;
+    buildSum(&sum);
+    char *text;
+    size_t size;
+    FILE *file = open_memstream(&text, &size);
+    mir_print(file, &sum.fn);
+    fclose(file);
+    const char *expected = "bb0:\n"
+                           "    mov v1, rdi\n"
+                           "    mov v2, 0\n"
+                           "    mov v3, 0\n"
+                           "bb1:\n"
+                           "    cmp v3, v1\n"
+                           "    jge bb3\n"
+                           "bb2:\n"
+                           "    imul v4, v3, 1\n";
+    assert(!strncmp(text, expected, strlen(expected)));
+    assert(strstr(text, "    add v3, 1\n    jmp bb1\nbb3:\n"
+                        "    mov rax, v2\n    ret\n"));
+    free(text);
+    mir_function_free(&sum.fn);
+}
+
+void testLiveness() {
+    struct sum_function sum;
+    buildSum(&sum);
+    struct mir_liveness live;
+    mir_liveness_compute(&live, &sum.fn);
+    // The loop carries n, s and i, the products die in the body.
+    uint64_t *in = mir_liveIn(&live, 1);
+    assert(mir_isLive(in, sum.n) && mir_isLive(in, sum.s) &&
+           mir_isLive(in, sum.i));
+    for (uint32_t v = sum.i + 1; v < sum.fn.vregCount; v++) {
+        assert(!mir_isLive(in, v));
+        assert(!mir_isLive(mir_liveOut(&live, 2), v));
+    }
+    assert(!mir_isLive(mir_liveIn(&live, 0), sum.n));
+    assert(!mir_isLive(mir_liveOut(&live, 3), sum.s));
+    mir_liveness_free(&live);
+    mir_function_free(&sum.fn);
+}
+
+// Allocate with @registerCount registers, add a frame and run it.
+void testRun(int registerCount) {
+    struct sum_function sum;
+    buildSum(&sum);
+    struct mir_function *fn = &sum.fn;
+    mir_schedule(fn);
+    mir_allocate(fn, registerCount);
+    mir_peephole(fn);
+
+    size_t count;
+    struct mir_block **blocks = mir_blocks(fn, &count);
+    for (size_t b = 0; b < count; b++) {
+        size_t instCount;
+        struct mir_inst *insts = mir_insts(blocks[b], &instCount);
+        for (size_t i = 0; i < instCount; i++) {
+            for (size_t o = 0; o < insts[i].operandCount; o++)
+                assert(insts[i].operands[o].kind != MIR_VREG);
+        }
+    }
+    // Blocks start in memory, so the loop carried values always get a slot.
+    // The products only get one when they don't fit.
+    if (registerCount >= 3 + WIDE_TEMPS)
+        assert(fn->frameSize == 3);
+    else
+        assert(fn->frameSize > 3);
+
+    struct mir_block prologue = {};
+    dbuffer_init(&prologue.insts);
+    mir_push(&prologue, RBP);
+    mir_mov(&prologue, mir_preg(RBP), mir_preg(RSP));
+    mir_alu(&prologue, ALU_SUB, mir_preg(RSP),
+            mir_imm((fn->frameSize * 8 + 15) & ~15));
+    struct mir_inst *insts = mir_insts(&prologue, &count);
+    mir_insert(blocks[0], 0, insts, count);
+    dbuffer_clear(&prologue.insts);
+    mir_mov(&prologue, mir_preg(RSP), mir_preg(RBP));
+    mir_pop(&prologue, RBP);
+    insts = mir_insts(&prologue, &count);
+    size_t exitCount;
+    mir_insts(blocks[3], &exitCount);
+    mir_insert(blocks[3], exitCount - 1, insts, count);
+    dbuffer_free(&prologue.insts);
+
+    struct codegen cg;
+    codegen_init(&cg, registerCount);
+    mir_encode(fn, &cg);
+    codegen_relaxBranches(&cg);
+    void *code = allocate_executable(cg.buffer.usage);
+    reloc_table_apply(&cg.relocs, cg.buffer.buffer, (unsigned long)code);
+    memcpy(code, cg.buffer.buffer, cg.buffer.usage);
+    for (int64_t n = 0; n < 10; n++)
+        assert(((native1)code)(n) == n * (n - 1) / 2 * 21);
+
+    free_executable(code, cg.buffer.usage);
+    codegen_free(&cg);
+    mir_function_free(fn);
+}
+
+// Allocated code with the usual spill traffic.
+void testPeephole() {
+    struct mir_function fn;
+    mir_function_init(&fn);
+    label_t labels[3] = {};
+    struct mir_block *entry = mir_addBlock(&fn, &labels[0], NULL);
+    struct mir_block *small = mir_addBlock(&fn, &labels[1], NULL);
+    struct mir_block *big = mir_addBlock(&fn, &labels[2], NULL);
+    struct mir_operand rax = mir_preg(RAX), rcx = mir_preg(RCX),
+                       rdx = mir_preg(RDX);
+
+    mir_mov(entry, mir_stackSlot(1), rax);
+    mir_mov(entry, rcx, mir_stackSlot(1));
+    mir_mov(entry, rdx, rcx);
+    mir_mov(entry, mir_stackSlot(1), rdx);
+    mir_mov(entry, rax, rax);
+    mir_alu(entry, ALU_ADD, rdx, mir_imm(1));
+    mir_mov(entry, mir_stackSlot(2), rdx);
+    mir_alu(entry, ALU_CMP, rdx, mir_imm(10));
+    mir_jcc(entry, CC_L, small->label);
+    mir_jmp(entry, big->label);
+
+    mir_mov(small, rax, mir_stackSlot(2));
+    mir_ret(small, 1);
+    mir_mov(big, rax, mir_imm(0));
+    mir_ret(big, 1);
+
+    mir_peephole(&fn);
+    char *text;
+    size_t size;
+    FILE *file = open_memstream(&text, &size);
+    mir_print(file, &fn);
+    fclose(file);
+    const char *expected = "bb0:\n"
+                           "    mov [rbp - 8], rax\n"
+                           "    mov rdx, rax\n"
+                           "    add rdx, 1\n"
+                           "    mov [rbp - 16], rdx\n"
+                           "    cmp rdx, 10\n"
+                           "    jge bb2\n"
+                           "bb1:\n"
+                           "    mov rax, [rbp - 16]\n"
+                           "    ret\n"
+                           "bb2:\n"
+                           "    mov rax, 0\n"
+                           "    ret\n";
+    assert(!strcmp(text, expected));
+    free(text);
+    mir_function_free(&fn);
+}
+
+// A chain of adds in front of a longer chain of multiplies.
+void testSchedule() {
+    struct mir_function fn;
+    mir_function_init(&fn);
+    label_t label = {};
+    struct mir_block *entry = mir_addBlock(&fn, &label, NULL);
+    struct mir_operand x = mir_vreg(mir_newVreg(&fn, 0)),
+                       sum = mir_vreg(mir_newVreg(&fn, 0)),
+                       product = mir_vreg(mir_newVreg(&fn, 0));
+
+    mir_mov(entry, x, mir_preg(RDI));
+    mir_mov(entry, sum, x);
+    for (int k = 1; k <= 3; k++)
+        mir_alu(entry, ALU_ADD, sum, mir_imm(k));
+    mir_mov(entry, product, x);
+    mir_imul(entry, product, product);
+    mir_imul(entry, product, product);
+    mir_alu(entry, ALU_ADD, sum, product);
+    mir_mov(entry, mir_preg(RAX), sum);
+    mir_ret(entry, 1);
+
+    mir_schedule(&fn);
+    char *text;
+    size_t size;
+    FILE *file = open_memstream(&text, &size);
+    mir_print(file, &fn);
+    fclose(file);
+    // The multiplies start first, the return value stays at the end.
+    const char *expected = "bb0:\n    mov v1, rdi\n    mov v3, v1\n";
+    assert(!strncmp(text, expected, strlen(expected)));
+    assert(strstr(text, "imul v3, v3") < strstr(text, "add v2, 1"));
+    assert(strstr(text, "    add v2, v3\n    mov rax, v2\n    ret\n"));
+    free(text);
+    mir_function_free(&fn);
+}
+
+// Every statement of parsed source starts with a position label, they must
+// not keep the division from starting before the multiplies. The values stay
+// live to the end so none of them share a stack slot.
+void testScheduleSource() {
+    static const char source[] =
+        "int64 f(int64 a, int64 b, int64 c, int64 d) {\n"
+        "    int64 y = c * d;\n"
+        "    int64 z = a * d;\n"
+        "    int64 w = y * z;\n"
+        "    int64 x = a / b;\n"
+        "    return x + w + y + z + a + b + c + d;\n"
+        "}\n";
+    ir_context_t ctx;
+    ir_context_init(&ctx);
+    function_t *fn = compileSource(&ctx, source);
+    struct jit_batch batch;
+    jit_compileBatch(&ctx, &fn, 1, &batch);
+    int64_t (*f)(int64_t, int64_t, int64_t, int64_t) = batch.entries[0];
+    assert(f(7, 2, 3, 5) == 3 + 3 * 5 * 7 * 5 + 15 + 35 + 17);
+
+    // First byte of the code of each line.
+    size_t first[8];
+    memset(first, -1, sizeof(first));
+    uint32_t line, col;
+    for (size_t i = batch.size; i-- > 0;) {
+        if (jit_batch_lookup(&batch, (uint8_t *)batch.code + i, &line, &col) &&
+            line < 8)
+            first[line] = i;
+    }
+    // The division starts first, the multiplies keep their order.
+    assert(first[5] < first[2] && first[5] < first[3]);
+    assert(first[2] < first[4] && first[3] < first[4] && first[4] < first[6]);
+
+    jit_batch_free(&batch);
+    ir_context_free(&ctx);
+}
+
+int main() {
+    testPrint();
+    testLiveness();
+    testPeephole();
+    testSchedule();
+    testScheduleSource();
+    testRun(14);
+    testRun(3);
+    testRun(2);
+    puts("mir tests passed");
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "format.h"
+#include "ir.h"
+#include "ir_fixtures.h"
+#include "jit.h"
+#include "perf.h"
+#include "profile.h"
+#include "ssa_conversion.h"
+
+// Functions cover the batch, blocks and edges cover their function.
+void checkSymbols(struct jit_batch *batch) {
+    struct jit_symbol *symbols = batch->symbols;
+    assert(batch->symbolCount > batch->count);
+    void *next = batch->code;
+    size_t count = batch->symbolCount;
+    for (size_t i = 0; i < count; i += symbols[i].blockCount + 1) {
+        assert(symbols[i].code == next);
+        next = symbols[i].code + symbols[i].size;
+
+        void *block = symbols[i].code;
+        for (size_t j = 1; j <= symbols[i].blockCount; j++) {
+            assert(symbols[i + j].code == block && symbols[i + j].block);
+            block += symbols[i + j].size;
+        }
+        assert(symbols[i].blockCount == 0 || block == next);
+    }
+    assert(next == batch->code + batch->size);
+}
+
+char *readFile(char *directory, char *name, size_t *size) {
+    char *extension = strcmp(name, "jit") ? "map" : "dump";
+    char *path = format("{str}/{str}-{uint}.{str}", directory, name,
+                        (unsigned)getpid(), extension);
+    FILE *file = fopen(path, "r");
+    assert(file && "output is missing");
+    dbuffer_t buffer;
+    dbuffer_init(&buffer);
+    char chunk[256];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)))
+        dbuffer_pushData(&buffer, chunk, read);
+    fclose(file);
+    unlink(path);
+    free(path);
+    *size = buffer.usage;
+    return buffer.buffer;
+}
+
+int main(int argc, char *args[]) {
+    ir_context_t ctx;
+    ir_context_init(&ctx);
+    function_t *square = buildSquare(&ctx);
+    function_t *sumSquares = buildSumSquares(&ctx, square);
+    ssa_convertFunction(&ctx, sumSquares);
+    ssa_convertFunction(&ctx, square);
+
+    struct jit_batch batch;
+    function_t *functions[] = {sumSquares, square};
+    jit_compileBatch(&ctx, functions, 2, &batch);
+    checkSymbols(&batch);
+    assert(RANGE_COMPARE(batch.symbols[0].name, "sumSquares"));
+    assert(RANGE_COMPARE(batch.symbols[1].name, "sumSquares.bb0"));
+
+    char directory[] = "/tmp/perf_testXXXXXX";
+    assert(mkdtemp(directory));
+
+    struct perf_output perf;
+    assert(perf_init(&perf, PERF_MAP | PERF_JITDUMP, directory));
+    perf_addBatch(&perf, &batch);
+    perf_free(&perf);
+
+    size_t size;
+    char *map = readFile(directory, "perf", &size);
+    char expected[128];
+    snprintf(expected, sizeof(expected), "%lx %zx sumSquares\n",
+             (unsigned long)batch.entries[0], batch.symbols[0].size);
+    assert(strncmp(map, expected, strlen(expected)) == 0);
+    free(map);
+
+    // Header, then a code load record with the name and the code.
+    uint8_t *dump = (uint8_t *)readFile(directory, "jit", &size);
+    assert(*(uint32_t *)dump == 0x4A695444);
+    uint32_t headerSize = *(uint32_t *)(dump + 8);
+    uint8_t *record = dump + headerSize;
+    assert(*(uint32_t *)record == 0);
+    assert(*(uint64_t *)(record + 24) == (uint64_t)batch.entries[0]);
+    char *name = (char *)record + 56;
+    assert(strcmp(name, "sumSquares") == 0);
+    assert(memcmp(name + strlen(name) + 1, batch.entries[0],
+                  batch.symbols[0].size) == 0);
+    free(dump);
+
+    // Blocks replace the functions.
+    assert(perf_init(&perf, PERF_MAP | PERF_BLOCKS, directory));
+    perf_addBatch(&perf, &batch);
+    perf_free(&perf);
+    map = readFile(directory, "perf", &size);
+    assert(strstr(map, "sumSquares.bb1") && !strstr(map, "sumSquares\n"));
+    free(map);
+    rmdir(directory);
+
+    jit_batch_free(&batch);
+
+    // Counters put the conditional edges after the blocks, they count for
+    // the block they leave.
+    struct profile profile;
+    profile_init(&profile);
+    struct jit_options options = {.instrument = &profile};
+    jit_compileBatchWith(&ctx, functions, 2, &options, &batch);
+    checkSymbols(&batch);
+    struct jit_symbol *edge = &batch.symbols[batch.symbols[0].blockCount];
+    assert(RANGE_COMPARE(edge->name, "sumSquares.edge1"));
+    jit_batch_free(&batch);
+    profile_free(&profile);
+
+    ir_context_free(&ctx);
+    return 0;
+}
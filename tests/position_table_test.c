@@ -0,0 +1,131 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "ir_creation.h"
+#include "jit.h"
+#include "parser.h"
+#include "position_table.h"
+#include "ssa_conversion.h"
+
+#define ENTRIES 1000
+
+typedef int64_t (*native0)();
+
+void testEncoding() {
+    struct position_entry entries[ENTRIES];
+    uint32_t pc = 0;
+    for (uint32_t i = 0; i < ENTRIES; i++) {
+        // Lines go back and forth like they do in loops.
+        entries[i] = (struct position_entry){
+            .pc = pc, .line = 1 + (i * 7919) % 500, .col = 1 + i % 80};
+        pc += 1 + (i * 31) % 300;
+    }
+
+    struct position_table table;
+    position_table_build(&table, entries, ENTRIES);
+    assert(table.checkpointCount ==
+           (ENTRIES + POSITION_TABLE_STRIDE - 1) / POSITION_TABLE_STRIDE);
+    assert(position_table_size(&table) < sizeof(entries) / 2);
+
+    uint32_t line, col;
+    for (size_t i = 0; i < ENTRIES; i++) {
+        uint32_t end = i + 1 < ENTRIES ? entries[i + 1].pc : pc;
+        for (uint32_t at = entries[i].pc; at < end; at += 7) {
+            assert(position_table_lookup(&table, at, &line, &col));
+            assert(line == entries[i].line && col == entries[i].col);
+        }
+    }
+    assert(position_table_lookup(&table, UINT32_MAX, &line, &col));
+    assert(line == entries[ENTRIES - 1].line);
+    position_table_free(&table);
+
+    // Nothing before the first entry.
+    struct position_entry late = {.pc = 10, .line = 3, .col = 4};
+    position_table_build(&table, &late, 1);
+    assert(!position_table_lookup(&table, 9, &line, &col));
+    assert(position_table_lookup(&table, 10, &line, &col));
+    assert(line == 3 && col == 4);
+    position_table_free(&table);
+
+    position_table_build(&table, NULL, 0);
+    assert(!position_table_lookup(&table, 0, &line, &col));
+    position_table_free(&table);
+}
+
+void testCompact() {
+    // Code that produced no bytes leaves entries on the same pc.
+    struct position_entry entries[] = {
+        {0, 1, 1}, {0, 2, 5}, {4, 2, 5}, {8, 3, 1}, {8, 2, 5}, {12, 4, 1},
+    };
+    struct position_table table;
+    position_table_build(&table, entries, 6);
+
+    uint32_t line, col;
+    assert(position_table_lookup(&table, 0, &line, &col) && line == 2);
+    assert(position_table_lookup(&table, 7, &line, &col) && line == 2);
+    assert(position_table_lookup(&table, 8, &line, &col) && line == 2);
+    assert(position_table_lookup(&table, 12, &line, &col) && line == 4);
+    // {0, 2, 5} and {12, 4, 1} are the only ones left.
+    assert(table.checkpointCount == 1);
+    assert(table.size == 3);
+    position_table_free(&table);
+}
+
+const char *source = "int64 sum() {\n"
+                     "    int64 x = 1;\n"
+                     "    int64 i = 0;\n"
+                     "    while (i < 10) {\n"
+                     "        x = x + i;\n"
+                     "        i = i + 1;\n"
+                     "    }\n"
+                     "    return x;\n"
+                     "}\n";
+
+void testCompiled() {
+    parser_t parser;
+    parser_init(&parser, range_fromString((char *)source));
+    struct ast_node *node = parser_parseFunction(&parser);
+    assert(node && "can't parse the source");
+    assert(node->pos.line == 0 && node->pos.col == 0);
+
+    ir_context_t ctx;
+    ir_context_init(&ctx);
+    struct ir_creator creator;
+    ir_creator_init(&creator, &ctx);
+    function_t *fn =
+        ir_creator_createFunction(&creator, AST_AS_TYPE(node, function));
+    zone_free(&parser.zone);
+
+    ssa_convertFunction(&ctx, fn);
+
+    struct jit_batch batch;
+    jit_compileBatch(&ctx, &fn, 1, &batch);
+    assert(((native0)batch.entries[0])() == 46);
+
+    // The constant declarations fold into SSA values, every other statement
+    // has code.
+    int seen[10] = {};
+    uint32_t line, col;
+    uint8_t *code = batch.code;
+    for (size_t i = 0; i < batch.size; i++) {
+        if (!jit_batch_lookup(&batch, code + i, &line, &col))
+            continue;
+        assert(line >= 2 && line <= 8 && col >= 5);
+        seen[line] = 1;
+    }
+    assert(seen[4] && seen[5] && seen[6] && seen[8]);
+    // The prologue comes before any statement.
+    assert(!jit_batch_lookup(&batch, batch.entries[0], &line, &col));
+    assert(!jit_batch_lookup(&batch, code + batch.size, &line, &col));
+
+    jit_batch_free(&batch);
+    ir_context_free(&ctx);
+}
+
+int main() {
+    testEncoding();
+    testCompact();
+    testCompiled();
+    puts("position table tests passed");
+    return 0;
+}
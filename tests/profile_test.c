@@ -0,0 +1,141 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "ir_codegen.h"
+#include "ir_fixtures.h"
+#include "jit.h"
+#include "profile.h"
+
+typedef int64_t (*native0)();
+
+// The branch inside the loop is never taken.
+const char *source = "int64 loop() {\n"
+                     "    int64 s = 0;\n"
+                     "    int64 i = 0;\n"
+                     "    while (i < 100) {\n"
+                     "        if (i == 500) {\n"
+                     "            s = s + 1000;\n"
+                     "        }\n"
+                     "        s = s + i;\n"
+                     "        i = i + 1;\n"
+                     "    }\n"
+                     "    return s;\n"
+                     "}\n";
+
+int64_t run(struct jit_options *options) {
+    ir_context_t ctx;
+    ir_context_init(&ctx);
+    function_t *fn = compileSource(&ctx, source);
+    struct jit_batch batch;
+    jit_compileBatchWith(&ctx, &fn, 1, options, &batch);
+    int64_t result = ((native0)batch.entries[0])();
+    jit_batch_free(&batch);
+    ir_context_free(&ctx);
+    return result;
+}
+
+void testInstrument(struct profile *profile) {
+    struct jit_options options = {.instrument = profile};
+    assert(run(&options) == 4950);
+    assert(run(&options) == 4950);
+
+    struct profile_function *pf =
+        profile_get(profile, RANGE_STRING("loop"));
+    assert(pf && pf->blockCount > 3);
+    assert(*profile_counter(pf, 0, PROFILE_ENTRY) == 2);
+
+    // The loop head is entered 101 times per run and leaves the loop once.
+    size_t heads = 0, cold = 0;
+    for (size_t b = 0; b < pf->blockCount; b++) {
+        uint64_t entries = *profile_counter(pf, b, PROFILE_ENTRY);
+        uint64_t taken = *profile_counter(pf, b, PROFILE_TAKEN);
+        uint64_t notTaken = *profile_counter(pf, b, PROFILE_NOT_TAKEN);
+        if (entries == 202) {
+            heads++;
+            assert(taken == 200 && notTaken == 2);
+        }
+        if (taken || notTaken)
+            assert(taken + notTaken == entries);
+        cold += entries == 0;
+    }
+    assert(heads == 1 && cold == 1);
+}
+
+void testFile(struct profile *profile) {
+    char path[] = "/tmp/profile_testXXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    assert(profile_save(profile, path));
+
+    struct profile loaded;
+    profile_init(&loaded);
+    assert(profile_load(&loaded, path));
+    assert(profile_load(&loaded, path));
+    struct profile_function *a = profile_get(profile, RANGE_STRING("loop"));
+    struct profile_function *b = profile_get(&loaded, RANGE_STRING("loop"));
+    assert(b && a->blockCount == b->blockCount);
+    for (size_t i = 0; i < a->blockCount * PROFILE_COUNTERS; i++)
+        assert(b->counters[i] == 2 * a->counters[i]);
+    profile_free(&loaded);
+
+    FILE *file = fopen(path, "w");
+    fputs("loop 2\n1 2\n", file);
+    fclose(file);
+    profile_init(&loaded);
+    assert(!profile_load(&loaded, path));
+    profile_free(&loaded);
+    unlink(path);
+}
+
+void testLayout(struct profile *profile) {
+    struct jit_options options = {.layout = profile};
+    assert(run(&options) == 4950);
+
+    ir_context_t ctx;
+    ir_context_init(&ctx);
+    function_t *fn = compileSource(&ctx, source);
+    size_t count;
+    basic_block_t **postorder = function_computePostorder(fn, &count);
+    struct profile_function *pf = profile_get(profile, RANGE_STRING("loop"));
+    assert(count == pf->blockCount);
+
+    struct codegen cg;
+    codegen_init(&cg, IR_CODEGEN_REGISTERS);
+    struct ir_codegen ic;
+    ir_codegen_init(&ic, &cg, &ctx, NULL, NULL);
+    ic.layout = profile;
+    label_t entry = {};
+    ir_codegen_function(&ic, fn, &entry);
+
+    // The block that never ran is moved to the end, the entry stays first.
+    // The code of the edges comes after the blocks.
+    struct ir_codegen_block *blocks = ic.blocks.buffer;
+    size_t placed = ic.blocks.usage / sizeof(struct ir_codegen_block);
+    assert(placed >= count && blocks[0].block == fn->entry);
+    for (size_t i = 0; i < placed; i++)
+        assert(blocks[i].edge == (i >= count));
+    for (size_t i = 0; i < count; i++) {
+        size_t index = count - 1 - i;
+        if (*profile_counter(pf, index, PROFILE_ENTRY) == 0)
+            assert(blocks[count - 1].block == postorder[i]);
+    }
+
+    ir_codegen_free(&ic);
+    codegen_free(&cg);
+    free(postorder);
+    ir_context_free(&ctx);
+}
+
+int main() {
+    struct profile profile;
+    profile_init(&profile);
+    testInstrument(&profile);
+    testFile(&profile);
+    testLayout(&profile);
+    profile_free(&profile);
+    puts("profile tests passed");
+    return 0;
+}
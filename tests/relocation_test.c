@@ -1,3 +1,5 @@
+#include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include "buffer.h"
@@ -7,17 +9,38 @@ int main(int argc, char *args[]) {
     dbuffer_t dbuffer;
     dbuffer_init(&dbuffer);
 
+    struct reloc_table table;
+    reloc_table_init(&table);
+
     label_t testLabel = (label_t){};
-    relocation_set(&testLabel, RELATIVE, INT32, -4, dbuffer.usage);
+    label_t otherLabel = (label_t){};
+    reloc_table_addLabel(&table, &testLabel);
+    reloc_table_addLabel(&table, &otherLabel);
+
+    relocation_set(&testLabel, RELATIVE, INT32, 4, dbuffer.usage);
     dbuffer_pushLong(&dbuffer, 0, 4);
     dbuffer_pushChars(&dbuffer, 0, 100);
+    relocation_emit(&dbuffer, &otherLabel, ABSOLUTE, INT64, 0);
+    // Out of order relocations must still end up sorted.
+    relocation_set(&otherLabel, ABSOLUTE, INT16, 0, 50);
+
+    size_t count;
+    relocation_t *relocs = reloc_table_relocations(&table, &count);
+    assert(count == 3 && relocs[1].offset == 50 && "table must be sorted");
 
-    label_setOffset(&testLabel, dbuffer.usage);
-    label_apply(&testLabel, dbuffer.buffer);
+    label_setPosition(&testLabel, dbuffer.usage);
+    label_setOffset(&otherLabel, 0x1234);
+    reloc_table_apply(&table, dbuffer.buffer, 0);
+
+    assert(*(int32_t *)dbuffer.buffer == 112 - 4 && "wrong relative value");
+    assert(*(int16_t *)(dbuffer.buffer + 50) == 0x1234 &&
+           "wrong absolute value");
 
     FILE *file = fopen("test.out", "wb");
 
     dbuffer_write(&dbuffer, file);
 
+    reloc_table_free(&table);
+
     return 0;
 }
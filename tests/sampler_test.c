@@ -0,0 +1,94 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ir_fixtures.h"
+#include "jit.h"
+#include "sampler.h"
+
+typedef int64_t (*native0)();
+
+const char *spinSource = "int64 spin() {\n"
+                         "    int64 s = 0;\n"
+                         "    int64 i = 0;\n"
+                         "    while (i < 20000000) {\n"
+                         "        s = s + i * 3;\n"
+                         "        i = i + 1;\n"
+                         "    }\n"
+                         "    return s;\n"
+                         "}\n";
+
+const char *quickSource = "int64 quick() {\n"
+                          "    return 7;\n"
+                          "}\n";
+
+double cpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main() {
+    ir_context_t ctx;
+    ir_context_init(&ctx);
+    function_t *functions[] = {compileSource(&ctx, spinSource),
+                               compileSource(&ctx, quickSource)};
+    struct jit_batch batch;
+    jit_compileBatch(&ctx, functions, 2, &batch);
+
+    struct sampler sampler, other;
+    sampler_init(&sampler, 4096);
+    sampler_init(&other, 16);
+    sampler_addBatch(&sampler, &batch);
+
+    // The entry block starts at the function.
+    struct sampler_region *region = sampler_find(&sampler, batch.entries[0]);
+    assert(region && region->fn == functions[0]);
+    assert(region->block == functions[0]->entry);
+    assert(!sampler_find(&sampler, (uint8_t *)batch.code + batch.size));
+    assert(!sampler_find(&sampler, (void *)main));
+
+    assert(sampler_start(&sampler, 1000));
+    assert(!sampler_start(&other, 1000));
+    double start = cpuSeconds();
+    int64_t expected = 3 * (19999999LL * 20000000LL / 2);
+    while (atomic_load(&sampler.count) < 100 && cpuSeconds() - start < 10) {
+        assert(((native0)batch.entries[0])() == expected);
+        assert(((native0)batch.entries[1])() == 7);
+    }
+    sampler_stop(&sampler);
+
+    sampler_collect(&sampler);
+    assert(sampler.collected >= 20 && "the timer didn't fire");
+    size_t count = sampler.regions.usage / sizeof(struct sampler_region);
+    struct sampler_region *regions = sampler.regions.buffer;
+    size_t spin = 0, hottest = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (regions[i].fn == functions[0])
+            spin += regions[i].samples;
+        if (regions[i].samples > regions[hottest].samples)
+            hottest = i;
+    }
+    // Nearly all of the time is spent in the loop of spin.
+    assert(spin * 10 >= sampler.collected * 8);
+    assert(regions[hottest].fn == functions[0]);
+    assert(regions[hottest].block != functions[0]->entry);
+
+    char *report;
+    size_t reportSize;
+    FILE *file = open_memstream(&report, &reportSize);
+    sampler_report(&sampler, file);
+    fclose(file);
+    assert(strstr(report, "functions:") && strstr(report, "blocks:"));
+    assert(strstr(report, "  spin\n") && strstr(report, "  spin.bb"));
+    free(report);
+
+    sampler_free(&other);
+    sampler_free(&sampler);
+    jit_batch_free(&batch);
+    ir_context_free(&ctx);
+    puts("sampler tests passed");
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "ir.h"
+#include "ir_fixtures.h"
+#include "tier.h"
+
+// A single long running call leaves the interpreter in the middle of the
+// loop.
+void testOsr(ir_context_t *ctx) {
+    function_t *square = buildSquare(ctx);
+    function_t *sumSquares = buildSumSquares(ctx, square);
+
+    struct tier tier;
+    tier_init(&tier, ctx, 1000, 100);
+    struct tier_function *tf = tier_add(&tier, sumSquares);
+
+    int64_t n = 100000;
+    assert(tier_call(&tier, tf, &n) == referenceSumSquares(n));
+    tier_wait(&tier);
+    assert(tier.osrList.usage == sizeof(void *));
+    struct tier_osr *osr = *(struct tier_osr **)tier.osrList.buffer;
+    assert(osr->entry != NULL && osr->fn == sumSquares);
+
+    // The entry is compiled now, the second call switches over after 100 back
+    // edges.
+    n = 12345;
+    assert(tier_call(&tier, tf, &n) == referenceSumSquares(n));
+    assert(tf->entry == NULL);
+
+    tier_free(&tier);
+}
+
+int main(int argc, char *args[]) {
+    ir_context_t ctx;
+    ir_context_init(&ctx);
+
+    function_t *square = buildSquare(&ctx);
+    function_t *sumSquares = buildSumSquares(&ctx, square);
+
+    struct tier tier;
+    tier_init(&tier, &ctx, 3, 0);
+    struct tier_function *tf = tier_add(&tier, sumSquares);
+
+    // Cold calls are interpreted.
+    for (int64_t n = 0; n < 2; n++)
+        assert(tier_call(&tier, tf, &n) == referenceSumSquares(n));
+    tier_wait(&tier);
+    assert(tf->entry == NULL);
+
+    // The third call queues the function, the result must not change while
+    // the worker swaps the entry.
+    for (int64_t n = 2; n < 200; n++)
+        assert(tier_call(&tier, tf, &n) == referenceSumSquares(n));
+    tier_wait(&tier);
+    assert(tf->entry != NULL && tf->batch.count == 2);
+
+    for (int64_t n = 0; n < 200; n++)
+        assert(tier_call(&tier, tf, &n) == referenceSumSquares(n));
+
+    tier_free(&tier);
+
+    testOsr(&ctx);
+    ir_context_free(&ctx);
+    return 0;
+}
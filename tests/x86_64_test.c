@@ -0,0 +1,205 @@
+#include "buffer.h"
+#include "x86_64.h"
+#include <assert.h>
+#include <stdio.h>
+
+// Expected encodings are taken from GNU as.
+
+#define EXPECT(dbuffer, ...)                                                   \
+    do {                                                                       \
+        uint8_t expected[] = {__VA_ARGS__};                                    \
+        expect_bytes((dbuffer), expected, sizeof(expected), __LINE__);         \
+    } while (0)
+
+void expect_bytes(dbuffer_t *dbuffer, uint8_t *expected, size_t size,
+                  int line) {
+    if (dbuffer->usage != size ||
+        memcmp(dbuffer->buffer, expected, size) != 0) {
+        printf("encoding mismatch at line %d\n", line);
+        for (size_t i = 0; i < dbuffer->usage; i++)
+            printf("%02x ", ((uint8_t *)dbuffer->buffer)[i]);
+        puts("");
+        assert(0 && "encoding mismatch");
+    }
+    dbuffer_clear(dbuffer);
+}
+
+void test_alu(dbuffer_t *dbuffer) {
+    emit_aluRegReg64(dbuffer, ALU_ADD, RAX, RCX);
+    EXPECT(dbuffer, 0x48, 0x01, 0xC8);
+
+    emit_aluRegReg64(dbuffer, ALU_ADD, R9, R12);
+    EXPECT(dbuffer, 0x4D, 0x01, 0xE1);
+
+    emit_aluRegImm64(dbuffer, ALU_SUB, RDX, 5);
+    EXPECT(dbuffer, 0x48, 0x83, 0xEA, 0x05);
+
+    emit_aluRegImm64(dbuffer, ALU_CMP, R10, 1000);
+    EXPECT(dbuffer, 0x49, 0x81, 0xFA, 0xE8, 0x03, 0x00, 0x00);
+
+    emit_aluRegMem64(dbuffer, ALU_XOR, RSI, RBP, -8);
+    EXPECT(dbuffer, 0x48, 0x33, 0x75, 0xF8);
+
+    emit_aluRegMem64(dbuffer, ALU_ADD, RAX, RSP, 16);
+    EXPECT(dbuffer, 0x48, 0x03, 0x44, 0x24, 0x10);
+
+    emit_aluRegMem64(dbuffer, ALU_ADD, R11, R13, 0);
+    EXPECT(dbuffer, 0x4D, 0x03, 0x5D, 0x00);
+
+    emit_aluMemReg64(dbuffer, ALU_CMP, RBP, -256, R8);
+    EXPECT(dbuffer, 0x4C, 0x39, 0x85, 0x00, 0xFF, 0xFF, 0xFF);
+}
+
+void test_mulDiv(dbuffer_t *dbuffer) {
+    emit_imulRegReg64(dbuffer, RAX, RCX);
+    EXPECT(dbuffer, 0x48, 0x0F, 0xAF, 0xC1);
+
+    emit_imulRegImm64(dbuffer, R8, RDX, 10);
+    EXPECT(dbuffer, 0x4C, 0x6B, 0xC2, 0x0A);
+
+    emit_imulRegImm64(dbuffer, R9, R15, 100000);
+    EXPECT(dbuffer, 0x4D, 0x69, 0xCF, 0xA0, 0x86, 0x01, 0x00);
+
+    emit_imulRegMem64(dbuffer, RCX, RBP, -16);
+    EXPECT(dbuffer, 0x48, 0x0F, 0xAF, 0x4D, 0xF0);
+
+    emit_unaryReg64(dbuffer, UNARY_IDIV, RCX);
+    EXPECT(dbuffer, 0x48, 0xF7, 0xF9);
+
+    emit_unaryMem64(dbuffer, UNARY_IDIV, RBP, -24);
+    EXPECT(dbuffer, 0x48, 0xF7, 0x7D, 0xE8);
+
+    emit_unaryReg64(dbuffer, UNARY_NEG, R9);
+    EXPECT(dbuffer, 0x49, 0xF7, 0xD9);
+
+    emit_cqo(dbuffer);
+    EXPECT(dbuffer, 0x48, 0x99);
+}
+
+void test_setcc(dbuffer_t *dbuffer) {
+    emit_setccReg(dbuffer, CC_E, RAX);
+    EXPECT(dbuffer, 0x0F, 0x94, 0xC0);
+
+    emit_setccReg(dbuffer, CC_L, RSI);
+    EXPECT(dbuffer, 0x40, 0x0F, 0x9C, 0xC6);
+
+    emit_setccReg(dbuffer, CC_G, R10);
+    EXPECT(dbuffer, 0x41, 0x0F, 0x9F, 0xC2);
+
+    emit_setccMem(dbuffer, CC_NE, RBP, -8);
+    EXPECT(dbuffer, 0x0F, 0x95, 0x45, 0xF8);
+
+    emit_zeroExtendReg8(dbuffer, RSI);
+    EXPECT(dbuffer, 0x48, 0x0F, 0xB6, 0xF6);
+
+    emit_cmovRegReg64(dbuffer, CC_L, RAX, RCX);
+    EXPECT(dbuffer, 0x48, 0x0F, 0x4C, 0xC1);
+
+    emit_cmovRegReg64(dbuffer, CC_E, RDX, R11);
+    EXPECT(dbuffer, 0x49, 0x0F, 0x44, 0xD3);
+
+    emit_cmovRegMem64(dbuffer, CC_G, R8, RBP, -8);
+    EXPECT(dbuffer, 0x4C, 0x0F, 0x4F, 0x45, 0xF8);
+}
+
+void test_mov(dbuffer_t *dbuffer) {
+    emit_loadRegRBP64(dbuffer, R8, -8);
+    EXPECT(dbuffer, 0x4C, 0x8B, 0x45, 0xF8);
+
+    emit_storeRegRBP64(dbuffer, R8, -8);
+    EXPECT(dbuffer, 0x4C, 0x89, 0x45, 0xF8);
+
+    // Slots past -128 need a disp32.
+    emit_loadRegRBP64(dbuffer, RAX, -136);
+    EXPECT(dbuffer, 0x48, 0x8B, 0x85, 0x78, 0xFF, 0xFF, 0xFF);
+
+    emit_storeRegRBP64(dbuffer, R8, -4096);
+    EXPECT(dbuffer, 0x4C, 0x89, 0x85, 0x00, 0xF0, 0xFF, 0xFF);
+}
+
+void test_indirect(dbuffer_t *dbuffer) {
+    emit_callReg64(dbuffer, RAX);
+    EXPECT(dbuffer, 0xFF, 0xD0);
+
+    emit_callReg64(dbuffer, R11);
+    EXPECT(dbuffer, 0x41, 0xFF, 0xD3);
+
+    emit_jumpReg64(dbuffer, RAX);
+    EXPECT(dbuffer, 0xFF, 0xE0);
+
+    emit_jumpMem64(dbuffer, RAX, 0);
+    EXPECT(dbuffer, 0xFF, 0x20);
+
+    emit_jumpMem64(dbuffer, R12, 8);
+    EXPECT(dbuffer, 0x41, 0xFF, 0x64, 0x24, 0x08);
+
+    emit_incMem64(dbuffer, RAX, 0);
+    EXPECT(dbuffer, 0x48, 0xFF, 0x00);
+
+    emit_incMem64(dbuffer, R11, 16);
+    EXPECT(dbuffer, 0x49, 0xFF, 0x43, 0x10);
+
+    emit_loadRegMem64(dbuffer, RAX, RBP, 16);
+    EXPECT(dbuffer, 0x48, 0x8B, 0x45, 0x10);
+
+    emit_storeMemReg64(dbuffer, RSP, 8, R9);
+    EXPECT(dbuffer, 0x4C, 0x89, 0x4C, 0x24, 0x08);
+
+    emit_storeMemReg64(dbuffer, RSP, 0, RDI);
+    EXPECT(dbuffer, 0x48, 0x89, 0x3C, 0x24);
+}
+
+void test_shortForms(dbuffer_t *dbuffer) {
+    emit_storeConstShort64(dbuffer, RAX, 1);
+    EXPECT(dbuffer, 0xB8, 0x01, 0x00, 0x00, 0x00);
+
+    emit_storeConstShort64(dbuffer, R9, 0x80000000);
+    EXPECT(dbuffer, 0x41, 0xB9, 0x00, 0x00, 0x00, 0x80);
+
+    emit_storeConstShort64(dbuffer, RAX, -1);
+    EXPECT(dbuffer, 0x48, 0xC7, 0xC0, 0xFF, 0xFF, 0xFF, 0xFF);
+
+    emit_storeConstShort64(dbuffer, R10, 1l << 40);
+    EXPECT(dbuffer, 0x49, 0xBA, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
+           0x00);
+
+    emit_zeroReg64(dbuffer, RAX);
+    EXPECT(dbuffer, 0x31, 0xC0);
+
+    emit_zeroReg64(dbuffer, R11);
+    EXPECT(dbuffer, 0x45, 0x31, 0xDB);
+}
+
+void test_lea(dbuffer_t *dbuffer) {
+    emit_lea64(dbuffer, RAX, RDI, RAX, 0, -1);
+    EXPECT(dbuffer, 0x48, 0x8D, 0x47, 0xFF);
+
+    emit_lea64(dbuffer, RAX, RCX, RDX, 4, 8);
+    EXPECT(dbuffer, 0x48, 0x8D, 0x44, 0x91, 0x08);
+
+    emit_lea64(dbuffer, RSI, RDI, RDI, 2, 0);
+    EXPECT(dbuffer, 0x48, 0x8D, 0x34, 0x7F);
+
+    // R13 as the base still needs a displacement.
+    emit_lea64(dbuffer, R8, R13, R12, 1, 0);
+    EXPECT(dbuffer, 0x4F, 0x8D, 0x44, 0x25, 0x00);
+
+    emit_lea64(dbuffer, RBX, RAX, R9, 8, 0x1000);
+    EXPECT(dbuffer, 0x4A, 0x8D, 0x9C, 0xC8, 0x00, 0x10, 0x00, 0x00);
+}
+
+int main(int argc, char *args[]) {
+    dbuffer_t dbuffer;
+    dbuffer_init(&dbuffer);
+
+    test_alu(&dbuffer);
+    test_mulDiv(&dbuffer);
+    test_setcc(&dbuffer);
+    test_mov(&dbuffer);
+    test_indirect(&dbuffer);
+    test_shortForms(&dbuffer);
+    test_lea(&dbuffer);
+
+    dbuffer_free(&dbuffer);
+    return 0;
+}
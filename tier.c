@@ -0,0 +1,242 @@
+#include "tier.h"
+#include "osr.h"
+#include "ssa_conversion.h"
+
+#include <assert.h>
+
+// Work for the compiler thread, exactly one of them is set.
+struct tier_job {
+    struct tier_function *tf;
+    struct tier_osr *osr;
+};
+
+void *_tier_worker(void *arg);
+int _tier_osr(void *ctx, struct interp_osr_state *state, int64_t *result);
+
+void tier_init(struct tier *tier, ir_context_t *ctx, size_t threshold,
+               size_t osrThreshold) {
+    *tier = (struct tier){};
+    tier->ctx = ctx;
+    tier->threshold = threshold;
+    interp_init(&tier->interp, ctx);
+    if (osrThreshold)
+        interp_setOsr(&tier->interp, osrThreshold, _tier_osr, tier);
+    hashmap_init(&tier->osrs, ptrKeyType);
+    dbuffer_init(&tier->osrList);
+    dbuffer_init(&tier->functions);
+    hashset_init(&tier->converted, ptrKeyType);
+    dbuffer_init(&tier->queue);
+
+    pthread_mutex_init(&tier->lock, NULL);
+    pthread_cond_init(&tier->wake, NULL);
+    pthread_cond_init(&tier->idle, NULL);
+    int err = pthread_create(&tier->worker, NULL, _tier_worker, tier);
+    assert(err == 0 && "couldn't start the compiler thread");
+}
+
+void tier_free(struct tier *tier) {
+    pthread_mutex_lock(&tier->lock);
+    tier->stop = 1;
+    pthread_cond_signal(&tier->wake);
+    pthread_mutex_unlock(&tier->lock);
+    pthread_join(tier->worker, NULL);
+
+    size_t count;
+    struct tier_function **functions = (struct tier_function **)
+        dbuffer_asPtrArray(&tier->functions, &count);
+    for (size_t i = 0; i < count; i++) {
+        if (functions[i]->batch.code)
+            jit_batch_free(&functions[i]->batch);
+        free(functions[i]);
+    }
+    struct tier_osr **osrs =
+        (struct tier_osr **)dbuffer_asPtrArray(&tier->osrList, &count);
+    for (size_t i = 0; i < count; i++) {
+        if (osrs[i]->batch.code)
+            jit_batch_free(&osrs[i]->batch);
+        free(osrs[i]);
+    }
+
+    pthread_cond_destroy(&tier->idle);
+    pthread_cond_destroy(&tier->wake);
+    pthread_mutex_destroy(&tier->lock);
+    dbuffer_free(&tier->queue);
+    hashset_free(&tier->converted);
+    dbuffer_free(&tier->functions);
+    hashmap_free(&tier->osrs);
+    dbuffer_free(&tier->osrList);
+    interp_free(&tier->interp);
+}
+
+struct tier_function *tier_add(struct tier *tier, function_t *fn) {
+    assert(fn->argumentCount <= TIER_MAX_ARGUMENTS && "too many arguments");
+    struct tier_function *tf = nnew(struct tier_function);
+    *tf = (struct tier_function){.fn = fn};
+    interp_prepare(&tier->interp, fn);
+    dbuffer_pushPtr(&tier->functions, tf);
+    return tf;
+}
+
+void _tier_enqueue(struct tier *tier, struct tier_job job) {
+    pthread_mutex_lock(&tier->lock);
+    dbuffer_pushData(&tier->queue, &job, sizeof(job));
+    pthread_cond_signal(&tier->wake);
+    pthread_mutex_unlock(&tier->lock);
+}
+
+typedef int64_t (*tier_native0)();
+typedef int64_t (*tier_native6)(int64_t, int64_t, int64_t, int64_t, int64_t,
+                                int64_t);
+
+int64_t _tier_callNative(void *entry, size_t argumentCount, int64_t *args) {
+    if (argumentCount == 0)
+        return ((tier_native0)entry)();
+    // Extra arguments are ignored by the callee.
+    int64_t a[TIER_MAX_ARGUMENTS] = {};
+    for (size_t i = 0; i < argumentCount; i++)
+        a[i] = args[i];
+    return ((tier_native6)entry)(a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+int64_t tier_call(struct tier *tier, struct tier_function *tf, int64_t *args) {
+    void *entry = atomic_load_explicit(&tf->entry, memory_order_acquire);
+    if (entry)
+        return _tier_callNative(entry, tf->fn->argumentCount, args);
+
+    size_t calls =
+        atomic_fetch_add_explicit(&tf->calls, 1, memory_order_relaxed) + 1;
+    if (calls == tier->threshold)
+        _tier_enqueue(tier, (struct tier_job){.tf = tf});
+    return interp_call(&tier->interp, tf->fn, args);
+}
+
+// Runs on the thread that interprets the loop.
+int _tier_osr(void *ctx, struct interp_osr_state *state, int64_t *result) {
+    struct tier *tier = ctx;
+    size_t count = state->fn->argumentCount + state->rIdCount;
+    struct hm_bucket_entry *entry = hashmap_getPtr(&tier->osrs, state->header);
+    if (!entry) {
+        struct tier_osr *osr = nnew(struct tier_osr);
+        *osr = (struct tier_osr){.fn = state->fn,
+                                 .header = state->header,
+                                 .rIds = state->rIds,
+                                 .rIdCount = state->rIdCount};
+        hashmap_setPtr(&tier->osrs, state->header, &osr->hmEntry);
+        dbuffer_pushPtr(&tier->osrList, osr);
+        // The whole state is passed in registers.
+        if (count <= TIER_MAX_ARGUMENTS)
+            _tier_enqueue(tier, (struct tier_job){.osr = osr});
+        return 0;
+    }
+
+    struct tier_osr *osr = containerof(entry, struct tier_osr, hmEntry);
+    void *code = atomic_load_explicit(&osr->entry, memory_order_acquire);
+    if (!code)
+        return 0;
+    *result = _tier_callNative(code, count, state->values);
+    return 1;
+}
+
+void tier_wait(struct tier *tier) {
+    pthread_mutex_lock(&tier->lock);
+    while (tier->busy ||
+           tier->queueHead * sizeof(struct tier_job) < tier->queue.usage)
+        pthread_cond_wait(&tier->idle, &tier->lock);
+    pthread_mutex_unlock(&tier->lock);
+}
+
+// Collect @fn and every function it can reach through calls.
+void _tier_collect(function_t *fn, hashset_t *seen, dbuffer_t *result) {
+    if (!hashset_insertPtr(seen, fn))
+        return;
+    dbuffer_pushPtr(result, fn);
+
+    size_t count;
+    basic_block_t **postorder = function_computePostorder(fn, &count);
+    for (size_t i = 0; i < count; i++) {
+        LIST_FOR_EACH(&postorder[i]->instructions) {
+            instruction_t *inst = containerof(c, instruction_t, inst_list);
+            if (inst->type != INST_FUNCTION_CALL)
+                continue;
+            inst_function_call_t *call =
+                IR_INST_AS_TYPE(inst, inst_function_call_t);
+            _tier_collect(containerof(call->uses[0]->value, function_t, value),
+                          seen, result);
+        }
+    }
+    free(postorder);
+}
+
+void _tier_convert(struct tier *tier, function_t *fn) {
+    if (!hashset_insertPtr(&tier->converted, fn))
+        return;
+    ssa_convertFunction(tier->ctx, fn);
+}
+
+// Compile @fn and everything it calls with the optimizing pipeline, returns
+// the entry of @fn.
+void *_tier_compile(struct tier *tier, function_t *fn,
+                    struct jit_batch *batch) {
+    hashset_t seen;
+    hashset_init(&seen, ptrKeyType);
+    dbuffer_t functions;
+    dbuffer_init(&functions);
+    _tier_collect(fn, &seen, &functions);
+
+    size_t count;
+    function_t **fns = (function_t **)dbuffer_asPtrArray(&functions, &count);
+    for (size_t i = 0; i < count; i++)
+        _tier_convert(tier, fns[i]);
+    jit_compileBatch(tier->ctx, fns, count, batch);
+
+    dbuffer_free(&functions);
+    hashset_free(&seen);
+    return batch->entries[0];
+}
+
+void _tier_promote(struct tier *tier, struct tier_function *tf) {
+    void *entry = _tier_compile(tier, tf->fn, &tf->batch);
+    atomic_store_explicit(&tf->entry, entry, memory_order_release);
+}
+
+void _tier_promoteOsr(struct tier *tier, struct tier_osr *osr) {
+    // The variables are gone once the function is in SSA form, that happens
+    // when it was compiled as a part of another batch.
+    if (hashset_existsPtr(&tier->converted, osr->fn))
+        return;
+    function_t *fn = osr_buildEntry(tier->ctx, osr->fn, osr->header,
+                                    osr->rIds, osr->rIdCount);
+    if (!fn)
+        return;
+    void *entry = _tier_compile(tier, fn, &osr->batch);
+    atomic_store_explicit(&osr->entry, entry, memory_order_release);
+}
+
+void *_tier_worker(void *arg) {
+    struct tier *tier = arg;
+    pthread_mutex_lock(&tier->lock);
+    while (1) {
+        while (!tier->stop &&
+               tier->queueHead * sizeof(struct tier_job) == tier->queue.usage)
+            pthread_cond_wait(&tier->wake, &tier->lock);
+        if (tier->stop)
+            break;
+
+        struct tier_job job =
+            ((struct tier_job *)tier->queue.buffer)[tier->queueHead++];
+        tier->busy = 1;
+        pthread_mutex_unlock(&tier->lock);
+
+        if (job.tf)
+            _tier_promote(tier, job.tf);
+        else
+            _tier_promoteOsr(tier, job.osr);
+
+        pthread_mutex_lock(&tier->lock);
+        tier->busy = 0;
+        if (tier->queueHead * sizeof(struct tier_job) == tier->queue.usage)
+            pthread_cond_broadcast(&tier->idle);
+    }
+    pthread_mutex_unlock(&tier->lock);
+    return NULL;
+}
@@ -0,0 +1,85 @@
+// Tiered execution, functions start in the interpreter and are compiled by
+// the SSA pipeline on a background thread once they get hot. Hot loops are
+// entered mid way through OSR entries.
+#ifndef TIER_H
+#define TIER_H
+
+#include "hashmap.h"
+#include "interp.h"
+#include "jit.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Native code can take at most this many arguments.
+#define TIER_MAX_ARGUMENTS 6
+
+struct tier_function {
+    function_t *fn;
+    // Native code, NULL while the function is interpreted.
+    _Atomic(void *) entry;
+    atomic_size_t calls;
+
+    // The function and everything it calls, compiled together.
+    struct jit_batch batch;
+};
+
+// Entry into optimized code at a loop header.
+struct tier_osr {
+    function_t *fn;
+    basic_block_t *header;
+    // Variables the entry takes after the arguments of fn.
+    size_t *rIds;
+    size_t rIdCount;
+    // Native code, NULL until it is compiled or if the loop can't be entered.
+    _Atomic(void *) entry;
+    struct jit_batch batch;
+
+    struct hm_bucket_entry hmEntry;
+};
+
+struct tier {
+    ir_context_t *ctx;
+    struct interp interp;
+    // Calls before a function is queued for compilation.
+    size_t threshold;
+    // header -> tier_osr, only touched by the thread that runs the code.
+    hashmap_t osrs;
+    dbuffer_t osrList;
+
+    // Functions given to tier_add.
+    dbuffer_t functions;
+    // Functions that are already in SSA form, only touched by the worker.
+    hashset_t converted;
+
+    pthread_t worker;
+    pthread_mutex_t lock;
+    // Signaled when the queue gets a new function or the tier stops.
+    pthread_cond_t wake;
+    // Signaled when the queue becomes empty.
+    pthread_cond_t idle;
+    // tier_job entries.
+    dbuffer_t queue;
+    size_t queueHead;
+    int busy;
+    int stop;
+};
+
+// Functions are compiled after @threshold calls, loops get an OSR entry
+// after @osrThreshold back edges, 0 disables OSR.
+void tier_init(struct tier *tier, ir_context_t *ctx, size_t threshold,
+               size_t osrThreshold);
+// Stops the worker, pending compilations are dropped.
+void tier_free(struct tier *tier);
+
+// Register @fn, it is decoded for the interpreter right away. From now on the
+// IR of @fn and the functions it calls belongs to the worker.
+struct tier_function *tier_add(struct tier *tier, function_t *fn);
+
+// Call through the fastest available tier.
+int64_t tier_call(struct tier *tier, struct tier_function *tf, int64_t *args);
+
+// Wait until every queued function is installed.
+void tier_wait(struct tier *tier);
+
+#endif
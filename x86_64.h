@@ -87,11 +87,63 @@
     o(a, R13, 13)        \
     o(a, R14, 14)        \
     o(a, R15, 15)
+
+// Instructions that share the classic ALU encoding scheme.
+// o(a, name, opcode, extension)
+// @opcode is the `op r/m64, r64` form, `op r64, r/m64` is @opcode + 2.
+// @extension is the /digit used by the 0x81 and 0x83 immediate forms.
+#define ALU_OPS(o, a)   \
+    o(a, ADD, 0x01, 0)  \
+    o(a, OR, 0x09, 1)   \
+    o(a, ADC, 0x11, 2)  \
+    o(a, SBB, 0x19, 3)  \
+    o(a, AND, 0x21, 4)  \
+    o(a, SUB, 0x29, 5)  \
+    o(a, XOR, 0x31, 6)  \
+    o(a, CMP, 0x39, 7)
+
+// Single operand instructions encoded as 0xF7 /digit.
+// o(a, name, extension)
+#define UNARY_OPS(o, a) \
+    o(a, NOT, 2)        \
+    o(a, NEG, 3)        \
+    o(a, MUL, 4)        \
+    o(a, IMUL, 5)       \
+    o(a, DIV, 6)        \
+    o(a, IDIV, 7)
+
+// Condition codes used by jcc, setcc and friends.
+// o(a, name, condition number)
+#define CONDITION_CODES(o, a) \
+    o(a, O, 0x0)              \
+    o(a, NO, 0x1)             \
+    o(a, B, 0x2)              \
+    o(a, AE, 0x3)             \
+    o(a, E, 0x4)              \
+    o(a, NE, 0x5)             \
+    o(a, BE, 0x6)             \
+    o(a, A, 0x7)              \
+    o(a, S, 0x8)              \
+    o(a, NS, 0x9)             \
+    o(a, P, 0xA)              \
+    o(a, NP, 0xB)             \
+    o(a, L, 0xC)              \
+    o(a, GE, 0xD)             \
+    o(a, LE, 0xE)             \
+    o(a, G, 0xF)
 // clang-format on
 
 #define FIRST3(a, b, c) a(b)
 #define SECOND3(a, b, c) a(c)
 
+#define FIRST4(a, b, c, d) a(b)
+#define SECOND4(a, b, c, d) a(c)
+#define THIRD4(a, b, c, d) a(d)
+
+#define ALU_COMMA(v) ALU_##v,
+#define UNARY_COMMA(v) UNARY_##v,
+#define CC_COMMA(v) CC_##v,
+
 typedef enum { REGISTER8(FIRST3, COMMA) } reg8;
 
 typedef enum { REGISTER16(FIRST3, COMMA) } reg16;
@@ -100,6 +152,12 @@ typedef enum { REGISTER32(FIRST3, COMMA) } reg32;
 
 typedef enum { REGISTER64(FIRST3, COMMA) } reg64;
 
+typedef enum { ALU_OPS(FIRST4, ALU_COMMA) } alu_op;
+
+typedef enum { UNARY_OPS(FIRST3, UNARY_COMMA) } unary_op;
+
+typedef enum { CONDITION_CODES(FIRST3, CC_COMMA) } cond_code;
+
 // Register encoding numbers.
 
 extern uint8_t kReg8Number[];
@@ -110,27 +168,52 @@ extern uint8_t kReg32Number[];
 
 extern uint8_t kReg64Number[];
 
+// Instruction encoding tables.
+
+extern uint8_t kAluOpcode[];
+
+extern uint8_t kAluExtension[];
+
+extern uint8_t kUnaryExtension[];
+
+extern uint8_t kCondNumber[];
+
 void emit_syscall(dbuffer_t *dbuffer);
 
 void emit_jumpRel8(dbuffer_t *dbuffer, label_t *label);
 
 void emit_jumpZeroRel8(dbuffer_t *dbuffer, label_t *label);
 
+void emit_jumpRel32(dbuffer_t *dbuffer, label_t *label);
+
+void emit_jumpCondRel8(dbuffer_t *dbuffer, cond_code cc, label_t *label);
+
+void emit_jumpCondRel32(dbuffer_t *dbuffer, cond_code cc, label_t *label);
+
 void emit_checkZero32(dbuffer_t *dbuffer, reg32 reg);
 
 void emit_checkZero64(dbuffer_t *dbuffer, reg64 reg);
 
 void emit_loadRegRBP32(dbuffer_t *dbuffer, reg32 reg, char disp);
 
-void emit_loadRegRBP64(dbuffer_t *dbuffer, reg64 reg, char disp);
+// mov reg, [rbp + disp], disp8 when it fits.
+void emit_loadRegRBP64(dbuffer_t *dbuffer, reg64 reg, int32_t disp);
 
 void emit_storeConst32(dbuffer_t *dbuffer, reg32 reg, int cons);
 
 void emit_storeConst64(dbuffer_t *dbuffer, reg64 reg, long cons);
 
+// mov reg, imm in the shortest form: mov r32, imm32 for values that fit
+// unsigned in 32 bits, a sign extended imm32 or a full movabs.
+void emit_storeConstShort64(dbuffer_t *dbuffer, reg64 reg, long cons);
+
+// xor reg32, reg32, the shortest way to zero a register. Clobbers the flags.
+void emit_zeroReg64(dbuffer_t *dbuffer, reg64 reg);
+
 void emit_storeLabel64(dbuffer_t *dbuffer, reg64 reg, label_t *label);
 
-void emit_storeRegRBP64(dbuffer_t *dbuffer, reg64 reg, char disp);
+// mov [rbp + disp], reg, disp8 when it fits.
+void emit_storeRegRBP64(dbuffer_t *dbuffer, reg64 reg, int32_t disp);
 
 void emit_storeReg64(dbuffer_t *dbuffer, reg64 from, reg64 to);
 
@@ -148,4 +231,79 @@ void emit_ret(dbuffer_t *dbuffer);
 
 void emit_call(dbuffer_t *dbuffer, label_t *label);
 
+// call reg
+void emit_callReg64(dbuffer_t *dbuffer, reg64 reg);
+
+// jmp reg
+void emit_jumpReg64(dbuffer_t *dbuffer, reg64 reg);
+
+// jmp [base + disp]
+void emit_jumpMem64(dbuffer_t *dbuffer, reg64 base, int32_t disp);
+
+// inc qword [base + disp]
+void emit_incMem64(dbuffer_t *dbuffer, reg64 base, int32_t disp);
+// mov reg, [base + disp]
+void emit_loadRegMem64(dbuffer_t *dbuffer, reg64 dst, reg64 base, int32_t disp);
+// mov [base + disp], reg
+void emit_storeMemReg64(dbuffer_t *dbuffer, reg64 base, int32_t disp,
+                        reg64 src);
+// lea dst, [base + index * scale + disp], a @scale of 0 leaves out the
+// index.
+void emit_lea64(dbuffer_t *dbuffer, reg64 dst, reg64 base, reg64 index,
+                int scale, int32_t disp);
+
+// -- Table driven encoder --
+// Memory operands are always [base + disp].
+
+// op dst, src
+void emit_aluRegReg64(dbuffer_t *dbuffer, alu_op op, reg64 dst, reg64 src);
+
+// op dst, imm. Uses the imm8 form when the immediate fits.
+void emit_aluRegImm64(dbuffer_t *dbuffer, alu_op op, reg64 dst, int32_t imm);
+
+// op dst, [base + disp]
+void emit_aluRegMem64(dbuffer_t *dbuffer, alu_op op, reg64 dst, reg64 base,
+                      int32_t disp);
+
+// op [base + disp], src
+void emit_aluMemReg64(dbuffer_t *dbuffer, alu_op op, reg64 base, int32_t disp,
+                      reg64 src);
+
+// op reg
+void emit_unaryReg64(dbuffer_t *dbuffer, unary_op op, reg64 reg);
+
+// op [base + disp]
+void emit_unaryMem64(dbuffer_t *dbuffer, unary_op op, reg64 base,
+                     int32_t disp);
+
+// imul dst, src
+void emit_imulRegReg64(dbuffer_t *dbuffer, reg64 dst, reg64 src);
+
+// imul dst, src, imm
+void emit_imulRegImm64(dbuffer_t *dbuffer, reg64 dst, reg64 src, int32_t imm);
+
+// imul dst, [base + disp]
+void emit_imulRegMem64(dbuffer_t *dbuffer, reg64 dst, reg64 base,
+                       int32_t disp);
+
+// setcc on the low byte of the register.
+void emit_setccReg(dbuffer_t *dbuffer, cond_code cc, reg64 reg);
+
+// setcc byte [base + disp]
+void emit_setccMem(dbuffer_t *dbuffer, cond_code cc, reg64 base, int32_t disp);
+
+// cmovcc dst, src
+void emit_cmovRegReg64(dbuffer_t *dbuffer, cond_code cc, reg64 dst,
+                       reg64 src);
+
+// cmovcc dst, [base + disp]
+void emit_cmovRegMem64(dbuffer_t *dbuffer, cond_code cc, reg64 dst,
+                       reg64 base, int32_t disp);
+
+// movzx reg, reg8
+void emit_zeroExtendReg8(dbuffer_t *dbuffer, reg64 reg);
+
+// Sign extend RAX into RDX:RAX, needed before idiv.
+void emit_cqo(dbuffer_t *dbuffer);
+
 #endif
@@ -3,6 +3,7 @@
 #include "platform_utils.h"
 #include "relocation.h"
 #include "x86_64.h"
+#include "x86_64_codegen.h"
 #include <stdint.h>
 #include <stdio.h>
 
@@ -14,6 +15,14 @@ uint8_t kReg32Number[] = {REGISTER32(SECOND3, COMMA)};
 
 uint8_t kReg64Number[] = {REGISTER64(SECOND3, COMMA)};
 
+uint8_t kAluOpcode[] = {ALU_OPS(SECOND4, COMMA)};
+
+uint8_t kAluExtension[] = {ALU_OPS(THIRD4, COMMA)};
+
+uint8_t kUnaryExtension[] = {UNARY_OPS(SECOND3, COMMA)};
+
+uint8_t kCondNumber[] = {CONDITION_CODES(SECOND3, COMMA)};
+
 // @W Make the addressing 64bit.
 // @R Extension for the ModR/M reg field.
 // @X Extension of the SIB index field.
@@ -33,6 +42,35 @@ void emit_modrm(dbuffer_t *dbuffer, uint8_t mod, uint8_t regop, uint8_t rm) {
     dbuffer_pushChar(dbuffer, result);
 }
 
+// ModR/M, SIB and displacement for a [base + disp] operand.
+void emit_modrmMem(dbuffer_t *dbuffer, uint8_t regop, reg64 base,
+                   int32_t disp) {
+    uint8_t baseNumber = kReg64Number[base] & 0b111;
+
+    uint8_t mod = 2;
+    // RBP and R13 can't be encoded without a displacement.
+    if (disp == 0 && baseNumber != 5)
+        mod = 0;
+    else if (disp >= INT8_MIN && disp <= INT8_MAX)
+        mod = 1;
+
+    emit_modrm(dbuffer, mod, regop & 0b111, baseNumber);
+    // RSP and R12 need a SIB byte.
+    if (baseNumber == 4)
+        dbuffer_pushChar(dbuffer, 0x24);
+
+    if (mod == 1)
+        dbuffer_pushChar(dbuffer, (uint8_t)disp);
+    else if (mod == 2)
+        dbuffer_pushInt(dbuffer, (uint32_t)disp, 4);
+}
+
+// REX.W prefix for a register in the reg field and a register or base in the
+// r/m field.
+void emit_rexW(dbuffer_t *dbuffer, reg64 reg, reg64 rm) {
+    emit_rex(dbuffer, 1, kReg64Number[reg] > 7, 0, kReg64Number[rm] > 7);
+}
+
 void emit_syscall(dbuffer_t *dbuffer) { dbuffer_push(dbuffer, 2, 0x0F, 0x05); }
 
 void emit_jumpRel8(dbuffer_t *dbuffer, label_t *label) {
@@ -45,6 +83,21 @@ void emit_jumpZeroRel8(dbuffer_t *dbuffer, label_t *label) {
     relocation_emit(dbuffer, label, RELATIVE, INT8, 1);
 }
 
+void emit_jumpRel32(dbuffer_t *dbuffer, label_t *label) {
+    dbuffer_push(dbuffer, 1, 0xE9);
+    relocation_emit(dbuffer, label, RELATIVE, INT32, 4);
+}
+
+void emit_jumpCondRel8(dbuffer_t *dbuffer, cond_code cc, label_t *label) {
+    dbuffer_push(dbuffer, 1, 0x70 | kCondNumber[cc]);
+    relocation_emit(dbuffer, label, RELATIVE, INT8, 1);
+}
+
+void emit_jumpCondRel32(dbuffer_t *dbuffer, cond_code cc, label_t *label) {
+    dbuffer_push(dbuffer, 2, 0x0F, 0x80 | kCondNumber[cc]);
+    relocation_emit(dbuffer, label, RELATIVE, INT32, 4);
+}
+
 void emit_checkZero32(dbuffer_t *dbuffer, reg32 reg) {
     uint8_t regNumber = kReg32Number[reg];
     if (regNumber > 7) {
@@ -78,14 +131,8 @@ void emit_loadRegRBP32(dbuffer_t *dbuffer, reg32 reg, char disp) {
     dbuffer_push(dbuffer, 1, disp);
 }
 
-void emit_loadRegRBP64(dbuffer_t *dbuffer, reg64 reg, char disp) {
-    uint8_t regNumber = kReg64Number[reg];
-    emit_rex(dbuffer, 1, 0, 0, regNumber > 7);
-    regNumber &= 0b111;
-
-    dbuffer_push(dbuffer, 1, 0x8B);
-    emit_modrm(dbuffer, 1, regNumber, kReg64Number[RBP]);
-    dbuffer_push(dbuffer, 1, disp);
+void emit_loadRegRBP64(dbuffer_t *dbuffer, reg64 reg, int32_t disp) {
+    emit_loadRegMem64(dbuffer, reg, RBP, disp);
 }
 
 void emit_storeConst32(dbuffer_t *dbuffer, reg32 reg, int cons) {
@@ -108,6 +155,32 @@ void emit_storeConst64(dbuffer_t *dbuffer, reg64 reg, long cons) {
     dbuffer_pushLong(dbuffer, cons, 8);
 }
 
+void emit_storeConstShort64(dbuffer_t *dbuffer, reg64 reg, long cons) {
+    if (cons >= 0 && cons <= UINT32_MAX) {
+        // Writing the 32 bit register clears the upper half.
+        emit_storeConst32(dbuffer, (reg32)reg, (int)cons);
+    } else if (cons >= INT32_MIN && cons <= INT32_MAX) {
+        // mov r/m64, imm32 sign extends.
+        uint8_t regNumber = kReg64Number[reg];
+        emit_rex(dbuffer, 1, 0, 0, regNumber > 7);
+        dbuffer_pushChar(dbuffer, 0xC7);
+        emit_modrm(dbuffer, 3, 0, regNumber & 0b111);
+        dbuffer_pushInt(dbuffer, (uint32_t)cons, 4);
+    } else {
+        emit_storeConst64(dbuffer, reg, cons);
+    }
+}
+
+void emit_zeroReg64(dbuffer_t *dbuffer, reg64 reg) {
+    uint8_t regNumber = kReg64Number[reg];
+    if (regNumber > 7)
+        emit_rex(dbuffer, 0, 1, 0, 1);
+    regNumber &= 0b111;
+
+    dbuffer_pushChar(dbuffer, 0x31); // xor
+    emit_modrm(dbuffer, 3, regNumber, regNumber);
+}
+
 void emit_storeLabel64(dbuffer_t *dbuffer, reg64 reg, label_t *label) {
     uint8_t regNumber = kReg64Number[reg];
     emit_rex(dbuffer, 1, 0, 0, regNumber > 7);
@@ -117,14 +190,8 @@ void emit_storeLabel64(dbuffer_t *dbuffer, reg64 reg, label_t *label) {
     relocation_emit(dbuffer, label, ABSOLUTE, INT64, 0);
 }
 
-void emit_storeRegRBP64(dbuffer_t *dbuffer, reg64 reg, char disp) {
-    uint8_t regNumber = kReg64Number[reg];
-    emit_rex(dbuffer, 1, regNumber > 7, 0, 0);
-    regNumber &= 0b111;
-
-    dbuffer_push(dbuffer, 1, 0x89); // mov
-    emit_modrm(dbuffer, 1, regNumber, kReg64Number[RBP]);
-    dbuffer_push(dbuffer, 1, disp);
+void emit_storeRegRBP64(dbuffer_t *dbuffer, reg64 reg, int32_t disp) {
+    emit_storeMemReg64(dbuffer, RBP, disp, reg);
 }
 
 void emit_storeReg64(dbuffer_t *dbuffer, reg64 from, reg64 to) {
@@ -140,7 +207,7 @@ void emit_storeReg64(dbuffer_t *dbuffer, reg64 from, reg64 to) {
 
 void emit_subConst64(dbuffer_t *dbuffer, reg64 reg, int imm) {
     uint8_t regNumber = kReg64Number[reg];
-    emit_rex(dbuffer, 1, 0, regNumber > 7, 0);
+    emit_rex(dbuffer, 1, 0, 0, regNumber > 7);
     regNumber &= 0b111;
 
     dbuffer_push(dbuffer, 1, 0x81);
@@ -150,7 +217,7 @@ void emit_subConst64(dbuffer_t *dbuffer, reg64 reg, int imm) {
 
 void emit_subLabel64(dbuffer_t *dbuffer, reg64 reg, label_t *label) {
     uint8_t regNumber = kReg64Number[reg];
-    emit_rex(dbuffer, 1, 0, regNumber > 7, 0);
+    emit_rex(dbuffer, 1, 0, 0, regNumber > 7);
     regNumber &= 0b111;
 
     dbuffer_push(dbuffer, 1, 0x81);
@@ -195,13 +262,229 @@ void emit_call(dbuffer_t *dbuffer, label_t *label) {
     relocation_emit(dbuffer, label, RELATIVE, INT32, 4);
 }
 
+// 0xFF /digit with a register operand.
+void _emit_indirectReg(dbuffer_t *dbuffer, uint8_t extension, reg64 reg) {
+    uint8_t regNumber = kReg64Number[reg];
+    if (regNumber > 7)
+        emit_rex(dbuffer, 0, 0, 0, 1);
+    dbuffer_pushChar(dbuffer, 0xFF);
+    emit_modrm(dbuffer, 3, extension, regNumber & 0b111);
+}
+
+void emit_callReg64(dbuffer_t *dbuffer, reg64 reg) {
+    _emit_indirectReg(dbuffer, 2, reg);
+}
+
+void emit_jumpReg64(dbuffer_t *dbuffer, reg64 reg) {
+    _emit_indirectReg(dbuffer, 4, reg);
+}
+
+void emit_jumpMem64(dbuffer_t *dbuffer, reg64 base, int32_t disp) {
+    if (kReg64Number[base] > 7)
+        emit_rex(dbuffer, 0, 0, 0, 1);
+    dbuffer_pushChar(dbuffer, 0xFF);
+    emit_modrmMem(dbuffer, 4, base, disp);
+}
+
+void emit_incMem64(dbuffer_t *dbuffer, reg64 base, int32_t disp) {
+    emit_rex(dbuffer, 1, 0, 0, kReg64Number[base] > 7);
+    dbuffer_pushChar(dbuffer, 0xFF);
+    emit_modrmMem(dbuffer, 0, base, disp);
+}
+
+void emit_loadRegMem64(dbuffer_t *dbuffer, reg64 dst, reg64 base,
+                       int32_t disp) {
+    emit_rexW(dbuffer, dst, base);
+    dbuffer_pushChar(dbuffer, 0x8B);
+    emit_modrmMem(dbuffer, kReg64Number[dst], base, disp);
+}
+
+void emit_storeMemReg64(dbuffer_t *dbuffer, reg64 base, int32_t disp,
+                        reg64 src) {
+    emit_rexW(dbuffer, src, base);
+    dbuffer_pushChar(dbuffer, 0x89);
+    emit_modrmMem(dbuffer, kReg64Number[src], base, disp);
+}
+
+void emit_lea64(dbuffer_t *dbuffer, reg64 dst, reg64 base, reg64 index,
+                int scale, int32_t disp) {
+    if (!scale) {
+        emit_rexW(dbuffer, dst, base);
+        dbuffer_pushChar(dbuffer, 0x8D);
+        emit_modrmMem(dbuffer, kReg64Number[dst], base, disp);
+        return;
+    }
+    assert(index != RSP && "rsp can't be an index");
+    assert((scale == 1 || scale == 2 || scale == 4 || scale == 8) &&
+           "scale must be 1, 2, 4 or 8");
+    uint8_t baseNumber = kReg64Number[base];
+    uint8_t indexNumber = kReg64Number[index];
+    emit_rex(dbuffer, 1, kReg64Number[dst] > 7, indexNumber > 7,
+             baseNumber > 7);
+    dbuffer_pushChar(dbuffer, 0x8D);
+
+    uint8_t mod = 2;
+    // RBP and R13 can't be encoded without a displacement.
+    if (disp == 0 && (baseNumber & 0b111) != 5)
+        mod = 0;
+    else if (disp >= INT8_MIN && disp <= INT8_MAX)
+        mod = 1;
+    // r/m 4 means a SIB byte follows.
+    emit_modrm(dbuffer, mod, kReg64Number[dst] & 0b111, 4);
+    uint8_t scaleBits = __builtin_ctz(scale);
+    dbuffer_pushChar(dbuffer, scaleBits << 6 | (indexNumber & 0b111) << 3 |
+                                  (baseNumber & 0b111));
+
+    if (mod == 1)
+        dbuffer_pushChar(dbuffer, (uint8_t)disp);
+    else if (mod == 2)
+        dbuffer_pushInt(dbuffer, (uint32_t)disp, 4);
+}
+
+// -- Table driven encoder --
+
+void emit_aluRegReg64(dbuffer_t *dbuffer, alu_op op, reg64 dst, reg64 src) {
+    emit_rexW(dbuffer, src, dst);
+    dbuffer_pushChar(dbuffer, kAluOpcode[op]);
+    emit_modrm(dbuffer, 3, kReg64Number[src] & 0b111,
+               kReg64Number[dst] & 0b111);
+}
+
+void emit_aluRegImm64(dbuffer_t *dbuffer, alu_op op, reg64 dst, int32_t imm) {
+    emit_rex(dbuffer, 1, 0, 0, kReg64Number[dst] > 7);
+    int isImm8 = imm >= INT8_MIN && imm <= INT8_MAX;
+
+    dbuffer_pushChar(dbuffer, isImm8 ? 0x83 : 0x81);
+    emit_modrm(dbuffer, 3, kAluExtension[op], kReg64Number[dst] & 0b111);
+    if (isImm8)
+        dbuffer_pushChar(dbuffer, (uint8_t)imm);
+    else
+        dbuffer_pushInt(dbuffer, (uint32_t)imm, 4);
+}
+
+void emit_aluRegMem64(dbuffer_t *dbuffer, alu_op op, reg64 dst, reg64 base,
+                      int32_t disp) {
+    emit_rexW(dbuffer, dst, base);
+    dbuffer_pushChar(dbuffer, kAluOpcode[op] + 2);
+    emit_modrmMem(dbuffer, kReg64Number[dst], base, disp);
+}
+
+void emit_aluMemReg64(dbuffer_t *dbuffer, alu_op op, reg64 base, int32_t disp,
+                      reg64 src) {
+    emit_rexW(dbuffer, src, base);
+    dbuffer_pushChar(dbuffer, kAluOpcode[op]);
+    emit_modrmMem(dbuffer, kReg64Number[src], base, disp);
+}
+
+void emit_unaryReg64(dbuffer_t *dbuffer, unary_op op, reg64 reg) {
+    emit_rex(dbuffer, 1, 0, 0, kReg64Number[reg] > 7);
+    dbuffer_pushChar(dbuffer, 0xF7);
+    emit_modrm(dbuffer, 3, kUnaryExtension[op], kReg64Number[reg] & 0b111);
+}
+
+void emit_unaryMem64(dbuffer_t *dbuffer, unary_op op, reg64 base,
+                     int32_t disp) {
+    emit_rex(dbuffer, 1, 0, 0, kReg64Number[base] > 7);
+    dbuffer_pushChar(dbuffer, 0xF7);
+    emit_modrmMem(dbuffer, kUnaryExtension[op], base, disp);
+}
+
+void emit_imulRegReg64(dbuffer_t *dbuffer, reg64 dst, reg64 src) {
+    emit_rexW(dbuffer, dst, src);
+    dbuffer_push(dbuffer, 2, 0x0F, 0xAF);
+    emit_modrm(dbuffer, 3, kReg64Number[dst] & 0b111,
+               kReg64Number[src] & 0b111);
+}
+
+void emit_imulRegImm64(dbuffer_t *dbuffer, reg64 dst, reg64 src, int32_t imm) {
+    emit_rexW(dbuffer, dst, src);
+    int isImm8 = imm >= INT8_MIN && imm <= INT8_MAX;
+
+    dbuffer_pushChar(dbuffer, isImm8 ? 0x6B : 0x69);
+    emit_modrm(dbuffer, 3, kReg64Number[dst] & 0b111,
+               kReg64Number[src] & 0b111);
+    if (isImm8)
+        dbuffer_pushChar(dbuffer, (uint8_t)imm);
+    else
+        dbuffer_pushInt(dbuffer, (uint32_t)imm, 4);
+}
+
+void emit_imulRegMem64(dbuffer_t *dbuffer, reg64 dst, reg64 base,
+                       int32_t disp) {
+    emit_rexW(dbuffer, dst, base);
+    dbuffer_push(dbuffer, 2, 0x0F, 0xAF);
+    emit_modrmMem(dbuffer, kReg64Number[dst], base, disp);
+}
+
+void emit_setccReg(dbuffer_t *dbuffer, cond_code cc, reg64 reg) {
+    uint8_t regNumber = kReg64Number[reg];
+    // Without a REX prefix 4-7 would be AH, CH, DH, BH.
+    if (regNumber > 3)
+        emit_rex(dbuffer, 0, 0, 0, regNumber > 7);
+
+    dbuffer_push(dbuffer, 2, 0x0F, 0x90 | kCondNumber[cc]);
+    emit_modrm(dbuffer, 3, 0, regNumber & 0b111);
+}
+
+void emit_cmovRegReg64(dbuffer_t *dbuffer, cond_code cc, reg64 dst,
+                       reg64 src) {
+    emit_rexW(dbuffer, dst, src);
+    dbuffer_push(dbuffer, 2, 0x0F, 0x40 | kCondNumber[cc]);
+    emit_modrm(dbuffer, 3, kReg64Number[dst] & 0b111,
+               kReg64Number[src] & 0b111);
+}
+
+void emit_cmovRegMem64(dbuffer_t *dbuffer, cond_code cc, reg64 dst,
+                       reg64 base, int32_t disp) {
+    emit_rexW(dbuffer, dst, base);
+    dbuffer_push(dbuffer, 2, 0x0F, 0x40 | kCondNumber[cc]);
+    emit_modrmMem(dbuffer, kReg64Number[dst], base, disp);
+}
+
+void emit_setccMem(dbuffer_t *dbuffer, cond_code cc, reg64 base, int32_t disp) {
+    if (kReg64Number[base] > 7)
+        emit_rex(dbuffer, 0, 0, 0, 1);
+
+    dbuffer_push(dbuffer, 2, 0x0F, 0x90 | kCondNumber[cc]);
+    emit_modrmMem(dbuffer, 0, base, disp);
+}
+
+void emit_zeroExtendReg8(dbuffer_t *dbuffer, reg64 reg) {
+    emit_rexW(dbuffer, reg, reg);
+    dbuffer_push(dbuffer, 2, 0x0F, 0xB6);
+    uint8_t regNumber = kReg64Number[reg] & 0b111;
+    emit_modrm(dbuffer, 3, regNumber, regNumber);
+}
+
+void emit_cqo(dbuffer_t *dbuffer) { dbuffer_push(dbuffer, 2, 0x48, 0x99); }
+
 // -- General code generation system --
 
+size_t arch_encodeBranch(dbuffer_t *dbuffer, int cond, int isLong) {
+    size_t dispOffset = 1;
+    if (cond < 0) {
+        dbuffer_pushChar(dbuffer, isLong ? 0xE9 : 0xEB);
+    } else if (isLong) {
+        dbuffer_push(dbuffer, 2, 0x0F, 0x80 | kCondNumber[cond]);
+        dispOffset = 2;
+    } else {
+        dbuffer_pushChar(dbuffer, 0x70 | kCondNumber[cond]);
+    }
+    dbuffer_pushChars(dbuffer, 0, isLong ? 4 : 1);
+    return dispOffset;
+}
+
+size_t arch_branchSize(int cond, int isLong) {
+    if (!isLong)
+        return 2;
+    return cond < 0 ? 5 : 6;
+}
+
 // Clean this up.
 int _getRealReg(int i) {
-    // We don't use RSP, RBP, RBX, R12-15, for register allocation.
-    // RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11
-    int realRegs[] = {0, 1, 2, 6, 7, 8, 9, 10, 11, 12};
+    // We don't use RSP and RBP for register allocation.
+    // RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11, RBX, R12, R13, R14, R15
+    int realRegs[] = {0, 1, 2, 6, 7, 8, 9, 10, 11, 3, 12, 13, 14, 15};
     return realRegs[i];
 }
 
@@ -238,46 +521,116 @@ void arch_spill(struct codegen *cg, struct variable *var) {
     arch_store(cg, var);
 }
 
-void arch_functionCall(struct codegen *cg, label_t *label, size_t count,
-                       struct variable **var) {
-    assert(count < 7 && "More than 6 args are currently not supported");
-    int regs[] = {4, 3, 2, 1, 5, 6};
+void arch_moveReg(struct codegen *cg, int from, int to) {
+    emit_storeReg64(&cg->buffer, _getRealReg(from), _getRealReg(to));
+}
 
-    for (int i = 0; i < cg->registerCount; i++) {
-        struct variable *regVar = cg->registerStatus[i];
-        if (regVar != NULL)
-            variable_store(cg, regVar);
+reg64 arch_realReg(int reg) { return _getRealReg(reg); }
+
+// Load an argument that doesn't live in a register.
+void _arch_loadArgument(struct codegen *cg, reg64 reg,
+                        struct arch_argument *arg) {
+    if (!arg->var) {
+        emit_storeConst64(&cg->buffer, reg, arg->constant);
+        return;
     }
+    assert(arg->var->stackPos > 0 && "argument has no value");
+    emit_loadRegRBP64(&cg->buffer, reg, -arg->var->stackPos * 8);
+}
 
-    for (int i = 0; i < 6; i++) {
-        // if the variable is already on the correct register then don't mess
-        // with it.
+int _arch_inRegister(struct arch_argument *arg) {
+    return arg->var && arg->var->reg >= 0;
+}
 
-        struct variable *regVar = cg->registerStatus[regs[i]];
+void arch_framePrologue(dbuffer_t *dbuffer, size_t slots) {
+    emit_pushReg(dbuffer, RBP);
+    emit_storeReg64(dbuffer, RSP, RBP);
+    // Keep the stack aligned to 16 bytes for calls.
+    int32_t size = (slots * 8 + 15) & ~15;
+    if (size)
+        emit_aluRegImm64(dbuffer, ALU_SUB, RSP, size);
+}
 
-        // This register is caller saved, so save it.
-        if (i < count) {
-            // If there is no register allocated to this variable then load id
-            // to the correct one.
-            if (var[i]->reg == -1) {
-                var[i]->reg = regs[i];
-                arch_loadReg(cg, var[i]);
+void arch_frameEpilogue(dbuffer_t *dbuffer) {
+    emit_storeReg64(dbuffer, RBP, RSP);
+    emit_popReg(dbuffer, RBP);
+}
+
+void arch_functionCall(struct codegen *cg, label_t *label, size_t count,
+                       struct arch_argument *args) {
+    // %rdi,%rsi,%rdx,%rcx,%r8,%r9
+    reg64 regs[] = {RDI, RSI, RDX, RCX, R8, R9};
+    dbuffer_t *buffer = &cg->buffer;
+    size_t regCount = count < 6 ? count : 6;
+
+    // The rest goes to the stack, the area keeps RSP aligned to 16 bytes.
+    int32_t stackSize = ((count - regCount) * 8 + 15) & ~15;
+    if (stackSize) {
+        emit_aluRegImm64(buffer, ALU_SUB, RSP, stackSize);
+        int scratch = codegen_allocateReg(cg);
+        for (size_t i = regCount; i < count; i++) {
+            reg64 src = _getRealReg(scratch);
+            if (_arch_inRegister(&args[i]))
+                src = arch_getRealReg(args[i].var);
+            else
+                _arch_loadArgument(cg, src, &args[i]);
+            emit_storeMemReg64(buffer, RSP, (i - regCount) * 8, src);
+        }
+    }
 
-                // no need to update the lru.
+    // Arguments in registers are a parallel move, a move can happen once
+    // no other move reads its destination. What remains are cycles, RAX
+    // isn't an argument register and breaks them.
+    reg64 from[6];
+    int pending[6] = {};
+    for (size_t i = 0; i < regCount; i++) {
+        if (!_arch_inRegister(&args[i]))
+            continue;
+        from[i] = arch_getRealReg(args[i].var);
+        pending[i] = from[i] != regs[i];
+    }
+    for (;;) {
+        int progress = 0, left = -1;
+        for (size_t i = 0; i < regCount; i++) {
+            if (!pending[i])
+                continue;
+            int blocked = 0;
+            for (size_t j = 0; j < regCount; j++)
+                blocked |= pending[j] && j != i && from[j] == regs[i];
+            if (blocked) {
+                left = i;
                 continue;
             }
-            // Move the variable to the correct register
-            // Wish I was a graph allocator :-(
-            emit_storeReg64(&cg->buffer, _getRealReg(var[i]->reg),
-                            _getRealReg(regs[i]));
+            emit_storeReg64(buffer, from[i], regs[i]);
+            pending[i] = 0;
+            progress = 1;
+        }
+        if (left < 0)
+            break;
+        if (!progress) {
+            emit_storeReg64(buffer, from[left], RAX);
+            for (size_t j = 0; j < regCount; j++) {
+                if (pending[j] && from[j] == from[left] && (int)j != left)
+                    from[j] = RAX;
+            }
+            from[left] = RAX;
         }
     }
-
-    for (int i = 0; i < count; i++) {
-        var[i]->reg = -1;
+    for (size_t i = 0; i < regCount; i++) {
+        if (!_arch_inRegister(&args[i]))
+            _arch_loadArgument(cg, regs[i], &args[i]);
     }
 
-    emit_call(&cg->buffer, label);
+    codegen_addLabel(cg, label);
+    emit_call(buffer, label);
+    if (stackSize)
+        emit_aluRegImm64(buffer, ALU_ADD, RSP, stackSize);
+
+    // Only the callee saved registers survive the call.
+    for (int i = 0; i < cg->registerCount && i < ARCH_CALLEE_SAVED; i++) {
+        if (cg->registerStatus[i])
+            variable_freeReg(cg, cg->registerStatus[i]);
+    }
 }
 
 // %rdi,%rsi,%rdx,%rcx,%r8, %r9
@@ -3,12 +3,42 @@
 
 // TODO: Target Abstraction.
 
+// Allocator ids from here on are callee saved: RBX, R12, R13, R14, R15.
+#define ARCH_CALLEE_SAVED 9
+#define ARCH_REGISTERS 14
+
 int arch_getRealReg(struct variable *var);
+// Machine register of the allocator id.
+reg64 arch_realReg(int reg);
+// Emit a move between the registers of two allocator ids.
+void arch_moveReg(struct codegen *cg, int from, int to);
 struct variable *arch_initFunctionArg(struct codegen *cg, int i);
 void arch_loadReg(struct codegen *cg, struct variable *var);
-void arch_functionCallArg(struct codegen *cg, struct variable *var, int i);
+
+// A call argument, constants have no variable.
+struct arch_argument {
+    struct variable *var;
+    int64_t constant;
+};
+
+// Call @label with the SysV AMD64 convention, the result is in RAX. Caller
+// saved registers are dropped without spilling, store the variables in them
+// that outlive the call first.
 void arch_functionCall(struct codegen *cg, label_t *label, size_t count,
-                       struct variable **var);
+                       struct arch_argument *args);
 void arch_spill(struct codegen *cg, struct variable *var);
 
+// Set up RBP and reserve @slots stack slots, the variables address them as
+// [rbp - 8 * stackPos]. Emitted once the frame size is known.
+void arch_framePrologue(dbuffer_t *dbuffer, size_t slots);
+// Tear the frame down, the ret is emitted separately.
+void arch_frameEpilogue(dbuffer_t *dbuffer);
+
+// Encode a jump with a zero displacement, @cond is a cond_code or -1 for
+// unconditional jumps. Returns the offset of the displacement inside the
+// instruction.
+size_t arch_encodeBranch(dbuffer_t *dbuffer, int cond, int isLong);
+// Size of the jump instruction, the displacement is always at the end.
+size_t arch_branchSize(int cond, int isLong);
+
 #endif